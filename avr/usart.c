@@ -209,6 +209,101 @@ static uint8_t usartReceive(void)
 	return r;
 }
 
+/** Receive as many bytes (up to a limit) as are in the receive buffer,
+  * with interrupts disabled only once for the whole transfer. Unlike
+  * usartReceive(), this will not block; it may receive fewer bytes than
+  * requested, including none at all.
+  * \param out The received bytes will be written here. This must have
+  *            space for length bytes.
+  * \param length The maximum number of bytes to receive.
+  * \return The number of bytes that were actually received.
+  */
+static uint8_t usartReceiveBlock(uint8_t *out, uint8_t length)
+{
+	uint8_t count;
+
+	count = 0;
+	cli();
+	while ((count < length) && ((rx_buffer_start != rx_buffer_end) || rx_buffer_full))
+	{
+		out[count] = rx_buffer[rx_buffer_start];
+		rx_buffer_start++;
+		rx_buffer_start = (uint8_t)(rx_buffer_start & RX_BUFFER_MASK);
+		rx_buffer_full = false;
+		count++;
+	}
+	sei();
+	return count;
+}
+
+/** Queue as many bytes (up to a limit) as will fit in the transmit buffer,
+  * with interrupts disabled only once for the whole transfer. Unlike
+  * usartSend(), this will not block; it may queue fewer bytes than
+  * requested, including none at all.
+  * \param data The bytes to send.
+  * \param length The maximum number of bytes to send.
+  * \return The number of bytes that were actually queued.
+  */
+static uint8_t usartSendBlock(const uint8_t *data, uint8_t length)
+{
+	uint8_t count;
+
+	count = 0;
+	cli();
+	while ((count < length) && !tx_buffer_full)
+	{
+		tx_buffer[tx_buffer_end] = data[count];
+		tx_buffer_end++;
+		tx_buffer_end = (uint8_t)(tx_buffer_end & TX_BUFFER_MASK);
+		if (tx_buffer_start == tx_buffer_end)
+		{
+			tx_buffer_full = true;
+		}
+		count++;
+	}
+	if (count > 0)
+	{
+		// The UDRE interrupt will move the bytes into UDR0.
+		UCSR0B |= _BV(UDRIE0);
+	}
+	sei();
+	return count;
+}
+
+/** Send an acknowledgement to the other side, telling it that it can send
+  * another #RX_BUFFER_SIZE bytes. This also resets #rx_acknowledge. */
+static void sendRxAcknowledge(void)
+{
+	uint8_t buffer[4];
+	uint8_t i;
+
+	rx_acknowledge = RX_BUFFER_SIZE;
+	writeU32LittleEndian(buffer, rx_acknowledge);
+	usartSend(0xff);
+	for (i = 0; i < 4; i++)
+	{
+		usartSend(buffer[i]);
+	}
+}
+
+/** Wait for an acknowledgement from the other side, then set
+  * #tx_acknowledge to the number of bytes it says can be sent. */
+static void waitForTxAcknowledge(void)
+{
+	uint8_t buffer[4];
+	uint8_t i;
+
+	do
+	{
+		// do nothing
+	} while (usartReceive() != 0xff);
+	for (i = 0; i < 4; i++)
+	{
+		buffer[i] = usartReceive();
+	}
+	tx_acknowledge = readU32LittleEndian(buffer);
+}
+
 /** This is called if a stream read or write error occurs. It never returns.
   * \warning Only call this if the error is unrecoverable. It halts the CPU.
   */
@@ -255,16 +350,7 @@ uint8_t streamGetOneByte(void)
 	if (rx_acknowledge == 0)
 	{
 		// Send acknowledgement to other side.
-		uint8_t buffer[4];
-		uint8_t i;
-
-		rx_acknowledge = RX_BUFFER_SIZE;
-		writeU32LittleEndian(buffer, rx_acknowledge);
-		usartSend(0xff);
-		for (i = 0; i < 4; i++)
-		{
-			usartSend(buffer[i]);
-		}
+		sendRxAcknowledge();
 	}
 	if (rx_buffer_overrun)
 	{
@@ -273,6 +359,47 @@ uint8_t streamGetOneByte(void)
 	return one_byte;
 }
 
+/** Grab a number of bytes from the communication stream. This has the same
+  * effect as calling streamGetOneByte() length times, but bytes are copied
+  * out of the receive buffer in blocks, as they become available.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint32_t limit;
+	uint8_t count;
+
+	while (length > 0)
+	{
+		// Don't read past the point where an acknowledgement needs to be
+		// sent, otherwise the host could be left waiting for it.
+		limit = length;
+		if (limit > rx_acknowledge)
+		{
+			limit = rx_acknowledge;
+		}
+		if (limit > RX_BUFFER_SIZE)
+		{
+			limit = RX_BUFFER_SIZE;
+		}
+		count = usartReceiveBlock(buffer, (uint8_t)limit);
+		rx_acknowledge -= count;
+		if (rx_acknowledge == 0)
+		{
+			// Send acknowledgement to other side.
+			sendRxAcknowledge();
+		}
+		if (rx_buffer_overrun)
+		{
+			streamReadOrWriteError();
+		}
+		buffer += count;
+		length -= count;
+	}
+}
+
 /** Send one byte to the communication stream. There is no way for this
   * function to indicate a write error. This is intentional; it
   * makes program flow simpler (no need to put checks everywhere). As a
@@ -290,18 +417,42 @@ void streamPutOneByte(uint8_t one_byte)
 	if (tx_acknowledge == 0)
 	{
 		// Need to wait for acknowledgement from other side.
-		uint8_t buffer[4];
-		uint8_t i;
+		waitForTxAcknowledge();
+	}
+}
 
-		do
+/** Send a number of bytes to the communication stream. This has the same
+  * effect as calling streamPutOneByte() for each byte, but bytes are copied
+  * into the transmit buffer in blocks.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t limit;
+	uint8_t count;
+
+	while (length > 0)
+	{
+		// Don't send more than the other side has acknowledged.
+		limit = length;
+		if (limit > tx_acknowledge)
 		{
-			// do nothing
-		} while (usartReceive() != 0xff);
-		for (i = 0; i < 4; i++)
+			limit = tx_acknowledge;
+		}
+		if (limit > TX_BUFFER_SIZE)
+		{
+			limit = TX_BUFFER_SIZE;
+		}
+		count = usartSendBlock(buffer, (uint8_t)limit);
+		tx_acknowledge -= count;
+		if (tx_acknowledge == 0)
 		{
-			buffer[i] = usartReceive();
+			// Need to wait for acknowledgement from other side.
+			waitForTxAcknowledge();
 		}
-		tx_acknowledge = readU32LittleEndian(buffer);
+		buffer += count;
+		length -= count;
 	}
 }
 
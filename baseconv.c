@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "test_helpers.h"
 #endif // #ifdef TEST_BASECONV
 
@@ -24,11 +25,12 @@
 #include "bignum256.h"
 #include "sha256.h"
 
-/** Shift list for bigDivide() to have it do division by 58. */
-static const uint8_t base58_shift_list[16] PROGMEM = {
-0x00, 0x1d, 0x80, 0x0e, 0x40, 0x07, 0xa0, 0x03,
-0xd0, 0x01, 0xe8, 0x00, 0x74, 0x00, 0x3a, 0x00};
+/** 58 ^ 4. hashToAddr() divides by this to get 4 base 58 digits at a time.
+  * This is the largest power of 58 which is small enough that
+  * (58 ^ 4 - 1) * 256 + 255 fits in 32 bits. */
+#define BASE58_CHUNK			11316496UL
 
+#if defined(BASECONV_NO_64BIT) || defined(TEST_BASECONV)
 /** Shift list for bigDivide() to have it do division by 10. */
 static const uint8_t base10_shift_list[16] PROGMEM = {
 0x00, 0x05, 0x80, 0x02, 0x40, 0x01, 0xa0, 0x00,
@@ -37,6 +39,27 @@ static const uint8_t base10_shift_list[16] PROGMEM = {
 /** Characters for the base 10 representation of numbers. */
 static const char base10_char_list[10] PROGMEM = {
 '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
+#endif // #if defined(BASECONV_NO_64BIT) || defined(TEST_BASECONV)
+
+#ifndef BASECONV_NO_64BIT
+/** Number of units of 10 ^ -8 BTC in 1 BTC. */
+#define UNITS_PER_BTC			100000000UL
+
+/** The base 10 representation of every number from 0 to 99, as two
+  * characters each. This lets amountToText() generate two digits for each
+  * division. */
+static const char base10_digit_pairs[200] PROGMEM = {
+'0', '0', '0', '1', '0', '2', '0', '3', '0', '4', '0', '5', '0', '6', '0', '7', '0', '8', '0', '9',
+'1', '0', '1', '1', '1', '2', '1', '3', '1', '4', '1', '5', '1', '6', '1', '7', '1', '8', '1', '9',
+'2', '0', '2', '1', '2', '2', '2', '3', '2', '4', '2', '5', '2', '6', '2', '7', '2', '8', '2', '9',
+'3', '0', '3', '1', '3', '2', '3', '3', '3', '4', '3', '5', '3', '6', '3', '7', '3', '8', '3', '9',
+'4', '0', '4', '1', '4', '2', '4', '3', '4', '4', '4', '5', '4', '6', '4', '7', '4', '8', '4', '9',
+'5', '0', '5', '1', '5', '2', '5', '3', '5', '4', '5', '5', '5', '6', '5', '7', '5', '8', '5', '9',
+'6', '0', '6', '1', '6', '2', '6', '3', '6', '4', '6', '5', '6', '6', '6', '7', '6', '8', '6', '9',
+'7', '0', '7', '1', '7', '2', '7', '3', '7', '4', '7', '5', '7', '6', '7', '7', '7', '8', '7', '9',
+'8', '0', '8', '1', '8', '2', '8', '3', '8', '4', '8', '5', '8', '6', '8', '7', '8', '8', '8', '9',
+'9', '0', '9', '1', '9', '2', '9', '3', '9', '4', '9', '5', '9', '6', '9', '7', '9', '8', '9', '9'};
+#endif // #ifndef BASECONV_NO_64BIT
 
 /** Characters for the base 58 representation of numbers. */
 static const char base58_char_list[58] PROGMEM = {
@@ -65,6 +88,7 @@ static const char base58_char_list[58] PROGMEM = {
   * \warning For platforms that use the PROGMEM attribute, the shift_list
   *          array must have that attribute.
   */
+#if defined(BASECONV_NO_64BIT) || defined(TEST_BASECONV)
 static void bigDivide(uint8_t *r, uint8_t *op1, uint8_t *temp, uint8_t size, const uint8_t *shift_list)
 {
 	uint8_t i;
@@ -93,14 +117,13 @@ static void bigDivide(uint8_t *r, uint8_t *op1, uint8_t *temp, uint8_t size, con
 	}
 }
 
-/** Convert a transaction amount (which is in 10 ^ -8 BTC) to a human-readable
-  * value such as "0.05", contained in a null-terminated character string.
-  * \param out Should point to a char array which has space for at least
-  *            #TEXT_AMOUNT_LENGTH characters, including the terminating null.
-  * \param in A 64 bit, unsigned, little-endian integer with the amount in
-  *           10 ^ -8 BTC.
+/** Convert a transaction amount to text, using only 8 bit multi-precision
+  * arithmetic. This is slower than the 64 bit version of amountToText(), but
+  * is more suitable for 8 bit platforms.
+  * \param out See amountToText().
+  * \param in See amountToText().
   */
-void amountToText(char *out, uint8_t *in)
+static void amountToTextBytes(char *out, uint8_t *in)
 {
 	uint8_t op1[9];
 	uint8_t temp[9];
@@ -154,6 +177,97 @@ void amountToText(char *out, uint8_t *in)
 		}
 	}
 }
+#endif // #if defined(BASECONV_NO_64BIT) || defined(TEST_BASECONV)
+
+#ifndef BASECONV_NO_64BIT
+/** Write a number in base 10, with a fixed number of digits (including
+  * leading zeroes). The output is not null-terminated.
+  * \param out The digits will be written here. This must have space for
+  *            num_digits characters.
+  * \param value The number to write. This must be less than
+  *              10 ^ num_digits.
+  * \param num_digits The number of digits to write.
+  */
+static void writeFixedDigits(char *out, uint32_t value, uint8_t num_digits)
+{
+	uint32_t pair;
+
+	while (num_digits >= 2)
+	{
+		pair = (value % 100) * 2;
+		value /= 100;
+		num_digits = (uint8_t)(num_digits - 2);
+		out[num_digits] = LOOKUP_BYTE(base10_digit_pairs[pair]);
+		out[num_digits + 1] = LOOKUP_BYTE(base10_digit_pairs[pair + 1]);
+	}
+	if (num_digits == 1)
+	{
+		out[0] = (char)('0' + value);
+	}
+}
+#endif // #ifndef BASECONV_NO_64BIT
+
+/** Convert a transaction amount (which is in 10 ^ -8 BTC) to a human-readable
+  * value such as "0.05", contained in a null-terminated character string.
+  *
+  * Unless #BASECONV_NO_64BIT is defined, this splits the amount into whole
+  * and fractional BTC using 64 bit division, then generates digits two at a
+  * time using 32 bit arithmetic. Define #BASECONV_NO_64BIT on platforms
+  * where 64 bit division is unavailable or expensive (like AVR), to use an
+  * implementation which only does 8 bit arithmetic.
+  * \param out Should point to a char array which has space for at least
+  *            #TEXT_AMOUNT_LENGTH characters, including the terminating null.
+  * \param in A 64 bit, unsigned, little-endian integer with the amount in
+  *           10 ^ -8 BTC.
+  */
+void amountToText(char *out, uint8_t *in)
+{
+#ifdef BASECONV_NO_64BIT
+	amountToTextBytes(out, in);
+#else
+	uint64_t amount;
+	uint64_t whole;
+	uint32_t fraction;
+	char whole_digits[12];
+	uint8_t i;
+	uint8_t length;
+
+	amount = ((uint64_t)readU32LittleEndian(&(in[4])) << 32) | readU32LittleEndian(in);
+	whole = amount / UNITS_PER_BTC;
+	fraction = (uint32_t)(amount % UNITS_PER_BTC);
+
+	// whole is at most (2 ^ 64 - 1) / 10 ^ 8, which has 12 digits. Write
+	// all of them, then remove leading zeroes up to one zero before the
+	// decimal point.
+	writeFixedDigits(whole_digits, (uint32_t)(whole / UNITS_PER_BTC), 4);
+	writeFixedDigits(&(whole_digits[4]), (uint32_t)(whole % UNITS_PER_BTC), 8);
+	for (i = 0; i < 11; i++)
+	{
+		if (whole_digits[i] != '0')
+		{
+			break;
+		}
+	}
+	length = 0;
+	for (; i < 12; i++)
+	{
+		out[length++] = whole_digits[i];
+	}
+
+	if (fraction != 0)
+	{
+		out[length++] = '.';
+		writeFixedDigits(&(out[length]), fraction, 8);
+		length = (uint8_t)(length + 8);
+		// Truncate trailing zeroes. There is at least one non-zero digit.
+		while (out[length - 1] == '0')
+		{
+			length--;
+		}
+	}
+	out[length] = '\0';
+#endif // #ifdef BASECONV_NO_64BIT
+}
 
 /** Convert 160 bit hash to a human-readable base 58 Bitcoin address such
   * as "1Dinox3mFw8yykpAZXFGEKeH4VX1Mzbcxe".
@@ -170,12 +284,12 @@ void amountToText(char *out, uint8_t *in)
 void hashToAddr(char *out, uint8_t *in, uint8_t address_version)
 {
 	uint8_t r[25];
-	uint8_t op1[26];
-	uint8_t temp[26];
 	uint8_t index;
 	uint8_t i;
 	uint8_t j;
 	uint8_t leading_zero_bytes;
+	uint32_t remainder;
+	uint32_t chunk;
 	HashState hs;
 
 	// Prepend address version and append checksum.
@@ -204,13 +318,27 @@ void hashToAddr(char *out, uint8_t *in, uint8_t address_version)
 		}
 	}
 
-	// Convert to base 58.
+	// Convert to base 58. Dividing the whole 25 byte number by 58 for every
+	// digit is slow, so instead divide it by 58 ^ 4 for every 4 digits.
+	// Each step of that long division only needs native 32 bit arithmetic,
+	// then the 4 digits are extracted from the (32 bit) remainder.
+	chunk = 0;
 	index = 34;
 	for (i = 0; i < 35; i++)
 	{
-		memcpy(op1, r, 25);
-		bigDivide(r, op1, temp, 25, base58_shift_list);
-		out[index--] = LOOKUP_BYTE(base58_char_list[op1[0]]);
+		if ((i & 3) == 0)
+		{
+			remainder = 0;
+			for (j = 24; j < 25; j--)
+			{
+				remainder = (remainder << 8) | r[j];
+				r[j] = (uint8_t)(remainder / BASE58_CHUNK);
+				remainder = remainder % BASE58_CHUNK;
+			}
+			chunk = remainder;
+		}
+		out[index--] = LOOKUP_BYTE(base58_char_list[chunk % 58]);
+		chunk /= 58;
 	}
 	out[35] = '\0';
 
@@ -424,12 +552,171 @@ const struct Base58TestStruct base58_tests[] = {
   "tWGD2u9stDSTHm6KJHfva2Xgepi3PSQ352"},
 };
 
+/** Shift list for bigDivide() to have it do division by 58. */
+static const uint8_t base58_shift_list[16] PROGMEM = {
+0x00, 0x1d, 0x80, 0x0e, 0x40, 0x07, 0xa0, 0x03,
+0xd0, 0x01, 0xe8, 0x00, 0x74, 0x00, 0x3a, 0x00};
+
+/** The original implementation of hashToAddr(), which does one bigDivide()
+  * for every base 58 digit. This is used to check that hashToAddr() produces
+  * identical output and to compare speed.
+  * \param out See hashToAddr().
+  * \param in See hashToAddr().
+  * \param address_version See hashToAddr().
+  */
+static void hashToAddrReference(char *out, uint8_t *in, uint8_t address_version)
+{
+	uint8_t r[25];
+	uint8_t op1[26];
+	uint8_t temp[26];
+	uint8_t index;
+	uint8_t i;
+	uint8_t j;
+	uint8_t leading_zero_bytes;
+	HashState hs;
+
+	sha256Begin(&hs);
+	r[24] = address_version;
+	sha256WriteByte(&hs, address_version);
+	for (i = 0; i < 20; i++)
+	{
+		r[23 - i] = in[i];
+		sha256WriteByte(&hs, in[i]);
+	}
+	sha256FinishDouble(&hs);
+	writeU32LittleEndian(r, hs.h[0]);
+	leading_zero_bytes = 0;
+	for (i = 24; i < 25; i--)
+	{
+		if (r[i] == 0)
+		{
+			leading_zero_bytes++;
+		}
+		else
+		{
+			break;
+		}
+	}
+	index = 34;
+	for (i = 0; i < 35; i++)
+	{
+		memcpy(op1, r, 25);
+		bigDivide(r, op1, temp, 25, base58_shift_list);
+		out[index--] = LOOKUP_BYTE(base58_char_list[op1[0]]);
+	}
+	out[35] = '\0';
+	for (i = 0; i < 35; i++)
+	{
+		if (out[0] == '1')
+		{
+			for (j = 0; j < 35; j++)
+			{
+				out[j] = out[j + 1];
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+	for (i = 0; i < leading_zero_bytes; i++)
+	{
+		for (j = 34; j < 35; j--)
+		{
+			out[j + 1] = out[j];
+		}
+		out[0] = '1';
+	}
+}
+
+/** Number of random amounts to check amountToText() against
+  * amountToTextBytes() with. */
+#define NUM_RANDOM_BASE10_TESTS		1000
+
+/** Number of times to go through #base10_tests when benchmarking
+  * amountToText() and amountToTextBytes(). */
+#define BASE10_BENCHMARK_ROUNDS		200
+
+/** Measure how many amounts per second an amount conversion function can do,
+  * using the amounts in #base10_tests.
+  * \param f The conversion function (amountToText() or
+  *          amountToTextBytes()).
+  * \return Number of amounts converted per second.
+  */
+static double benchmarkAmountToText(void (*f)(char *, uint8_t *))
+{
+	char amount[TEXT_AMOUNT_LENGTH];
+	clock_t start;
+	clock_t elapsed;
+	int num_tests;
+	int i;
+	int j;
+
+	num_tests = sizeof(base10_tests) / sizeof(struct Base10TestStruct);
+	start = clock();
+	for (i = 0; i < BASE10_BENCHMARK_ROUNDS; i++)
+	{
+		for (j = 0; j < num_tests; j++)
+		{
+			f(amount, (uint8_t *)base10_tests[j].value);
+		}
+	}
+	elapsed = clock() - start;
+	if (elapsed == 0)
+	{
+		elapsed = 1;
+	}
+	return (double)(BASE10_BENCHMARK_ROUNDS * num_tests) * (double)CLOCKS_PER_SEC / (double)elapsed;
+}
+
+/** Number of random hashes to check hashToAddr() against
+  * hashToAddrReference() with. */
+#define NUM_RANDOM_BASE58_TESTS		200
+
+/** Number of addresses to convert when benchmarking hashToAddr() and
+  * hashToAddrReference(). */
+#define BASE58_BENCHMARK_COUNT		2000
+
+/** Measure how many addresses per second an address conversion function can
+  * do.
+  * \param f The conversion function (hashToAddr() or hashToAddrReference()).
+  * \return Number of addresses converted per second.
+  */
+static double benchmarkHashToAddr(void (*f)(char *, uint8_t *, uint8_t))
+{
+	char addr[TEXT_ADDRESS_LENGTH];
+	uint8_t hash[20];
+	clock_t start;
+	clock_t elapsed;
+	int i;
+
+	memset(hash, 0, sizeof(hash));
+	start = clock();
+	for (i = 0; i < BASE58_BENCHMARK_COUNT; i++)
+	{
+		hash[i % 20] = (uint8_t)i;
+		f(addr, hash, ADDRESS_VERSION_PUBKEY);
+	}
+	elapsed = clock() - start;
+	if (elapsed == 0)
+	{
+		elapsed = 1;
+	}
+	return (double)BASE58_BENCHMARK_COUNT * (double)CLOCKS_PER_SEC / (double)elapsed;
+}
+
 int main(void)
 {
 	char amount[TEXT_AMOUNT_LENGTH];
 	char addr[TEXT_ADDRESS_LENGTH];
+	char reference_addr[TEXT_ADDRESS_LENGTH];
+	char reference_amount[TEXT_AMOUNT_LENGTH];
+	uint8_t value[8];
+	uint8_t hash[20];
+	uint8_t address_version;
 	int num_tests;
 	int i;
+	int j;
 
 	initTests(__FILE__);
 	num_tests = sizeof(base10_tests) / sizeof(struct Base10TestStruct);
@@ -452,6 +739,42 @@ int main(void)
 		}
 	}
 
+	// The 64 bit version of amountToText() should produce the same output as
+	// the 8 bit version.
+	srand(42);
+	for (i = 0; i < NUM_RANDOM_BASE10_TESTS; i++)
+	{
+		for (j = 0; j < 8; j++)
+		{
+			value[j] = (uint8_t)rand();
+		}
+		// Sometimes use smaller amounts, and amounts which are a whole
+		// number of BTC or have trailing zeroes.
+		for (j = 0; j < (i % 8); j++)
+		{
+			value[7 - j] = 0;
+		}
+		if ((i % 5) == 0)
+		{
+			value[0] = 0;
+		}
+		amountToText(amount, value);
+		amountToTextBytes(reference_amount, value);
+		if (strcmp(amount, reference_amount))
+		{
+			printf("Random base10 test number %d failed\n", i);
+			printf("Got:      %s\n", amount);
+			printf("Expected: %s\n", reference_amount);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+	printf("amountToText(): %.0f amounts per second\n", benchmarkAmountToText(amountToText));
+	printf("amountToTextBytes(): %.0f amounts per second\n", benchmarkAmountToText(amountToTextBytes));
+
 	num_tests = sizeof(base58_tests) / sizeof(struct Base58TestStruct);
 	for (i = 0; i < num_tests; i++)
 	{
@@ -472,6 +795,39 @@ int main(void)
 		}
 	}
 
+	// hashToAddr() should produce the same output as the original
+	// (one division per digit) implementation.
+	for (i = 0; i < NUM_RANDOM_BASE58_TESTS; i++)
+	{
+		for (j = 0; j < 20; j++)
+		{
+			hash[j] = (uint8_t)rand();
+		}
+		// Sometimes use leading zero bytes, since they are handled
+		// specially.
+		for (j = 0; j < (i % 4); j++)
+		{
+			hash[j] = 0;
+		}
+		address_version = (uint8_t)(((i % 3) == 0) ? 0 : rand());
+		hashToAddr(addr, hash, address_version);
+		hashToAddrReference(reference_addr, hash, address_version);
+		if (strcmp(addr, reference_addr))
+		{
+			printf("Random base58 test number %d failed\n", i);
+			printf("Got:      %s\n", addr);
+			printf("Expected: %s\n", reference_addr);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
+	printf("hashToAddr(): %.0f addresses per second\n", benchmarkHashToAddr(hashToAddr));
+	printf("Original hashToAddr(): %.0f addresses per second\n", benchmarkHashToAddr(hashToAddrReference));
+
 	finishTests();
 
 	exit(0);
@@ -13,8 +13,10 @@
   *   emulation).
   * - The FFT size is fixed by #FFT_SIZE. If the FFT size is changed, some
   *   parts of this file will also need to be modified.
-  * - The use of lookup tables is minimised, resulting in smaller code at
-  *   the expense of slightly slower speed.
+  * - fft() uses precomputed lookup tables for twiddle factors and for the
+  *   bit-reversal permutation, since it is on the hot path of the hardware
+  *   random number generator tests. fftPostProcessReal(), which is called
+  *   much less often, still uses a smaller quarter-wave table.
   * - The aim was for the code to be fast enough so that the LPC11Uxx (running
   *   at 48 Mhz) microcontrollers be capable of performing size 512 real FFTs
   *   on a 22050 Hz bandwidth signal in real-time.
@@ -28,21 +30,107 @@
 #include "fix16.h"
 #include "fft.h"
 
-/** 3rd level of #R_DEF0 definition. */
-#define R_DEF3(x)	x,			x + 8
-/** 2nd level of #R_DEF0 definition. */
-#define R_DEF2(x)	R_DEF3(x),	R_DEF3(x + 4)
-/** 1st level of #R_DEF0 definition. */
-#define R_DEF1(x)	R_DEF2(x),	R_DEF2(x + 2)
-/** Recursively defined contents of #bit_reverse_lookup.
-  * Inspired by http://graphics.stanford.edu/~seander/bithacks.html#ParityLookupTable
-  * accessed 18-July-2012. */
-#define R_DEF0(x)	R_DEF1(x),	R_DEF1(x + 1)
-
-/** Bit reverse lookup table. Its contents are defined by recursively using
-  * the C preprocessor. reverseBits() uses this to reverse groups of bits. */
-static const uint8_t bit_reverse_lookup[16] =
-{R_DEF0(0)};
+#if FFT_SIZE != 256
+#error "You may need to update bit_reverse_swaps using gen_twiddle."
+#endif
+/** Pairs of indices which need to be swapped to put the input of fft() into
+  * bit-reversed order. Each pair (i, j) satisfies i < j, and j is i with its
+  * 8 bits reversed. Indices which are their own bit reversal are not listed.
+  * Precomputing the permutation means that fft() doesn't have to reverse
+  * every index or check whether a pair has already been swapped.
+  *
+  * Table generated using gen_twiddle.
+  * FFT size: 256.
+  */
+static const uint8_t bit_reverse_swaps[120][2] = {
+{1, 128}, {2, 64}, {3, 192}, {4, 32}, {5, 160}, {6, 96},
+{7, 224}, {8, 16}, {9, 144}, {10, 80}, {11, 208}, {12, 48},
+{13, 176}, {14, 112}, {15, 240}, {17, 136}, {18, 72}, {19, 200},
+{20, 40}, {21, 168}, {22, 104}, {23, 232}, {25, 152}, {26, 88},
+{27, 216}, {28, 56}, {29, 184}, {30, 120}, {31, 248}, {33, 132},
+{34, 68}, {35, 196}, {37, 164}, {38, 100}, {39, 228}, {41, 148},
+{42, 84}, {43, 212}, {44, 52}, {45, 180}, {46, 116}, {47, 244},
+{49, 140}, {50, 76}, {51, 204}, {53, 172}, {54, 108}, {55, 236},
+{57, 156}, {58, 92}, {59, 220}, {61, 188}, {62, 124}, {63, 252},
+{65, 130}, {67, 194}, {69, 162}, {70, 98}, {71, 226}, {73, 146},
+{74, 82}, {75, 210}, {77, 178}, {78, 114}, {79, 242}, {81, 138},
+{83, 202}, {85, 170}, {86, 106}, {87, 234}, {89, 154}, {91, 218},
+{93, 186}, {94, 122}, {95, 250}, {97, 134}, {99, 198}, {101, 166},
+{103, 230}, {105, 150}, {107, 214}, {109, 182}, {110, 118}, {111, 246},
+{113, 142}, {115, 206}, {117, 174}, {119, 238}, {121, 158}, {123, 222},
+{125, 190}, {127, 254}, {131, 193}, {133, 161}, {135, 225}, {137, 145},
+{139, 209}, {141, 177}, {143, 241}, {147, 201}, {149, 169}, {151, 233},
+{155, 217}, {157, 185}, {159, 249}, {163, 197}, {167, 229}, {171, 213},
+{173, 181}, {175, 245}, {179, 205}, {183, 237}, {187, 221}, {191, 253},
+{199, 227}, {203, 211}, {207, 243}, {215, 235}, {223, 251}, {239, 247}
+};
+
+#if FFT_SIZE != 256
+#error "You may need to update twiddle_factor_table using gen_twiddle."
+#endif
+/** Lookup table of twiddle factors (complex roots of unity) for fft(). Entry
+  * k contains (cos(phi), sin(phi)), where phi = k * 2 * pi / #FFT_SIZE. The
+  * radix-4 butterflies in fft() need phi in [0, 3 * pi / 2), and this table
+  * covers that whole range, so no symmetries need to be applied in the inner
+  * loop. This costs 1.5 kilobytes, which was judged to be worth it since fft()
+  * is called many times for every batch of samples that hwrng.c tests.
+  *
+  * The values are multiplied by 65536 and rounded to the nearest integer.
+  * This process assumes that the underlying fixed-point format is Q16.16.
+  *
+  * Table generated using gen_twiddle.
+  * FFT size: 256.
+  */
+static const ComplexFixed twiddle_factor_table[192] = {
+{65536, 0}, {65516, 1608}, {65457, 3216}, {65358, 4821},
+{65220, 6424}, {65043, 8022}, {64827, 9616}, {64571, 11204},
+{64277, 12785}, {63944, 14359}, {63572, 15924}, {63162, 17479},
+{62714, 19024}, {62228, 20557}, {61705, 22078}, {61145, 23586},
+{60547, 25080}, {59914, 26558}, {59244, 28020}, {58538, 29466},
+{57798, 30893}, {57022, 32303}, {56212, 33692}, {55368, 35062},
+{54491, 36410}, {53581, 37736}, {52639, 39040}, {51665, 40320},
+{50660, 41576}, {49624, 42806}, {48559, 44011}, {47464, 45190},
+{46341, 46341}, {45190, 47464}, {44011, 48559}, {42806, 49624},
+{41576, 50660}, {40320, 51665}, {39040, 52639}, {37736, 53581},
+{36410, 54491}, {35062, 55368}, {33692, 56212}, {32303, 57022},
+{30893, 57798}, {29466, 58538}, {28020, 59244}, {26558, 59914},
+{25080, 60547}, {23586, 61145}, {22078, 61705}, {20557, 62228},
+{19024, 62714}, {17479, 63162}, {15924, 63572}, {14359, 63944},
+{12785, 64277}, {11204, 64571}, {9616, 64827}, {8022, 65043},
+{6424, 65220}, {4821, 65358}, {3216, 65457}, {1608, 65516},
+{0, 65536}, {-1608, 65516}, {-3216, 65457}, {-4821, 65358},
+{-6424, 65220}, {-8022, 65043}, {-9616, 64827}, {-11204, 64571},
+{-12785, 64277}, {-14359, 63944}, {-15924, 63572}, {-17479, 63162},
+{-19024, 62714}, {-20557, 62228}, {-22078, 61705}, {-23586, 61145},
+{-25080, 60547}, {-26558, 59914}, {-28020, 59244}, {-29466, 58538},
+{-30893, 57798}, {-32303, 57022}, {-33692, 56212}, {-35062, 55368},
+{-36410, 54491}, {-37736, 53581}, {-39040, 52639}, {-40320, 51665},
+{-41576, 50660}, {-42806, 49624}, {-44011, 48559}, {-45190, 47464},
+{-46341, 46341}, {-47464, 45190}, {-48559, 44011}, {-49624, 42806},
+{-50660, 41576}, {-51665, 40320}, {-52639, 39040}, {-53581, 37736},
+{-54491, 36410}, {-55368, 35062}, {-56212, 33692}, {-57022, 32303},
+{-57798, 30893}, {-58538, 29466}, {-59244, 28020}, {-59914, 26558},
+{-60547, 25080}, {-61145, 23586}, {-61705, 22078}, {-62228, 20557},
+{-62714, 19024}, {-63162, 17479}, {-63572, 15924}, {-63944, 14359},
+{-64277, 12785}, {-64571, 11204}, {-64827, 9616}, {-65043, 8022},
+{-65220, 6424}, {-65358, 4821}, {-65457, 3216}, {-65516, 1608},
+{-65536, 0}, {-65516, -1608}, {-65457, -3216}, {-65358, -4821},
+{-65220, -6424}, {-65043, -8022}, {-64827, -9616}, {-64571, -11204},
+{-64277, -12785}, {-63944, -14359}, {-63572, -15924}, {-63162, -17479},
+{-62714, -19024}, {-62228, -20557}, {-61705, -22078}, {-61145, -23586},
+{-60547, -25080}, {-59914, -26558}, {-59244, -28020}, {-58538, -29466},
+{-57798, -30893}, {-57022, -32303}, {-56212, -33692}, {-55368, -35062},
+{-54491, -36410}, {-53581, -37736}, {-52639, -39040}, {-51665, -40320},
+{-50660, -41576}, {-49624, -42806}, {-48559, -44011}, {-47464, -45190},
+{-46341, -46341}, {-45190, -47464}, {-44011, -48559}, {-42806, -49624},
+{-41576, -50660}, {-40320, -51665}, {-39040, -52639}, {-37736, -53581},
+{-36410, -54491}, {-35062, -55368}, {-33692, -56212}, {-32303, -57022},
+{-30893, -57798}, {-29466, -58538}, {-28020, -59244}, {-26558, -59914},
+{-25080, -60547}, {-23586, -61145}, {-22078, -61705}, {-20557, -62228},
+{-19024, -62714}, {-17479, -63162}, {-15924, -63572}, {-14359, -63944},
+{-12785, -64277}, {-11204, -64571}, {-9616, -64827}, {-8022, -65043},
+{-6424, -65220}, {-4821, -65358}, {-3216, -65457}, {-1608, -65516}
+};
 
 #if FFT_SIZE != 256
 #error "You may need to update twiddle_factor_lookup using gen_twiddle."
@@ -52,7 +140,9 @@ static const uint8_t bit_reverse_lookup[16] =
   * factors would need both sines and cosines for phi in [0, pi), needing 4
   * times as much space as this table. To recover the other values,
   * getTwiddleFactor() exploits various symmetries of the sine and cosine
-  * functions.
+  * functions. This table is only used by fftPostProcessReal(), which needs
+  * twiddle factors with twice the angular resolution of
+  * #twiddle_factor_table.
   *
   * The sin(phi) values are multiplied by 65536 and rounded to the nearest
   * integer. This process assumes that the underlying fixed-point format
@@ -135,23 +225,6 @@ static ComplexFixed complexFixedConjugate(ComplexFixed op1)
 	return r;
 }
 
-/** Reverse the bits in an integer. For example, 0x59 (0b01011001) becomes
-  * 0x9A (0b10011010).
-  * \param op1 The integer to reverse.
-  * \return The integer, with bits reversed.
-  * \warning The implementation of this function depends on #FFT_SIZE.
-  *          If #FFT_SIZE is changed, the code for this function will also
-  *          need to be changed.
-  */
-static uint32_t reverseBits(uint32_t op1)
-{
-#if FFT_SIZE != 256
-#error "You may need to update reverseBits()."
-#endif
-	return ((bit_reverse_lookup[op1 & 15] << 4)
-		+ bit_reverse_lookup[(op1 >> 4) & 15]);
-}
-
 /** Get the complex twiddle factor (complex root of unity) for a given angle.
   * This function uses the lookup table #twiddle_factor_lookup and complements
   * it with trigonometric symmetries.
@@ -205,21 +278,48 @@ static ComplexFixed getTwiddleFactor(uint32_t tf_index)
 	return r;
 }
 
-/** Perform a complex, in-place Fast Fourier Transform using the radix-2
+/** Get a twiddle factor from #twiddle_factor_table, conjugating it if
+  * necessary. fft() uses this to fetch the twiddle factors for each radix-4
+  * butterfly.
+  * \param tf_index The angle, in radian * FFT_SIZE / (2 * pi). This must be
+  *                 less than the number of entries in #twiddle_factor_table.
+  * \param is_inverse If false, the conjugate of the table entry is returned,
+  *                   as is appropriate for a forward FFT.
+  * \return The complex twiddle factor.
+  */
+static ComplexFixed lookupTwiddleFactor(uint32_t tf_index, bool is_inverse)
+{
+	ComplexFixed r;
+
+	r = twiddle_factor_table[tf_index];
+	if (!is_inverse)
+	{
+		r.imag = fix16_sub(fix16_zero, r.imag);
+	}
+	return r;
+}
+
+/** Perform a complex, in-place Fast Fourier Transform using the radix-4
   * Cooley-Tukey algorithm.
   * This does a complex FFT of size #FFT_SIZE. If the input data is purely
   * real, this can do a real FFT of size #FFT_SIZE * 2, but that requires
   * some post-processing. See fftRealPostProcess() for more details.
   *
-  * The code was heavily inspired by Sergey Chernenko's FFT code, available
-  * from http://www.librow.com/articles/article-10, accessed 18-July-2012.
-  * Like Sergey's code, no recursion is used. Some changes:
-  * - A lookup table for twiddle factors (see getTwiddleFactor()) is used
-  *   instead of a trigonometric recurrence relation. This gives better
-  *   numerical performance, at little space cost.
-  * - If the twiddle factor is 1, no multiplication is done. For a size
-  *   512 complex FFT, this removes 12.5% of the multiplications, at little
-  *   space cost.
+  * This was originally a radix-2 FFT, heavily inspired by Sergey Chernenko's
+  * FFT code, available from http://www.librow.com/articles/article-10,
+  * accessed 18-July-2012. Some changes since then:
+  * - Each pass does a radix-4 butterfly, which combines two radix-2 passes.
+  *   This halves the number of passes over the data array and needs 3
+  *   complex multiplications per butterfly instead of 4. Multiplications by
+  *   -1 and +/-i are done by swapping and negating components.
+  * - The input is reordered using the precomputed #bit_reverse_swaps table.
+  *   A radix-4 FFT would normally want its input in base-4 digit-reversed
+  *   order. With bit-reversed input, the 2nd and 3rd quarters of each group
+  *   of 4 sub-transforms are swapped compared to digit-reversed order. That
+  *   is compensated for by swapping their roles in the butterfly.
+  * - Twiddle factors come from #twiddle_factor_table, which covers every
+  *   angle needed, so no symmetries need to be applied in the inner loop.
+  * - If the twiddle factors are all 1, no multiplication is done.
   *
   * \param data The input data array. The output of the FFT will also be
   *             written here. This must be an array of size #FFT_SIZE.
@@ -227,66 +327,100 @@ static ComplexFixed getTwiddleFactor(uint32_t tf_index)
   *                   FFT.
   * \return false for success, true if an arithmetic error (eg. overflow)
   *         occurred.
+  * \warning The implementation of this function depends on #FFT_SIZE being
+  *          a power of 4.
   */
 bool fft(ComplexFixed *data, bool is_inverse)
 {
 	uint32_t i;
 	uint32_t j;
-	uint32_t pair;
+	uint32_t k;
+	uint32_t group;
 	uint32_t jump;
-	uint32_t match;
-	uint32_t tf_index; // twiddle factor index
 	uint32_t tf_step; // twiddle factor index increment
-	ComplexFixed factor; // twiddle factor
-	ComplexFixed product;
+	ComplexFixed factor1; // twiddle factors
+	ComplexFixed factor2;
+	ComplexFixed factor3;
+	ComplexFixed a;
+	ComplexFixed b;
+	ComplexFixed c;
+	ComplexFixed d;
+	ComplexFixed sum_ac;
+	ComplexFixed diff_ac;
+	ComplexFixed sum_bd;
+	ComplexFixed diff_bd;
 	ComplexFixed temp;
 
+#if FFT_SIZE != 256
+#error "You may need to update the number of radix-4 passes in fft()."
+#endif
+
 	fix16_error_occurred = false;
 
 	// Do in-place input data reordering.
-	for (i = 0; i < FFT_SIZE; i++)
+	for (i = 0; i < (sizeof(bit_reverse_swaps) / sizeof(bit_reverse_swaps[0])); i++)
 	{
-		j = reverseBits(i);
-		if (j > i) // only swap if not already swapped
-		{
-			temp = data[i];
-			data[i] = data[j];
-			data[j] = temp;
-		}
+		j = bit_reverse_swaps[i][0];
+		k = bit_reverse_swaps[i][1];
+		temp = data[j];
+		data[j] = data[k];
+		data[k] = temp;
 	}
 
-	// Perform the actual FFT calculation.
-	tf_step = FFT_SIZE;
-	for (i = 1; i < FFT_SIZE; i <<= 1)
+	// Perform the actual FFT calculation. Each pass combines groups of 4
+	// sub-transforms of size i into transforms of size 4 * i. Because the
+	// input was put in bit-reversed order, the sub-transform of the odd
+	// quarter (which is the one that gets twiddled by factor1) is at
+	// group + 2 * i and the sub-transform of the second even quarter is at
+	// group + i.
+	tf_step = FFT_SIZE / 4;
+	for (i = 1; i < FFT_SIZE; i <<= 2)
 	{
-		jump = i << 1;
-		tf_index = 0;
+		jump = i << 2;
 		for (j = 0; j < i; j++)
 		{
-			factor = getTwiddleFactor(tf_index);
-			if (!is_inverse)
-			{
-				factor = complexFixedConjugate(factor);
-			}
-			for (pair = j; pair < FFT_SIZE; pair += jump)
+			factor1 = lookupTwiddleFactor(j * tf_step, is_inverse);
+			factor2 = lookupTwiddleFactor(2 * j * tf_step, is_inverse);
+			factor3 = lookupTwiddleFactor(3 * j * tf_step, is_inverse);
+			for (group = j; group < FFT_SIZE; group += jump)
 			{
-				match = pair + i;
-				if (tf_index == 0)
+				a = data[group];
+				if (j == 0)
+				{
+					// Save multiplications since all factors = 1.0.
+					b = data[group + 2 * i];
+					c = data[group + i];
+					d = data[group + 3 * i];
+				}
+				else
+				{
+					b = complexFixedMultiply(factor1, data[group + 2 * i]);
+					c = complexFixedMultiply(factor2, data[group + i]);
+					d = complexFixedMultiply(factor3, data[group + 3 * i]);
+				}
+				sum_ac = complexFixedAdd(a, c);
+				diff_ac = complexFixedSubtract(a, c);
+				sum_bd = complexFixedAdd(b, d);
+				diff_bd = complexFixedSubtract(b, d);
+				// Multiply diff_bd by -i (forward) or +i (inverse).
+				temp.real = diff_bd.imag;
+				temp.imag = diff_bd.real;
+				if (is_inverse)
 				{
-					// Save multiplications since factor = 1.0.
-					product = data[match];
+					temp.real = fix16_sub(fix16_zero, temp.real);
 				}
 				else
 				{
-					product = complexFixedMultiply(factor, data[match]);
+					temp.imag = fix16_sub(fix16_zero, temp.imag);
 				}
-				data[match] = complexFixedSubtract(data[pair], product);
-				data[pair] = complexFixedAdd(data[pair], product);
+				data[group] = complexFixedAdd(sum_ac, sum_bd);
+				data[group + i] = complexFixedAdd(diff_ac, temp);
+				data[group + 2 * i] = complexFixedSubtract(sum_ac, sum_bd);
+				data[group + 3 * i] = complexFixedSubtract(diff_ac, temp);
 			}
-			tf_index += tf_step;
 		}
-		tf_step >>= 1;
-	} // end for (i = 1; i < FFT_SIZE; i <<= 1)
+		tf_step >>= 2;
+	} // end for (i = 1; i < FFT_SIZE; i <<= 2)
 
 	if (is_inverse)
 	{
@@ -21,7 +21,7 @@
   * real-valued FFT of twice this size, some post-processing is necessary;
   * see fftPostProcessReal() for more information.
   *
-  * \warning This must be a power of 2, since fft.c uses a radix-2 FFT
+  * \warning This must be a power of 4, since fft.c uses a radix-4 FFT
   *          algorithm.
   */
 #define FFT_SIZE	256
@@ -1,12 +1,17 @@
 /** \file gen_twiddle.c
   *
-  * \brief Generates fixed-point twiddle factor lookup table.
+  * \brief Generates fixed-point twiddle factor and bit reversal lookup tables.
   *
-  * This generates the twiddle factor lookup table for use in fft.c. This
-  * outputs the table as C source, with integer constants representing
-  * sin(phi) in 16.16 fixed-point format.
+  * This generates the lookup tables for use in fft.c. The tables are outputted
+  * as C source. There are three kinds of table:
+  * - The quarter-wave table (the default), which fftPostProcessReal() uses.
+  * - The full twiddle factor table (the "full" option), which the radix-4
+  *   butterflies in fft() use.
+  * - The bit reversal swap table (the "bitrev" option), which fft() uses to
+  *   reorder its input.
   *
-  * There are a couple of space optimisations:
+  * The quarter-wave table consists of integer constants representing sin(phi)
+  * in 16.16 fixed-point format. There are a couple of space optimisations:
   * - Only sin(phi) values for the first quadrant; phi in [0, pi / 2); are
   *   generated, since various symmetries of sin(phi) can be exploited in
   *   order to get values for the other quadrants.
@@ -16,17 +21,136 @@
   * - Only the fractional part of sin(phi) is outputted, since sin(phi) is in
   *   [0, 1) when phi is in [0, pi / 2).
   *
+  * The full table consists of (cos(phi), sin(phi)) pairs in 16.16 fixed-point
+  * format, for phi in [0, 3 * pi / 2). No symmetries are exploited, so that
+  * fft() can look up every twiddle factor it needs without any branching.
+  * A radix-4 decimation-in-time FFT needs angles of up to
+  * 3 * (size / 4 - 1) * 2 * pi / size, which is why the table stops at
+  * 3 * pi / 2.
+  *
+  * The bit reversal table lists every pair of indices (i, j) where i < j and
+  * j is the bit-reversed version of i. Swapping each pair puts the FFT input
+  * into bit-reversed order. Indices which are their own bit reversal are
+  * omitted, since they don't need to move.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 
 /** Mmmm. Pie. */
 #define PI					3.141592653589793238462643
 /** Number of constants per line in C source output. */
 #define VALUES_PER_LINE		8
+/** Number of (cos, sin) pairs per line in full table output. */
+#define PAIRS_PER_LINE		4
+/** Number of index pairs per line in bit reversal table output. */
+#define SWAPS_PER_LINE		6
+
+/** Convert a real number to the nearest 16.16 fixed-point value.
+  * \param x The real number to convert.
+  * \return The fixed-point representation of x, as an integer.
+  */
+static long toFixed(double x)
+{
+	// The "* (double)0x00010000" is to convert to 16.16 fixed-point.
+	return (long)floor(x * (double)0x00010000 + 0.5);
+}
+
+/** Output the full twiddle factor table.
+  * \param fft_size Size of (complex) FFT.
+  */
+static void outputFullTable(int fft_size)
+{
+	int i;
+	int table_size;
+	double phi;
+
+	table_size = (fft_size * 3) / 4;
+	printf("// Table generated using gen_twiddle.\n");
+	printf("// FFT size: %d.\n", fft_size);
+	printf("static const ComplexFixed twiddle_factor_table[%d] = {\n", table_size);
+	for (i = 0; i < table_size; i++)
+	{
+		phi = i * (2.0 * PI / (double)fft_size);
+		printf("{%ld, %ld}", toFixed(cos(phi)), toFixed(sin(phi)));
+		if (i != (table_size - 1))
+		{
+			printf(", ");
+		}
+		if ((i % PAIRS_PER_LINE) == (PAIRS_PER_LINE - 1))
+		{
+			printf("\n");
+		}
+	}
+	printf("};\n");
+}
+
+/** Output the bit reversal swap table.
+  * \param fft_size Size of (complex) FFT. This must be a power of 2.
+  */
+static void outputBitReverseTable(int fft_size)
+{
+	int i;
+	int j;
+	int bit;
+	int num_bits;
+	int num_swaps;
+
+	num_bits = 0;
+	while ((1 << num_bits) < fft_size)
+	{
+		num_bits++;
+	}
+	num_swaps = 0;
+	for (i = 0; i < fft_size; i++)
+	{
+		j = 0;
+		for (bit = 0; bit < num_bits; bit++)
+		{
+			if ((i & (1 << bit)) != 0)
+			{
+				j |= 1 << (num_bits - bit - 1);
+			}
+		}
+		if (j > i)
+		{
+			num_swaps++;
+		}
+	}
+	printf("// Table generated using gen_twiddle.\n");
+	printf("// FFT size: %d.\n", fft_size);
+	printf("static const uint8_t bit_reverse_swaps[%d][2] = {\n", num_swaps);
+	num_swaps = 0;
+	for (i = 0; i < fft_size; i++)
+	{
+		j = 0;
+		for (bit = 0; bit < num_bits; bit++)
+		{
+			if ((i & (1 << bit)) != 0)
+			{
+				j |= 1 << (num_bits - bit - 1);
+			}
+		}
+		if (j > i)
+		{
+			if (num_swaps != 0)
+			{
+				printf(", ");
+				if ((num_swaps % SWAPS_PER_LINE) == 0)
+				{
+					printf("\n");
+				}
+			}
+			printf("{%d, %d}", i, j);
+			num_swaps++;
+		}
+	}
+	printf("\n};\n");
+}
 
 int main(int argc, char **argv)
 {
@@ -35,10 +159,12 @@ int main(int argc, char **argv)
 	int table_size;
 	unsigned int out; // C spec guarantees unsigned int can hold [0, 65535]
 
-	if (argc != 2)
+	if ((argc != 2) && (argc != 3))
 	{
-		printf("Usage: %s <size>\n", argv[0]);
+		printf("Usage: %s <size> [full|bitrev]\n", argv[0]);
 		printf("  <size>: size of (complex) FFT\n");
+		printf("  full:   output full twiddle factor table for fft()\n");
+		printf("  bitrev: output bit reversal swap table for fft()\n");
 		printf("\n");
 		exit(1);
 	}
@@ -52,6 +178,28 @@ int main(int argc, char **argv)
 		printf("Error: Invalid size\n");
 		exit(1);
 	}
+	if (argc == 3)
+	{
+		if ((fft_size & (fft_size - 1)) != 0)
+		{
+			printf("Error: Size must be a power of 2\n");
+			exit(1);
+		}
+		if (!strcmp(argv[2], "full"))
+		{
+			outputFullTable(fft_size);
+		}
+		else if (!strcmp(argv[2], "bitrev"))
+		{
+			outputBitReverseTable(fft_size);
+		}
+		else
+		{
+			printf("Error: Unknown table type\n");
+			exit(1);
+		}
+		exit(0);
+	}
 
 	// A complex FFT of size fft_size would normally need fft_size / 2 twiddle
 	// factors, corresponding to phi in [0, pi). But since fft.c uses various
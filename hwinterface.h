@@ -163,17 +163,55 @@ extern uint8_t streamGetOneByte(void);
   * \param one_byte The byte to send.
   */
 extern void streamPutOneByte(uint8_t one_byte);
+/** Grab a number of bytes from the communication stream. This has the same
+  * effect as calling streamGetOneByte() length times, but allows the
+  * implementation to move bytes in blocks instead of one at a time. Like
+  * streamGetOneByte(), this should only return if all the bytes were
+  * received free of read errors.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+extern void streamGetBytes(uint8_t *buffer, uint32_t length);
+/** Send a number of bytes to the communication stream. This has the same
+  * effect as calling streamPutOneByte() for each byte, but allows the
+  * implementation to move bytes in blocks instead of one at a time. Like
+  * streamPutOneByte(), this should only return if all the bytes were sent
+  * free of write errors.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+extern void streamPutBytes(const uint8_t *buffer, uint32_t length);
+
+/** A transaction output which is waiting for approval from the user. This
+  * is about half the size of the text of the amount and address, so user
+  * interfaces store outputs passed to newOutputSeen() like this and only
+  * convert them to text when they are displayed. */
+typedef struct StoredOutputStruct
+{
+	/** Output amount, as an 8 byte little-endian multi-precision integer. */
+	uint8_t amount[8];
+	/** Address version byte (see hashToAddr()). */
+	uint8_t address_version;
+	/** Public key hash or script hash which the output pays to. */
+	uint8_t hash[20];
+} StoredOutput;
 
 /** Notify the user interface that the transaction parser has seen a new
-  * Bitcoin amount/address pair.
-  * \param text_amount The output amount, as a null-terminated text string
-  *                    such as "0.01".
-  * \param text_address The output address, as a null-terminated text string
-  *                     such as "1RaTTuSEN7jJUDiW1EGogHwtek7g9BiEn".
+  * Bitcoin amount/address pair. The amount and address are passed in binary
+  * form, so that the user interface can store them compactly and only
+  * convert them to text (using amountToText() and hashToAddr()) when they
+  * are displayed.
+  * \param amount The output amount, as an 8 byte little-endian
+  *               multi-precision integer (in satoshis).
+  * \param hash The 20 byte hash (public key hash or script hash) which the
+  *             output pays to.
+  * \param address_version The address version byte which identifies the
+  *                        type of hash, for example #ADDRESS_VERSION_PUBKEY.
   * \return false if no error occurred, true if there was not enough space to
   *         store the amount/address pair.
   */
-extern bool newOutputSeen(char *text_amount, char *text_address);
+extern bool newOutputSeen(uint8_t *amount, uint8_t *hash, uint8_t address_version);
 /** Notify the user interface that the transaction parser has seen the
   * transaction fee. If there is no transaction fee, the transaction parser
   * will not call this.
@@ -10,12 +10,12 @@
   * period in between each conversion so that the results of FFTs are
   * meaningful.
   *
-  * The results of conversions go into #adc_sample_buffer. To begin a series
-  * of conversions, call beginFillingADCBuffer(), then wait
-  * until #sample_buffer_full is true. #adc_sample_buffer will then
-  * contain #SAMPLE_BUFFER_SIZE samples. This interface allows one buffer of
-  * samples to be collected while the previous one is processed, which speeds
-  * up entropy collection.
+  * The results of conversions go into one of the #ADC_NUM_SAMPLE_BUFFERS
+  * buffers in #adc_sample_buffers. To begin a series of conversions, call
+  * beginFillingADCBuffer(), then wait until #sample_buffer_full is true. The
+  * selected buffer will then contain #SAMPLE_BUFFER_SIZE samples. This
+  * interface allows one buffer of samples to be collected while the previous
+  * one is processed, which speeds up entropy collection.
   *
   * For details on hardware interfacing requirements, see initADC().
   *
@@ -26,13 +26,18 @@
 #include "LPC11Uxx.h"
 #include "adc.h"
 
-/** A place to store samples from the ADC. When #sample_buffer_full is
-  * true, every entry in this array will be filled with ADC samples
-  * taken periodically. */
-volatile uint16_t adc_sample_buffer[SAMPLE_BUFFER_SIZE];
-/** Index into #sample_buffer where the next sample will be written. */
+/** Places to store samples from the ADC. When #sample_buffer_full is
+  * true, every entry in the buffer most recently passed to
+  * beginFillingADCBuffer() will be filled with ADC samples taken
+  * periodically. The other buffer is untouched, so it can be processed while
+  * the ADC interrupt handler is filling this one. */
+volatile uint16_t adc_sample_buffers[ADC_NUM_SAMPLE_BUFFERS][SAMPLE_BUFFER_SIZE];
+/** The buffer (one of #adc_sample_buffers) which is being filled. */
+static volatile uint16_t *sample_buffer_being_filled;
+/** Index into #sample_buffer_being_filled where the next sample will be
+  * written. */
 static volatile uint32_t sample_buffer_current_index;
-/** Whether #sample_buffer is full.  */
+/** Whether #sample_buffer_being_filled is full.  */
 volatile bool sample_buffer_full;
 
 /** Set up ADC to sample from AD5 (pin 19 on mbed) periodically using the
@@ -71,24 +76,28 @@ void ADC_IRQHandler(void)
 	}
 	else
 	{
-		adc_sample_buffer[sample_buffer_current_index] = (uint16_t)sample;
+		sample_buffer_being_filled[sample_buffer_current_index] = (uint16_t)sample;
 		sample_buffer_current_index++;
 	}
 }
 
 /** Begin collecting #SAMPLE_BUFFER_SIZE samples, filling
-  * up #adc_sample_buffer. This will return before all the samples have been
-  * collected, allowing the caller to do something else while samples are
-  * collected in the background. #sample_buffer_full can be used to indicate
-  * when #adc_sample_buffer is full.
+  * up one of #adc_sample_buffers. This will return before all the samples
+  * have been collected, allowing the caller to do something else (like
+  * processing the other buffer) while samples are collected in the
+  * background. #sample_buffer_full can be used to indicate when the buffer
+  * is full.
   *
-  * It is okay to call this while the sample buffer is still being filled up.
+  * It is okay to call this while a sample buffer is still being filled up.
   * In that case, calling this will reset #sample_buffer_current_index so that
-  * the sample buffer will commence filling from the start.
+  * the specified buffer will commence filling from the start.
+  * \param buffer_index Which buffer (0 to #ADC_NUM_SAMPLE_BUFFERS - 1) of
+  *                     #adc_sample_buffers to fill.
   */
-void beginFillingADCBuffer(void)
+void beginFillingADCBuffer(unsigned int buffer_index)
 {
 	__disable_irq();
+	sample_buffer_being_filled = adc_sample_buffers[buffer_index];
 	sample_buffer_current_index = 0;
 	sample_buffer_full = false;
 	LPC_CT32B0->TCR = 1; // enable timer
@@ -15,11 +15,14 @@
   *          will attempt to read past the end of the sample buffer.
   */
 #define SAMPLE_BUFFER_SIZE		(FFT_SIZE * 2)
+/** Number of buffers in #adc_sample_buffers. With two buffers, one can be
+  * filled while the other is processed. */
+#define ADC_NUM_SAMPLE_BUFFERS	2
 
-extern volatile uint16_t adc_sample_buffer[SAMPLE_BUFFER_SIZE];
+extern volatile uint16_t adc_sample_buffers[ADC_NUM_SAMPLE_BUFFERS][SAMPLE_BUFFER_SIZE];
 extern volatile bool sample_buffer_full;
 
 extern void initADC(void);
-extern void beginFillingADCBuffer(void);
+extern void beginFillingADCBuffer(unsigned int buffer_index);
 
 #endif // #ifndef LPC11UXX_ADC_H_INCLUDED
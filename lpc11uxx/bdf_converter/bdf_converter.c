@@ -25,6 +25,10 @@
   * column. If you get to the bottom of the last column, move to the top-left
   * pixel of the next glyph.
   *
+  * Alternatively, this can output a page-aligned glyph table (see
+  * outputPagedTable()), which ssd1306.c can render from using straight byte
+  * copies.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
@@ -53,6 +57,8 @@ static int bytes_per_row;
 static int *bitmaps[ENCODING_END];
 /** Number of bytes on current line of C source output. */
 static int values_on_output_line;
+/** Bitmap of all 00s, to output when the font doesn't define a glyph. */
+static int *null_bitmap;
 
 /** Parse the definition of one glyph. The parser looks at everything between
   * the next occurence of "STARTCHAR <char_name>" and "ENDCHAR".
@@ -178,24 +184,117 @@ static void outputTableByte(int output_byte, int no_comma)
 	}
 }
 
+/** Get the horizontal bitmap for a glyph, substituting a blank bitmap if the
+  * font doesn't define that glyph.
+  * \param encoding The encoding value of the glyph.
+  * \return The horizontal bitmap of the glyph.
+  */
+static int *getBitmap(int encoding)
+{
+	if (bitmaps[encoding] != NULL)
+	{
+		return bitmaps[encoding];
+	}
+	else
+	{
+		return null_bitmap;
+	}
+}
+
+/** Output a page-aligned glyph table. Each entry of the table is one glyph.
+  * Each glyph consists of one byte per column per 8 pixel high page, in
+  * column-major order: the first byte is the top 8 pixels of the leftmost
+  * column, the next byte is the 8 pixels below that, and so on. Within each
+  * byte, the least significant bit is the topmost pixel. If the glyph height
+  * is not a multiple of 8, the bottom of each column is padded with 0s.
+  *
+  * This matches the order in which the SSD1306 expects data bytes when its
+  * memory addressing mode is "vertical", so that a glyph can be sent
+  * without any bit manipulation.
+  * \param file_name Name of BDF file, for the table header comment.
+  * \param font_name Name of font, for the table header comment.
+  */
+static void outputPagedTable(char *file_name, char *font_name)
+{
+	int i, j, k;
+	int pages;
+	int *current_bitmap;
+	int output_byte;
+
+	pages = (height + 7) >> 3; // round up
+	printf("// Table generated from file \"%s\" using bdf_converter (paged).\n", file_name);
+	printf("// Font name: \"%s\".\n", font_name);
+	printf("const uint8_t glyph_table[%d][%d] = {\n", ENCODING_END - ENCODING_START, width * pages);
+	for (i = ENCODING_START; i < ENCODING_END; i++)
+	{
+		current_bitmap = getBitmap(i);
+		printf("{");
+		for (j = 0; j < (width * pages); j++)
+		{
+			// Inspect pixels of glyph with encoding value i, at column
+			// (j / pages) and rows within page (j % pages).
+			output_byte = 0;
+			for (k = 0; k < 8; k++)
+			{
+				if ((((j % pages) * 8 + k) < height)
+					&& (current_bitmap[((j % pages) * 8 + k) * bytes_per_row + ((j / pages) >> 3)] & (0x80 >> ((j / pages) & 7))))
+				{
+					output_byte |= 1 << k;
+				}
+			}
+			if (j != 0)
+			{
+				printf(" ");
+			}
+			printf("0x%02x", output_byte);
+			if (j != (width * pages - 1))
+			{
+				printf(",");
+			}
+		}
+		printf("}");
+		if (i != (ENCODING_END - 1))
+		{
+			printf(",");
+		}
+		printf(" // 0x%02x\n", i);
+	}
+	printf("};\n");
+}
+
 int main(int argc, char **argv)
 {
 	char current_line[256];
 	char font_name[256];
 	int found_font_name;
+	int is_paged;
 	int i, j, k;
-	int *null_bitmap; // bitmap of all 00s, to output when the font doesn't define a glyph
 	int *current_bitmap;
 	int output_byte;
 	int mask;
 	int bits_shifted;
 	FILE *bdf;
 
-	if (argc != 2)
+	if ((argc != 2) && (argc != 3))
 	{
-		printf("Usage: %s <bdf_file_name>\n", argv[0]);
+		printf("Usage: %s <bdf_file_name> [paged]\n", argv[0]);
+		printf("  paged: output page-aligned glyph table instead of packed font table\n");
+		printf("\n");
 		exit(1);
 	}
+	is_paged = 0;
+	if (argc == 3)
+	{
+		if (!strcmp(argv[2], "paged"))
+		{
+			is_paged = 1;
+		}
+		else
+		{
+			printf("Error: Unknown table type\n");
+			exit(1);
+		}
+	}
 
 	bdf = fopen(argv[1], "r");
 	if (bdf == NULL)
@@ -212,9 +311,6 @@ int main(int argc, char **argv)
 		if (sscanf(current_line, "FONT %s", font_name) == 1)
 		{
 			found_font_name = 1;
-			printf("// Table generated from file \"%s\" using bdf_converter.\n", argv[1]);
-			printf("// Font name: \"%s\".\n", font_name);
-			printf("const uint8_t font_table[] = {\n");
 			break;
 		}
 	}
@@ -234,24 +330,24 @@ int main(int argc, char **argv)
 		parseGlyph(bdf);
 	}
 	fclose(bdf);
+	null_bitmap = calloc(bytes_per_row * height, sizeof(int));
+
+	if (is_paged)
+	{
+		outputPagedTable(argv[1], font_name);
+		exit(0);
+	}
 
 	// Convert horizontal bitmaps into packed vertical bitmaps.
+	printf("// Table generated from file \"%s\" using bdf_converter.\n", argv[1]);
+	printf("// Font name: \"%s\".\n", font_name);
+	printf("const uint8_t font_table[] = {\n");
 	output_byte = 0;
-	null_bitmap = calloc(bytes_per_row * height, sizeof(int));
 	bits_shifted = 0;
 	values_on_output_line = 0;
 	for (i = ENCODING_START; i < ENCODING_END; i++)
 	{
-		if (bitmaps[i] != NULL)
-		{
-			current_bitmap = bitmaps[i];
-		}
-		else
-		{
-			// Font doesn't define the glyph with encoding value i. Just
-			// use a bitmap of all 00s.
-			current_bitmap = null_bitmap;
-		}
+		current_bitmap = getBitmap(i);
 		for (j = 0; j < width; j++)
 		{
 			for (k = 0; k < height; k++)
@@ -35,6 +35,7 @@
 
 static void reportStatistics(uint32_t tests_failed);
 static void reportFftResults(ComplexFixed *fft_buffer);
+static void reportFrameResults(int max_bin, int bandwidth, fix16_t max_autocorrelation, fix16_t autocorrelation_limit, uint32_t tests_failed);
 
 // These are copies of some variables in histogramTestsFailed() and
 // fftTestsFailed() which are reported by reportStatistics().
@@ -50,7 +51,7 @@ static fix16_t most_recent_entropy_estimate;
 /** Set to non-zero to send statistical properties to stream. 1 = moment-based
   * statistical properties, 2 = power spectral density estimate, 3 = bandwidth
   * estimate, 4 = autocorrelation results, 5 = maximum autocorrelation value
-  * and entropy estimate. */
+  * and entropy estimate, 6 = results of early tests for each frame. */
 static int report_to_stream;
 #endif // #ifdef TEST_STATISTICS
 
@@ -64,6 +65,9 @@ static bool is_not_first_in_histogram;
 /** Number of samples in the sample buffer that hardwareRandom32Bytes() has
   * used up. */
 static uint32_t sample_buffer_consumed;
+/** Which of #adc_sample_buffers hardwareRandom32Bytes() is consuming
+  * samples from. The other buffer is being filled in the background. */
+static unsigned int current_buffer;
 
 /** Obtains an estimate of the bandwidth of the HWRNG, based on the power
   * spectrum density estimate (see #psd_accumulator).
@@ -192,10 +196,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	fix16_t entropy_estimate;
 
 	fix16_error_occurred = false;
-	mean = calculateCentralMoment(fix16_zero, 1);
-	*variance = calculateCentralMoment(mean, 2);
-	kappa3 = calculateCentralMoment(mean, 3);
-	kappa4 = calculateCentralMoment(mean, 4);
+	calculateMoments(&mean, variance, &kappa3, &kappa4);
 	moment_error_occurred = fix16_error_occurred;
 	fix16_error_occurred = false;
 	entropy_estimate = estimateEntropy();
@@ -212,7 +213,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	tests_failed = 0;
 	// STATTEST_MIN_MEAN and STATTEST_MAX_MEAN are in ADC output numbers.
 	// To be comparable to mean, they need to be scaled and offset, just
-	// as samples are in updateIteratorCache().
+	// as samples are in scaleSample().
 	if (mean <= F16((STATTEST_MIN_MEAN - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN))
 	{
 		tests_failed |= 1; // mean below minimum
@@ -331,6 +332,73 @@ static NOINLINE uint32_t fftTestsFailed(fix16_t variance)
 	return tests_failed;
 }
 
+/** Run FFT-based statistical tests on a partial power spectral density
+  * estimate, so that a badly broken HWRNG can be detected before a whole set
+  * of #SAMPLE_COUNT samples has been collected. This should be called after
+  * every call to accumulatePowerSpectralDensity().
+  *
+  * A partial estimate is noisier than the one that fftTestsFailed() sees,
+  * so the limits used here (eg. #PSD_EARLY_MIN_BANDWIDTH) are looser. Thus
+  * a failure here means that a limit in hwrng_limits.h has been conclusively
+  * violated. The variance isn't known until the histogram is complete, so
+  * the autocorrelation test is normalised using the lag 0 value of the
+  * correlogram instead.
+  * \return 0 if all tests passed (or if it's too early or too late to do
+  *         the tests), non-zero if any tests failed. The bits which are set
+  *         have the same meaning as they do for fftTestsFailed().
+  */
+static NOINLINE uint32_t fftEarlyTestsFailed(void)
+{
+	uint32_t tests_failed;
+	bool autocorrelation_error_occurred;
+	int bandwidth; // as FFT bin number
+	int max_bin; // as FFT bin number
+	fix16_t max_autocorrelation;
+	fix16_t autocorrelation_limit;
+	ComplexFixed fft_buffer[FFT_SIZE + 1];
+
+	if ((psd_frames_accumulated < PSD_EARLY_MIN_FRAMES)
+		|| (psd_frames_accumulated >= PSD_NUM_FRAMES))
+	{
+		// Either the estimate is too noisy to be conclusive, or it's
+		// complete and fftTestsFailed() is about to be called anyway.
+		return 0;
+	}
+	bandwidth = estimateBandwidth(&max_bin);
+	fix16_error_occurred = false;
+	autocorrelation_error_occurred = calculateAutoCorrelation(fft_buffer);
+	max_autocorrelation = findMaximumAutoCorrelation(fft_buffer);
+	autocorrelation_limit = fix16_mul(fft_buffer[0].real, F16(AUTOCORR_EARLY_THRESHOLD / AUTOCORR_VARIANCE_SCALE));
+
+	// The location of the peak isn't tested, since it isn't conclusive;
+	// see #PSD_EARLY_MIN_BANDWIDTH.
+	tests_failed = 0;
+	if (fix16_from_int(bandwidth) < F16(PSD_EARLY_MIN_BANDWIDTH * 2.0 * FFT_SIZE))
+	{
+		tests_failed |= 32; // bandwidth of HWRNG below minimum
+	}
+	if (psd_accumulator_error_occurred)
+	{
+		tests_failed |= 48; // arithmetic error (probably overflow)
+	}
+	if (max_autocorrelation > autocorrelation_limit)
+	{
+		tests_failed |= 64; // maximum autocorrelation amplitude above maximum
+	}
+	if (autocorrelation_error_occurred)
+	{
+		tests_failed |= 64; // arithmetic error (probably overflow)
+	}
+
+#ifdef TEST_STATISTICS
+	if (report_to_stream == 6)
+	{
+		reportFrameResults(max_bin, bandwidth, max_autocorrelation, autocorrelation_limit, tests_failed);
+	}
+#endif // #ifdef TEST_STATISTICS
+	return tests_failed;
+}
+
 /** Fill buffer with 32 random bytes from a hardware random number generator.
   * \param buffer The buffer to fill. This should have enough space for 32
   *               bytes.
@@ -350,13 +418,14 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 		// everything needs to start from a blank state.
 		clearHistogram();
 		clearPowerSpectralDensity();
-		// The histogram is empty. The sample buffer is also assumed to be
+		// The histogram is empty. The sample buffers are also assumed to be
 		// empty, since this may be the first call to hardwareRandom32Bytes()
 		// after power-on. Therefore an extra call to beginFillingADCBuffer()
 		// needs to be done to ensure that a full, current sample buffer is
 		// available.
 		sample_buffer_consumed = 0;
-		beginFillingADCBuffer();
+		current_buffer = 0;
+		beginFillingADCBuffer(current_buffer);
 		is_not_first_in_histogram = true;
 	}
 	if (sample_buffer_consumed == 0)
@@ -366,6 +435,14 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 		{
 			// do nothing
 		}
+		// Start acquiring the next block into the other buffer, so that
+		// it fills while this one is consumed and tested. There's no need
+		// to do this for the last block before the statistical tests,
+		// since that would only be discarded.
+		if ((samples_in_histogram + SAMPLE_BUFFER_SIZE) < SAMPLE_COUNT)
+		{
+			beginFillingADCBuffer(current_buffer ^ 1);
+		}
 	}
 	// From here on, code can assume that a full, current sample buffer is
 	// available.
@@ -377,7 +454,7 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 #endif // #if ((SAMPLE_BUFFER_SIZE & 15) != 0)
 	for (i = 0; i < 16; i++)
 	{
-		sample = adc_sample_buffer[sample_buffer_consumed];
+		sample = adc_sample_buffers[current_buffer][sample_buffer_consumed];
 		incrementHistogram(sample);
 		// Fill entropy buffer with ADC sample data.
 		buffer[i * 2] = (uint8_t)sample;
@@ -393,10 +470,21 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 #if SAMPLE_BUFFER_SIZE != (FFT_SIZE * 2)
 #error "SAMPLE_BUFFER_SIZE not twice FFT_SIZE"
 #endif // #if SAMPLE_BUFFER_SIZE != (FFT_SIZE * 2)
-		accumulatePowerSpectralDensity(adc_sample_buffer);
-		// Sample buffer fully consumed; need to get a new buffer.
+		accumulatePowerSpectralDensity(adc_sample_buffers[current_buffer]);
+		tests_failed = fftEarlyTestsFailed();
+		// Sample buffer fully consumed; switch to the other buffer, which
+		// should already be filling (or full).
 		sample_buffer_consumed = 0;
-		beginFillingADCBuffer();
+		current_buffer ^= 1;
+		if (tests_failed != 0)
+		{
+			// A limit has already been conclusively violated, so there's
+			// no point in collecting the rest of the samples. Start again
+			// from a blank state on the next call. The ADC may still be
+			// filling a buffer; that will be restarted by the next call.
+			is_not_first_in_histogram = false;
+			return -1; // statistical tests indicate HWRNG failure
+		}
 	}
 
 	if (samples_in_histogram >= SAMPLE_COUNT)
@@ -524,6 +612,46 @@ static void reportFftResults(ComplexFixed *fft_buffer)
 	}
 }
 
+/** Write the results of fftEarlyTestsFailed() for one frame to stream, so
+  * that the host may capture them into a comma-seperated variable file. Each
+  * line contains the number of frames accumulated so far, the peak frequency
+  * and bandwidth estimates (in FFT bins), the maximum autocorrelation
+  * amplitude, the autocorrelation limit it was compared against, and whether
+  * the early tests passed.
+  * \param max_bin The bin number of the peak value in the power spectrum.
+  * \param bandwidth The bandwidth estimate, in number of FFT bins.
+  * \param max_autocorrelation The maximum autocorrelation amplitude.
+  * \param autocorrelation_limit The limit for max_autocorrelation.
+  * \param tests_failed Indicates which tests failed (0 means none).
+  */
+static void reportFrameResults(int max_bin, int bandwidth, fix16_t max_autocorrelation, fix16_t autocorrelation_limit, uint32_t tests_failed)
+{
+	char buffer[20];
+
+	sprintFix16(buffer, fix16_from_int((int)psd_frames_accumulated));
+	sendString(buffer);
+	sendString(", ");
+	sprintFix16(buffer, fix16_from_int(max_bin));
+	sendString(buffer);
+	sendString(", ");
+	sprintFix16(buffer, fix16_from_int(bandwidth));
+	sendString(buffer);
+	sendString(", ");
+	sprintFix16(buffer, max_autocorrelation);
+	sendString(buffer);
+	sendString(", ");
+	sprintFix16(buffer, autocorrelation_limit);
+	sendString(buffer);
+	if (tests_failed == 0)
+	{
+		sendString(", pass\r\n");
+	}
+	else
+	{
+		sendString(", fail\r\n");
+	}
+}
+
 /** Write statistical properties to screen so that they may be inspected in
   * real-time. Because there are too many properties to fit on-screen,
   * there are various testing modes which will write different properties.
@@ -680,6 +808,7 @@ static void sendFix16(fix16_t value)
   * - 'A': Send results of autocorrelation computation to stream.
   * - 'E': Send maximum autocorrelation amplitude and entropy esimate to
   *        stream.
+  * - 'F': Send results of early FFT-based tests for each frame to stream.
   * - Anything which is not an uppercase letter: grab input data from the
   *   stream, compute various statistical values and send them to the stream.
   *   The host can then check the output.
@@ -721,6 +850,10 @@ void testStatistics(void)
 		{
 			report_to_stream = 5;
 		}
+		else if (mode == 'F')
+		{
+			report_to_stream = 6;
+		}
 		else
 		{
 			report_to_stream = 0;
@@ -756,10 +889,7 @@ void testStatistics(void)
 			SysTick->LOAD = 0x00FFFFFF; // set timer reload to max
 			SysTick->CTRL = 5; // enable system tick timer, frequency = CPU
 
-			mean = calculateCentralMoment(fix16_zero, 1);
-			variance = calculateCentralMoment(mean, 2);
-			kappa3 = calculateCentralMoment(mean, 3);
-			kappa4 = calculateCentralMoment(mean, 4);
+			calculateMoments(&mean, &variance, &kappa3, &kappa4);
 			entropy_estimate = estimateEntropy();
 
 			cycles = SysTick->VAL; // read as soon as possible
@@ -151,6 +151,36 @@
   * This value was estimated from an ensemble of measured correlograms.
   */
 #define AUTOCORR_THRESHOLD			1.94
+/** Number of frames (see #PSD_NUM_FRAMES) which must be accumulated into the
+  * power spectral density estimate before the early FFT-based tests
+  * (see fftEarlyTestsFailed() in hwrng.c) are applied. Those tests allow a
+  * badly broken HWRNG to be detected before a whole set of #SAMPLE_COUNT
+  * samples has been collected. Estimates from a single frame are too noisy to
+  * be conclusive about anything. Setting this to #PSD_NUM_FRAMES or more
+  * disables the early tests.
+  */
+#define PSD_EARLY_MIN_FRAMES		2
+/** The minimum bandwidth in a partial power spectrum estimate. Below this,
+  * #PSD_MIN_BANDWIDTH is considered to be conclusively violated.
+  * The value is expressed as a fraction of the sampling rate.
+  *
+  * There are no early equivalents of #PSD_MIN_PEAK and #PSD_MAX_PEAK, because
+  * the location of the peak of a partial estimate of a flat spectrum can be
+  * anywhere in the passband. So an out-of-range peak is never conclusive.
+  */
+#define PSD_EARLY_MIN_BANDWIDTH		(0.5 * PSD_MIN_BANDWIDTH)
+/** The normalised autocorrelation threshold for a partial power spectrum
+  * estimate. Above this, #AUTOCORR_THRESHOLD is considered to be conclusively
+  * violated. This is normalised in the same way as #AUTOCORR_THRESHOLD,
+  * except that the variance is estimated from the lag 0 value of the
+  * correlogram, since the histogram isn't complete yet.
+  *
+  * For a white noise source, the maximum autocorrelation amplitude of a
+  * partial estimate scales roughly as 1 / sqrt(number of frames), so with
+  * #PSD_EARLY_MIN_FRAMES frames it is about twice what it would be for the
+  * full estimate.
+  */
+#define AUTOCORR_EARLY_THRESHOLD	(2.0 * AUTOCORR_THRESHOLD)
 /** Minimum acceptable entropy estimate (in bits) per sample. This is
   * approximately 10 standard deviations (calculated using N = 4096) below
   * the mean entropy estimate for a Gaussian distribution with a standard
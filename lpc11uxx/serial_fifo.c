@@ -223,6 +223,219 @@ void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_
 	}
 }
 
+/** Get the contiguous region of a circular buffer which can be read without
+  * wrapping around. The region starts at the oldest byte in the buffer. The
+  * caller can read the region directly (e.g. using memcpy() or DMA), then
+  * remove the bytes from the buffer using circularBufferCommitRead().
+  *
+  * Since the producer only ever adds bytes, the region can only grow between
+  * this call and the commit. The region is guaranteed to remain valid until
+  * the commit, provided that there is only one consumer.
+  * \param buffer The circular buffer to examine.
+  * \param out_span A pointer to the start of the region will be written
+  *                 here.
+  * \return The length, in bytes, of the region. This will be 0 if the buffer
+  *         is empty.
+  */
+uint32_t circularBufferReadSpan(volatile CircularBuffer *buffer, volatile uint8_t **out_span)
+{
+	uint32_t primask;
+	uint32_t next;
+	uint32_t length;
+
+	// Save PRIMASK instead of unconditionally re-enabling interrupts, since
+	// this may be called from an interrupt request handler.
+	primask = __get_PRIMASK();
+	__disable_irq();
+	next = buffer->next;
+	length = buffer->remaining;
+	__set_PRIMASK(primask);
+	if (length > (buffer->size - next))
+	{
+		length = buffer->size - next;
+	}
+	*out_span = &(buffer->storage[next]);
+	return length;
+}
+
+/** Remove bytes from a circular buffer after they have been read from the
+  * region returned by circularBufferReadSpan().
+  * \param buffer The circular buffer to remove bytes from.
+  * \param length The number of bytes to remove. This must not be greater
+  *               than the length returned by circularBufferReadSpan().
+  */
+void circularBufferCommitRead(volatile CircularBuffer *buffer, uint32_t length)
+{
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	buffer->next = (buffer->next + length) & (buffer->size - 1);
+	buffer->remaining -= length;
+	__set_PRIMASK(primask);
+}
+
+/** Get the contiguous region of a circular buffer which can be written
+  * without wrapping around. The region starts just after the newest byte in
+  * the buffer. The caller can fill the region directly (e.g. using memcpy()
+  * or DMA), then add the bytes to the buffer using
+  * circularBufferCommitWrite().
+  *
+  * Since the consumer only ever removes bytes, the region can only grow
+  * between this call and the commit. The region is guaranteed to remain
+  * valid until the commit, provided that there is only one producer.
+  * \param buffer The circular buffer to examine.
+  * \param out_span A pointer to the start of the region will be written
+  *                 here.
+  * \return The length, in bytes, of the region. This will be 0 if the buffer
+  *         is full.
+  */
+uint32_t circularBufferWriteSpan(volatile CircularBuffer *buffer, volatile uint8_t **out_span)
+{
+	uint32_t primask;
+	uint32_t index;
+	uint32_t length;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	index = (buffer->next + buffer->remaining) & (buffer->size - 1);
+	length = buffer->size - buffer->remaining;
+	__set_PRIMASK(primask);
+	if (length > (buffer->size - index))
+	{
+		length = buffer->size - index;
+	}
+	*out_span = &(buffer->storage[index]);
+	return length;
+}
+
+/** Add bytes to a circular buffer after they have been written into the
+  * region returned by circularBufferWriteSpan().
+  * \param buffer The circular buffer to add bytes to.
+  * \param length The number of bytes to add. This must not be greater
+  *               than the length returned by circularBufferWriteSpan().
+  */
+void circularBufferCommitWrite(volatile CircularBuffer *buffer, uint32_t length)
+{
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	buffer->remaining += length;
+	__set_PRIMASK(primask);
+}
+
+/** Read as many bytes as are available (up to a limit) from a circular
+  * buffer, copying them in contiguous blocks. Unlike circularBufferRead(),
+  * this will not block; it may read fewer bytes than requested, including
+  * none at all. The bytes are copied out of at most two spans (see
+  * circularBufferReadSpan()).
+  * \param buffer The circular buffer to read from.
+  * \param out The bytes that were read will be written here. This must
+  *            have space for length bytes.
+  * \param length The maximum number of bytes to read.
+  * \return The number of bytes that were actually read.
+  */
+uint32_t circularBufferReadBlock(volatile CircularBuffer *buffer, uint8_t *out, uint32_t length)
+{
+	volatile uint8_t *span;
+	uint32_t total;
+	uint32_t chunk;
+
+	// Usually two spans are enough: one up to the end of the storage array,
+	// and one after wrapping around.
+	total = 0;
+	while (total < length)
+	{
+		chunk = circularBufferReadSpan(buffer, &span);
+		if (chunk == 0)
+		{
+			break;
+		}
+		if (chunk > (length - total))
+		{
+			chunk = length - total;
+		}
+		memcpy(&(out[total]), (const void *)span, chunk);
+		circularBufferCommitRead(buffer, chunk);
+		total += chunk;
+	}
+	return total;
+}
+
+/** Write as many bytes as will fit (up to a limit) into a circular buffer,
+  * copying them in contiguous blocks. Unlike circularBufferWrite(), this
+  * will not block; it may write fewer bytes than requested, including none
+  * at all. The bytes are copied into at most two spans (see
+  * circularBufferWriteSpan()).
+  * \param buffer The circular buffer to write to.
+  * \param data The bytes to write.
+  * \param length The maximum number of bytes to write.
+  * \return The number of bytes that were actually written.
+  */
+uint32_t circularBufferWriteBlock(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length)
+{
+	volatile uint8_t *span;
+	uint32_t total;
+	uint32_t chunk;
+
+	// Usually two spans are enough: one up to the end of the storage array,
+	// and one after wrapping around.
+	total = 0;
+	while (total < length)
+	{
+		chunk = circularBufferWriteSpan(buffer, &span);
+		if (chunk == 0)
+		{
+			break;
+		}
+		if (chunk > (length - total))
+		{
+			chunk = length - total;
+		}
+		memcpy((void *)span, &(data[total]), chunk);
+		circularBufferCommitWrite(buffer, chunk);
+		total += chunk;
+	}
+	return total;
+}
+
+/** Send an acknowledgement to the other side, telling it that it can send
+  * another #RECEIVE_BUFFER_SIZE bytes. This also resets
+  * #receive_acknowledge. */
+static void sendReceiveAcknowledge(void)
+{
+	uint8_t buffer[4];
+	uint32_t i;
+
+	receive_acknowledge = RECEIVE_BUFFER_SIZE;
+	writeU32LittleEndian(buffer, receive_acknowledge);
+	circularBufferWrite(&transmit_buffer, 0xff, false);
+	for (i = 0; i < 4; i++)
+	{
+		circularBufferWrite(&transmit_buffer, buffer[i], false);
+	}
+	serialSendNotify();
+}
+
+/** Wait for an acknowledgement from the other side, then set
+  * #transmit_acknowledge to the number of bytes it says can be sent. */
+static void waitForTransmitAcknowledge(void)
+{
+	uint8_t buffer[4];
+	uint32_t i;
+
+	do
+	{
+		// do nothing
+	} while (circularBufferRead(&receive_buffer, false) != 0xff);
+	for (i = 0; i < 4; i++)
+	{
+		buffer[i] = circularBufferRead(&receive_buffer, false);
+	}
+	transmit_acknowledge = readU32LittleEndian(buffer);
+}
+
 /** Grab one byte from the communication stream. There is no way for this
   * function to indicate a read error. This is intentional; it
   * makes program flow simpler (no need to put checks everywhere). As a
@@ -249,24 +462,60 @@ void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_
 uint8_t streamGetOneByte(void)
 {
 	uint8_t one_byte;
-	uint8_t buffer[4];
-	uint32_t i;
 
 	one_byte = circularBufferRead(&receive_buffer, false);
 	receive_acknowledge--;
 	if (receive_acknowledge == 0)
 	{
 		// Send acknowledgement to other side.
-		receive_acknowledge = RECEIVE_BUFFER_SIZE;
-		writeU32LittleEndian(buffer, receive_acknowledge);
-		circularBufferWrite(&transmit_buffer, 0xff, false);
-		for (i = 0; i < 4; i++)
+		sendReceiveAcknowledge();
+	}
+	return one_byte;
+}
+
+/** Grab a number of bytes from the communication stream. This has the same
+  * effect as calling streamGetOneByte() length times, but bytes are copied
+  * out of the receive buffer in blocks, as they become available.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint32_t count;
+
+	while (length > 0)
+	{
+		while (isCircularBufferEmpty(&receive_buffer))
 		{
-			circularBufferWrite(&transmit_buffer, buffer[i], false);
+			enterSleepMode();
 		}
-		serialSendNotify();
+		if (receive_buffer.error_occurred)
+		{
+			streamError();
+			__disable_irq();
+			while (true)
+			{
+				// do nothing
+			}
+		}
+		// Don't read past the point where an acknowledgement needs to be
+		// sent, otherwise the host could be left waiting for it.
+		count = length;
+		if (count > receive_acknowledge)
+		{
+			count = receive_acknowledge;
+		}
+		count = circularBufferReadBlock(&receive_buffer, buffer, count);
+		receive_acknowledge -= count;
+		if (receive_acknowledge == 0)
+		{
+			// Send acknowledgement to other side.
+			sendReceiveAcknowledge();
+		}
+		buffer += count;
+		length -= count;
 	}
-	return one_byte;
 }
 
 /** Send one byte to the communication stream. There is no way for this
@@ -281,24 +530,57 @@ uint8_t streamGetOneByte(void)
   */
 void streamPutOneByte(uint8_t one_byte)
 {
-	uint8_t buffer[4];
-	uint32_t i;
-
 	circularBufferWrite(&transmit_buffer, one_byte, false);
 	serialSendNotify();
 	transmit_acknowledge--;
 	if (transmit_acknowledge == 0)
 	{
 		// Need to wait for acknowledgement from other side.
-		do
+		waitForTransmitAcknowledge();
+	}
+}
+
+/** Send a number of bytes to the communication stream. This has the same
+  * effect as calling streamPutOneByte() for each byte, but bytes are copied
+  * into the transmit buffer in blocks.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t count;
+
+	while (length > 0)
+	{
+		if (transmit_buffer.error_occurred)
 		{
-			// do nothing
-		} while (circularBufferRead(&receive_buffer, false) != 0xff);
-		for (i = 0; i < 4; i++)
+			streamError();
+			__disable_irq();
+			while (true)
+			{
+				// do nothing
+			}
+		}
+		while (transmit_buffer.remaining == transmit_buffer.size)
+		{
+			enterSleepMode();
+		}
+		// Don't send more than the other side has acknowledged.
+		count = length;
+		if (count > transmit_acknowledge)
+		{
+			count = transmit_acknowledge;
+		}
+		count = circularBufferWriteBlock(&transmit_buffer, buffer, count);
+		serialSendNotify();
+		transmit_acknowledge -= count;
+		if (transmit_acknowledge == 0)
 		{
-			buffer[i] = circularBufferRead(&receive_buffer, false);
+			// Need to wait for acknowledgement from other side.
+			waitForTransmitAcknowledge();
 		}
-		transmit_acknowledge = readU32LittleEndian(buffer);
+		buffer += count;
+		length -= count;
 	}
 }
 
@@ -50,6 +50,137 @@
 /** The character encoding value for a blank (all-zero bitmap) character. */
 #define FONT_BLANK			32
 
+/** Set this to 1 to render using #glyph_table, which is page-aligned, so
+  * that characters can be sent to the SSD1306 using straight byte copies.
+  * Set this to 0 to render using the packed #font_table, which is slower
+  * but can deal with a #CHARACTER_HEIGHT which is not a multiple of 8.
+  */
+#ifndef USE_GLYPH_TABLE
+#define USE_GLYPH_TABLE		1
+#endif // #ifndef USE_GLYPH_TABLE
+
+#if USE_GLYPH_TABLE && ((CHARACTER_HEIGHT % 8) != 0)
+#error "USE_GLYPH_TABLE requires CHARACTER_HEIGHT to be a multiple of 8"
+#endif // #if USE_GLYPH_TABLE && ((CHARACTER_HEIGHT % 8) != 0)
+
+#if USE_GLYPH_TABLE
+
+/** Page-aligned, vertical, monochrome bitmaps for each character, starting
+  * at #FONT_TABLE_START.
+  *
+  * Each glyph consists of #CHARACTER_WIDTH columns of #CHARACTER_HEIGHT / 8
+  * bytes. The first byte is the top 8 pixels of the leftmost column, the
+  * next byte is the 8 pixels below that, and so on. Within each byte, the
+  * least significant bit is the topmost pixel. This is the order in which
+  * the SSD1306 expects data bytes when its memory addressing mode is
+  * "vertical" and its address window covers whole characters (see
+  * setAddressWindow()), so glyphs can be sent without any bit manipulation.
+  *
+  * Table generated from file "ter-u16b.bdf" using bdf_converter, with the
+  * "paged" option.
+  * Font name: "-xos4-Terminus-Bold-R-Normal--16-160-72-72-C-80-ISO10646-1".
+  */
+const uint8_t glyph_table[96][16] = {
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x20
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfc, 0x0d, 0xfc, 0x0d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x21
+{0x00, 0x00, 0x0e, 0x00, 0x0e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x0e, 0x00, 0x00, 0x00}, // 0x22
+{0x20, 0x01, 0xfc, 0x0f, 0xfc, 0x0f, 0x20, 0x01, 0xfc, 0x0f, 0xfc, 0x0f, 0x20, 0x01, 0x00, 0x00}, // 0x23
+{0x70, 0x04, 0xf8, 0x0c, 0x88, 0x08, 0xfe, 0x3f, 0x88, 0x08, 0x98, 0x0f, 0x10, 0x07, 0x00, 0x00}, // 0x24
+{0x08, 0x00, 0x1c, 0x0c, 0x14, 0x0f, 0xc8, 0x03, 0xf0, 0x04, 0x3c, 0x0a, 0x0c, 0x0e, 0x00, 0x04}, // 0x25
+{0x80, 0x07, 0xd8, 0x0f, 0x7c, 0x08, 0xe4, 0x0c, 0xbc, 0x07, 0xd8, 0x0f, 0x40, 0x08, 0x00, 0x00}, // 0x26
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x0e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x27
+{0x00, 0x00, 0x00, 0x00, 0xf0, 0x03, 0xf8, 0x07, 0x0c, 0x0c, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}, // 0x28
+{0x00, 0x00, 0x00, 0x00, 0x04, 0x08, 0x0c, 0x0c, 0xf8, 0x07, 0xf0, 0x03, 0x00, 0x00, 0x00, 0x00}, // 0x29
+{0x80, 0x00, 0xa0, 0x02, 0xe0, 0x03, 0xc0, 0x01, 0xe0, 0x03, 0xa0, 0x02, 0x80, 0x00, 0x00, 0x00}, // 0x2a
+{0x00, 0x00, 0x80, 0x00, 0x80, 0x00, 0xe0, 0x03, 0xe0, 0x03, 0x80, 0x00, 0x80, 0x00, 0x00, 0x00}, // 0x2b
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x1c, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x2c
+{0x80, 0x00, 0x80, 0x00, 0x80, 0x00, 0x80, 0x00, 0x80, 0x00, 0x80, 0x00, 0x80, 0x00, 0x00, 0x00}, // 0x2d
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x2e
+{0x00, 0x00, 0x00, 0x0c, 0x00, 0x0f, 0xc0, 0x03, 0xf0, 0x00, 0x3c, 0x00, 0x0c, 0x00, 0x00, 0x00}, // 0x2f
+{0xf8, 0x07, 0xfc, 0x0f, 0x84, 0x09, 0xc4, 0x08, 0x64, 0x08, 0xfc, 0x0f, 0xf8, 0x07, 0x00, 0x00}, // 0x30
+{0x00, 0x00, 0x10, 0x08, 0x18, 0x08, 0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x08, 0x00, 0x08, 0x00, 0x00}, // 0x31
+{0x18, 0x0c, 0x1c, 0x0e, 0x04, 0x0b, 0x84, 0x09, 0xc4, 0x08, 0x7c, 0x08, 0x38, 0x08, 0x00, 0x00}, // 0x32
+{0x18, 0x06, 0x1c, 0x0e, 0x44, 0x08, 0x44, 0x08, 0x44, 0x08, 0xfc, 0x0f, 0xb8, 0x07, 0x00, 0x00}, // 0x33
+{0x80, 0x01, 0xc0, 0x01, 0x60, 0x01, 0x30, 0x01, 0x18, 0x01, 0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x00}, // 0x34
+{0x7c, 0x04, 0x7c, 0x0c, 0x44, 0x08, 0x44, 0x08, 0x44, 0x08, 0xc4, 0x0f, 0x84, 0x07, 0x00, 0x00}, // 0x35
+{0xf0, 0x07, 0xf8, 0x0f, 0x4c, 0x08, 0x44, 0x08, 0x44, 0x08, 0xc4, 0x0f, 0x80, 0x07, 0x00, 0x00}, // 0x36
+{0x04, 0x00, 0x04, 0x00, 0x04, 0x0e, 0x84, 0x0f, 0xe4, 0x01, 0x7c, 0x00, 0x1c, 0x00, 0x00, 0x00}, // 0x37
+{0xb8, 0x07, 0xfc, 0x0f, 0x44, 0x08, 0x44, 0x08, 0x44, 0x08, 0xfc, 0x0f, 0xb8, 0x07, 0x00, 0x00}, // 0x38
+{0x78, 0x00, 0xfc, 0x08, 0x84, 0x08, 0x84, 0x08, 0x84, 0x0c, 0xfc, 0x07, 0xf8, 0x03, 0x00, 0x00}, // 0x39
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x0c, 0x60, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x3a
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x60, 0x1c, 0x60, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x3b
+{0x00, 0x00, 0x80, 0x00, 0xc0, 0x01, 0x60, 0x03, 0x30, 0x06, 0x18, 0x0c, 0x08, 0x08, 0x00, 0x00}, // 0x3c
+{0x20, 0x01, 0x20, 0x01, 0x20, 0x01, 0x20, 0x01, 0x20, 0x01, 0x20, 0x01, 0x20, 0x01, 0x00, 0x00}, // 0x3d
+{0x00, 0x00, 0x08, 0x08, 0x18, 0x0c, 0x30, 0x06, 0x60, 0x03, 0xc0, 0x01, 0x80, 0x00, 0x00, 0x00}, // 0x3e
+{0x38, 0x00, 0x3c, 0x00, 0x04, 0x00, 0x84, 0x0d, 0xc4, 0x0d, 0x7c, 0x00, 0x38, 0x00, 0x00, 0x00}, // 0x3f
+{0xf8, 0x07, 0xfc, 0x0f, 0x04, 0x08, 0xe4, 0x09, 0x14, 0x0a, 0xfc, 0x0b, 0xf8, 0x0b, 0x00, 0x00}, // 0x40
+{0xf8, 0x0f, 0xfc, 0x0f, 0x84, 0x00, 0x84, 0x00, 0x84, 0x00, 0xfc, 0x0f, 0xf8, 0x0f, 0x00, 0x00}, // 0x41
+{0xfc, 0x0f, 0xfc, 0x0f, 0x44, 0x08, 0x44, 0x08, 0x44, 0x08, 0xfc, 0x0f, 0xb8, 0x07, 0x00, 0x00}, // 0x42
+{0xf8, 0x07, 0xfc, 0x0f, 0x04, 0x08, 0x04, 0x08, 0x04, 0x08, 0x1c, 0x0e, 0x18, 0x06, 0x00, 0x00}, // 0x43
+{0xfc, 0x0f, 0xfc, 0x0f, 0x04, 0x08, 0x04, 0x08, 0x0c, 0x0c, 0xf8, 0x07, 0xf0, 0x03, 0x00, 0x00}, // 0x44
+{0xfc, 0x0f, 0xfc, 0x0f, 0x44, 0x08, 0x44, 0x08, 0x44, 0x08, 0x04, 0x08, 0x04, 0x08, 0x00, 0x00}, // 0x45
+{0xfc, 0x0f, 0xfc, 0x0f, 0x44, 0x00, 0x44, 0x00, 0x44, 0x00, 0x04, 0x00, 0x04, 0x00, 0x00, 0x00}, // 0x46
+{0xf8, 0x07, 0xfc, 0x0f, 0x04, 0x08, 0x84, 0x08, 0x84, 0x08, 0x9c, 0x0f, 0x98, 0x07, 0x00, 0x00}, // 0x47
+{0xfc, 0x0f, 0xfc, 0x0f, 0x40, 0x00, 0x40, 0x00, 0x40, 0x00, 0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x00}, // 0x48
+{0x00, 0x00, 0x00, 0x00, 0x04, 0x08, 0xfc, 0x0f, 0xfc, 0x0f, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}, // 0x49
+{0x00, 0x06, 0x00, 0x0e, 0x00, 0x08, 0x04, 0x08, 0xfc, 0x0f, 0xfc, 0x07, 0x04, 0x00, 0x00, 0x00}, // 0x4a
+{0xfc, 0x0f, 0xfc, 0x0f, 0xc0, 0x00, 0xe0, 0x01, 0x30, 0x03, 0x1c, 0x0e, 0x0c, 0x0c, 0x00, 0x00}, // 0x4b
+{0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x08, 0x00, 0x08, 0x00, 0x08, 0x00, 0x08, 0x00, 0x08, 0x00, 0x00}, // 0x4c
+{0xfc, 0x0f, 0xf8, 0x0f, 0x30, 0x00, 0x60, 0x00, 0x30, 0x00, 0xf8, 0x0f, 0xfc, 0x0f, 0x00, 0x00}, // 0x4d
+{0xfc, 0x0f, 0xfc, 0x0f, 0x60, 0x00, 0xc0, 0x00, 0x80, 0x01, 0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x00}, // 0x4e
+{0xf8, 0x07, 0xfc, 0x0f, 0x04, 0x08, 0x04, 0x08, 0x04, 0x08, 0xfc, 0x0f, 0xf8, 0x07, 0x00, 0x00}, // 0x4f
+{0xfc, 0x0f, 0xfc, 0x0f, 0x84, 0x00, 0x84, 0x00, 0x84, 0x00, 0xfc, 0x00, 0x78, 0x00, 0x00, 0x00}, // 0x50
+{0xf8, 0x07, 0xfc, 0x0f, 0x04, 0x08, 0x04, 0x0c, 0x04, 0x0c, 0xfc, 0x1f, 0xf8, 0x17, 0x00, 0x00}, // 0x51
+{0xfc, 0x0f, 0xfc, 0x0f, 0x84, 0x01, 0x84, 0x03, 0x84, 0x06, 0xfc, 0x0c, 0x78, 0x08, 0x00, 0x00}, // 0x52
+{0x38, 0x06, 0x7c, 0x0e, 0x44, 0x08, 0x44, 0x08, 0x44, 0x08, 0xcc, 0x0f, 0x88, 0x07, 0x00, 0x00}, // 0x53
+{0x04, 0x00, 0x04, 0x00, 0x04, 0x00, 0xfc, 0x0f, 0xfc, 0x0f, 0x04, 0x00, 0x04, 0x00, 0x04, 0x00}, // 0x54
+{0xfc, 0x07, 0xfc, 0x0f, 0x00, 0x08, 0x00, 0x08, 0x00, 0x08, 0xfc, 0x0f, 0xfc, 0x07, 0x00, 0x00}, // 0x55
+{0x7c, 0x00, 0xfc, 0x03, 0x80, 0x0f, 0x00, 0x0c, 0x80, 0x0f, 0xfc, 0x03, 0x7c, 0x00, 0x00, 0x00}, // 0x56
+{0xfc, 0x0f, 0xfc, 0x07, 0x00, 0x03, 0x80, 0x01, 0x00, 0x03, 0xfc, 0x07, 0xfc, 0x0f, 0x00, 0x00}, // 0x57
+{0x0c, 0x0c, 0x3c, 0x0f, 0xf0, 0x03, 0xc0, 0x00, 0xf0, 0x03, 0x3c, 0x0f, 0x0c, 0x0c, 0x00, 0x00}, // 0x58
+{0x0c, 0x00, 0x3c, 0x00, 0x70, 0x00, 0xc0, 0x0f, 0xc0, 0x0f, 0x70, 0x00, 0x3c, 0x00, 0x0c, 0x00}, // 0x59
+{0x04, 0x0e, 0x04, 0x0f, 0x84, 0x09, 0xc4, 0x08, 0x64, 0x08, 0x3c, 0x08, 0x1c, 0x08, 0x00, 0x00}, // 0x5a
+{0x00, 0x00, 0x00, 0x00, 0xfc, 0x0f, 0xfc, 0x0f, 0x04, 0x08, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}, // 0x5b
+{0x00, 0x00, 0x0c, 0x00, 0x3c, 0x00, 0xf0, 0x00, 0xc0, 0x03, 0x00, 0x0f, 0x00, 0x0c, 0x00, 0x00}, // 0x5c
+{0x00, 0x00, 0x00, 0x00, 0x04, 0x08, 0x04, 0x08, 0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x00, 0x00, 0x00}, // 0x5d
+{0x00, 0x00, 0x08, 0x00, 0x0c, 0x00, 0x06, 0x00, 0x06, 0x00, 0x0c, 0x00, 0x08, 0x00, 0x00, 0x00}, // 0x5e
+{0x00, 0x20, 0x00, 0x20, 0x00, 0x20, 0x00, 0x20, 0x00, 0x20, 0x00, 0x20, 0x00, 0x20, 0x00, 0x00}, // 0x5f
+{0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x03, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x60
+{0x00, 0x07, 0xa0, 0x0f, 0xa0, 0x08, 0xa0, 0x08, 0xa0, 0x08, 0xe0, 0x0f, 0xc0, 0x0f, 0x00, 0x00}, // 0x61
+{0xfc, 0x0f, 0xfc, 0x0f, 0x20, 0x08, 0x20, 0x08, 0x20, 0x08, 0xe0, 0x0f, 0xc0, 0x07, 0x00, 0x00}, // 0x62
+{0xc0, 0x07, 0xe0, 0x0f, 0x20, 0x08, 0x20, 0x08, 0x20, 0x08, 0x60, 0x0c, 0x40, 0x04, 0x00, 0x00}, // 0x63
+{0xc0, 0x07, 0xe0, 0x0f, 0x20, 0x08, 0x20, 0x08, 0x20, 0x08, 0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x00}, // 0x64
+{0xc0, 0x07, 0xe0, 0x0f, 0x20, 0x09, 0x20, 0x09, 0x20, 0x09, 0xe0, 0x09, 0xc0, 0x01, 0x00, 0x00}, // 0x65
+{0x20, 0x00, 0x20, 0x00, 0xf8, 0x0f, 0xfc, 0x0f, 0x24, 0x00, 0x24, 0x00, 0x04, 0x00, 0x00, 0x00}, // 0x66
+{0xc0, 0x07, 0xe0, 0x4f, 0x20, 0x48, 0x20, 0x48, 0x20, 0x48, 0xe0, 0x7f, 0xe0, 0x3f, 0x00, 0x00}, // 0x67
+{0xfc, 0x0f, 0xfc, 0x0f, 0x20, 0x00, 0x20, 0x00, 0x20, 0x00, 0xe0, 0x0f, 0xc0, 0x0f, 0x00, 0x00}, // 0x68
+{0x00, 0x00, 0x00, 0x00, 0x20, 0x08, 0xec, 0x0f, 0xec, 0x0f, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00}, // 0x69
+{0x00, 0x00, 0x00, 0x30, 0x00, 0x70, 0x00, 0x40, 0x20, 0x40, 0xec, 0x7f, 0xec, 0x3f, 0x00, 0x00}, // 0x6a
+{0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x01, 0x80, 0x03, 0xc0, 0x06, 0x60, 0x0c, 0x20, 0x08, 0x00, 0x00}, // 0x6b
+{0x00, 0x00, 0x00, 0x00, 0x04, 0x08, 0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00}, // 0x6c
+{0xe0, 0x0f, 0xe0, 0x0f, 0x20, 0x00, 0xe0, 0x0f, 0x20, 0x00, 0xe0, 0x0f, 0xc0, 0x0f, 0x00, 0x00}, // 0x6d
+{0xe0, 0x0f, 0xe0, 0x0f, 0x20, 0x00, 0x20, 0x00, 0x20, 0x00, 0xe0, 0x0f, 0xc0, 0x0f, 0x00, 0x00}, // 0x6e
+{0xc0, 0x07, 0xe0, 0x0f, 0x20, 0x08, 0x20, 0x08, 0x20, 0x08, 0xe0, 0x0f, 0xc0, 0x07, 0x00, 0x00}, // 0x6f
+{0xe0, 0x7f, 0xe0, 0x7f, 0x20, 0x08, 0x20, 0x08, 0x20, 0x08, 0xe0, 0x0f, 0xc0, 0x07, 0x00, 0x00}, // 0x70
+{0xc0, 0x07, 0xe0, 0x0f, 0x20, 0x08, 0x20, 0x08, 0x20, 0x08, 0xe0, 0x7f, 0xe0, 0x7f, 0x00, 0x00}, // 0x71
+{0xe0, 0x0f, 0xe0, 0x0f, 0xc0, 0x00, 0x60, 0x00, 0x20, 0x00, 0x20, 0x00, 0x20, 0x00, 0x00, 0x00}, // 0x72
+{0xc0, 0x08, 0xe0, 0x09, 0x20, 0x09, 0x20, 0x09, 0x20, 0x09, 0x20, 0x0f, 0x20, 0x06, 0x00, 0x00}, // 0x73
+{0x20, 0x00, 0x20, 0x00, 0xfc, 0x07, 0xfc, 0x0f, 0x20, 0x08, 0x20, 0x08, 0x00, 0x08, 0x00, 0x00}, // 0x74
+{0xe0, 0x07, 0xe0, 0x0f, 0x00, 0x08, 0x00, 0x08, 0x00, 0x08, 0xe0, 0x0f, 0xe0, 0x0f, 0x00, 0x00}, // 0x75
+{0xe0, 0x00, 0xe0, 0x03, 0x00, 0x0f, 0x00, 0x0c, 0x00, 0x0f, 0xe0, 0x03, 0xe0, 0x00, 0x00, 0x00}, // 0x76
+{0xe0, 0x07, 0xe0, 0x0f, 0x00, 0x08, 0x80, 0x0f, 0x00, 0x08, 0xe0, 0x0f, 0xe0, 0x07, 0x00, 0x00}, // 0x77
+{0x60, 0x0c, 0xe0, 0x0e, 0x80, 0x03, 0x00, 0x01, 0x80, 0x03, 0xe0, 0x0e, 0x60, 0x0c, 0x00, 0x00}, // 0x78
+{0xe0, 0x07, 0xe0, 0x4f, 0x00, 0x48, 0x00, 0x48, 0x00, 0x48, 0xe0, 0x7f, 0xe0, 0x3f, 0x00, 0x00}, // 0x79
+{0x20, 0x0c, 0x20, 0x0e, 0x20, 0x0b, 0xa0, 0x09, 0xe0, 0x08, 0x60, 0x08, 0x20, 0x08, 0x00, 0x00}, // 0x7a
+{0x00, 0x00, 0x40, 0x00, 0xf8, 0x07, 0xbc, 0x0f, 0x04, 0x08, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}, // 0x7b
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfc, 0x0f, 0xfc, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x7c
+{0x00, 0x00, 0x04, 0x08, 0x04, 0x08, 0xbc, 0x0f, 0xf8, 0x07, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00}, // 0x7d
+{0x0c, 0x00, 0x0e, 0x00, 0x02, 0x00, 0x06, 0x00, 0x0c, 0x00, 0x08, 0x00, 0x0e, 0x00, 0x06, 0x00}, // 0x7e
+{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00} // 0x7f
+};
+
+#else
+
 /** Packed, vertical, monochrome bitmaps for each character.
   *
   * The packed vertical bitmap can be interpreted as follows: imagine the font
@@ -166,11 +297,18 @@ const uint8_t font_table[] = {
 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 0x00};
 
+#endif // #if USE_GLYPH_TABLE
+
 /** Character buffer, in row-major order, starting from the top-left.
   * Characters should have their ASCII values written here.
   * renderDisplay() will render the contents of this buffer to the display.
   */
 static uint8_t text_buffer[CHARACTERS_PER_LINE * NUMBER_OF_LINES];
+/** Copy of #text_buffer as it was when it was last rendered to the display.
+  * A character cell is "dirty" (needs to be rendered again) if it differs
+  * between this and #text_buffer. See renderDisplay().
+  */
+static uint8_t rendered_text_buffer[CHARACTERS_PER_LINE * NUMBER_OF_LINES];
 /** The line where the (hidden) cursor is at. 0 = topmost. This is also the
   * line within #text_buffer that writeStringToDisplay() will write to next.
   */
@@ -302,28 +440,25 @@ static void resetSSD1306(void)
 	writeSPI1Byte(false, 0x01); // memory addressing mode = vertical
 }
 
-/** Clear the display and all associated buffers. */
-void clearDisplay(void)
+/** Set the window which subsequent data bytes will be written into. Since
+  * the SSD1306 memory addressing mode is set to "vertical" by resetSSD1306(),
+  * data bytes fill the window column by column, starting at the top-left.
+  * \param start_column Leftmost column (in pixels) of the window.
+  * \param end_column Rightmost column (in pixels) of the window, inclusive.
+  * \param start_page Topmost page (8 pixel high row) of the window.
+  * \param end_page Bottommost page of the window, inclusive.
+  */
+static void setAddressWindow(uint32_t start_column, uint32_t end_column, uint32_t start_page, uint32_t end_page)
 {
-	uint32_t i;
-
-	for (i = 0; i < 1024; i++)
-	{
-		writeSPI1Byte(true, 0);
-	}
-	cursor_line = 0;
-	cursor_pos = 0;
-	memset(text_buffer, FONT_BLANK, sizeof(text_buffer));
+	writeSPI1Byte(false, 0x21); // set column address
+	writeSPI1Byte(false, (uint8_t)start_column);
+	writeSPI1Byte(false, (uint8_t)end_column);
+	writeSPI1Byte(false, 0x22); // set page address
+	writeSPI1Byte(false, (uint8_t)start_page);
+	writeSPI1Byte(false, (uint8_t)end_page);
 }
 
-/** Set up everything so that the display is ready to start having text
-  * rendered on it. */
-void initSSD1306(void)
-{
-	configurePeripheralsForSSD1306();
-	resetSSD1306();
-	clearDisplay();
-}
+#if !USE_GLYPH_TABLE
 
 /** Font table byte lookup function which has bit granularity. Alternatively,
   * this can be thought of as treating the font table as a giant little-endian
@@ -347,6 +482,8 @@ static uint8_t lookupFontTable(uint32_t bit_offset)
 	return (uint8_t)(data >> (bit_offset & 7));
 }
 
+#endif // #if !USE_GLYPH_TABLE
+
 /** Text buffer query function. As well as obtaining a character from
   * the text buffer, this also range checks its inputs and accounts
   * for the font table not starting at 0 (see #FONT_TABLE_START).
@@ -376,17 +513,42 @@ static uint8_t lookupTextBuffer(uint32_t char_x, uint32_t char_y)
 	}
 }
 
-/** Using the contents of the text buffer (#text_buffer) and the font
-  * in #font_table, this outputs a series of data bytes to the SSD1306
-  * display.
-  *
-  * Since the SSD1306 memory addressing mode is set to "vertical" by
-  * resetSSD1306(), this function renders in columns, 8 pixels at a time.
-  * The rendering loop starts at the top-left, moves downwards and when it
-  * hits the bottom of the current column, moves right to start at the top
-  * of the next column. Column-based rendering is done because the SSD1306's
-  * GDDRAM is column-based (each byte of data corresponds to an 8 pixel high
-  * column).
+#if USE_GLYPH_TABLE
+
+/** Render a run of characters on one line and send them to the display.
+  * Each character is copied straight from #glyph_table into the SSP1
+  * transmit FIFO.
+  * \param start_char_x First character (0 = leftmost) of the run.
+  * \param end_char_x One past the last character of the run.
+  * \param char_y Line (0 = topmost) which the run is on.
+  */
+static void renderCharacterRun(uint32_t start_char_x, uint32_t end_char_x, uint32_t char_y)
+{
+	uint32_t char_x;
+	uint32_t i;
+	uint8_t glyph;
+
+	setAddressWindow(start_char_x * CHARACTER_WIDTH, end_char_x * CHARACTER_WIDTH - 1, char_y * (CHARACTER_HEIGHT / 8), (char_y + 1) * (CHARACTER_HEIGHT / 8) - 1);
+	for (char_x = start_char_x; char_x < end_char_x; char_x++)
+	{
+		glyph = lookupTextBuffer(char_x, char_y);
+		if (glyph >= (sizeof(glyph_table) / sizeof(glyph_table[0])))
+		{
+			glyph = FONT_BLANK - FONT_TABLE_START; // not in glyph table
+		}
+		for (i = 0; i < sizeof(glyph_table[0]); i++)
+		{
+			writeSPI1Byte(true, glyph_table[glyph][i]);
+		}
+	}
+}
+
+#else
+
+/** Render one byte of the display, using the contents of the text buffer
+  * (#text_buffer) and the font in #font_table. Each byte of the SSD1306's
+  * GDDRAM corresponds to an 8 pixel high column, with the least significant
+  * bit at the top.
   *
   * In order for the renderer to work
   * correctly, #DISPLAY_WIDTH, #DISPLAY_HEIGHT, #CHARACTER_WIDTH
@@ -394,76 +556,158 @@ static uint8_t lookupTextBuffer(uint32_t char_x, uint32_t char_y)
   * The renderer only supports monochrome, fixed-width fonts.
   * However, the renderer can deal with fonts with a height which is not a
   * multiple of 8.
-  *
-  * This renderer isn't very fast. But it doesn't need to be. With the SPI bus
-  * running at a bit rate of 1 Mhz, the renderer only needs to be able to
-  * write one byte every 384 cycles, which is a long time.
+  * \param x Column, in pixels, of the byte (0 = left edge).
+  * \param page Page (8 pixel high row) of the byte (0 = top edge).
+  * \return The rendered byte.
   */
-static void renderDisplay(void)
+static uint8_t renderColumnByte(uint32_t x, uint32_t page)
 {
-	uint32_t x; // 0 = left edge, positive = right
-	uint32_t y; // 0 = top edge, positive = down
 	uint32_t char_x; // 0 = leftmost character, 1 = the one to the right of that etc.
 	uint32_t char_y; // 0 = topmost character, 1 = the one below that etc.
 	uint32_t char_x_offset; // x offset within character
 	uint32_t char_y_offset; // y offset within character
 	uint32_t amount; // number of bits to use
-	uint8_t current_character;
-	uint8_t next_character;
 	uint8_t data;
 	uint8_t temp_data;
 
-	char_x = 0;
-	char_x_offset = 0;
-	for (x = 0; x < DISPLAY_WIDTH; x++)
+	char_x = x / CHARACTER_WIDTH;
+	char_x_offset = x % CHARACTER_WIDTH;
+	char_y = (page * 8) / CHARACTER_HEIGHT;
+	char_y_offset = (page * 8) % CHARACTER_HEIGHT;
+	if ((char_y_offset + 8) > CHARACTER_HEIGHT)
+	{
+		// Byte goes across character height boundary.
+		amount = CHARACTER_HEIGHT - char_y_offset;
+	}
+	else
+	{
+		// Byte resides entirely within current character.
+		amount = 8;
+	}
+	data = lookupFontTable(lookupTextBuffer(char_x, char_y) * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT);
+	data &= (1 << amount) - 1;
+	if ((char_y_offset + 8) > CHARACTER_HEIGHT)
+	{
+		// Need to fetch partial character column from next (i.e. one below)
+		// character.
+		temp_data = lookupFontTable(lookupTextBuffer(char_x, char_y + 1) * CHARACTER_BITS + char_x_offset * CHARACTER_HEIGHT);
+		data |= temp_data << amount;
+	}
+	return data;
+}
+
+/** Render a run of characters on one line and send them to the display,
+  * one byte at a time (see renderColumnByte()).
+  * \param start_char_x First character (0 = leftmost) of the run.
+  * \param end_char_x One past the last character of the run.
+  * \param char_y Line (0 = topmost) which the run is on.
+  */
+static void renderCharacterRun(uint32_t start_char_x, uint32_t end_char_x, uint32_t char_y)
+{
+	uint32_t start_page;
+	uint32_t end_page;
+	uint32_t x;
+	uint32_t page;
+
+	start_page = (char_y * CHARACTER_HEIGHT) / 8;
+	end_page = (char_y * CHARACTER_HEIGHT + CHARACTER_HEIGHT - 1) / 8;
+	if (end_page >= (DISPLAY_HEIGHT / 8))
+	{
+		end_page = (DISPLAY_HEIGHT / 8) - 1;
+	}
+	setAddressWindow(start_char_x * CHARACTER_WIDTH, end_char_x * CHARACTER_WIDTH - 1, start_page, end_page);
+	for (x = start_char_x * CHARACTER_WIDTH; x < (end_char_x * CHARACTER_WIDTH); x++)
 	{
-		// Render a column.
-		char_y = 0;
-		char_y_offset = 0;
-		// The next (i.e. one below) character needs to be fetched in advance
-		// because the next 8 pixels may go across the current's character
-		// height boundary.
-		current_character = lookupTextBuffer(char_x, char_y);
-		next_character = lookupTextBuffer(char_x, char_y + 1);
-		for (y = 0; y < DISPLAY_HEIGHT; y += 8)
+		for (page = start_page; page <= end_page; page++)
 		{
-			if ((char_y_offset + 8) > CHARACTER_HEIGHT)
-			{
-				// Byte goes across character height boundary.
-				amount = CHARACTER_HEIGHT - char_y_offset;
-			}
-			else
-			{
-				// Next byte resides entirely within current character.
-				amount = 8;
-			}
-			data = lookupFontTable(current_character * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT);
-			data &= (1 << amount) - 1;
-			if ((char_y_offset + 8) > CHARACTER_HEIGHT)
+			writeSPI1Byte(true, renderColumnByte(x, page));
+		}
+	}
+}
+
+#endif // #if USE_GLYPH_TABLE
+
+/** Bring the display up to date with the contents of the text buffer
+  * (#text_buffer).
+  *
+  * Only dirty character cells (those which differ from
+  * #rendered_text_buffer) are rendered. Each run of adjacent dirty cells on
+  * a line is sent as one window (see renderCharacterRun()) which covers
+  * those cells' columns and pages. Thus changing one character costs 6 command
+  * bytes plus #CHARACTER_WIDTH bytes per page, instead of the 1024 bytes
+  * needed for the whole display. Since the SSD1306 memory addressing mode is
+  * set to "vertical" by resetSSD1306(), each window is rendered in columns,
+  * top to bottom, then left to right.
+  *
+  * This renderer isn't very fast. But it doesn't need to be. With the SPI bus
+  * running at a bit rate of 1 Mhz, the renderer only needs to be able to
+  * write one byte every 384 cycles, which is a long time.
+  */
+static void renderDisplay(void)
+{
+	uint32_t char_y; // line being checked for dirty cells
+	uint32_t start_char_x; // first cell of a run of dirty cells
+	uint32_t end_char_x; // one past the last cell of a run of dirty cells
+	uint32_t line_start; // index into text buffers of start of line
+
+	for (char_y = 0; char_y < NUMBER_OF_LINES; char_y++)
+	{
+		line_start = char_y * CHARACTERS_PER_LINE;
+		start_char_x = 0;
+		while (start_char_x < CHARACTERS_PER_LINE)
+		{
+			if (text_buffer[line_start + start_char_x] == rendered_text_buffer[line_start + start_char_x])
 			{
-				// Need to fetch partial character column from next character.
-				temp_data = lookupFontTable(next_character * CHARACTER_BITS + char_x_offset * CHARACTER_HEIGHT);
-				data |= temp_data << amount;
+				start_char_x++;
+				continue;
 			}
-			writeSPI1Byte(true, data);
-			// Prepare for next byte.
-			char_y_offset += 8;
-			if (char_y_offset >= CHARACTER_HEIGHT)
+			end_char_x = start_char_x + 1;
+			while ((end_char_x < CHARACTERS_PER_LINE)
+				&& (text_buffer[line_start + end_char_x] != rendered_text_buffer[line_start + end_char_x]))
 			{
-				char_y_offset -= CHARACTER_HEIGHT;
-				char_y++;
-				current_character = next_character;
-				next_character = lookupTextBuffer(char_x, char_y + 1);
+				end_char_x++;
 			}
-		} // end for (y = 0; y < DISPLAY_HEIGHT; y += 8)
-		// Prepare for next column.
-		char_x_offset++;
-		if (char_x_offset >= CHARACTER_WIDTH)
-		{
-			char_x_offset = 0;
-			char_x++;
-		}
-	} // end for (x = 0; x < DISPLAY_WIDTH; x++)
+			renderCharacterRun(start_char_x, end_char_x, char_y);
+			memcpy(&(rendered_text_buffer[line_start + start_char_x]), &(text_buffer[line_start + start_char_x]), end_char_x - start_char_x);
+			start_char_x = end_char_x;
+		} // end while (start_char_x < CHARACTERS_PER_LINE)
+	} // end for (char_y = 0; char_y < NUMBER_OF_LINES; char_y++)
+}
+
+/** Clear all of the SSD1306's display RAM (GDDRAM). After this,
+  * #rendered_text_buffer describes what is on the display, so that
+  * renderDisplay() only has to render non-blank characters.
+  */
+static void clearGDDRAM(void)
+{
+	uint32_t i;
+
+	setAddressWindow(0, DISPLAY_WIDTH - 1, 0, (DISPLAY_HEIGHT / 8) - 1);
+	for (i = 0; i < (DISPLAY_WIDTH * DISPLAY_HEIGHT / 8); i++)
+	{
+		writeSPI1Byte(true, 0);
+	}
+	memset(rendered_text_buffer, FONT_BLANK, sizeof(rendered_text_buffer));
+}
+
+/** Clear the display and all associated buffers. Only the parts of the
+  * display which aren't already blank are sent to the SSD1306. */
+void clearDisplay(void)
+{
+	cursor_line = 0;
+	cursor_pos = 0;
+	memset(text_buffer, FONT_BLANK, sizeof(text_buffer));
+	renderDisplay();
+}
+
+/** Set up everything so that the display is ready to start having text
+  * rendered on it. */
+void initSSD1306(void)
+{
+	configurePeripheralsForSSD1306();
+	resetSSD1306();
+	clearGDDRAM();
+	clearDisplay();
 }
 
 /** Move cursor to the start of the next line, but only if the cursor is not
@@ -138,6 +138,25 @@ const pb_field_t Signature_fields[2] = {
     PB_LAST_FIELD
 };
 
+const pb_field_t SignTransactionBatch_fields[4] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, SignTransactionBatch, first_input, first_input, 0),
+    PB_FIELD2(  2, UINT32  , REPEATED, STATIC, OTHER, SignTransactionBatch, address_handle, first_input, 0),
+    PB_FIELD2(  3, BYTES   , REQUIRED, CALLBACK, OTHER, SignTransactionBatch, transaction_data, address_handle, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t Signatures_fields[2] = {
+    PB_FIELD2(  1, MESSAGE , REPEATED, CALLBACK, FIRST, Signatures, signature, signature, &Signature_fields),
+    PB_LAST_FIELD
+};
+
+const pb_field_t SignPsbt_fields[4] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, SignPsbt, first_input, first_input, 0),
+    PB_FIELD2(  2, UINT32  , REPEATED, STATIC, OTHER, SignPsbt, address_handle, first_input, 0),
+    PB_FIELD2(  3, BYTES   , REQUIRED, CALLBACK, OTHER, SignPsbt, psbt_data, address_handle, 0),
+    PB_LAST_FIELD
+};
+
 const pb_field_t LoadWallet_fields[2] = {
     PB_FIELD2(  1, UINT32  , OPTIONAL, STATIC, FIRST, LoadWallet, wallet_number, wallet_number, &LoadWallet_wallet_number_default),
     PB_LAST_FIELD
@@ -218,10 +237,10 @@ const pb_field_t MasterPublicKey_fields[3] = {
 
 /* Check that field information fits in pb_field_t */
 #if !defined(PB_FIELD_16BIT) && !defined(PB_FIELD_32BIT)
-STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 256 && pb_membersize(RestoreWallet, new_wallet) < 256), YOU_MUST_DEFINE_PB_FIELD_16BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey)
+STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 256 && pb_membersize(RestoreWallet, new_wallet) < 256), YOU_MUST_DEFINE_PB_FIELD_16BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_SignTransactionBatch_Signatures_SignPsbt_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey)
 #endif
 
 #if !defined(PB_FIELD_32BIT)
-STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 65536 && pb_membersize(RestoreWallet, new_wallet) < 65536), YOU_MUST_DEFINE_PB_FIELD_32BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey)
+STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 65536 && pb_membersize(RestoreWallet, new_wallet) < 65536), YOU_MUST_DEFINE_PB_FIELD_32BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_SignTransactionBatch_Signatures_SignPsbt_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey)
 #endif
 
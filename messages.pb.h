@@ -246,6 +246,13 @@ typedef struct _SignTransaction {
     pb_callback_t transaction_data;
 } SignTransaction;
 
+typedef struct _SignTransactionBatch {
+    uint32_t first_input;
+    size_t address_handle_count;
+    uint32_t address_handle[8];
+    pb_callback_t transaction_data;
+} SignTransactionBatch;
+
 typedef struct {
     size_t size;
     uint8_t bytes[73];
@@ -255,6 +262,17 @@ typedef struct _Signature {
     Signature_signature_data_t signature_data;
 } Signature;
 
+typedef struct _Signatures {
+    pb_callback_t signature;
+} Signatures;
+
+typedef struct _SignPsbt {
+    uint32_t first_input;
+    size_t address_handle_count;
+    uint32_t address_handle[8];
+    pb_callback_t psbt_data;
+} SignPsbt;
+
 typedef struct {
     size_t size;
     uint8_t bytes[40];
@@ -336,6 +354,13 @@ extern const uint32_t BackupWallet_device_default;
 #define SignTransaction_address_handle_tag       1
 #define SignTransaction_transaction_data_tag     2
 #define Signature_signature_data_tag             1
+#define SignTransactionBatch_first_input_tag     1
+#define SignTransactionBatch_address_handle_tag  2
+#define SignTransactionBatch_transaction_data_tag 3
+#define Signatures_signature_tag                 1
+#define SignPsbt_first_input_tag                 1
+#define SignPsbt_address_handle_tag              2
+#define SignPsbt_psbt_data_tag                   3
 #define WalletInfo_wallet_number_tag             1
 #define WalletInfo_wallet_name_tag               2
 #define WalletInfo_wallet_uuid_tag               3
@@ -368,6 +393,9 @@ extern const pb_field_t NumberOfAddresses_fields[2];
 extern const pb_field_t GetAddressAndPublicKey_fields[2];
 extern const pb_field_t SignTransaction_fields[3];
 extern const pb_field_t Signature_fields[2];
+extern const pb_field_t SignTransactionBatch_fields[4];
+extern const pb_field_t Signatures_fields[2];
+extern const pb_field_t SignPsbt_fields[4];
 extern const pb_field_t LoadWallet_fields[2];
 extern const pb_field_t FormatWalletArea_fields[2];
 extern const pb_field_t ChangeEncryptionKey_fields[2];
@@ -10,12 +10,13 @@
   * period in between each conversion so that the results of FFTs are
   * meaningful.
   *
-  * The results of conversions are written into #adc_sample_buffer using DMA
+  * The results of conversions are written into one of the
+  * #ADC_NUM_SAMPLE_BUFFERS buffers in #adc_sample_buffers using DMA
   * transfers. To begin a series of conversions, call beginFillingADCBuffer(),
-  * then wait until isADCBufferFull() returns
-  * true. #adc_sample_buffer will then contain #ADC_SAMPLE_BUFFER_SIZE
-  * samples. This interface allows one buffer of samples to be collected while
-  * the previous one is processed, which speeds up entropy collection.
+  * then wait until isADCBufferFull() returns true. The selected buffer will
+  * then contain #ADC_SAMPLE_BUFFER_SIZE samples. This interface allows one
+  * buffer of samples to be collected while the previous one is processed,
+  * which speeds up entropy collection.
   *
   * For details on hardware interfacing requirements, see initADC().
   *
@@ -32,13 +33,15 @@
 #include "adc.h"
 #include "pic32_system.h"
 
-/** A place to store samples from the ADC. When isADCBufferFull() returns
-  * true, every entry in this array will be filled with ADC samples
-  * taken periodically. */
-volatile uint16_t adc_sample_buffer[ADC_SAMPLE_BUFFER_SIZE];
+/** Places to store samples from the ADC. When isADCBufferFull() returns
+  * true, every entry in the buffer most recently passed to
+  * beginFillingADCBuffer() will be filled with ADC samples taken
+  * periodically. The other buffer is untouched, so it can be processed while
+  * the DMA controller is filling this one. */
+volatile uint16_t adc_sample_buffers[ADC_NUM_SAMPLE_BUFFERS][ADC_SAMPLE_BUFFER_SIZE];
 
 /** Set up the PIC32 ADC to sample from AN2 periodically using Timer3 as the
-  * trigger. DMA is used to move the ADC result into #adc_sample_buffer. */
+  * trigger. DMA is used to move the ADC result into #adc_sample_buffers. */
 void initADC(void)
 {
 	// Initialise DMA module and DMA channel 0.
@@ -105,16 +108,19 @@ void initADC(void)
 }
 
 /** Begin collecting #ADC_SAMPLE_BUFFER_SIZE samples, filling
-  * up #adc_sample_buffer. This will return before all the samples have been
-  * collected, allowing the caller to do something else while samples are
-  * collected in the background. isADCBufferFull() can be used to determine
-  * when #adc_sample_buffer is full.
+  * up one of #adc_sample_buffers. This will return before all the samples
+  * have been collected, allowing the caller to do something else (like
+  * processing the other buffer) while samples are collected in the
+  * background. isADCBufferFull() can be used to determine when the buffer is
+  * full.
   *
-  * It is okay to call this while the sample buffer is still being filled up.
+  * It is okay to call this while a sample buffer is still being filled up.
   * In that case, calling this will abort the current fill and commence
-  * filling from the start.
+  * filling the specified buffer from the start.
+  * \param buffer_index Which buffer (0 to #ADC_NUM_SAMPLE_BUFFERS - 1) of
+  *                     #adc_sample_buffers to fill.
   */
-void beginFillingADCBuffer(void)
+void beginFillingADCBuffer(unsigned int buffer_index)
 {
 	uint32_t status;
 
@@ -135,15 +141,16 @@ void beginFillingADCBuffer(void)
 	DCH0ECONbits.CABORT = 0;
 	DCH0INTCLR = 0x00ff00ff; // clear existing events, disable all interrupts
 	DCH0SSA = VIRTUAL_TO_PHYSICAL(&ADC1BUF0); // transfer source physical address
-	DCH0DSA = VIRTUAL_TO_PHYSICAL(&adc_sample_buffer); // transfer destination physical address
+	DCH0DSA = VIRTUAL_TO_PHYSICAL(&(adc_sample_buffers[buffer_index])); // transfer destination physical address
 	DCH0SSIZ = sizeof(uint16_t); // source size
-	DCH0DSIZ = sizeof(adc_sample_buffer); // destination size
+	DCH0DSIZ = sizeof(adc_sample_buffers[buffer_index]); // destination size
 	DCH0CSIZ = sizeof(uint16_t); // cell size (bytes transferred per event)
 	DCH0CONbits.CHEN = 1; // enable channel
 	restoreInterrupts(status);
 }
 
-/** Check whether ADC buffer (#adc_sample_buffer) is full.
+/** Check whether the ADC buffer most recently passed to
+  * beginFillingADCBuffer() is full.
   * \return false if ADC buffer is not full, true if it is.
   */
 bool isADCBufferFull(void)
@@ -16,11 +16,14 @@
   *          will attempt to read past the end of the sample buffer.
   */
 #define ADC_SAMPLE_BUFFER_SIZE	(FFT_SIZE * 4)
+/** Number of buffers in #adc_sample_buffers. With two buffers, one can be
+  * filled while the other is processed. */
+#define ADC_NUM_SAMPLE_BUFFERS	2
 
-extern volatile uint16_t adc_sample_buffer[ADC_SAMPLE_BUFFER_SIZE];
+extern volatile uint16_t adc_sample_buffers[ADC_NUM_SAMPLE_BUFFERS][ADC_SAMPLE_BUFFER_SIZE];
 
 extern void initADC(void);
-extern void beginFillingADCBuffer(void);
+extern void beginFillingADCBuffer(unsigned int buffer_index);
 extern bool isADCBufferFull(void);
 
 #endif // #ifndef PIC32_ADC_H_INCLUDED
@@ -7,6 +7,11 @@
   * (HWRNG) samples from the ADC (see adc.c). However, the majority of code in
   * this file is dedicated to statistical testing of those samples.
   *
+  * Sample collection and testing can be done in the background, while the
+  * CPU would otherwise be idle (see hwrngBackgroundTask()). This keeps a
+  * reservoir of tested samples around, so that requests for random bytes
+  * usually don't have to wait for the ADC or the statistical tests.
+  *
   * Why bother going to all the trouble to test the HWRNG? Many cryptographic
   * operations (eg. signing, wallet seed generation) depend on the quality of
   * their entropy source. Hardware failure could compromise a HWRNG's quality.
@@ -36,6 +41,7 @@
 
 static void reportStatistics(uint32_t tests_failed);
 static void reportFftResults(ComplexFixed *fft_buffer);
+static void reportFrameResults(int max_bin, int bandwidth, fix16_t max_autocorrelation, fix16_t autocorrelation_limit, uint32_t tests_failed);
 
 // These are copies of some variables in histogramTestsFailed() and
 // fftTestsFailed() which are reported by reportStatistics().
@@ -51,7 +57,7 @@ static fix16_t most_recent_entropy_estimate;
 /** Set to non-zero to send statistical properties to stream. 1 = moment-based
   * statistical properties, 2 = power spectral density estimate, 3 = bandwidth
   * estimate, 4 = autocorrelation results, 5 = maximum autocorrelation value
-  * and entropy estimate. */
+  * and entropy estimate, 6 = results of early tests for each frame. */
 static int report_to_stream;
 #endif // #ifdef TEST_STATISTICS
 
@@ -75,14 +81,95 @@ static const int32_t fir_lowpass_coefficients[FILTER_ORDER] = {
 -123, 202, 711, 0, -2681, -2929, 5309, 19161,
 26236,
 19161, 5309, -2929, -2681, 0, 711, 202, -123};
+/** Length of each polyphase component in #filter_phases. Each component
+  * needs enough samples for #DECIMATED_SAMPLE_BUFFER_SIZE outputs, plus
+  * enough extra samples to cover the length of the filter. */
+#define FILTER_PHASE_LENGTH				(DECIMATED_SAMPLE_BUFFER_SIZE + (FILTER_ORDER - 1) / OVERSAMPLE_RATIO)
+/** Polyphase components of the ADC buffer being filtered by firDecimate().
+  * Component p contains every #OVERSAMPLE_RATIO th sample, starting from
+  * sample p (offset by the filter delay). These are static instead of on the
+  * stack because together they take up a few kilobytes. */
+static int32_t filter_phases[OVERSAMPLE_RATIO][FILTER_PHASE_LENGTH];
+/** Accumulated (not yet rounded) output samples of firDecimate(), in Q16.16
+  * fixed-point representation. */
+static int32_t filter_sums[DECIMATED_SAMPLE_BUFFER_SIZE];
+
+/** Number of sample sets in #samples. One set can be consumed by
+  * hardwareRandom32Bytes() while the other is prepared in the background by
+  * hwrngBackgroundTask(). */
+#define NUM_SAMPLE_SETS					2
+/** Value for #preparing_set which means that no set is being prepared. */
+#define NO_SET							NUM_SAMPLE_SETS
 
-/** Array of samples which have passed statistical tests. #SAMPLE_COUNT samples
-  * need to be stored because hardwareRandom32Bytes() cannot start returning
-  * samples from this array until all statistical tests have passed. */
-static volatile uint16_t samples[SAMPLE_COUNT];
-/** Number of samples in #samples that hardwareRandom32Bytes() has
-  * used up. */
+/** States for each set in #samples. */
+typedef enum SampleSetStatesEnum
+{
+	/** The set is empty or used up, and needs to be prepared. */
+	SET_EMPTY		=	0,
+	/** The set is being filled with samples and tested. */
+	SET_PREPARING	=	1,
+	/** The set has been filled and tested. See #set_tests_failed for the
+	  * results of the tests. */
+	SET_READY		=	2
+} SampleSetStates;
+
+/** Sets of samples which have passed (or are undergoing) statistical tests.
+  * #SAMPLE_COUNT samples need to be stored per set because
+  * hardwareRandom32Bytes() cannot start returning samples from a set until
+  * all statistical tests on that set have passed. */
+static volatile uint16_t samples[NUM_SAMPLE_SETS][SAMPLE_COUNT];
+/** State of each set in #samples. */
+static SampleSetStates set_state[NUM_SAMPLE_SETS];
+/** Statistical test results for each set in #samples which is in
+  * the #SET_READY state. 0 means all tests passed. */
+static uint32_t set_tests_failed[NUM_SAMPLE_SETS];
+/** Index of the set in #samples which hardwareRandom32Bytes() is consuming
+  * samples from. */
+static unsigned int current_set;
+/** Number of samples in the current set (see #current_set) that
+  * hardwareRandom32Bytes() has used up. */
 static uint32_t samples_consumed;
+/** Index of the set in #samples which is being prepared, or #NO_SET if no
+  * set is being prepared. */
+static unsigned int preparing_set = NO_SET;
+/** Number of samples in the set being prepared which have been filtered and
+  * added to the histogram. */
+static unsigned int samples_prepared;
+/** Steps which prepareSampleSetStep() goes through, for each set. Each step
+  * does at most one FFT-sized piece of work, so that a single call
+  * to hwrngBackgroundTask() never takes long. */
+typedef enum PrepareStepsEnum
+{
+	/** Wait for an ADC buffer, then filter it and add it to the
+	  * histogram. */
+	STEP_FILTER_BUFFER		=	0,
+	/** Add one frame to the power spectral density estimate. */
+	STEP_ACCUMULATE_FRAME	=	1,
+	/** Test the partial power spectral density estimate. */
+	STEP_EARLY_TESTS		=	2,
+	/** Run the histogram-based tests on the complete set. */
+	STEP_HISTOGRAM_TESTS	=	3,
+	/** Run the FFT-based tests on the complete set. */
+	STEP_FFT_TESTS			=	4
+} PrepareSteps;
+/** The next step that prepareSampleSetStep() will do for the set being
+  * prepared. */
+static PrepareSteps prepare_step;
+/** Index (into the set being prepared) of the first sample of the next frame
+  * to add to the power spectral density estimate. */
+static unsigned int frames_position;
+/** Result of histogramTestsFailed() on the set being prepared, kept until
+  * fftTestsFailed() has also been run. */
+static uint32_t prepare_tests_failed;
+/** Variance of the set being prepared, as calculated
+  * by histogramTestsFailed(). fftTestsFailed() needs this. */
+static fix16_t prepare_variance;
+/** Which of #adc_sample_buffers the ADC is filling or has filled, while a
+  * set is being prepared. */
+static unsigned int current_adc_buffer;
+/** This is true while hardwareRandom32Bytes() or hwrngBackgroundTask() is
+  * running, to stop hwrngBackgroundTask() from being re-entered. */
+static bool hwrng_busy;
 
 /** Obtains an estimate of the bandwidth of the HWRNG, based on the power
   * spectrum density estimate (see #psd_accumulator).
@@ -211,10 +298,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	fix16_t entropy_estimate;
 
 	fix16_error_occurred = false;
-	mean = calculateCentralMoment(fix16_zero, 1);
-	*variance = calculateCentralMoment(mean, 2);
-	kappa3 = calculateCentralMoment(mean, 3);
-	kappa4 = calculateCentralMoment(mean, 4);
+	calculateMoments(&mean, variance, &kappa3, &kappa4);
 	moment_error_occurred = fix16_error_occurred;
 	fix16_error_occurred = false;
 	entropy_estimate = estimateEntropy();
@@ -231,7 +315,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	tests_failed = 0;
 	// STATTEST_MIN_MEAN and STATTEST_MAX_MEAN are in ADC output numbers.
 	// To be comparable to mean, they need to be scaled and offset, just
-	// as samples are in updateIteratorCache().
+	// as samples are in scaleSample().
 	if (mean <= F16((STATTEST_MIN_MEAN - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN))
 	{
 		tests_failed |= 1; // mean below minimum
@@ -350,111 +434,363 @@ static NOINLINE uint32_t fftTestsFailed(fix16_t variance)
 	return tests_failed;
 }
 
-/** Apply FIR filter to samples.
-  * \param samples Array of input samples. It must
-  *                contain #ADC_SAMPLE_BUFFER_SIZE samples.
-  * \param base_index Index into samples array to begin applying filter.
-  * \param coefficients Array of FIR filter coefficients, in Q16.16
-  *                     fixed-point representation.
-  * \param order Order (number of coefficients) of the filter.
-  * \return The output sample.
-  * \warning All filter coefficients should have a magnitude of less than one.
+/** Run FFT-based statistical tests on a partial power spectral density
+  * estimate, so that a badly broken HWRNG can be detected before a whole set
+  * of #SAMPLE_COUNT samples has been collected. This should be called after
+  * every call to accumulatePowerSpectralDensity().
+  *
+  * A partial estimate is noisier than the one that fftTestsFailed() sees,
+  * so the limits used here (eg. #PSD_EARLY_MIN_BANDWIDTH) are looser. Thus
+  * a failure here means that a limit in hwrng_limits.h has been conclusively
+  * violated. The variance isn't known until the histogram is complete, so
+  * the autocorrelation test is normalised using the lag 0 value of the
+  * correlogram instead.
+  * \return 0 if all tests passed (or if it's too early or too late to do
+  *         the tests), non-zero if any tests failed. The bits which are set
+  *         have the same meaning as they do for fftTestsFailed().
   */
-static int32_t firFilter(const volatile uint16_t *samples, const unsigned int base_index, const int32_t *coefficients, const unsigned int order)
+static NOINLINE uint32_t fftEarlyTestsFailed(void)
 {
-	int32_t sum; // Q16.16 fixed-point representation
-	unsigned int i;
-	unsigned int index;
+	uint32_t tests_failed;
+	bool autocorrelation_error_occurred;
+	int bandwidth; // as FFT bin number
+	int max_bin; // as FFT bin number
+	fix16_t max_autocorrelation;
+	fix16_t autocorrelation_limit;
+	ComplexFixed fft_buffer[FFT_SIZE + 1];
 
-	// Convolute samples with coefficients.
-	sum = 0;
-	for (i = 0; i < order; i++)
+	if ((psd_frames_accumulated < PSD_EARLY_MIN_FRAMES)
+		|| (psd_frames_accumulated >= PSD_NUM_FRAMES))
 	{
-		// The "& (ADC_SAMPLE_BUFFER_SIZE - 1)" makes this a circular
-		// convolution. Circular convolution treats every sample in the
-		// ADC buffer fairly.
-		index = (base_index + i) & (ADC_SAMPLE_BUFFER_SIZE - 1);
-		sum += ((int32_t)samples[index]) * coefficients[i];
+		// Either the estimate is too noisy to be conclusive, or it's
+		// complete and fftTestsFailed() is about to be called anyway.
+		return 0;
 	}
-	return (sum >> 16) + ((sum >> 15) & 1); // round result
+	bandwidth = estimateBandwidth(&max_bin);
+	fix16_error_occurred = false;
+	autocorrelation_error_occurred = calculateAutoCorrelation(fft_buffer);
+	max_autocorrelation = findMaximumAutoCorrelation(fft_buffer);
+	autocorrelation_limit = fix16_mul(fft_buffer[0].real, F16(AUTOCORR_EARLY_THRESHOLD / AUTOCORR_VARIANCE_SCALE));
+
+	// The location of the peak isn't tested, since it isn't conclusive;
+	// see #PSD_EARLY_MIN_BANDWIDTH.
+	tests_failed = 0;
+	if (fix16_from_int(bandwidth) < F16(PSD_EARLY_MIN_BANDWIDTH * 2.0 * FFT_SIZE))
+	{
+		tests_failed |= 32; // bandwidth of HWRNG below minimum
+	}
+	if (psd_accumulator_error_occurred)
+	{
+		tests_failed |= 48; // arithmetic error (probably overflow)
+	}
+	if (max_autocorrelation > autocorrelation_limit)
+	{
+		tests_failed |= 64; // maximum autocorrelation amplitude above maximum
+	}
+	if (autocorrelation_error_occurred)
+	{
+		tests_failed |= 64; // arithmetic error (probably overflow)
+	}
+
+#ifdef TEST_STATISTICS
+	if (report_to_stream == 6)
+	{
+		reportFrameResults(max_bin, bandwidth, max_autocorrelation, autocorrelation_limit, tests_failed);
+	}
+#endif // #ifdef TEST_STATISTICS
+	return tests_failed;
 }
 
-/** Gather #SAMPLE_COUNT ADC samples into #samples and run statistical tests
-  * on the sample array.
-  * \return false on success, true if any statistical test failed.
+/** Filter and decimate a buffer of ADC samples, using a polyphase
+  * implementation of the FIR low-pass filter.
+  *
+  * The filter only needs to be evaluated at every #OVERSAMPLE_RATIO th input
+  * sample. So the input is split into #OVERSAMPLE_RATIO polyphase
+  * components (see #filter_phases), each of which is filtered by every
+  * #OVERSAMPLE_RATIO th filter coefficient. This has a few advantages over
+  * evaluating a dot product for each output sample:
+  * - The circular buffer index only needs to be wrapped once per input
+  *   sample, when the polyphase components are built, instead of once per
+  *   filter tap.
+  * - The inner loop runs over consecutive output samples with a fixed
+  *   coefficient, so it is a simple multiply-accumulate over two arrays. The
+  *   compiler can keep the coefficient in a register and, on hosts with SIMD
+  *   instructions, vectorise the loop.
+  * - Taps whose coefficient is 0 are skipped entirely.
+  *
+  * Because everything is done using integer arithmetic, the results are
+  * exactly the same as evaluating the convolution directly.
+  * \param in Array of input samples. It must contain #ADC_SAMPLE_BUFFER_SIZE
+  *           samples. The filter treats this as a circular buffer, so that
+  *           every sample in the ADC buffer is treated fairly.
+  * \param out Array where the filtered and decimated samples will be
+  *            written. It must have space for #DECIMATED_SAMPLE_BUFFER_SIZE
+  *            samples.
+  * \warning All filter coefficients should have a magnitude of less than one.
   */
-static bool fillAndTestSamplesArray(void)
+static void firDecimate(const volatile uint16_t *in, volatile uint16_t *out)
 {
 	unsigned int i;
 	unsigned int j;
-	unsigned int base_index;
-	int32_t filtered_sample;
-	uint32_t tests_failed;
-	fix16_t variance;
+	unsigned int phase;
+	int32_t coefficient;
+	int32_t *samples;
+	int32_t sum; // Q16.16 fixed-point representation
+
+	// Split input into polyphase components. The "- FILTER_HALF_ORDER" is
+	// there to account for the delay of the low-pass filter.
+	for (phase = 0; phase < OVERSAMPLE_RATIO; phase++)
+	{
+		for (i = 0; i < FILTER_PHASE_LENGTH; i++)
+		{
+			filter_phases[phase][i] = in[((i * OVERSAMPLE_RATIO) + phase - FILTER_HALF_ORDER) & (ADC_SAMPLE_BUFFER_SIZE - 1)];
+		}
+	}
+
+	// Convolute polyphase components with coefficients. Coefficient i
+	// belongs to polyphase component (i % OVERSAMPLE_RATIO), and is delayed
+	// by (i / OVERSAMPLE_RATIO) output samples.
+	for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j++)
+	{
+		filter_sums[j] = 0;
+	}
+	for (i = 0; i < FILTER_ORDER; i++)
+	{
+		coefficient = fir_lowpass_coefficients[i];
+		if (coefficient != 0)
+		{
+			samples = &(filter_phases[i % OVERSAMPLE_RATIO][i / OVERSAMPLE_RATIO]);
+			for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j++)
+			{
+				filter_sums[j] += samples[j] * coefficient;
+			}
+		}
+	}
+
+	for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j++)
+	{
+		sum = filter_sums[j];
+		out[j] = (uint16_t)((sum >> 16) + ((sum >> 15) & 1)); // round result
+	}
+}
 
+/** Choose a sample set to prepare, and start preparing it. A set which
+  * hardwareRandom32Bytes() is waiting for (#current_set) is preferred, so
+  * that a synchronous refill isn't stuck behind a background one.
+  * \return false if a set was chosen, true if all sets are already prepared
+  *         (i.e. the reservoir is full).
+  */
+static bool beginPreparingSampleSet(void)
+{
+	if (set_state[current_set] == SET_EMPTY)
+	{
+		preparing_set = current_set;
+	}
+	else if (set_state[current_set ^ 1] == SET_EMPTY)
+	{
+		preparing_set = current_set ^ 1;
+	}
+	else
+	{
+		return true; // reservoir is full
+	}
+	set_state[preparing_set] = SET_PREPARING;
 	clearHistogram();
 	clearPowerSpectralDensity();
-	samples_consumed = 0;
+	samples_prepared = 0;
+	frames_position = 0;
+	prepare_step = STEP_FILTER_BUFFER;
+	// The ADC is stopped in idle mode, so idle mode needs to be suppressed
+	// for as long as any buffer is being filled.
+	suppressIdleMode(true); // start suppressing CPU idle mode
+	current_adc_buffer = 0;
+	beginFillingADCBuffer(current_adc_buffer);
+	return false;
+}
+
+/** Mark the set being prepared as ready, with the specified test results.
+  * \param tests_failed 0 if all tests passed, non-zero if any tests failed.
+  */
+static void finishPreparingSampleSet(uint32_t tests_failed)
+{
+	set_tests_failed[preparing_set] = tests_failed;
+	set_state[preparing_set] = SET_READY;
+	preparing_set = NO_SET;
+}
+
+/** Do the next step of preparing a set of #SAMPLE_COUNT samples in #samples.
+  * This never waits for the ADC, so it can be called from idle time
+  * (see hwrngBackgroundTask()).
+  *
+  * ADC samples are double-buffered (see #adc_sample_buffers): as soon as one
+  * buffer is full, the DMA controller starts filling the other one, and
+  * the full buffer is filtered, added to the histogram and FFT'd while that
+  * happens. Thus most of the statistical testing is hidden behind ADC
+  * acquisition, and only the final tests (histogramTestsFailed() and
+  * fftTestsFailed()) are done after the last sample comes in.
+  *
+  * The power spectral density estimate is also tested after every frame
+  * (see fftEarlyTestsFailed()). If a limit is conclusively violated, the set
+  * is marked as failed straight away, without waiting for the rest of its
+  * samples.
+  *
+  * The work is split into steps (see #PrepareSteps) so that no single call
+  * does more than one of: filtering one ADC buffer, one
+  * accumulatePowerSpectralDensity(), one fftEarlyTestsFailed(),
+  * histogramTestsFailed() or fftTestsFailed(). Each of those is dominated by
+  * a fixed amount of arithmetic (at most a couple of #FFT_SIZE point FFTs or
+  * one pass over the histogram), so the time per call doesn't depend on the
+  * HWRNG signal. In the replay tester (pic32/testers/hwrng_replay), the
+  * slowest step (accumulatePowerSpectralDensity()) takes about 0.1 ms on a
+  * 2 GHz x86 host; scaling by clock speed and instructions per cycle, that
+  * is an estimated 5 ms on the 72 MHz PIC32 (not measured on hardware). That
+  * is still well under the 40 ms or so that the ADC takes to fill a buffer.
+  */
+static void prepareSampleSetStep(void)
+{
+	unsigned int j;
+	uint32_t tests_failed;
+	volatile uint16_t *set_samples;
+
+	if (preparing_set == NO_SET)
+	{
+		if (beginPreparingSampleSet())
+		{
+			return; // nothing to do
+		}
+	}
+	set_samples = samples[preparing_set];
 
-	// Fill samples array.
-	// The following loop assumes that #SAMPLE_COUNT is a multiple
+	// The following code assumes that #SAMPLE_COUNT is a multiple
 	// of #DECIMATED_SAMPLE_BUFFER_SIZE.
 #if ((SAMPLE_COUNT % DECIMATED_SAMPLE_BUFFER_SIZE) != 0)
 #error "SAMPLE_COUNT not a multiple of DECIMATED_SAMPLE_BUFFER_SIZE"
 #endif // #if ((SAMPLE_COUNT % DECIMATED_SAMPLE_BUFFER_SIZE) != 0)
-	for (i = 0; i < SAMPLE_COUNT; i += DECIMATED_SAMPLE_BUFFER_SIZE)
+	// It also assumes that each decimated buffer can be split into
+	// whole double-sized real FFTs for accumulatePowerSpectralDensity().
+#if ((DECIMATED_SAMPLE_BUFFER_SIZE % (FFT_SIZE * 2)) != 0)
+#error "DECIMATED_SAMPLE_BUFFER_SIZE not a multiple of FFT_SIZE * 2"
+#endif // #if ((DECIMATED_SAMPLE_BUFFER_SIZE % (FFT_SIZE * 2)) != 0)
+	switch (prepare_step)
 	{
-		suppressIdleMode(true); // start suppressing CPU idle mode
-		beginFillingADCBuffer();
-		while (!isADCBufferFull())
+	case STEP_FILTER_BUFFER:
+		if (!isADCBufferFull())
 		{
-			// do nothing
+			return; // come back later
+		}
+		if ((samples_prepared + DECIMATED_SAMPLE_BUFFER_SIZE) < SAMPLE_COUNT)
+		{
+			// Start acquiring the next block while this one is processed.
+			beginFillingADCBuffer(current_adc_buffer ^ 1);
+		}
+		else
+		{
+			suppressIdleMode(false); // stop suppressing CPU idle mode
 		}
-		suppressIdleMode(false); // stop suppressing CPU idle mode
 		// Filter ADC samples, placing result into samples array.
+		firDecimate(adc_sample_buffers[current_adc_buffer], &(set_samples[samples_prepared]));
 		for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j++)
 		{
-			// The "- FILTER_HALF_ORDER" is there to account for the
-			// delay of the low-pass filter.
-			base_index = ((j * OVERSAMPLE_RATIO) - FILTER_HALF_ORDER) & (ADC_SAMPLE_BUFFER_SIZE - 1);
-			filtered_sample = firFilter(adc_sample_buffer, base_index, fir_lowpass_coefficients, FILTER_ORDER);
-			samples[i + j] = filtered_sample;
+			incrementHistogram(set_samples[samples_prepared + j]);
 		}
-	}
+		current_adc_buffer ^= 1;
+		samples_prepared += DECIMATED_SAMPLE_BUFFER_SIZE;
+		prepare_step = STEP_ACCUMULATE_FRAME;
+		break;
 
-	// Run statistical tests on samples array.
-	for (i = 0; i < SAMPLE_COUNT; i++)
-	{
-		incrementHistogram(samples[i]);
-	}
-	// The following loop assumes that #SAMPLE_COUNT is a multiple
-	// of #FFT_SIZE * 2.
-#if ((SAMPLE_COUNT % (FFT_SIZE * 2)) != 0)
-#error "SAMPLE_COUNT not a multiple of FFT_SIZE * 2"
-#endif // #if ((SAMPLE_COUNT % (FFT_SIZE * 2)) != 0)
-	for (i = 0; i < SAMPLE_COUNT; i += (FFT_SIZE * 2))
-	{
-		accumulatePowerSpectralDensity(&(samples[i]));
-	}
-	tests_failed = histogramTestsFailed(&variance);
-	tests_failed |= fftTestsFailed(variance);
+	case STEP_ACCUMULATE_FRAME:
+		accumulatePowerSpectralDensity(&(set_samples[frames_position]));
+		frames_position += (FFT_SIZE * 2);
+		prepare_step = STEP_EARLY_TESTS;
+		break;
+
+	case STEP_EARLY_TESTS:
+		tests_failed = fftEarlyTestsFailed();
+#ifndef IGNORE_HWRNG_FAILURE
+		if (tests_failed != 0)
+		{
+			// A limit has already been conclusively violated, so there's
+			// no point in collecting the rest of the set. The set is
+			// incomplete, but that doesn't matter because it will never be
+			// used. The ADC may still be filling a buffer; that will be
+			// aborted when the next set is started.
+			suppressIdleMode(false); // stop suppressing CPU idle mode
+			finishPreparingSampleSet(tests_failed);
+			break;
+		}
+#endif // #ifndef IGNORE_HWRNG_FAILURE
+		if (frames_position < samples_prepared)
+		{
+			prepare_step = STEP_ACCUMULATE_FRAME; // more frames in this buffer
+		}
+		else if (samples_prepared < SAMPLE_COUNT)
+		{
+			prepare_step = STEP_FILTER_BUFFER;
+		}
+		else
+		{
+			prepare_step = STEP_HISTOGRAM_TESTS;
+		}
+		break;
+
+	case STEP_HISTOGRAM_TESTS:
+		// Run statistical tests on the histogram and power spectral density
+		// estimate which were accumulated above.
+		prepare_tests_failed = histogramTestsFailed(&prepare_variance);
+		prepare_step = STEP_FFT_TESTS;
+		break;
+
+	case STEP_FFT_TESTS:
+	default:
+		tests_failed = prepare_tests_failed | fftTestsFailed(prepare_variance);
 #ifdef TEST_STATISTICS
-	reportStatistics(tests_failed);
+		reportStatistics(tests_failed);
 #endif // #ifdef TEST_STATISTICS
-	if (tests_failed != 0)
-	{
+		if (tests_failed != 0)
+		{
 #ifdef IGNORE_HWRNG_FAILURE
-		PORTDSET = 0x10; // turn on red LED
-		delayCycles(CYCLES_PER_MILLISECOND * 100);
-		PORTDCLR = 0x10; // turn off red LED
-#else
-		return true; // statistical tests indicate HWRNG failure
+			PORTDSET = 0x10; // turn on red LED
+			delayCycles(CYCLES_PER_MILLISECOND * 100);
+			PORTDCLR = 0x10; // turn off red LED
+			tests_failed = 0;
 #endif // #ifdef IGNORE_HWRNG_FAILURE
+		}
+		finishPreparingSampleSet(tests_failed);
+		break;
+	} // end switch (prepare_step)
+}
+
+/** Make progress on filling the reservoir of statistically tested sample
+  * sets. This should be called regularly while the CPU has nothing better to
+  * do; it returns quickly if it is waiting for the ADC or if the reservoir
+  * is full. Calling this means that hardwareRandom32Bytes() usually
+  * doesn't have to wait for ADC acquisition or statistical testing.
+  *
+  * Each call does at most one step of prepareSampleSetStep(); see that
+  * function for the worst-case time per call. This matters because this is
+  * called while waiting for data from the host (see runIdleTask()), so a
+  * long call would delay receiving it.
+  */
+void hwrngBackgroundTask(void)
+{
+	// The statistical tests may use the stream (in test builds), which may
+	// come back here via runIdleTask(). Also, the histogram and
+	// power spectral density accumulators can't be shared with a
+	// hardwareRandom32Bytes() call which is in progress.
+	if (!hwrng_busy)
+	{
+		hwrng_busy = true;
+		prepareSampleSetStep();
+		hwrng_busy = false;
 	}
-	return false;
 }
 
 /** Fill buffer with 32 random bytes from a hardware random number generator.
+  *
+  * Samples come from a statistically tested set which was (hopefully)
+  * prepared by hwrngBackgroundTask(). If that set isn't ready yet, this will
+  * wait for it to be prepared. When a set is used up, this switches to the
+  * other set, so that the used-up one can be refilled in the background.
   * \param buffer The buffer to fill. This should have enough space for 32
   *               bytes.
   * \return An estimate of the total number of bits (not bytes) of entropy in
@@ -470,14 +806,31 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 	uint32_t sample;
 	bool tests_failed;
 
+	hwrng_busy = true;
 	tests_failed = false;
-	if ((samples_consumed == 0) || (samples_consumed >= SAMPLE_COUNT))
+	if (samples_consumed >= SAMPLE_COUNT)
+	{
+		// Current set is used up; give it back to the background task and
+		// switch to the other set.
+		set_state[current_set] = SET_EMPTY;
+		current_set ^= 1;
+		samples_consumed = 0;
+	}
+	if (samples_consumed == 0)
 	{
-		if (fillAndTestSamplesArray())
+		while (set_state[current_set] != SET_READY)
+		{
+			prepareSampleSetStep();
+		}
+		if (set_tests_failed[current_set] != 0)
 		{
 #ifdef TEST_STATISTICS
 			tests_failed = true;
 #else
+			// Discard the set, so that the next call will prepare a new
+			// one.
+			set_state[current_set] = SET_EMPTY;
+			hwrng_busy = false;
 			return -1; // statistical tests indicate HWRNG failure
 #endif // #ifdef TEST_STATISTICS
 		}
@@ -491,11 +844,12 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 #endif // #if ((DECIMATED_SAMPLE_BUFFER_SIZE % 16) != 0)
 	for (i = 0; i < 16; i++)
 	{
-		sample = samples[samples_consumed];
+		sample = samples[current_set][samples_consumed];
 		buffer[i * 2] = (uint8_t)sample;
 		buffer[i * 2 + 1] = (uint8_t)(sample >> 8);
 		samples_consumed++;
 	}
+	hwrng_busy = false;
 	if (tests_failed)
 	{
 		return -1; // statistical tests indicate HWRNG failure
@@ -602,6 +956,46 @@ static void reportFftResults(ComplexFixed *fft_buffer)
 	}
 }
 
+/** Write the results of fftEarlyTestsFailed() for one frame to stream, so
+  * that the host may capture them into a comma-seperated variable file. Each
+  * line contains the number of frames accumulated so far, the peak frequency
+  * and bandwidth estimates (in FFT bins), the maximum autocorrelation
+  * amplitude, the autocorrelation limit it was compared against, and whether
+  * the early tests passed.
+  * \param max_bin The bin number of the peak value in the power spectrum.
+  * \param bandwidth The bandwidth estimate, in number of FFT bins.
+  * \param max_autocorrelation The maximum autocorrelation amplitude.
+  * \param autocorrelation_limit The limit for max_autocorrelation.
+  * \param tests_failed Indicates which tests failed (0 means none).
+  */
+static void reportFrameResults(int max_bin, int bandwidth, fix16_t max_autocorrelation, fix16_t autocorrelation_limit, uint32_t tests_failed)
+{
+	char buffer[20];
+
+	sprintFix16(buffer, fix16_from_int((int)psd_frames_accumulated));
+	sendString(buffer);
+	sendString(", ");
+	sprintFix16(buffer, fix16_from_int(max_bin));
+	sendString(buffer);
+	sendString(", ");
+	sprintFix16(buffer, fix16_from_int(bandwidth));
+	sendString(buffer);
+	sendString(", ");
+	sprintFix16(buffer, max_autocorrelation);
+	sendString(buffer);
+	sendString(", ");
+	sprintFix16(buffer, autocorrelation_limit);
+	sendString(buffer);
+	if (tests_failed == 0)
+	{
+		sendString(", pass\r\n");
+	}
+	else
+	{
+		sendString(", fail\r\n");
+	}
+}
+
 /** Write statistical properties to screen so that they may be inspected in
   * real-time. Because there are too many properties to fit on-screen,
   * there are various testing modes which will write different properties.
@@ -763,6 +1157,7 @@ static void sendFix16(fix16_t value)
   * - 'A': Send results of autocorrelation computation to stream.
   * - 'E': Send maximum autocorrelation amplitude and entropy esimate to
   *        stream.
+  * - 'F': Send results of early FFT-based tests for each frame to stream.
   * - Anything which is not an uppercase letter: grab input data from the
   *   stream, compute various statistical values and send them to the stream.
   *   The host can then check the output.
@@ -806,6 +1201,10 @@ void __attribute__ ((nomips16)) testStatistics(void)
 		{
 			report_to_stream = 5;
 		}
+		else if (mode == 'F')
+		{
+			report_to_stream = 6;
+		}
 		else
 		{
 			report_to_stream = 0;
@@ -838,10 +1237,7 @@ void __attribute__ ((nomips16)) testStatistics(void)
 
 			asm volatile("mfc0 %0, $9" : "=r"(start_count));
 
-			mean = calculateCentralMoment(fix16_zero, 1);
-			variance = calculateCentralMoment(mean, 2);
-			kappa3 = calculateCentralMoment(mean, 3);
-			kappa4 = calculateCentralMoment(mean, 4);
+			calculateMoments(&mean, &variance, &kappa3, &kappa4);
 			entropy_estimate = estimateEntropy();
 
 			asm volatile("mfc0 %0, $9" : "=r"(end_count)); // read as soon as possible
@@ -22,6 +22,7 @@
 #include "sst25x.h"
 #include "hwrng.h"
 #include "../hwinterface.h"
+#include "../prandom.h"
 #include "../endian.h"
 #include "../stream_comm.h"
 
@@ -29,6 +30,53 @@
 #include "test_fft.h"
 #endif // #ifdef TEST_FFT
 
+#ifdef TEST_MODE
+/** Number of bytes to move through the FIFO in each run of the FIFO
+  * throughput benchmark (test mode 'f'). */
+#define FIFO_BENCHMARK_BYTES	65536
+/** Storage for the FIFO used in the FIFO throughput benchmark. This is the
+  * same size as the receive FIFO in usb_hid_stream.c. */
+static volatile uint8_t benchmark_fifo_storage[256];
+#endif // #ifdef TEST_MODE
+
+/** Entropy estimate, in bits, for the 32 bytes returned by each call to
+  * atsha204Random32Bytes(). The ATSHA204's internal random number generator
+  * is a black box, so this is deliberately much lower than the 256 bits that
+  * the datasheet implies. */
+#define ATSHA204_ENTROPY_ESTIMATE	64
+/** Maximum amount of entropy, in bits, which the ATSHA204 will be credited
+  * with for each getRandom256() call. See addEntropySource(). */
+#define ATSHA204_MAX_ENTROPY		256
+
+/** Get 32 random bytes from the ATSHA204's internal random number generator.
+  * This is meant to be used as an additional entropy source (see
+  * addEntropySource()). The "Random" command takes up to 50 millisecond, so
+  * HWRNG sample acquisition is started (if it isn't already under way)
+  * beforehand; the ADC's DMA transfers then continue while this waits for
+  * the ATSHA204.
+  * \param buffer The buffer to fill. This should have enough space for 32
+  *               bytes.
+  * \return #ATSHA204_ENTROPY_ESTIMATE on success, or -1 if the ATSHA204
+  *         couldn't be woken up or didn't return a valid response.
+  */
+static int atsha204Random32Bytes(uint8_t *buffer)
+{
+	bool failed;
+
+	hwrngBackgroundTask();
+	failed = atsha204Wake();
+	if (!failed)
+	{
+		failed = atsha204Random(buffer);
+	}
+	atsha204Sleep();
+	if (failed)
+	{
+		return -1;
+	}
+	return ATSHA204_ENTROPY_ESTIMATE;
+}
+
 /** This will be called whenever an unrecoverable error occurs. This should
   * not return. */
 void usbFatalError(void)
@@ -94,6 +142,7 @@ int main(void)
 	initSST25x();
 	initATSHA204();
 	initADC();
+	addEntropySource(atsha204Random32Bytes, ATSHA204_MAX_ENTROPY);
 	usbInit();
 	usbHIDStreamInit();
 	usbDisconnect(); // just in case
@@ -168,6 +217,42 @@ int main(void)
 			string_buffer[1] = '\0';
 			writeStringToDisplay(string_buffer);
 		}
+		else if (mode == 'f')
+		{
+			// FIFO throughput benchmark. This moves bytes through a FIFO in
+			// packet-sized chunks, first one byte at a time, then using
+			// spans. The number of cycles each method took is sent as two
+			// little-endian 32 bit integers.
+			CircularBuffer fifo;
+			uint8_t packet[64];
+			uint8_t report[8];
+			uint32_t start_count;
+			uint32_t j;
+
+			memset(packet, 0, sizeof(packet));
+			initCircularBuffer(&fifo, benchmark_fifo_storage, sizeof(benchmark_fifo_storage));
+			start_count = getCycleCount();
+			for (i = 0; i < FIFO_BENCHMARK_BYTES; i += sizeof(packet))
+			{
+				for (j = 0; j < sizeof(packet); j++)
+				{
+					circularBufferWrite(&fifo, packet[j], false);
+				}
+				for (j = 0; j < sizeof(packet); j++)
+				{
+					packet[j] = circularBufferRead(&fifo, false);
+				}
+			}
+			writeU32LittleEndian(report, getCycleCount() - start_count);
+			start_count = getCycleCount();
+			for (i = 0; i < FIFO_BENCHMARK_BYTES; i += sizeof(packet))
+			{
+				circularBufferWriteBlock(&fifo, packet, sizeof(packet));
+				circularBufferReadBlock(&fifo, packet, sizeof(packet));
+			}
+			writeU32LittleEndian(&(report[4]), getCycleCount() - start_count);
+			streamPutBytes(report, sizeof(report));
+		}
 		else if (mode == 'n')
 		{
 			// Non-volatile I/O test.
@@ -243,6 +328,9 @@ int main(void)
 		// do nothing
 	}
 #else
+	// Collect and test HWRNG samples while waiting for packets, so that
+	// they're ready when they're needed.
+	setIdleTask(hwrngBackgroundTask);
 	while (true)
 	{
 		processPacket();
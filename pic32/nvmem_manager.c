@@ -11,29 +11,196 @@
   * To deal with this problem, the functions in this file implement a
   * translation layer which uses a cache to accumulate writes within a sector.
   * nonVolatileFlush() can then be used to actually write the sector to
-  * flash memory.
+  * flash memory. The cache is a small set-associative write-back cache
+  * (see #NV_CACHE_SETS and #NV_CACHE_WAYS), so that interleaved writes to
+  * different sectors (eg. an entropy pool update in the middle of a wallet
+  * update) don't each cause a sector to be erased and programmed. Dirty
+  * sectors are written back in the order they became dirty. This is not a
+  * full ordering of writes: a later write to an already dirty sector can
+  * reach flash memory before an earlier write to another sector.
+  *
+  * The global partition occupies the first sector of flash memory and is
+  * updated in place. The accounts partition is stored differently, as a log
+  * of sectors. It is divided into #LOG_LOGICAL_SECTORS logical sectors, each
+  * holding #LOG_DATA_SIZE bytes. Whenever any part of the accounts partition
+  * is flushed, a new "generation" is appended to the log area: every dirty
+  * logical sector is programmed into a free physical sector, along with a
+  * footer containing the logical sector number, the set of logical sectors
+  * in the generation, a sequence number (the same for the whole generation)
+  * and a checksum. Logical sectors which aren't dirty keep their existing
+  * copies; the sequence numbers in the footers say which copy of each
+  * logical sector is the most recent. Only once the entire new generation
+  * has been programmed and verified are the copies it supersedes erased.
+  * This has two benefits:
+  * - Wallet updates (eg. new addresses) are spread over the entire log area,
+  *   instead of repeatedly erasing the same sector. Each flush only erases
+  *   and programs as many sectors as there are dirty logical sectors.
+  * - Updates to the accounts partition are atomic. If power is lost during a
+  *   flush, the old copies are still intact, and an incomplete new
+  *   generation will be discarded (see mountLog()). In particular, wallet
+  *   records which straddle a logical sector boundary can't be torn.
+  *
+  * Once a generation has been committed, some of its copies may be erased
+  * because a later generation superseded them. So a generation which is
+  * missing some of its logical sectors isn't necessarily incomplete. To tell
+  * the difference, each footer also records the sequence number of the most
+  * recent generation which had been committed when it was written (see
+  * LogFooter#committed). Any sectors left over from a generation which
+  * wasn't committed are erased before the next generation is written, so
+  * that they can never be mistaken for committed ones.
+  *
+  * The write pattern does reveal which logical sectors were written in
+  * each flush, and the footers record the order of the most recent writes to
+  * each logical sector. That is coarser than which wallet records were
+  * written (each logical sector holds many records), but it is more than an
+  * in-place update would leave behind. Superseded copies are erased straight
+  * away, instead of being left for garbage collection later, because two
+  * copies of the same logical sector would reveal which wallet records had
+  * changed. If erasing a superseded copy fails, it is left as garbage to be
+  * erased later by mountLog() or allocateLogSector().
+  *
+  * The map from logical sectors to physical sectors is kept in RAM. It is
+  * rebuilt (see mountLog()) from the footers the first time the accounts
+  * partition is accessed after reset.
   *
   * This file is licensed as described by the file LICENCE.
   */
 
 #include <stdint.h>
 #include <string.h>
+#include "../common.h"
 #include "../hwinterface.h"
+#include "../hash.h"
+#include "../ripemd160.h"
 #include "sst25x.h"
+#include "nvmem_manager.h"
+
+/** Footer which is placed in the last #LOG_FOOTER_SIZE bytes of every
+  * programmed sector in the accounts log area. */
+typedef struct LogFooterStruct
+{
+	/** This must be #LOG_FOOTER_MAGIC for the footer to be considered. */
+	uint16_t magic;
+	/** Which logical sector (0 to #LOG_LOGICAL_SECTORS - 1) of the accounts
+	  * partition is stored in this physical sector. */
+	uint8_t logical_sector;
+	/** Bit mask of the logical sectors which are in the same generation as
+	  * this sector (bit n set means logical sector n). This always includes
+	  * LogFooter#logical_sector. */
+	uint8_t members;
+	/** Sequence number of the generation this sector belongs to. This is
+	  * incremented every time a generation is appended to the log (even if
+	  * appending fails). When there are two committed copies of a logical
+	  * sector, the one with the larger sequence number is the more recent
+	  * one. */
+	uint32_t sequence;
+	/** Sequence number of the most recent generation which had been
+	  * committed (i.e. completely programmed) when this generation was
+	  * written. Every generation with a sequence number up to and including
+	  * this one was committed, even if some of its sectors have since been
+	  * erased. */
+	uint32_t committed;
+	/** RIPEMD-160 hash of the #LOG_DATA_SIZE bytes of data and the fields
+	  * above. */
+	uint8_t checksum[20];
+} LogFooter;
 
-/** Whether write cache is valid. */
-static bool write_cache_valid;
-/** Sector address of current contents of write cache. This is only
-  * well-defined if #write_cache_valid is true. */
-static uint32_t write_cache_tag;
-/** Current contents of write cache. This is only well-defined
-  * if #write_cache_valid is true. */
-static uint8_t write_cache[SECTOR_SIZE];
+/** Value of LogFooter#magic which identifies a (possibly) valid footer. */
+#define LOG_FOOTER_MAGIC		0x4c47
 
-/** Bitmask applied to addresses to get the sector address. */
-#define SECTOR_TAG_MASK			(~(SECTOR_SIZE - 1))
-/** Bitmask applied to addresses to get the offset within a sector. */
-#define SECTOR_OFFSET_MASK		(SECTOR_SIZE - 1)
+/** This will fail to compile if #LogFooter doesn't fit
+  * in #LOG_FOOTER_SIZE bytes. */
+typedef char LogFooterSizeCheck[(sizeof(LogFooter) <= LOG_FOOTER_SIZE) ? 1 : -1];
+
+#if LOG_PHYSICAL_SECTORS < (2 * LOG_LOGICAL_SECTORS)
+#error "LOG_PHYSICAL_SECTORS too small to hold two generations"
+#endif // #if LOG_PHYSICAL_SECTORS < (2 * LOG_LOGICAL_SECTORS)
+#if LOG_LOGICAL_SECTORS > 8
+#error "LOG_LOGICAL_SECTORS too large for LogFooter#members"
+#endif // #if LOG_LOGICAL_SECTORS > 8
+
+/** Cache tag which refers to the global partition. Cache tags 1 to
+  * #LOG_LOGICAL_SECTORS refer to logical sectors 0 to
+  * #LOG_LOGICAL_SECTORS - 1 of the accounts partition. */
+#define GLOBAL_CACHE_TAG		0
+
+/** Value of an entry of #log_map which indicates that the logical sector
+  * has never been written. */
+#define LOG_UNMAPPED			0xffffffff
+
+/** Number of sets in the write cache. Each sector maps to exactly one set.
+  * This can be overridden at build time.
+  * \warning This must be at least 1.
+  */
+#ifndef NV_CACHE_SETS
+#define NV_CACHE_SETS			1
+#endif // #ifndef NV_CACHE_SETS
+/** Number of cache lines (ways) in each set of the write cache. Each cache
+  * line uses #SECTOR_SIZE bytes of RAM. This can be overridden at build time.
+  * With at least 2 ways, an update to the global partition (eg. the entropy
+  * pool) won't evict a wallet record which is in the middle of being
+  * updated, and vice versa.
+  * \warning This must be at least 1.
+  */
+#ifndef NV_CACHE_WAYS
+#define NV_CACHE_WAYS			2
+#endif // #ifndef NV_CACHE_WAYS
+
+/** One line of the write cache. Each line can hold the contents of one
+  * sector. */
+typedef struct NVCacheLineStruct
+{
+	/** Whether this cache line holds anything. */
+	bool valid;
+	/** Whether the contents of this cache line differ from what is in flash
+	  * memory. This is only well-defined if NVCacheLine#valid is true. */
+	bool dirty;
+	/** Cache tag (see #GLOBAL_CACHE_TAG) of the sector held in this line.
+	  * This is only well-defined if NVCacheLine#valid is true. */
+	uint32_t tag;
+	/** Value of #cache_clock when this line was last accessed. This is used
+	  * to find the least recently used line in a set. */
+	uint32_t last_used;
+	/** Value of #dirty_clock when this line went from clean to dirty. Dirty
+	  * lines are written back in this order. This is not updated by further
+	  * writes to a line which is already dirty. This is only well-defined if
+	  * NVCacheLine#dirty is true. */
+	uint32_t dirty_since;
+	/** Cached contents of the sector. */
+	uint8_t contents[SECTOR_SIZE];
+} NVCacheLine;
+
+/** The write cache. Lines are write-back: nothing is written to flash memory
+  * until nonVolatileFlush() is called or until a dirty line is evicted. */
+static NVCacheLine nv_cache[NV_CACHE_SETS][NV_CACHE_WAYS];
+/** Incremented on every cache access, for least recently used eviction. */
+static uint32_t cache_clock;
+/** Incremented whenever a clean cache line becomes dirty, so that dirty lines
+  * can be written back in the order that they became dirty. */
+static uint32_t dirty_clock;
+/** Counts of non-volatile memory operations, for profiling. */
+static NVOperationCounts nv_operation_counts;
+
+/** Whether #log_map, #log_next_sequence, #log_committed_sequence,
+  * #log_next_free and #log_uncommitted are valid. */
+static bool log_mounted;
+/** Map from logical sector number to physical address of the sector which
+  * holds the most recent copy of that logical sector. An entry will be
+  * #LOG_UNMAPPED if the logical sector has never been written. */
+static uint32_t log_map[LOG_LOGICAL_SECTORS];
+/** Sequence number to use for the next generation appended to the log. */
+static uint32_t log_next_sequence;
+/** Sequence number of the most recently committed generation. This goes
+  * into LogFooter#committed. */
+static uint32_t log_committed_sequence;
+/** Which physical sectors in the log area might hold part of a generation
+  * which wasn't committed. These must be erased before another generation
+  * is committed; see appendGeneration(). */
+static bool log_uncommitted[LOG_PHYSICAL_SECTORS];
+/** Index (0 to #LOG_PHYSICAL_SECTORS - 1) of the physical sector in the log
+  * area to try first when appending to the log. Allocating sectors in a
+  * round-robin fashion spreads wear evenly over the log area. */
+static uint32_t log_next_free;
 
 /** Get size of a partition.
   * \param out_size On success, the size of the partition (in number of bytes)
@@ -44,61 +211,744 @@ static uint8_t write_cache[SECTOR_SIZE];
   */
 extern NonVolatileReturn nonVolatileGetSize(uint32_t *out_size, NVPartitions partition)
 {
-    if (partition == PARTITION_GLOBAL)
-    {
-        *out_size = GLOBAL_PARTITION_SIZE;
-        return NV_NO_ERROR;
-    }
-    else if (partition == PARTITION_ACCOUNTS)
-    {
-        *out_size = ACCOUNTS_PARTITION_SIZE;
-        return NV_NO_ERROR;
-    }
-    else
-    {
-        return NV_INVALID_ADDRESS;
-    }
+	if (partition == PARTITION_GLOBAL)
+	{
+		*out_size = GLOBAL_PARTITION_SIZE;
+		return NV_NO_ERROR;
+	}
+	else if (partition == PARTITION_ACCOUNTS)
+	{
+		*out_size = ACCOUNTS_PARTITION_SIZE;
+		return NV_NO_ERROR;
+	}
+	else
+	{
+		return NV_INVALID_ADDRESS;
+	}
 }
 
-/** Check that an address range lies entirely within a partition, and tweak
-  * the address to convert from partition offset to non-volatile memory offset.
+/** Check that an address range lies entirely within a partition.
   * \param address Address (offset) within a partition.
   * \param partition The partition to check against. Must be one
   *                  of #NVPartitions.
   * \param length The number of bytes in the address range.
   * \return See #NonVolatileReturnEnum for return values.
   */
-static NonVolatileReturn checkAndTweakAddress(uint32_t *address, NVPartitions partition, uint32_t length)
+static NonVolatileReturn checkAddress(uint32_t address, NVPartitions partition, uint32_t length)
 {
-    uint32_t size;
-    NonVolatileReturn r;
+	uint32_t size;
+	NonVolatileReturn r;
 
-    // As long as NV_MEMORY_SIZE is much smaller than 2 ^ 32, address + length
-	// cannot overflow.
-	if ((*address >= NV_MEMORY_SIZE) || (length > NV_MEMORY_SIZE)
-		|| ((*address + length) > NV_MEMORY_SIZE))
+	r = nonVolatileGetSize(&size, partition);
+	if (r != NV_NO_ERROR)
+	{
+		return r;
+	}
+	// As long as partition sizes are much smaller than 2 ^ 32,
+	// address + length cannot overflow.
+	if ((address >= size) || (length > size) || ((address + length) > size))
 	{
 		return NV_INVALID_ADDRESS;
 	}
+	return NV_NO_ERROR;
+}
+
+/** Convert a partition offset into a cache tag and an offset within the
+  * sector that the cache tag refers to.
+  * \param out_tag The cache tag (see #GLOBAL_CACHE_TAG) will be written here.
+  * \param out_offset The offset within the sector will be written here.
+  * \param partition The partition the address refers to. Must be one
+  *                  of #NVPartitions.
+  * \param address Address (offset) within the partition. This should have
+  *                been checked using checkAddress().
+  * \return The number of bytes from the address to the end of the sector
+  *         (or to the end of the data area of the sector).
+  */
+static uint32_t locateAddress(uint32_t *out_tag, uint32_t *out_offset, NVPartitions partition, uint32_t address)
+{
+	if (partition == PARTITION_GLOBAL)
+	{
+		*out_tag = GLOBAL_CACHE_TAG;
+		*out_offset = address;
+		return GLOBAL_PARTITION_SIZE - address;
+	}
+	else
+	{
+		*out_tag = (address / LOG_DATA_SIZE) + 1;
+		*out_offset = address % LOG_DATA_SIZE;
+		return LOG_DATA_SIZE - *out_offset;
+	}
+}
 
-    // Check that address range falls entirely within partition.
-    r = nonVolatileGetSize(&size, partition);
-    if (r != NV_NO_ERROR)
-    {
-        return r;
-    }
-    if ((*address + length) > size)
-    {
-        return NV_INVALID_ADDRESS;
-    }
-
-    // Add partition base address to convert from partition offset to
-    // non-volatile memory offset.
-    if (partition == PARTITION_ACCOUNTS)
-    {
-        *address += GLOBAL_PARTITION_SIZE;
-    }
-    return NV_NO_ERROR;
+/** Read from flash memory and count the operation.
+  * \param data A pointer to the buffer which will receive the data.
+  * \param address Flash memory address to start reading from.
+  * \param length The number of bytes to read.
+  */
+static void flashRead(uint8_t *data, uint32_t address, uint32_t length)
+{
+	nv_operation_counts.flash_reads++;
+	sst25xRead(data, address, length);
+}
+
+/** Read directly from flash memory (bypassing the write cache).
+  * \param data A pointer to the buffer which will receive the data.
+  * \param tag Cache tag (see #GLOBAL_CACHE_TAG) of sector to read from.
+  * \param offset Offset within the sector to start reading from.
+  * \param length The number of bytes to read.
+  */
+static void readSector(uint8_t *data, uint32_t tag, uint32_t offset, uint32_t length)
+{
+	uint32_t physical;
+
+	if (tag == GLOBAL_CACHE_TAG)
+	{
+		flashRead(data, offset, length);
+	}
+	else
+	{
+		physical = log_map[tag - 1];
+		if (physical == LOG_UNMAPPED)
+		{
+			// Logical sector has never been written; pretend that it is
+			// erased.
+			memset(data, 0xff, length);
+		}
+		else
+		{
+			flashRead(data, physical + offset, length);
+		}
+	}
+}
+
+/** Erase a sector and verify that the erase was successful.
+  * \param address The address of the sector to erase.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn eraseAndVerify(uint32_t address)
+{
+	unsigned int i;
+	uint8_t read_buffer[SECTOR_SIZE];
+
+	nv_operation_counts.flash_erases++;
+	sst25xEraseSector(address);
+	flashRead(read_buffer, address, SECTOR_SIZE);
+	for (i = 0; i < SECTOR_SIZE; i++)
+	{
+		if (read_buffer[i] != 0xff)
+		{
+			return NV_IO_ERROR; // erase did not complete properly
+		}
+	}
+	return NV_NO_ERROR;
+}
+
+/** Program an (erased) sector and verify that the program was successful.
+  * \param data The data to program the sector with. This must be
+  *             #SECTOR_SIZE bytes in size.
+  * \param address The address of the sector to program.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn programAndVerify(uint8_t *data, uint32_t address)
+{
+	uint8_t read_buffer[SECTOR_SIZE];
+
+	nv_operation_counts.flash_programs++;
+	sst25xProgramSector(data, address);
+	flashRead(read_buffer, address, SECTOR_SIZE);
+	if (memcmp(read_buffer, data, SECTOR_SIZE))
+	{
+		return NV_IO_ERROR; // program did not complete properly
+	}
+	return NV_NO_ERROR;
+}
+
+/** Check whether a sector is entirely erased.
+  * \param address The address of the sector to check.
+  * \return true if every byte in the sector is 0xff, false otherwise.
+  */
+static bool isSectorErased(uint32_t address)
+{
+	unsigned int i;
+	uint8_t read_buffer[SECTOR_SIZE];
+
+	flashRead(read_buffer, address, SECTOR_SIZE);
+	for (i = 0; i < SECTOR_SIZE; i++)
+	{
+		if (read_buffer[i] != 0xff)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Calculate the checksum of a sector in the log area.
+  * \param out The checksum will be written here. This must have space
+  *            for 20 bytes (the size of LogFooter#checksum).
+  * \param data The contents of the sector. Only the first #LOG_DATA_SIZE
+  *             bytes will be used.
+  * \param footer The footer of the sector. Everything except for the
+  *               checksum will be used.
+  */
+static void calculateLogChecksum(uint8_t *out, uint8_t *data, LogFooter *footer)
+{
+	HashState hs;
+	uint8_t hash[32];
+	unsigned int i;
+
+	ripemd160Begin(&hs);
+	for (i = 0; i < LOG_DATA_SIZE; i++)
+	{
+		ripemd160WriteByte(&hs, data[i]);
+	}
+	for (i = 0; i < (sizeof(LogFooter) - sizeof(footer->checksum)); i++)
+	{
+		ripemd160WriteByte(&hs, ((uint8_t *)footer)[i]);
+	}
+	ripemd160Finish(&hs);
+	// writeHashToByteArray() always writes 32 bytes, even though a
+	// RIPEMD-160 hash is only 20 bytes long.
+	writeHashToByteArray(hash, &hs, true);
+	memcpy(out, hash, sizeof(footer->checksum));
+}
+
+/** Check whether a sector in the log area contains a complete, intact copy
+  * of a logical sector.
+  * \param address The address of the sector to check.
+  * \param footer The footer of the sector will be written here.
+  * \return true if the sector is valid, false if it is not.
+  */
+static bool isLogSectorValid(uint32_t address, LogFooter *footer)
+{
+	uint8_t read_buffer[SECTOR_SIZE];
+	uint8_t checksum[20];
+
+	flashRead(read_buffer, address, SECTOR_SIZE);
+	memcpy(footer, &(read_buffer[LOG_DATA_SIZE]), sizeof(LogFooter));
+	if ((footer->magic != LOG_FOOTER_MAGIC)
+		|| (footer->logical_sector >= LOG_LOGICAL_SECTORS)
+		|| ((footer->members & (1 << footer->logical_sector)) == 0))
+	{
+		return false;
+	}
+	calculateLogChecksum(checksum, read_buffer, footer);
+	if (memcmp(checksum, footer->checksum, sizeof(checksum)))
+	{
+		return false;
+	}
+	return true;
+}
+
+/** Scan the accounts log area and build the map from logical sectors to
+  * physical sectors, using the most recent committed copy of each logical
+  * sector. This also cleans up after any flush which was interrupted by a
+  * loss of power: incomplete copies, uncommitted generations and superseded
+  * copies are all erased. Sectors which can't be erased are left as garbage;
+  * they can't be mistaken for committed copies.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn mountLog(void)
+{
+	LogFooter footer;
+	uint32_t sequence[LOG_PHYSICAL_SECTORS];
+	uint8_t logical_sector[LOG_PHYSICAL_SECTORS];
+	uint8_t members[LOG_PHYSICAL_SECTORS];
+	bool valid[LOG_PHYSICAL_SECTORS];
+	bool committed[LOG_PHYSICAL_SECTORS];
+	uint32_t map_index[LOG_LOGICAL_SECTORS];
+	uint32_t present; // bit mask of logical sectors present in a generation
+	uint32_t newest_committed_field; // newest LogFooter#committed seen
+	uint32_t newest_seen; // newest sequence number of any valid sector
+	uint32_t newest_index; // index of newest mapped sector
+	bool seen_any;
+	bool mapped_any;
+	uint32_t address;
+	uint32_t i;
+	uint32_t j;
+
+	// Read all footers. Anything which isn't a valid copy of a logical
+	// sector is an incomplete copy (or partially erased old copy). Leaving
+	// it around would reveal what was being written. If it can't be erased,
+	// it's still invalid, so it can't be confused with a real copy.
+	seen_any = false;
+	newest_seen = 0;
+	newest_committed_field = 0;
+	for (i = 0; i < LOG_PHYSICAL_SECTORS; i++)
+	{
+		address = LOG_START_ADDRESS + i * SECTOR_SIZE;
+		log_uncommitted[i] = false;
+		valid[i] = isLogSectorValid(address, &footer);
+		if (valid[i])
+		{
+			sequence[i] = footer.sequence;
+			logical_sector[i] = footer.logical_sector;
+			members[i] = footer.members;
+			// Sequence numbers are compared in a way which handles
+			// wrap-around.
+			if (!seen_any || ((int32_t)(footer.sequence - newest_seen) > 0))
+			{
+				newest_seen = footer.sequence;
+			}
+			if (!seen_any || ((int32_t)(footer.committed - newest_committed_field) > 0))
+			{
+				newest_committed_field = footer.committed;
+			}
+			seen_any = true;
+		}
+		else if (!isSectorErased(address))
+		{
+			eraseAndVerify(address);
+		}
+	}
+
+	// A generation was committed if a later footer says so, or if all of
+	// its logical sectors are present (i.e. power wasn't lost before it
+	// could be committed).
+	for (i = 0; i < LOG_PHYSICAL_SECTORS; i++)
+	{
+		committed[i] = false;
+		if (valid[i])
+		{
+			if ((int32_t)(sequence[i] - newest_committed_field) <= 0)
+			{
+				committed[i] = true;
+			}
+			else
+			{
+				present = 0;
+				for (j = 0; j < LOG_PHYSICAL_SECTORS; j++)
+				{
+					if (valid[j] && (sequence[j] == sequence[i]))
+					{
+						present |= (uint32_t)1 << logical_sector[j];
+					}
+				}
+				committed[i] = ((present & members[i]) == members[i]);
+			}
+		}
+	}
+
+	// Map the most recent committed copy of each logical sector.
+	for (i = 0; i < LOG_LOGICAL_SECTORS; i++)
+	{
+		log_map[i] = LOG_UNMAPPED;
+		map_index[i] = 0;
+	}
+	for (i = 0; i < LOG_PHYSICAL_SECTORS; i++)
+	{
+		if (committed[i])
+		{
+			j = logical_sector[i];
+			if ((log_map[j] == LOG_UNMAPPED)
+				|| ((int32_t)(sequence[i] - sequence[map_index[j]]) > 0))
+			{
+				log_map[j] = LOG_START_ADDRESS + i * SECTOR_SIZE;
+				map_index[j] = i;
+			}
+		}
+	}
+
+	// Erase everything else. Superseded copies which can't be erased are
+	// harmless, since a more recent copy will always be preferred. But
+	// uncommitted copies could later be mistaken for committed ones (once
+	// a footer's LogFooter#committed passes their sequence number), so
+	// they must be erased before anything else is committed.
+	for (i = 0; i < LOG_PHYSICAL_SECTORS; i++)
+	{
+		address = LOG_START_ADDRESS + i * SECTOR_SIZE;
+		if (valid[i] && (log_map[logical_sector[i]] != address))
+		{
+			if (eraseAndVerify(address) != NV_NO_ERROR)
+			{
+				log_uncommitted[i] = !committed[i];
+			}
+		}
+	}
+
+	// Continue round-robin allocation from just after the most recently
+	// written copy.
+	mapped_any = false;
+	newest_index = 0;
+	for (i = 0; i < LOG_LOGICAL_SECTORS; i++)
+	{
+		if ((log_map[i] != LOG_UNMAPPED)
+			&& (!mapped_any || ((int32_t)(sequence[map_index[i]] - sequence[newest_index]) > 0)))
+		{
+			mapped_any = true;
+			newest_index = map_index[i];
+		}
+	}
+	if (mapped_any)
+	{
+		log_next_free = (newest_index + 1) % LOG_PHYSICAL_SECTORS;
+		log_committed_sequence = sequence[newest_index];
+	}
+	else
+	{
+		log_next_free = 0;
+	}
+	if (seen_any)
+	{
+		log_next_sequence = newest_seen + 1;
+	}
+	else
+	{
+		log_next_sequence = 0;
+	}
+	if (!mapped_any)
+	{
+		log_committed_sequence = log_next_sequence - 1;
+	}
+	log_mounted = true;
+	return NV_NO_ERROR;
+}
+
+/** Find an erased sector in the accounts log area which isn't currently
+  * holding a logical sector. Sectors are allocated in round-robin order so
+  * that wear is spread evenly.
+  * \param out_address On success, the address of the erased sector will be
+  *                    written here.
+  * \param pending_map Addresses of sectors which have already been allocated
+  *                    for the generation which is being written.
+  * \param pending_count Number of entries in pending_map.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn allocateLogSector(uint32_t *out_address, uint32_t *pending_map, uint32_t pending_count)
+{
+	uint32_t address;
+	uint32_t i;
+	uint32_t j;
+	bool in_use;
+
+	for (i = 0; i < LOG_PHYSICAL_SECTORS; i++)
+	{
+		address = LOG_START_ADDRESS + log_next_free * SECTOR_SIZE;
+		log_next_free = (log_next_free + 1) % LOG_PHYSICAL_SECTORS;
+		in_use = false;
+		for (j = 0; j < LOG_LOGICAL_SECTORS; j++)
+		{
+			if ((log_map[j] == address)
+				|| ((j < pending_count) && (pending_map[j] == address)))
+			{
+				in_use = true;
+			}
+		}
+		if (!in_use)
+		{
+			// Free sectors should already be erased, but a failed erase
+			// could have left garbage behind.
+			if (!isSectorErased(address))
+			{
+				if (eraseAndVerify(address) != NV_NO_ERROR)
+				{
+					continue; // try the next one
+				}
+			}
+			*out_address = address;
+			return NV_NO_ERROR;
+		}
+	}
+	return NV_IO_ERROR; // no usable sectors
+}
+
+/** Look for a sector in the write cache, without counting the access as a
+  * cache hit or miss.
+  * \param tag Cache tag (see #GLOBAL_CACHE_TAG) of the sector to look for.
+  * \return The cache line which holds the sector, or NULL if the sector
+  *         isn't in the cache.
+  */
+static NVCacheLine *findCacheLine(uint32_t tag)
+{
+	NVCacheLine *line;
+	unsigned int way;
+
+	for (way = 0; way < NV_CACHE_WAYS; way++)
+	{
+		line = &(nv_cache[tag % NV_CACHE_SETS][way]);
+		if (line->valid && (line->tag == tag))
+		{
+			return line;
+		}
+	}
+	return NULL;
+}
+
+/** Append a new generation (a new copy of every dirty logical sector) to
+  * the accounts log, then erase the copies it supersedes. Afterwards, every
+  * cache line which holds part of the accounts partition is clean.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn appendGeneration(void)
+{
+	LogFooter footer;
+	uint32_t new_map[LOG_LOGICAL_SECTORS];
+	uint32_t old_map[LOG_LOGICAL_SECTORS];
+	uint8_t logical_sectors[LOG_LOGICAL_SECTORS];
+	uint32_t count;
+	uint32_t sequence;
+	uint8_t members;
+	uint32_t i;
+	NVCacheLine *line;
+	NonVolatileReturn r;
+
+	members = 0;
+	count = 0;
+	for (i = 0; i < LOG_LOGICAL_SECTORS; i++)
+	{
+		line = findCacheLine(i + 1);
+		if ((line != NULL) && line->dirty)
+		{
+			members |= (uint8_t)(1 << i);
+			logical_sectors[count] = (uint8_t)i;
+			count++;
+		}
+	}
+	if (count == 0)
+	{
+		return NV_NO_ERROR; // nothing to do
+	}
+
+	// Leftovers from a generation which wasn't committed must be gone
+	// before this generation is committed, since its footers will say that
+	// everything before it was committed (see LogFooter#committed).
+	for (i = 0; i < LOG_PHYSICAL_SECTORS; i++)
+	{
+		if (log_uncommitted[i])
+		{
+			r = eraseAndVerify(LOG_START_ADDRESS + i * SECTOR_SIZE);
+			if (r != NV_NO_ERROR)
+			{
+				return r;
+			}
+			log_uncommitted[i] = false;
+		}
+	}
+
+	// The sequence number is used up even if this fails, so that the
+	// sectors of a failed generation can never be completed by a later one.
+	sequence = log_next_sequence;
+	log_next_sequence++;
+	for (i = 0; i < count; i++)
+	{
+		line = findCacheLine((uint32_t)logical_sectors[i] + 1);
+		footer.magic = LOG_FOOTER_MAGIC;
+		footer.logical_sector = logical_sectors[i];
+		footer.members = members;
+		footer.sequence = sequence;
+		footer.committed = log_committed_sequence;
+		calculateLogChecksum(footer.checksum, line->contents, &footer);
+		memset(&(line->contents[LOG_DATA_SIZE]), 0xff, LOG_FOOTER_SIZE);
+		memcpy(&(line->contents[LOG_DATA_SIZE]), &footer, sizeof(LogFooter));
+		r = allocateLogSector(&(new_map[i]), new_map, i);
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+		// If anything fails from here on, the incomplete generation will be
+		// discarded by mountLog(), or erased before the next one.
+		log_uncommitted[(new_map[i] - LOG_START_ADDRESS) / SECTOR_SIZE] = true;
+		r = programAndVerify(line->contents, new_map[i]);
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+	}
+
+	// The new generation is now committed; from this point on, a loss of
+	// power will be cleaned up by mountLog(). Update the whole map before
+	// erasing anything, so that a failed erase can't leave the map pointing
+	// at superseded copies.
+	log_committed_sequence = sequence;
+	for (i = 0; i < count; i++)
+	{
+		log_uncommitted[(new_map[i] - LOG_START_ADDRESS) / SECTOR_SIZE] = false;
+		old_map[i] = log_map[logical_sectors[i]];
+		log_map[logical_sectors[i]] = new_map[i];
+		findCacheLine((uint32_t)logical_sectors[i] + 1)->dirty = false;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (old_map[i] != LOG_UNMAPPED)
+		{
+			// If this fails, the superseded copy is left as garbage.
+			// mountLog() will ignore it (there's a more recent copy) and
+			// try to erase it, as will allocateLogSector() when it gets
+			// there.
+			eraseAndVerify(old_map[i]);
+		}
+	}
+	return NV_NO_ERROR;
+}
+
+/** Write the contents of a dirty cache line to flash memory. This doesn't
+  * respect the write back order; use writeBackUpTo() for that.
+  * \param line The cache line to write back.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn writeBackLine(NVCacheLine *line)
+{
+	NonVolatileReturn r;
+
+	if (line->tag == GLOBAL_CACHE_TAG)
+	{
+		// The global partition is updated in place.
+		r = eraseAndVerify(0);
+		if (r == NV_NO_ERROR)
+		{
+			r = programAndVerify(line->contents, 0);
+		}
+	}
+	else if (line->tag <= LOG_LOGICAL_SECTORS)
+	{
+		// This writes back every other dirty accounts partition line too.
+		r = appendGeneration();
+	}
+	else
+	{
+		r = NV_INVALID_ADDRESS;
+	}
+	if (r == NV_NO_ERROR)
+	{
+		line->dirty = false;
+	}
+	return r;
+}
+
+/** Find the dirty cache line which has been dirty for the longest time.
+  * \return The oldest dirty cache line, or NULL if there are no dirty
+  *         cache lines.
+  */
+static NVCacheLine *findOldestDirtyLine(void)
+{
+	NVCacheLine *line;
+	NVCacheLine *oldest;
+	unsigned int set;
+	unsigned int way;
+
+	oldest = NULL;
+	for (set = 0; set < NV_CACHE_SETS; set++)
+	{
+		for (way = 0; way < NV_CACHE_WAYS; way++)
+		{
+			line = &(nv_cache[set][way]);
+			if (line->valid && line->dirty)
+			{
+				if ((oldest == NULL) || ((int32_t)(line->dirty_since - oldest->dirty_since) < 0))
+				{
+					oldest = line;
+				}
+			}
+		}
+	}
+	return oldest;
+}
+
+/** Write back dirty cache lines, in the order they became dirty, up to and
+  * including a specified line. This does not guarantee that flash memory
+  * holds a prefix of the sequence of updates if power is lost. Only the
+  * first write to each line is ordered; a line which was dirtied first and
+  * then written again after another line became dirty will be written back
+  * first, including the later write. Writing back an accounts partition
+  * line also writes back every other dirty accounts partition line (see
+  * appendGeneration()).
+  * \param last The last cache line to write back. Use NULL to write back
+  *             every dirty cache line.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn writeBackUpTo(NVCacheLine *last)
+{
+	NVCacheLine *line;
+	NonVolatileReturn r;
+
+	while ((line = findOldestDirtyLine()) != NULL)
+	{
+		r = writeBackLine(line);
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+		if ((last != NULL) && !last->dirty)
+		{
+			break;
+		}
+	}
+	return NV_NO_ERROR;
+}
+
+/** Look for a sector in the write cache.
+  * \param tag Cache tag (see #GLOBAL_CACHE_TAG) of the sector to look for.
+  * \return The cache line which holds the sector, or NULL if the sector
+  *         isn't in the cache.
+  */
+static NVCacheLine *lookupCacheLine(uint32_t tag)
+{
+	NVCacheLine *line;
+
+	line = findCacheLine(tag);
+	if (line != NULL)
+	{
+		line->last_used = cache_clock++;
+		nv_operation_counts.cache_hits++;
+	}
+	else
+	{
+		nv_operation_counts.cache_misses++;
+	}
+	return line;
+}
+
+/** Load a sector into the write cache, evicting the least recently used
+  * line in its set if necessary.
+  * \param out_line On success, the cache line which holds the sector will
+  *                 be written here.
+  * \param tag Cache tag (see #GLOBAL_CACHE_TAG) of the sector to load.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn loadCacheLine(NVCacheLine **out_line, uint32_t tag)
+{
+	NVCacheLine *line;
+	NVCacheLine *victim;
+	unsigned int way;
+	NonVolatileReturn r;
+
+	line = lookupCacheLine(tag);
+	if (line == NULL)
+	{
+		// Not in cache. Prefer an empty line; otherwise evict the least
+		// recently used line.
+		victim = &(nv_cache[tag % NV_CACHE_SETS][0]);
+		for (way = 0; way < NV_CACHE_WAYS; way++)
+		{
+			line = &(nv_cache[tag % NV_CACHE_SETS][way]);
+			if (!line->valid)
+			{
+				victim = line;
+				break;
+			}
+			if ((int32_t)(line->last_used - victim->last_used) < 0)
+			{
+				victim = line;
+			}
+		}
+		if (victim->valid && victim->dirty)
+		{
+			nv_operation_counts.dirty_evictions++;
+			r = writeBackUpTo(victim);
+			if (r != NV_NO_ERROR)
+			{
+				return r;
+			}
+		}
+		line = victim;
+		line->valid = true;
+		line->dirty = false;
+		line->tag = tag;
+		line->last_used = cache_clock++;
+		readSector(line->contents, tag, 0, SECTOR_SIZE);
+	}
+	*out_line = line;
+	return NV_NO_ERROR;
 }
 
 /** Write to non-volatile storage. All platform-independent code assumes that
@@ -116,41 +966,72 @@ static NonVolatileReturn checkAndTweakAddress(uint32_t *address, NVPartitions pa
   */
 extern NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
 {
-	uint32_t address_tag;
-	uint32_t end; // exclusive
-	uint32_t data_index;
+	uint32_t tag;
+	uint32_t offset;
+	uint32_t chunk_length;
+	uint32_t chunk_address;
+	uint32_t remaining;
+	NVCacheLine *line;
 	NonVolatileReturn r;
 
-    r = checkAndTweakAddress(&address, partition, length);
-    if (r != NV_NO_ERROR)
-    {
-        return r;
-    }
+	r = checkAddress(address, partition, length);
+	if (r != NV_NO_ERROR)
+	{
+		return r;
+	}
+	if ((partition == PARTITION_ACCOUNTS) && !log_mounted)
+	{
+		r = mountLog();
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+	}
+
+	// Load every sector the write touches before modifying any of them. Any
+	// eviction will then commit only what was there before this write, so
+	// that (as long as the write touches no more than #NV_CACHE_WAYS
+	// sectors) a wallet record which straddles a logical sector boundary
+	// can't be committed half-written.
+	chunk_address = address;
+	remaining = length;
+	while (remaining > 0)
+	{
+		chunk_length = MIN(remaining, locateAddress(&tag, &offset, partition, chunk_address));
+		r = loadCacheLine(&line, tag);
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+		chunk_address += chunk_length;
+		remaining -= chunk_length;
+	}
 
-	end = address + length;
-	data_index = 0;
-	while (address < end)
+	while (length > 0)
 	{
-		address_tag = address & SECTOR_TAG_MASK;
-		if (!write_cache_valid || (address_tag != write_cache_tag))
+		chunk_length = MIN(length, locateAddress(&tag, &offset, partition, address));
+		// The sector was loaded above, so this doesn't count as another
+		// cache access. It can only be missing if the write touches more
+		// sectors than there are ways in a set.
+		line = findCacheLine(tag);
+		if (line == NULL)
 		{
-			// Address is not in cache; load sector into cache.
-			if (write_cache_valid)
+			r = loadCacheLine(&line, tag);
+			if (r != NV_NO_ERROR)
 			{
-				r = nonVolatileFlush();
-				if (r != NV_NO_ERROR)
-				{
-					return r;
-				}
+				return r;
 			}
-			write_cache_valid = true;
-			write_cache_tag = address_tag;
-			sst25xRead(write_cache, address_tag, SECTOR_SIZE);
 		}
-		// Address is guaranteed to be in cache; write to the cache.
-		write_cache[address & SECTOR_OFFSET_MASK] = data[data_index];
-		address++;
-		data_index++;
+		// Sector is guaranteed to be in cache; write to the cache.
+		if (!line->dirty)
+		{
+			line->dirty = true;
+			line->dirty_since = dirty_clock++;
+		}
+		memcpy(&(line->contents[offset]), data, chunk_length);
+		data += chunk_length;
+		address += chunk_length;
+		length -= chunk_length;
 	}
 	return NV_NO_ERROR;
 }
@@ -165,97 +1046,73 @@ extern NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition,
   */
 extern NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
 {
-	uint32_t address_tag;
-	uint32_t end; // exclusive
-	uint32_t nv_read_length; // length of contiguous non-volatile read
-	uint32_t data_index;
-    NonVolatileReturn r;
-
-	r = checkAndTweakAddress(&address, partition, length);
-    if (r != NV_NO_ERROR)
-    {
-        return r;
-    }
-
-	end = address + length;
-	nv_read_length = 0;
-	data_index = 0;
-	// The code below attempts to group non-volatile reads together. It is
+	uint32_t tag;
+	uint32_t offset;
+	uint32_t chunk_length;
+	NVCacheLine *line;
+	NonVolatileReturn r;
+
+	r = checkAddress(address, partition, length);
+	if (r != NV_NO_ERROR)
+	{
+		return r;
+	}
+	if ((partition == PARTITION_ACCOUNTS) && !log_mounted)
+	{
+		r = mountLog();
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+	}
+
+	// Reads are done in chunks which each lie within a single sector. It is
 	// possible (and simpler) to read one byte at a time, but that is much less
 	// efficient. For example, in SST25x serial flash memory chips, reading a
 	// byte at a time is about 5 times slower (per byte) than reading a large
 	// array of bytes in a single command.
 	// Since reads are expected to occur much more frequently than writes,
 	// inefficient reading will incur a significant performance penalty.
-	while (address < end)
+	while (length > 0)
 	{
-		address_tag = address & SECTOR_TAG_MASK;
-		if (write_cache_valid && (address_tag == write_cache_tag))
+		chunk_length = MIN(length, locateAddress(&tag, &offset, partition, address));
+		line = lookupCacheLine(tag);
+		if (line != NULL)
 		{
-			if (nv_read_length > 0)
-			{
-				// Beginning of write cache; end of contiguous non-volatile
-				// read.
-				sst25xRead(&(data[data_index]), address - nv_read_length, nv_read_length);
-				data_index += nv_read_length;
-				nv_read_length = 0;
-			}
-			// Address is in cache; read from the cache.
-			data[data_index] = write_cache[address & SECTOR_OFFSET_MASK];
-			data_index++;
+			// Sector is in cache; read from the cache.
+			memcpy(data, &(line->contents[offset]), chunk_length);
 		}
 		else
 		{
-			// Don't read just yet; queue it up and do all the reads together.
-			nv_read_length++;
+			readSector(data, tag, offset, chunk_length);
 		}
-		address++;
-	}
-	if (nv_read_length > 0)
-	{
-		// End of contiguous non-volatile read.
-		sst25xRead(&(data[data_index]), address - nv_read_length, nv_read_length);
+		data += chunk_length;
+		address += chunk_length;
+		length -= chunk_length;
 	}
 	return NV_NO_ERROR;
 }
 
 /** Ensure that all buffered writes are committed to non-volatile storage.
+  * Dirty sectors are written in the order that they became dirty.
   * \return See #NonVolatileReturnEnum for return values.
   */
 NonVolatileReturn nonVolatileFlush(void)
 {
-	unsigned int i;
-	uint8_t read_buffer[SECTOR_SIZE];
-
-	if (write_cache_valid)
-	{
-		if (write_cache_tag >= NV_MEMORY_SIZE)
-		{
-			return NV_INVALID_ADDRESS;
-		}
-
-		// Erase sector and verify erase.
-		sst25xEraseSector(write_cache_tag);
-		sst25xRead(read_buffer, write_cache_tag, SECTOR_SIZE);
-		for (i = 0; i < SECTOR_SIZE; i++)
-		{
-			if (read_buffer[i] != 0xff)
-			{
-				return NV_IO_ERROR; // erase did not complete properly
-			}
-		}
+	return writeBackUpTo(NULL);
+}
 
-		// Program sector and verify program.
-		sst25xProgramSector(write_cache, write_cache_tag);
-		sst25xRead(read_buffer, write_cache_tag, SECTOR_SIZE);
-		if (memcmp(read_buffer, write_cache, SECTOR_SIZE))
-		{
-			return NV_IO_ERROR; // program did not complete properly
-		}
+/** Get counts of non-volatile memory operations since reset (or since the
+  * last call to clearNVOperationCounts()). This is useful for profiling.
+  * \param out The counts will be written here.
+  */
+void getNVOperationCounts(NVOperationCounts *out)
+{
+	memcpy(out, &nv_operation_counts, sizeof(NVOperationCounts));
+}
 
-		write_cache_valid = false;
-		write_cache_tag = 0;
-		memset(write_cache, 0, sizeof(write_cache));
-	}
-	return NV_NO_ERROR;
+/** Reset all counts of non-volatile memory operations to 0. */
+void clearNVOperationCounts(void)
+{
+	memset(&nv_operation_counts, 0, sizeof(NVOperationCounts));
 }
@@ -0,0 +1,38 @@
+/** \file nvmem_manager.h
+  *
+  * \brief Describes types and functions exported by nvmem_manager.c.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef PIC32_NVMEM_MANAGER_H
+#define	PIC32_NVMEM_MANAGER_H
+
+#include <stdint.h>
+
+/** Counts of non-volatile memory operations, for profiling. All counts
+  * start at 0 on reset and can be cleared using clearNVOperationCounts(). */
+typedef struct NVOperationCountsStruct
+{
+	/** Number of read commands issued to the flash memory. This includes
+	  * reads done to verify erase/program operations. */
+	uint32_t flash_reads;
+	/** Number of sector erase operations. */
+	uint32_t flash_erases;
+	/** Number of sector program operations. */
+	uint32_t flash_programs;
+	/** Number of sector-sized chunks of nonVolatileRead() or
+	  * nonVolatileWrite() calls which were found in the cache. */
+	uint32_t cache_hits;
+	/** Number of sector-sized chunks of nonVolatileRead() or
+	  * nonVolatileWrite() calls which were not found in the cache. */
+	uint32_t cache_misses;
+	/** Number of times a dirty cache line had to be written back to make
+	  * space for another sector. */
+	uint32_t dirty_evictions;
+} NVOperationCounts;
+
+extern void getNVOperationCounts(NVOperationCounts *out);
+extern void clearNVOperationCounts(void);
+
+#endif	// #ifndef PIC32_NVMEM_MANAGER_H
@@ -3,13 +3,16 @@
   * \brief Miscellaneous PIC32-related system functions
   *
   * Note that this does use the Timer2 peripheral. See enterIdleMode() for
-  * reasons why.
+  * reasons why. Timer2 interrupts also ensure that the idle task (see
+  * setIdleTask()) is run regularly while the CPU is waiting for data from
+  * the host.
   *
   * This file is licensed as described by the file LICENCE.
   */
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <p32xxxx.h>
 #include "pic32_system.h"
 
@@ -48,6 +51,10 @@ static uint32_t timer2_interrupt_counter;
   * the CPU is allowed to enter idle mode. */
 static bool idle_mode_suppressed;
 
+/** Function which enterIdleMode() will call before entering idle mode, or
+  * NULL if there is no such function. See setIdleTask(). */
+static void (*idle_task)(void);
+
 /** Disable interrupts.
   * \return Saved value of Status CP0 register, to pass to restoreInterrupts().
   */
@@ -90,6 +97,22 @@ void __attribute__((nomips16)) delayCycles(uint32_t num_cycles)
 	} while ((current_count - start_count) < num_cycles);
 }
 
+/** Get the current value of a free-running cycle counter. This is useful for
+  * measuring how long something takes; subtract two values to get the
+  * number of cycles between them. The counter wraps around roughly every
+  * minute, so it can't be used to measure longer intervals.
+  * \return The cycle counter value. This will always be even, because the
+  *         underlying counter is incremented every 2 CPU cycles.
+  */
+uint32_t __attribute__((nomips16)) getCycleCount(void)
+{
+	uint32_t count;
+
+	// Use Count register ($9) to count cycles.
+	asm volatile("mfc0 %0, $9" : "=r"(count));
+	return count << 1;
+}
+
 /** Delay for at least the specified number of cycles. This is not as precise
   * as delayCycles(), but it consumes less power because the CPU is placed in
   * idle mode while delaying.
@@ -166,6 +189,35 @@ void suppressIdleMode(bool do_suppress)
 	idle_mode_suppressed = do_suppress;
 }
 
+/** Set a function which will be called whenever the CPU is waiting for
+  * data from the host (see runIdleTask()). This allows background work to be
+  * done while the main loop is waiting for the next packet. Because Timer2
+  * interrupts wake the CPU from idle mode about every 0.5 ms, the function
+  * will be called at least that often while waiting.
+  *
+  * The function should do a small amount of work and then return, since
+  * receiving the host's data is delayed until it does.
+  * \param task The function to call, or NULL to not call anything.
+  */
+void setIdleTask(void (*task)(void))
+{
+	idle_task = task;
+}
+
+/** Call the idle task (see setIdleTask()), if there is one. This should
+  * only be called while waiting for data from the host, just before calling
+  * enterIdleMode(). enterIdleMode() doesn't call it, because its other
+  * callers (eg. delayCyclesAndIdle() while debouncing buttons, or writers
+  * waiting for space in a FIFO) expect to resume as soon as possible.
+  */
+void runIdleTask(void)
+{
+	if (idle_task != NULL)
+	{
+		idle_task();
+	}
+}
+
 /** Interrupt service handler for Timer2. See enterIdleMode() for
   * justification as to why a serial FIFO implementation needs a timer. */
 void __attribute__((vector(_TIMER_2_VECTOR), interrupt(ipl2), nomips16)) _Timer2Handler(void)
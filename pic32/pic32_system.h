@@ -26,10 +26,13 @@
 
 extern uint32_t __attribute__((nomips16)) disableInterrupts(void);
 extern void __attribute__((nomips16)) restoreInterrupts(uint32_t status);
+extern uint32_t __attribute__((nomips16)) getCycleCount(void);
 extern void __attribute__((nomips16)) delayCycles(uint32_t num_cycles);
 extern void __attribute__((nomips16)) delayCyclesAndIdle(uint32_t num_cycles);
 extern void __attribute__((nomips16)) enterIdleMode(void);
 extern void suppressIdleMode(bool do_suppress);
+extern void setIdleTask(void (*task)(void));
+extern void runIdleTask(void);
 extern void pic32SystemInit(void);
 extern void usbActivityLED(void);
 
@@ -147,3 +147,174 @@ void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_
 	buffer->remaining++;
 	restoreInterrupts(status);
 }
+
+/** Get the contiguous region of a circular buffer which can be read without
+  * wrapping around. The region starts at the oldest byte in the buffer. The
+  * caller can read the region directly (e.g. using memcpy() or DMA), then
+  * remove the bytes from the buffer using circularBufferCommitRead().
+  *
+  * Since the producer only ever adds bytes, the region can only grow between
+  * this call and the commit. The region is guaranteed to remain valid until
+  * the commit, provided that there is only one consumer.
+  * \param buffer The circular buffer to examine.
+  * \param out_span A pointer to the start of the region will be written
+  *                 here.
+  * \return The length, in bytes, of the region. This will be 0 if the buffer
+  *         is empty.
+  */
+uint32_t circularBufferReadSpan(volatile CircularBuffer *buffer, volatile uint8_t **out_span)
+{
+	uint32_t status;
+	uint32_t next;
+	uint32_t length;
+
+	status = disableInterrupts();
+	next = buffer->next;
+	length = buffer->remaining;
+	restoreInterrupts(status);
+	if (length > (buffer->size - next))
+	{
+		length = buffer->size - next;
+	}
+	*out_span = &(buffer->storage[next]);
+	return length;
+}
+
+/** Remove bytes from a circular buffer after they have been read from the
+  * region returned by circularBufferReadSpan().
+  * \param buffer The circular buffer to remove bytes from.
+  * \param length The number of bytes to remove. This must not be greater
+  *               than the length returned by circularBufferReadSpan().
+  */
+void circularBufferCommitRead(volatile CircularBuffer *buffer, uint32_t length)
+{
+	uint32_t status;
+
+	status = disableInterrupts();
+	buffer->next = (buffer->next + length) & (buffer->size - 1);
+	buffer->remaining -= length;
+	restoreInterrupts(status);
+}
+
+/** Get the contiguous region of a circular buffer which can be written
+  * without wrapping around. The region starts just after the newest byte in
+  * the buffer. The caller can fill the region directly (e.g. using memcpy()
+  * or DMA), then add the bytes to the buffer using
+  * circularBufferCommitWrite().
+  *
+  * Since the consumer only ever removes bytes, the region can only grow
+  * between this call and the commit. The region is guaranteed to remain
+  * valid until the commit, provided that there is only one producer.
+  * \param buffer The circular buffer to examine.
+  * \param out_span A pointer to the start of the region will be written
+  *                 here.
+  * \return The length, in bytes, of the region. This will be 0 if the buffer
+  *         is full.
+  */
+uint32_t circularBufferWriteSpan(volatile CircularBuffer *buffer, volatile uint8_t **out_span)
+{
+	uint32_t status;
+	uint32_t index;
+	uint32_t length;
+
+	status = disableInterrupts();
+	index = (buffer->next + buffer->remaining) & (buffer->size - 1);
+	length = buffer->size - buffer->remaining;
+	restoreInterrupts(status);
+	if (length > (buffer->size - index))
+	{
+		length = buffer->size - index;
+	}
+	*out_span = &(buffer->storage[index]);
+	return length;
+}
+
+/** Add bytes to a circular buffer after they have been written into the
+  * region returned by circularBufferWriteSpan().
+  * \param buffer The circular buffer to add bytes to.
+  * \param length The number of bytes to add. This must not be greater
+  *               than the length returned by circularBufferWriteSpan().
+  */
+void circularBufferCommitWrite(volatile CircularBuffer *buffer, uint32_t length)
+{
+	uint32_t status;
+
+	status = disableInterrupts();
+	buffer->remaining += length;
+	restoreInterrupts(status);
+}
+
+/** Read as many bytes as are available (up to a limit) from a circular
+  * buffer, copying them in contiguous blocks. Unlike circularBufferRead(),
+  * this will not block; it may read fewer bytes than requested, including
+  * none at all. The bytes are copied out of at most two spans (see
+  * circularBufferReadSpan()).
+  * \param buffer The circular buffer to read from.
+  * \param out The bytes that were read will be written here. This must
+  *            have space for length bytes.
+  * \param length The maximum number of bytes to read.
+  * \return The number of bytes that were actually read.
+  */
+uint32_t circularBufferReadBlock(volatile CircularBuffer *buffer, uint8_t *out, uint32_t length)
+{
+	volatile uint8_t *span;
+	uint32_t total;
+	uint32_t chunk;
+
+	// Usually two spans are enough: one up to the end of the storage array,
+	// and one after wrapping around.
+	total = 0;
+	while (total < length)
+	{
+		chunk = circularBufferReadSpan(buffer, &span);
+		if (chunk == 0)
+		{
+			break;
+		}
+		if (chunk > (length - total))
+		{
+			chunk = length - total;
+		}
+		memcpy(&(out[total]), (const void *)span, chunk);
+		circularBufferCommitRead(buffer, chunk);
+		total += chunk;
+	}
+	return total;
+}
+
+/** Write as many bytes as will fit (up to a limit) into a circular buffer,
+  * copying them in contiguous blocks. Unlike circularBufferWrite(), this
+  * will not block; it may write fewer bytes than requested, including none
+  * at all. The bytes are copied into at most two spans (see
+  * circularBufferWriteSpan()).
+  * \param buffer The circular buffer to write to.
+  * \param data The bytes to write.
+  * \param length The maximum number of bytes to write.
+  * \return The number of bytes that were actually written.
+  */
+uint32_t circularBufferWriteBlock(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length)
+{
+	volatile uint8_t *span;
+	uint32_t total;
+	uint32_t chunk;
+
+	// Usually two spans are enough: one up to the end of the storage array,
+	// and one after wrapping around.
+	total = 0;
+	while (total < length)
+	{
+		chunk = circularBufferWriteSpan(buffer, &span);
+		if (chunk == 0)
+		{
+			break;
+		}
+		if (chunk > (length - total))
+		{
+			chunk = length - total;
+		}
+		memcpy((void *)span, &(data[total]), chunk);
+		circularBufferCommitWrite(buffer, chunk);
+		total += chunk;
+	}
+	return total;
+}
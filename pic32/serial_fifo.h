@@ -31,5 +31,11 @@ extern bool isCircularBufferFull(volatile CircularBuffer *buffer);
 extern uint32_t circularBufferSpaceRemaining(volatile CircularBuffer *buffer);
 extern uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq);
 extern void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_irq);
+extern uint32_t circularBufferReadSpan(volatile CircularBuffer *buffer, volatile uint8_t **out_span);
+extern void circularBufferCommitRead(volatile CircularBuffer *buffer, uint32_t length);
+extern uint32_t circularBufferWriteSpan(volatile CircularBuffer *buffer, volatile uint8_t **out_span);
+extern void circularBufferCommitWrite(volatile CircularBuffer *buffer, uint32_t length);
+extern uint32_t circularBufferReadBlock(volatile CircularBuffer *buffer, uint8_t *out, uint32_t length);
+extern uint32_t circularBufferWriteBlock(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length);
 
 #endif // #ifndef SERIAL_FIFO_H_INCLUDED
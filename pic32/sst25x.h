@@ -16,21 +16,42 @@
   *          be invalid.
   */
 #define SECTOR_SIZE             4096
-/** Total number of bytes in non-volatile storage.
-  * This has been temporarily reduced to the size of the wallet storage area.
-  * It will be increased back to the real value when storage partitioning is
-  * implemented.
+/** Total number of bytes in non-volatile storage. This is the size of the
+  * SST25VF080B.
   * \warning This must be much smaller than 2 ^ 32 or some overflow checks
   *          in nvmem_manager.c won't work.
   */
-#define NV_MEMORY_SIZE          4096
+#define NV_MEMORY_SIZE          1048576
 /** Size of global partition, in bytes. This is large enough to reduce wear
-  * (due to DRBG state writes) by a factor of at least 10, but only reduces
-  * maximum number of simultaneous accounts by about 25%. */
+  * (due to DRBG state writes) by a factor of at least 10. The global
+  * partition lives in the first sector of non-volatile storage.
+  * \warning This must not be larger than #SECTOR_SIZE.
+  */
 #define GLOBAL_PARTITION_SIZE   1024
-/** Size of accounts partition, in bytes. This is
-  * just #NV_MEMORY_SIZE - #GLOBAL_PARTITION_SIZE. */
-#define ACCOUNTS_PARTITION_SIZE 3072
+/** Number of bytes at the end of every sector in the accounts log area which
+  * are reserved for the log footer (see nvmem_manager.c). */
+#define LOG_FOOTER_SIZE         32
+/** Number of bytes of accounts partition data stored in each sector of the
+  * accounts log area. This is a multiple of 16 so that XEX blocks never
+  * straddle sectors. Wallet records may straddle sectors; that is safe
+  * because all logical sectors which are flushed together are committed
+  * together (see nvmem_manager.c). */
+#define LOG_DATA_SIZE           (SECTOR_SIZE - LOG_FOOTER_SIZE)
+/** Number of logical sectors which make up the accounts partition. */
+#define LOG_LOGICAL_SECTORS     4
+/** Size of accounts partition, in bytes. */
+#define ACCOUNTS_PARTITION_SIZE (LOG_LOGICAL_SECTORS * LOG_DATA_SIZE)
+/** Address of the first sector of the accounts log area. This comes
+  * immediately after the sector used by the global partition. */
+#define LOG_START_ADDRESS       SECTOR_SIZE
+/** Number of physical sectors in the accounts log area. Writes to the
+  * accounts partition are spread over all of these, so making this larger
+  * reduces wear.
+  * \warning This must be at least twice #LOG_LOGICAL_SECTORS, since the old
+  *          generation of logical sectors is only erased once a complete new
+  *          generation has been written.
+  */
+#define LOG_PHYSICAL_SECTORS    64
 
 extern void initSST25x(void);
 extern uint8_t sst25xReadStatusRegister(void);
@@ -80,6 +80,10 @@ static char *packetCommandToText(int command)
 		return "DeleteWallet";
 	case 0x17:
 		return "Initialize";
+	case 0x18:
+		return "SignTransactionBatch";
+	case 0x19:
+		return "SignPsbt";
 	case 0x30:
 		return "Address";
 	case 0x31:
@@ -102,6 +106,8 @@ static char *packetCommandToText(int command)
 		return "Signature";
 	case 0x3a:
 		return "Features";
+	case 0x3b:
+		return "Signatures";
 	case 0x50:
 		return "ButtonRequest";
 	case 0x51:
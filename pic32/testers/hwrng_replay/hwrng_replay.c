@@ -0,0 +1,503 @@
+// ***********************************************************************
+// hwrng_replay.c
+// ***********************************************************************
+//
+// Run the PIC32 hardware random number generator (HWRNG) statistical tests
+// on the host, using ADC samples read from a file instead of from the ADC.
+// This makes it possible to tune the limits in ../../hwrng_limits.h, or
+// to work on the performance of statistics.c and fft.c, using large
+// collections of recorded (or synthetic) ADC traces.
+//
+// To make sure that exactly the same code is run as on the device,
+// ../../hwrng.c is included directly and the hardware it touches (the ADC
+// and a few special function registers) is replaced by stubs. Each "window"
+// is one sample set, as prepared by hwrngBackgroundTask(). Windows are
+// taken from the file back-to-back, just like they would be taken from the
+// ADC. If a window is abandoned early (see fftEarlyTestsFailed()), the next
+// window starts after the samples that were used.
+//
+// Input files consist of raw 10 bit ADC samples, each stored as a 16 bit
+// little-endian integer. They are memory-mapped, so they can be much
+// larger than RAM. This program can also generate synthetic files
+// containing Gaussian white noise, and benchmark the FIR decimation filter
+// in hwrng.c against the direct-form filter it replaced.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../hwrng.c"
+
+// Number of ADC samples in one window (a full sample set).
+#define ADC_SAMPLES_PER_WINDOW	(SAMPLE_COUNT * OVERSAMPLE_RATIO)
+// Maximum value of an ADC sample.
+#define MAX_ADC_VALUE			(HISTOGRAM_NUM_BINS - 1)
+// Number of random ADC buffers on which firDecimate() is checked against
+// the reference filter.
+#define FILTER_CHECK_ROUNDS		1000
+// Number of ADC buffers filtered when timing each filter implementation.
+#define FILTER_BENCHMARK_ROUNDS	20000
+
+// Stand-ins for special function registers used by hwrng.c.
+volatile unsigned int PORTDSET;
+volatile unsigned int PORTDCLR;
+
+// Stand-in for the buffers that the PIC32's DMA controller fills.
+volatile uint16_t adc_sample_buffers[ADC_NUM_SAMPLE_BUFFERS][ADC_SAMPLE_BUFFER_SIZE];
+
+// Contents of the memory-mapped input file.
+static const uint8_t *replay_data;
+// Number of ADC samples in the input file.
+static size_t replay_num_samples;
+// Index of the next ADC sample that beginFillingADCBuffer() will use.
+static size_t replay_position;
+
+// Stub for the ADC driver. Instead of starting a DMA transfer, this copies
+// the next ADC_SAMPLE_BUFFER_SIZE samples from the input file.
+// If there aren't enough samples left, the buffer is filled with mid-scale
+// values; replayFile() makes sure this doesn't happen in a window that it
+// reports on.
+void beginFillingADCBuffer(unsigned int buffer_index)
+{
+	unsigned int i;
+	uint16_t sample;
+
+	for (i = 0; i < ADC_SAMPLE_BUFFER_SIZE; i++)
+	{
+		if (replay_position < replay_num_samples)
+		{
+			sample = (uint16_t)(replay_data[replay_position * 2]
+				| (replay_data[replay_position * 2 + 1] << 8));
+			replay_position++;
+		}
+		else
+		{
+			sample = HISTOGRAM_NUM_BINS / 2;
+		}
+		if (sample > MAX_ADC_VALUE)
+		{
+			sample = MAX_ADC_VALUE;
+		}
+		adc_sample_buffers[buffer_index][i] = sample;
+	}
+}
+
+// Stub for the ADC driver. beginFillingADCBuffer() fills buffers instantly.
+bool isADCBufferFull(void)
+{
+	return true;
+}
+
+// Stub for the PIC32 system functions. There's no idle mode on the host.
+void suppressIdleMode(bool do_suppress)
+{
+	(void)do_suppress;
+}
+
+// Stub for the PIC32 system functions. There's no need to wait on the host.
+void delayCycles(uint32_t num_cycles)
+{
+	(void)num_cycles;
+}
+
+// Get a monotonic time, in microseconds.
+static double getMicroseconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec * 1000000.0 + (double)now.tv_nsec / 1000.0;
+}
+
+// Convert a fixed-point number to a double.
+static double fix16ToDouble(fix16_t value)
+{
+	return (double)value / 65536.0;
+}
+
+// Get a normally distributed random number with mean 0 and standard
+// deviation 1, using the Box-Muller transform.
+static double gaussianRandom(void)
+{
+	double u1;
+	double u2;
+
+	u1 = ((double)rand() + 1.0) / ((double)RAND_MAX + 2.0);
+	u2 = ((double)rand() + 1.0) / ((double)RAND_MAX + 2.0);
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+// Write a file of synthetic ADC samples consisting of Gaussian white noise,
+// clipped to the range of the ADC. Returns 0 on success, non-zero on failure.
+static int generateFile(const char *filename, long num_samples, double mean, double std_dev)
+{
+	FILE *f;
+	long i;
+	double value;
+	uint16_t sample;
+
+	f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		printf("Could not open \"%s\" for writing\n", filename);
+		return 1;
+	}
+	srand(42); // so that generated files are reproducible
+	for (i = 0; i < num_samples; i++)
+	{
+		value = floor(mean + std_dev * gaussianRandom() + 0.5);
+		if (value < 0.0)
+		{
+			value = 0.0;
+		}
+		if (value > MAX_ADC_VALUE)
+		{
+			value = MAX_ADC_VALUE;
+		}
+		sample = (uint16_t)value;
+		fputc(sample & 0xff, f);
+		fputc(sample >> 8, f);
+	}
+	fclose(f);
+	printf("Wrote %ld samples to \"%s\"\n", num_samples, filename);
+	return 0;
+}
+
+// This is the direct-form FIR filter which hwrng.c used before firDecimate()
+// was introduced. It computes one output sample as a dot product, wrapping
+// the circular buffer index on every tap. It's kept here so that
+// firDecimate() can be checked and benchmarked against it.
+static int32_t referenceFirFilter(const volatile uint16_t *samples, const unsigned int base_index, const int32_t *coefficients, const unsigned int order)
+{
+	int32_t sum; // Q16.16 fixed-point representation
+	unsigned int i;
+	unsigned int index;
+
+	sum = 0;
+	for (i = 0; i < order; i++)
+	{
+		index = (base_index + i) & (ADC_SAMPLE_BUFFER_SIZE - 1);
+		sum += ((int32_t)samples[index]) * coefficients[i];
+	}
+	return (sum >> 16) + ((sum >> 15) & 1); // round result
+}
+
+// Filter and decimate one ADC buffer using referenceFirFilter(), in the same
+// way that hwrng.c used to.
+static void referenceFirDecimate(const volatile uint16_t *in, volatile uint16_t *out)
+{
+	unsigned int j;
+	unsigned int base_index;
+
+	for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j++)
+	{
+		base_index = ((j * OVERSAMPLE_RATIO) - FILTER_HALF_ORDER) & (ADC_SAMPLE_BUFFER_SIZE - 1);
+		out[j] = (uint16_t)referenceFirFilter(in, base_index, fir_lowpass_coefficients, FILTER_ORDER);
+	}
+}
+
+// Get a time stamp counter value, for measuring cycles. Returns 0 if the
+// host doesn't have an accessible cycle counter.
+static uint64_t readTimeStampCounter(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Time one of the decimating filters, returning the average number of
+// nanoseconds (and, through out_cycles, time stamp counter cycles) per
+// output sample.
+static double timeFilter(void (*filter)(const volatile uint16_t *, volatile uint16_t *), volatile uint16_t *out, double *out_cycles)
+{
+	unsigned int i;
+	double start_time;
+	double elapsed;
+	uint64_t start_cycles;
+	uint64_t cycles;
+
+	start_time = getMicroseconds();
+	start_cycles = readTimeStampCounter();
+	for (i = 0; i < FILTER_BENCHMARK_ROUNDS; i++)
+	{
+		filter(adc_sample_buffers[i & 1], out);
+	}
+	cycles = readTimeStampCounter() - start_cycles;
+	elapsed = getMicroseconds() - start_time;
+	*out_cycles = (double)cycles / ((double)FILTER_BENCHMARK_ROUNDS * DECIMATED_SAMPLE_BUFFER_SIZE);
+	return elapsed * 1000.0 / ((double)FILTER_BENCHMARK_ROUNDS * DECIMATED_SAMPLE_BUFFER_SIZE);
+}
+
+// Check firDecimate() against referenceFirDecimate() on random ADC buffers,
+// then compare their speed. Returns 0 if the outputs matched, non-zero if
+// they didn't.
+static int benchmarkFilter(void)
+{
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	unsigned int mismatches;
+	double new_ns;
+	double new_cycles;
+	double old_ns;
+	double old_cycles;
+	static volatile uint16_t reference_out[DECIMATED_SAMPLE_BUFFER_SIZE];
+	static volatile uint16_t polyphase_out[DECIMATED_SAMPLE_BUFFER_SIZE];
+
+	srand(42);
+	mismatches = 0;
+	for (i = 0; i < FILTER_CHECK_ROUNDS; i++)
+	{
+		for (j = 0; j < ADC_NUM_SAMPLE_BUFFERS; j++)
+		{
+			for (k = 0; k < ADC_SAMPLE_BUFFER_SIZE; k++)
+			{
+				adc_sample_buffers[j][k] = (uint16_t)(rand() % HISTOGRAM_NUM_BINS);
+			}
+		}
+		referenceFirDecimate(adc_sample_buffers[0], reference_out);
+		firDecimate(adc_sample_buffers[0], polyphase_out);
+		for (k = 0; k < DECIMATED_SAMPLE_BUFFER_SIZE; k++)
+		{
+			if (reference_out[k] != polyphase_out[k])
+			{
+				mismatches++;
+			}
+		}
+	}
+	printf("Checked %u buffers: %u mismatched output samples\n", FILTER_CHECK_ROUNDS, mismatches);
+
+	old_ns = timeFilter(referenceFirDecimate, reference_out, &old_cycles);
+	new_ns = timeFilter(firDecimate, polyphase_out, &new_cycles);
+	printf("Direct-form FIR: %.2f ns, %.1f cycles per output sample\n", old_ns, old_cycles);
+	printf("Polyphase FIR:   %.2f ns, %.1f cycles per output sample\n", new_ns, new_cycles);
+	if (mismatches != 0)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+// Print the statistical properties of the window which was just prepared.
+// These are recalculated from the histogram and power spectral density
+// estimate, which hwrng.c leaves alone until the next window is started. The
+// properties are converted back into ADC units so that they can be compared
+// against the limits in hwrng_limits.h.
+static void printProperties(void)
+{
+	fix16_t mean;
+	fix16_t variance;
+	fix16_t kappa3;
+	fix16_t kappa4;
+	fix16_t entropy_estimate;
+	double v;
+	int bandwidth;
+	int max_bin;
+
+	calculateMoments(&mean, &variance, &kappa3, &kappa4);
+	entropy_estimate = estimateEntropy();
+	bandwidth = estimateBandwidth(&max_bin);
+	v = fix16ToDouble(variance);
+	printf("%.3f, ", fix16ToDouble(mean) * SAMPLE_SCALE_DOWN + (HISTOGRAM_NUM_BINS / 2));
+	printf("%.3f, ", v * SAMPLE_SCALE_DOWN * SAMPLE_SCALE_DOWN);
+	if (v > 0.0)
+	{
+		printf("%.4f, ", fix16ToDouble(kappa3) / pow(v, 1.5));
+		printf("%.4f, ", fix16ToDouble(kappa4) / (v * v) - 3.0);
+	}
+	else
+	{
+		printf(", , ");
+	}
+	printf("%.4f, ", (double)max_bin / (2.0 * FFT_SIZE));
+	printf("%.4f, ", (double)bandwidth / (2.0 * FFT_SIZE));
+	printf("%.3f, ", fix16ToDouble(entropy_estimate));
+}
+
+// Run the statistical tests on every whole window in the (memory-mapped)
+// input file, printing one line of comma-separated values per window.
+// Returns the number of windows which failed.
+static unsigned long replayFile(void)
+{
+	unsigned int i;
+	unsigned int set;
+	unsigned long window;
+	unsigned long num_failed;
+	size_t start_position;
+	uint32_t tests_failed;
+	bool early;
+	double start_time;
+	double window_time;
+	double total_time;
+	double call_start_time;
+	double call_time;
+	PrepareSteps step;
+	double step_total_time[STEP_FFT_TESTS + 1];
+	double step_longest_time[STEP_FFT_TESTS + 1];
+	unsigned long step_calls[STEP_FFT_TESTS + 1];
+
+	printf("window, first sample, samples used, frames, time (us), mean, "
+		"variance, skewness, kurtosis, peak, bandwidth, entropy, "
+		"tests failed, result\n");
+	window = 0;
+	num_failed = 0;
+	total_time = 0.0;
+	for (i = 0; i <= STEP_FFT_TESTS; i++)
+	{
+		step_total_time[i] = 0.0;
+		step_longest_time[i] = 0.0;
+		step_calls[i] = 0;
+	}
+	while ((replay_num_samples - replay_position) >= ADC_SAMPLES_PER_WINDOW)
+	{
+		start_position = replay_position;
+		start_time = getMicroseconds();
+		// hwrngBackgroundTask() starts preparing a set on the first call,
+		// then does one step per call until the set is ready.
+		hwrngBackgroundTask();
+		set = preparing_set;
+		while (preparing_set != NO_SET)
+		{
+			// Time each call, per step, to see how long a single call can
+			// hold up the firmware's stream I/O.
+			step = prepare_step;
+			call_start_time = getMicroseconds();
+			hwrngBackgroundTask();
+			call_time = getMicroseconds() - call_start_time;
+			step_total_time[step] += call_time;
+			step_calls[step]++;
+			if (call_time > step_longest_time[step])
+			{
+				step_longest_time[step] = call_time;
+			}
+		}
+		window_time = getMicroseconds() - start_time;
+		total_time += window_time;
+		tests_failed = set_tests_failed[set];
+		early = (samples_prepared < SAMPLE_COUNT);
+		// Give the set back, as if hardwareRandom32Bytes() had used it up.
+		set_state[set] = SET_EMPTY;
+
+		printf("%lu, %lu, %lu, %u, %.1f, ", window, (unsigned long)start_position,
+			(unsigned long)(replay_position - start_position),
+			(unsigned int)psd_frames_accumulated, window_time);
+		if (early)
+		{
+			// The histogram only contains part of a window, so its
+			// properties would be meaningless.
+			printf(", , , , , , , ");
+		}
+		else
+		{
+			printProperties();
+		}
+		printf("0x%02x, ", (unsigned int)tests_failed);
+		if (tests_failed == 0)
+		{
+			printf("pass\n");
+		}
+		else if (early)
+		{
+			printf("fail (early)\n");
+			num_failed++;
+		}
+		else
+		{
+			printf("fail\n");
+			num_failed++;
+		}
+		window++;
+	}
+
+	printf("\n%lu windows, %lu passed, %lu failed\n", window, window - num_failed, num_failed);
+	if (window > 0)
+	{
+		printf("Average time per window: %.1f us\n", total_time / (double)window);
+		printf("Throughput: %.0f ADC samples per second\n", (double)replay_position / (total_time / 1000000.0));
+		printf("Time per hwrngBackgroundTask() call, by step (average, longest):\n");
+		for (i = 0; i <= STEP_FFT_TESTS; i++)
+		{
+			if (step_calls[i] != 0)
+			{
+				printf("  step %u: %.1f us, %.1f us\n", i, step_total_time[i] / (double)step_calls[i], step_longest_time[i]);
+			}
+		}
+	}
+	return num_failed;
+}
+
+int main(int argc, char **argv)
+{
+	int fd;
+	struct stat file_stat;
+	void *map;
+	unsigned long num_failed;
+
+	if ((argc == 6) && !strcmp(argv[1], "-g"))
+	{
+		return generateFile(argv[2], atol(argv[3]), atof(argv[4]), atof(argv[5]));
+	}
+	if ((argc == 2) && !strcmp(argv[1], "-b"))
+	{
+		return benchmarkFilter();
+	}
+	if (argc != 2)
+	{
+		printf("Usage: %s <file>\n", argv[0]);
+		printf("       %s -g <file> <num_samples> <mean> <std_dev>\n", argv[0]);
+		printf("       %s -b\n", argv[0]);
+		printf("The first form runs the HWRNG statistical tests on the ADC samples\n");
+		printf("in <file>, %d samples at a time. The second form generates a\n", ADC_SAMPLES_PER_WINDOW);
+		printf("file of Gaussian white noise ADC samples. The third form checks and\n");
+		printf("benchmarks the FIR decimation filter.\n");
+		exit(1);
+	}
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0)
+	{
+		printf("Could not open \"%s\"\n", argv[1]);
+		exit(1);
+	}
+	if (fstat(fd, &file_stat) != 0)
+	{
+		printf("Could not get size of \"%s\"\n", argv[1]);
+		exit(1);
+	}
+	replay_num_samples = (size_t)file_stat.st_size / 2;
+	if (replay_num_samples < ADC_SAMPLES_PER_WINDOW)
+	{
+		printf("\"%s\" is too small; it needs at least %d samples\n", argv[1], ADC_SAMPLES_PER_WINDOW);
+		exit(1);
+	}
+	map = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		printf("Could not memory-map \"%s\"\n", argv[1]);
+		exit(1);
+	}
+	replay_data = (const uint8_t *)map;
+	replay_position = 0;
+
+	num_failed = replayFile();
+
+	munmap(map, (size_t)file_stat.st_size);
+	close(fd);
+	if (num_failed != 0)
+	{
+		exit(1);
+	}
+	exit(0);
+}
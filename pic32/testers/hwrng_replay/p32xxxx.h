@@ -0,0 +1,18 @@
+// ***********************************************************************
+// p32xxxx.h
+// ***********************************************************************
+//
+// Stand-in for the PIC32 device header, so that ../../hwrng.c can be
+// compiled on the host by hwrng_replay.c. Only the special function
+// registers which hwrng.c touches are declared; they are defined in
+// hwrng_replay.c.
+//
+// This file is licensed as described by the file LICENCE.
+
+#ifndef HWRNG_REPLAY_P32XXXX_H_INCLUDED
+#define HWRNG_REPLAY_P32XXXX_H_INCLUDED
+
+extern volatile unsigned int PORTDSET;
+extern volatile unsigned int PORTDCLR;
+
+#endif // #ifndef HWRNG_REPLAY_P32XXXX_H_INCLUDED
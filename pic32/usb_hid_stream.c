@@ -10,7 +10,8 @@
   * done this way to allow "driverless" operation on Windows systems.
   *
   * Here's a high-level overview of what's provided in this file. There is
-  * an implementation of streamGetOneByte() and streamPutOneByte(), which
+  * an implementation of streamGetOneByte() and streamPutOneByte() (and their
+  * block counterparts streamGetBytes() and streamPutBytes()), which
   * read from or write to FIFOs. The interface to USB happens mainly through
   * callbacks, because USB is fundamentally asynchronous from a device's point
   * of view. The nature of asynchronous I/O means that care must be taken to
@@ -162,20 +163,11 @@ static void fillTransmitPacketBufferAndTransmit(void)
 {
 	uint32_t status;
 	uint32_t count;
-	uint32_t i;
 
 	// Put everything in a critical section so that bytes are either in
 	// the transmit FIFO or in interrupt_packet_buffer.
 	status = disableInterrupts();
-	i = 1;
-	while ((i < sizeof(interrupt_packet_buffer)) && !isCircularBufferEmpty(&transmit_fifo))
-	{
-		// Note that is_irq is set because interrupts are disabled; that's
-		// equivalent to an interrupt request handler context.
-		interrupt_packet_buffer[i] = circularBufferRead(&transmit_fifo, true);
-		i++;
-	}
-	count = i - 1;
+	count = circularBufferReadBlock(&transmit_fifo, &(interrupt_packet_buffer[1]), sizeof(interrupt_packet_buffer) - 1);
 	interrupt_packet_buffer[0] = (uint8_t)count;
 	if (count > 0)
 	{
@@ -199,17 +191,12 @@ static void fillTransmitPacketBufferAndTransmit(void)
   */
 static void transferIntoReceiveFIFO(uint8_t *buffer, uint32_t length)
 {
-	uint32_t i;
-
 	if (circularBufferSpaceRemaining(&receive_fifo) < length)
 	{
 		// This should never happen.
 		usbFatalError();
 	}
-	for (i = 0; i < length; i++)
-	{
-		circularBufferWrite(&receive_fifo, buffer[i], true);
-	}
+	circularBufferWriteBlock(&receive_fifo, buffer, length);
 }
 
 /** Remove a byte from the existing queued packet which was intended to be
@@ -647,6 +634,34 @@ void usbHIDStreamInit(void)
 	receive_endpoint_state.transmitCallback = &ep2TransmitCallback;
 }
 
+/** Queue a receive on the appropriate endpoint, if one isn't already queued
+  * and there is enough space in the receive FIFO. This should be called
+  * after bytes are removed from the receive FIFO.
+  * \warning This must be called with interrupts disabled.
+  */
+static void queueReceiveIfSpace(void)
+{
+	// Control transfers take precedence over interrupt transfers, because
+	// a control transfer will block all subsequent control transfers, which
+	// would make device reconfiguration difficult.
+	if (do_control_receive_queue)
+	{
+		if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
+		{
+			do_control_receive_queue = false;
+			usbQueueReceivePacket(CONTROL_ENDPOINT_NUMBER);
+		}
+	}
+	else if (!interrupt_receive_queued)
+	{
+		if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
+		{
+			interrupt_receive_queued = true;
+			usbQueueReceivePacket(RECEIVE_ENDPOINT_NUMBER);
+		}
+	}
+}
+
 /** Grab one byte from the communication stream. There is no way for this
   * function to indicate a read error. This is intentional; it
   * makes program flow simpler (no need to put checks everywhere). As a
@@ -675,31 +690,46 @@ uint8_t streamGetOneByte(void)
 	uint32_t status;
 	uint8_t one_byte;
 
+	while (isCircularBufferEmpty(&receive_fifo))
+	{
+		runIdleTask();
+		enterIdleMode();
+	}
 	one_byte = circularBufferRead(&receive_fifo, false);
 	// It's probably safe to leave interrupts enabled, but just to be sure,
 	// disable them so that no race conditions can occur.
 	status = disableInterrupts();
-	// Control transfers take precedence over interrupt transfers, because
-	// a control transfer will block all subsequent control transfers, which
-	// would make device reconfiguration difficult.
-	if (do_control_receive_queue)
-	{
-		if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
-		{
-			do_control_receive_queue = false;
-			usbQueueReceivePacket(CONTROL_ENDPOINT_NUMBER);
-		}
-	}
-	else if (!interrupt_receive_queued)
+	queueReceiveIfSpace();
+	restoreInterrupts(status);
+	return one_byte;
+}
+
+/** Grab a number of bytes from the communication stream. This has the same
+  * effect as calling streamGetOneByte() length times, but bytes are copied
+  * out of the receive FIFO in blocks, as they become available.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint32_t status;
+	uint32_t count;
+
+	while (length > 0)
 	{
-		if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
+		while (isCircularBufferEmpty(&receive_fifo))
 		{
-			interrupt_receive_queued = true;
-			usbQueueReceivePacket(RECEIVE_ENDPOINT_NUMBER);
+			runIdleTask();
+			enterIdleMode();
 		}
+		status = disableInterrupts();
+		count = circularBufferReadBlock(&receive_fifo, buffer, length);
+		queueReceiveIfSpace();
+		restoreInterrupts(status);
+		buffer += count;
+		length -= count;
 	}
-	restoreInterrupts(status);
-	return one_byte;
 }
 
 /** Send one byte to the communication stream. There is no way for this
@@ -750,3 +780,47 @@ void streamPutOneByte(uint8_t one_byte)
 	}
 	restoreInterrupts(status);
 }
+
+/** Send a number of bytes to the communication stream. This has the same
+  * effect as calling streamPutOneByte() for each byte, but bytes are copied
+  * into the transmit FIFO in blocks, so that full packets can be queued
+  * for transmission.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t status;
+	uint32_t count;
+
+	while (length > 0)
+	{
+		// Ensure that there is space in the transmit FIFO so that some
+		// progress is made below.
+		while (isCircularBufferFull(&transmit_fifo))
+		{
+			enterIdleMode();
+		}
+		// Everything below is in a critical section to avoid race conditions
+		// with the "Get Report" request.
+		status = disableInterrupts();
+		if (do_build_transmit_report)
+		{
+			// The report being built for the control endpoint takes bytes
+			// one at a time, since it may be completed by any one of them.
+			buildTransmitReport(*buffer);
+			count = 1;
+		}
+		else
+		{
+			count = circularBufferWriteBlock(&transmit_fifo, buffer, length);
+		}
+		if (!interrupt_transmit_queued)
+		{
+			fillTransmitPacketBufferAndTransmit();
+		}
+		restoreInterrupts(status);
+		buffer += count;
+		length -= count;
+	}
+}
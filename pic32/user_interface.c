@@ -20,15 +20,14 @@
 /** Maximum number of address/amount pairs that can be stored in RAM waiting
   * for approval from the user. This incidentally sets the maximum
   * number of outputs per transaction that parseTransaction() can deal with.
+  * Each one costs sizeof(#StoredOutput) (29) bytes of RAM.
   */
-#define MAX_OUTPUTS		16
+#define MAX_OUTPUTS		32
 
-/** Storage for the text of transaction output amounts. */
-static char list_amount[MAX_OUTPUTS][TEXT_AMOUNT_LENGTH];
-/** Storage for the text of transaction output addresses. */
-static char list_address[MAX_OUTPUTS][TEXT_ADDRESS_LENGTH];
-/** Index into #list_amount and #list_address which specifies where the next
-  * output amount/address will be copied into. */
+/** Storage for transaction outputs. */
+static StoredOutput list_outputs[MAX_OUTPUTS];
+/** Index into #list_outputs which specifies where the next output will be
+  * copied into. */
 static uint32_t list_index;
 /** Whether the transaction fee has been set. If
   * the transaction fee still hasn't been set after parsing, then the
@@ -39,29 +38,31 @@ static bool transaction_fee_set;
 static char transaction_fee_amount[TEXT_AMOUNT_LENGTH];
 
 /** Notify the user interface that the transaction parser has seen a new
-  * Bitcoin amount/address pair.
-  * \param text_amount The output amount, as a null-terminated text string
-  *                    such as "0.01".
-  * \param text_address The output address, as a null-terminated text string
-  *                     such as "1RaTTuSEN7jJUDiW1EGogHwtek7g9BiEn".
+  * Bitcoin amount/address pair. The amount and address are passed in binary
+  * form, so that the user interface can store them compactly and only
+  * convert them to text (using amountToText() and hashToAddr()) when they
+  * are displayed.
+  * \param amount The output amount, as an 8 byte little-endian
+  *               multi-precision integer (in satoshis).
+  * \param hash The 20 byte hash (public key hash or script hash) which the
+  *             output pays to.
+  * \param address_version The address version byte which identifies the
+  *                        type of hash, for example #ADDRESS_VERSION_PUBKEY.
   * \return false if no error occurred, true if there was not enough space to
   *         store the amount/address pair.
   */
-bool newOutputSeen(char *text_amount, char *text_address)
+bool newOutputSeen(uint8_t *amount, uint8_t *hash, uint8_t address_version)
 {
-	char *amount_dest;
-	char *address_dest;
+	StoredOutput *dest;
 
 	if (list_index >= MAX_OUTPUTS)
 	{
 		return true; // not enough space to store the amount/address pair
 	}
-	amount_dest = list_amount[list_index];
-	address_dest = list_address[list_index];
-	strncpy(amount_dest, text_amount, TEXT_AMOUNT_LENGTH);
-	strncpy(address_dest, text_address, TEXT_ADDRESS_LENGTH);
-	amount_dest[TEXT_AMOUNT_LENGTH - 1] = '\0';
-	address_dest[TEXT_ADDRESS_LENGTH - 1] = '\0';
+	dest = &(list_outputs[list_index]);
+	memcpy(dest->amount, amount, sizeof(dest->amount));
+	dest->address_version = address_version;
+	memcpy(dest->hash, hash, sizeof(dest->hash));
 	list_index++;
 	return false; // success
 }
@@ -142,6 +143,8 @@ bool userDenied(AskUserCommand command)
 {
 	uint8_t i;
 	bool r; // what will be returned
+	char text_amount[TEXT_AMOUNT_LENGTH];
+	char text_address[TEXT_ADDRESS_LENGTH];
 
 	clearDisplay();
 	displayOn();
@@ -168,10 +171,12 @@ bool userDenied(AskUserCommand command)
 		{
 			clearDisplay();
 			waitForNoButtonPress();
+			amountToText(text_amount, list_outputs[i].amount);
+			hashToAddr(text_address, list_outputs[i].hash, list_outputs[i].address_version);
 			writeStringToDisplay("Send ");
-			writeStringToDisplay(list_amount[i]);
+			writeStringToDisplay(text_amount);
 			writeStringToDisplay(" BTC to ");
-			writeStringToDisplay(list_address[i]);
+			writeStringToDisplay(text_address);
 			writeStringToDisplay("?");
 			r = waitForButtonPress();
 			if (r)
@@ -61,6 +61,21 @@ static PointAffine cached_parent_public_key;
 /** Specifies whether the contents of #parent_public_key are valid. */
 static bool cached_parent_public_key_valid;
 
+/** Maximum number of 256 bit values which can be drawn from one random
+  * batch (see beginRandomBatch()) before the batch is automatically renewed.
+  * This bounds how long the persistent entropy pool in non-volatile memory
+  * can go without being updated. */
+#define RANDOM_BATCH_MAX_DRAWS	32
+
+/** Whether a random batch (see beginRandomBatch()) is active. */
+static bool random_batch_active;
+/** The RAM-based entropy pool used by getRandom256() while a random batch is
+  * active. The contents of this variable are only valid if
+  * #random_batch_active is true. */
+static uint8_t random_batch_pool[ENTROPY_POOL_LENGTH];
+/** Number of 256 bit values drawn from the current random batch. */
+static uint8_t random_batch_draws;
+
 #ifdef TEST_PRANDOM
 /** Hack to allow test to access derived chain code. This is needed for the
   * sipa test cases. */
@@ -219,11 +234,132 @@ bool initialiseEntropyPool(uint8_t *initial_pool_state)
 	}
 }
 
+/** Calculate H(in | padding), where "|" is concatenation, H(x) is the
+  * SHA-256 hash of x and padding consists of 32 bytes, each with the
+  * specified value. Different padding values give unrelated outputs, so this
+  * can be used to derive several independent values from one pool state.
+  * \param out The hash will be written here. This must be a byte array with
+  *            space for 32 bytes.
+  * \param in The 32 byte value to hash.
+  * \param padding_byte The value of each padding byte.
+  */
+static void hashWithPadding(uint8_t *out, uint8_t *in, uint8_t padding_byte)
+{
+	HashState hs;
+	uint8_t i;
+
+	sha256Begin(&hs);
+	for (i = 0; i < 32; i++)
+	{
+		sha256WriteByte(&hs, in[i]);
+	}
+	for (i = 0; i < 32; i++)
+	{
+		sha256WriteByte(&hs, padding_byte);
+	}
+	sha256Finish(&hs);
+	writeHashToByteArray(out, &hs, true);
+}
+
 /** Safety factor for entropy accumulation. The hardware random number
   * generator can (but should strive not to) overestimate its entropy. It can
   * overestimate its entropy by this factor without loss of security. */
 #define ENTROPY_SAFETY_FACTOR	2
 
+/** Limit on the total entropy (in bits) which can be credited to sources
+  * added using addEntropySource(), for each call to getRandom256Internal().
+  * Additional sources, such as a security chip's internal random number
+  * generator, are often opaque, so they aren't trusted to replace any of the
+  * HWRNG's entropy. Their entropy is counted on top of the
+  * 256 * #ENTROPY_SAFETY_FACTOR bits which the HWRNG (hardwareRandom32Bytes())
+  * must provide by itself. So this limit doesn't affect security; it only
+  * bounds the time spent calling additional sources.
+  */
+#ifndef ADDITIONAL_ENTROPY_LIMIT
+#define ADDITIONAL_ENTROPY_LIMIT	256
+#endif // #ifndef ADDITIONAL_ENTROPY_LIMIT
+
+/** An entropy source which was added using addEntropySource(). */
+typedef struct EntropySourceStruct
+{
+	/** Function which fills a buffer with 32 random bytes. This follows the
+	  * same conventions as hardwareRandom32Bytes(). */
+	int (*get32Bytes)(uint8_t *buffer);
+	/** Maximum amount of entropy, in bits, which this source can be credited
+	  * with for each call to getRandom256Internal(). */
+	uint16_t max_entropy;
+	/** Amount of entropy, in bits, which this source has been credited with
+	  * in the current (or most recent) call to getRandom256Internal(). */
+	uint16_t entropy_credited;
+	/** Whether this source has failed during the current (or most recent)
+	  * call to getRandom256Internal(). */
+	bool failed;
+} EntropySource;
+
+/** Entropy sources which are used in addition to the HWRNG. The first
+  * #num_entropy_sources entries are valid. */
+static EntropySource entropy_sources[MAX_ENTROPY_SOURCES];
+/** Number of valid entries in #entropy_sources. */
+static uint8_t num_entropy_sources;
+/** Amount of entropy, in bits, which the HWRNG has been credited with in the
+  * current (or most recent) call to getRandom256Internal(). */
+static uint16_t hwrng_entropy_credited;
+
+/** Add an entropy source which getRandom256() will use in addition to
+  * the HWRNG (hardwareRandom32Bytes()). getRandom256() calls each additional
+  * source before each call to hardwareRandom32Bytes(), so a source which
+  * spends most of its time waiting (for example, for a reply from an
+  * external chip) can do so while the HWRNG is acquiring samples.
+  *
+  * Entropy is accounted for separately for each source. Each source will be
+  * credited with at most max_entropy bits of entropy per getRandom256()
+  * call, regardless of what the source claims. Once a source has reached
+  * that limit, it won't be called again until the next getRandom256() call.
+  * If a source fails, it is skipped for the rest of that getRandom256()
+  * call; only a failure of the HWRNG causes getRandom256() to fail.
+  * \param source Function which fills a buffer with 32 random bytes and
+  *               returns an estimate of the entropy (in bits) of those bytes,
+  *               or a negative number on failure. See hardwareRandom32Bytes()
+  *               for details.
+  * \param max_entropy Maximum amount of entropy, in bits, to credit to this
+  *                    source for each getRandom256() call.
+  * \return false on success, true if there is no space for another source or
+  *         if the sum of the max_entropy values of all sources would exceed
+  *         #ADDITIONAL_ENTROPY_LIMIT.
+  */
+bool addEntropySource(int (*source)(uint8_t *buffer), uint16_t max_entropy)
+{
+	uint16_t total_max_entropy;
+	uint8_t i;
+
+	if (num_entropy_sources >= MAX_ENTROPY_SOURCES)
+	{
+		return true; // no space
+	}
+	total_max_entropy = max_entropy;
+	for (i = 0; i < num_entropy_sources; i++)
+	{
+		total_max_entropy = (uint16_t)(total_max_entropy + entropy_sources[i].max_entropy);
+	}
+	if (total_max_entropy > ADDITIONAL_ENTROPY_LIMIT)
+	{
+		return true; // too much time would be spent on additional sources
+	}
+	entropy_sources[num_entropy_sources].get32Bytes = source;
+	entropy_sources[num_entropy_sources].max_entropy = max_entropy;
+	entropy_sources[num_entropy_sources].entropy_credited = 0;
+	entropy_sources[num_entropy_sources].failed = false;
+	num_entropy_sources++;
+	return false; // success
+}
+
+/** Remove all entropy sources which were added using addEntropySource(), so
+  * that getRandom256() only uses the HWRNG. */
+void clearEntropySources(void)
+{
+	num_entropy_sources = 0;
+}
+
 /** Uses a hash function to accumulate entropy from a hardware random number
   * generator (HWRNG), along with the state of a persistent pool. The
   * operations used are: intermediate = H(HWRNG | pool),
@@ -239,8 +375,11 @@ bool initialiseEntropyPool(uint8_t *initial_pool_state)
   * section 5.2 addresses entropy accumulation by a hash function.
   *
   * Entropy is accumulated by hashing bytes obtained from the HWRNG until the
-  * total entropy (as reported by the HWRNG) is at least
-  * 256 * ENTROPY_SAFETY_FACTOR bits.
+  * entropy (as reported by the HWRNG) is at least
+  * 256 * ENTROPY_SAFETY_FACTOR bits. Bytes from any sources added using
+  * addEntropySource() are hashed in as well, but their entropy (limited as
+  * described in addEntropySource()) is counted on top of that, not towards
+  * it.
   * If the HWRNG breaks in a way that is undetected, the (maybe secret) pool
   * of random bits ensures that outputs will still be unpredictable, albeit
   * not strictly meeting their advertised amount of entropy.
@@ -265,35 +404,68 @@ bool initialiseEntropyPool(uint8_t *initial_pool_state)
 static bool getRandom256Internal(BigNum256 n, uint8_t *pool_state, bool use_pool_state)
 {
 	int r;
-	uint16_t total_entropy;
+	int source_r;
 	uint8_t random_bytes[MAX(32, ENTROPY_POOL_LENGTH)];
 	uint8_t intermediate[32];
 	HashState hs;
+	EntropySource *source;
 	uint8_t i;
+	uint8_t j;
 
-	// Hash in HWRNG randomness until we've reached the entropy required.
+	// Hash in HWRNG (and additional source) randomness until we've reached
+	// the entropy required.
 	// This needs to happen before hashing the pool itself due to the
 	// possibility of length extension attacks; see below.
-	total_entropy = 0;
+	hwrng_entropy_credited = 0;
+	for (j = 0; j < num_entropy_sources; j++)
+	{
+		entropy_sources[j].entropy_credited = 0;
+		entropy_sources[j].failed = false;
+	}
 	sha256Begin(&hs);
-	while (total_entropy < (256 * ENTROPY_SAFETY_FACTOR))
+	do
 	{
+		// Additional sources go first, so that they can overlap with any
+		// HWRNG sample acquisition which is in progress.
+		for (j = 0; j < num_entropy_sources; j++)
+		{
+			source = &(entropy_sources[j]);
+			if (!source->failed && (source->entropy_credited < source->max_entropy))
+			{
+				source_r = source->get32Bytes(random_bytes);
+				if (source_r < 0)
+				{
+					source->failed = true;
+				}
+				else
+				{
+					source_r = MIN(source_r, source->max_entropy - source->entropy_credited);
+					source->entropy_credited = (uint16_t)(source->entropy_credited + source_r);
+					for (i = 0; i < 32; i++)
+					{
+						sha256WriteByte(&hs, random_bytes[i]);
+					}
+				}
+			}
+		}
 		r = hardwareRandom32Bytes(random_bytes);
 		if (r < 0)
 		{
 			return true; // HWRNG failure
 		}
-		// Sometimes hardwareRandom32Bytes() returns 0, which signifies that
-		// more samples are needed in order to do statistical testing.
-		// hardwareRandom32Bytes() assumes it will be repeatedly called until
-		// it returns a non-zero value. If anything in this while loop is
-		// changed, make sure the code still respects this assumption.
-		total_entropy = (uint16_t)(total_entropy + r);
+		hwrng_entropy_credited = (uint16_t)(hwrng_entropy_credited + r);
 		for (i = 0; i < 32; i++)
 		{
 			sha256WriteByte(&hs, random_bytes[i]);
 		}
-	}
+		// Sometimes hardwareRandom32Bytes() returns 0, which signifies that
+		// more samples are needed in order to do statistical testing.
+		// hardwareRandom32Bytes() assumes it will be repeatedly called until
+		// it returns a non-zero value. If anything in this loop is changed,
+		// make sure the code still respects this assumption. Only the HWRNG's
+		// entropy counts towards the target, so the loop can't end in an
+		// iteration where hardwareRandom32Bytes() returned 0.
+	} while (hwrng_entropy_credited < (256 * ENTROPY_SAFETY_FACTOR));
 
 	// Now include the previous state of the pool.
 	if (use_pool_state)
@@ -318,17 +490,7 @@ static bool getRandom256Internal(BigNum256 n, uint8_t *pool_state, bool use_pool
 	// We can't use the intermediate state as the new pool state, or an
 	// attacker who obtained access to the pool state could determine
 	// the most recent returned random output.
-	sha256Begin(&hs);
-	for (i = 0; i < 32; i++)
-	{
-		sha256WriteByte(&hs, intermediate[i]);
-	}
-	for (i = 0; i < 32; i++)
-	{
-		sha256WriteByte(&hs, 0x42); // padding
-	}
-	sha256Finish(&hs);
-	writeHashToByteArray(random_bytes, &hs, true);
+	hashWithPadding(random_bytes, intermediate, 0x42);
 
 	// Save the pool state to non-volatile memory immediately as we don't want
 	// it to be possible to reuse the pool state.
@@ -364,12 +526,107 @@ static bool getRandom256Internal(BigNum256 n, uint8_t *pool_state, bool use_pool
 
 /** Version of getRandom256Internal() which uses non-volatile memory to store
   * the persistent entropy pool. See getRandom256Internal() for more details.
+  * If a random batch is active (see beginRandomBatch()), then the batch's
+  * RAM-based pool is used instead.
   * \param n See getRandom256Internal()
   * \return See getRandom256Internal()
   */
 bool getRandom256(BigNum256 n)
 {
-	return getRandom256Internal(n, NULL, false);
+	if (random_batch_active)
+	{
+		if (random_batch_draws >= RANDOM_BATCH_MAX_DRAWS)
+		{
+			// This batch is used up; start a new one. That will write a
+			// new state to the persistent entropy pool.
+			if (beginRandomBatch())
+			{
+				return true;
+			}
+		}
+		random_batch_draws++;
+		return getRandom256Internal(n, random_batch_pool, true);
+	}
+	else
+	{
+		return getRandom256Internal(n, NULL, false);
+	}
+}
+
+/** Begin a random batch. While a random batch is active, getRandom256()
+  * will use a pool in RAM instead of reading and writing the persistent
+  * entropy pool in non-volatile memory every time. This is useful when
+  * several random values are needed at once (eg. when creating a new wallet),
+  * because otherwise each one would cost a non-volatile memory write.
+  *
+  * When a batch begins, the persistent entropy pool is read and fresh HWRNG
+  * output is mixed into it, exactly as getRandom256Internal() would do (call
+  * the resulting state pool). Then batch_pool = H(pool | padding1) becomes
+  * the RAM-based pool, and new_pool = H(pool | padding2) is written to
+  * non-volatile memory. See hashWithPadding() for the meaning of this
+  * notation. Mixing in HWRNG output first means that fresh entropy reaches
+  * the persistent entropy pool with every batch, just as it does with every
+  * getRandom256() call outside a batch. The write of new_pool completes
+  * before any values are drawn from the batch. Therefore:
+  * - If power is lost during a batch, the next batch (or getRandom256()
+  *   call) will not use a pool state which was used by this batch.
+  * - An attacker who later obtains the persistent entropy pool (new_pool or
+  *   anything after it) cannot determine batch_pool and thus cannot
+  *   determine any values drawn from the batch.
+  * Each draw from a batch still mixes in HWRNG output, as described in
+  * getRandom256Internal(), so draws are just as unpredictable as they would
+  * be without a batch.
+  *
+  * A batch is automatically renewed (i.e. this is called again) after
+  * #RANDOM_BATCH_MAX_DRAWS draws. Batches should be kept short, and
+  * endRandomBatch() must be called once the batch is no longer needed.
+  * \return false on success, true if an error (couldn't access
+  *         non-volatile memory, invalid entropy pool checksum or HWRNG
+  *         failure) occurred. If an error occurred, no batch will be active.
+  */
+bool beginRandomBatch(void)
+{
+	uint8_t pool_state[ENTROPY_POOL_LENGTH];
+	uint8_t new_pool_state[ENTROPY_POOL_LENGTH];
+	uint8_t discard[32];
+	bool r;
+
+	endRandomBatch();
+	if (getEntropyPool(pool_state))
+	{
+		return true; // error reading from non-volatile memory, or invalid checksum
+	}
+	// This updates pool_state (in RAM only) with fresh HWRNG output.
+	r = getRandom256Internal(discard, pool_state, true);
+	memset(discard, 0, sizeof(discard));
+	if (r)
+	{
+		memset(pool_state, 0, sizeof(pool_state));
+		return true; // HWRNG failure
+	}
+	hashWithPadding(new_pool_state, pool_state, 0x42);
+	r = setEntropyPool(new_pool_state);
+	if (!r)
+	{
+		hashWithPadding(random_batch_pool, pool_state, 0x5c);
+		random_batch_draws = 0;
+		random_batch_active = true;
+	}
+	memset(pool_state, 0, sizeof(pool_state));
+	memset(new_pool_state, 0, sizeof(new_pool_state));
+	return r;
+}
+
+/** End a random batch (see beginRandomBatch()), clearing its RAM-based pool.
+  * After this is called, getRandom256() will go back to using the persistent
+  * entropy pool in non-volatile memory. It is okay to call this if no batch
+  * is active. */
+void endRandomBatch(void)
+{
+	memset(random_batch_pool, 0xff, sizeof(random_batch_pool)); // just to be sure
+	memset(random_batch_pool, 0, sizeof(random_batch_pool));
+	random_batch_draws = 0;
+	random_batch_active = false;
 }
 
 /** Version of getRandom256Internal() which uses RAM to store
@@ -427,6 +684,75 @@ void generateInsecureOTP(char *otp)
 	otp[OTP_LENGTH - 1] = '\0';
 }
 
+/** Extract the parent private key for the BIP 0032 deterministic key
+  * generator from a seed.
+  * \param k_par The parent private key will be written here, in little-endian
+  *              format. This must be a byte array with space for 32 bytes.
+  * \param seed See generateDeterministic256().
+  * \return false on success, true if the seed is invalid.
+  */
+static bool getParentPrivateKey(uint8_t *k_par, const uint8_t *seed)
+{
+	setFieldToN();
+	memcpy(k_par, seed, 32);
+	swapEndian256(k_par); // since seed is big-endian
+	bigModulo(k_par, k_par); // just in case
+	// k_par cannot be 0. If it is zero, then the output of this generator
+	// will always be 0.
+	if (bigIsZero(k_par))
+	{
+		return true; // invalid seed
+	}
+	return false;
+}
+
+/** Get the parent public key for the deterministic key generator (see
+  * generateDeterministic256()), so that it can be saved and later restored
+  * using setParentPublicKey(). This will also set the parent public key
+  * cache, if it isn't already set.
+  * \param out The parent public key will be written here: the x component
+  *            followed by the y component, both in little-endian format.
+  *            This must be a byte array with space
+  *            for #PARENT_PUBLIC_KEY_LENGTH bytes.
+  * \param seed See generateDeterministic256().
+  * \return false on success, true if the seed is invalid.
+  * \warning If the parent public key cache is already set, this assumes that
+  *          it was set using the same seed.
+  */
+bool getParentPublicKey(uint8_t *out, const uint8_t *seed)
+{
+	uint8_t k_par[32];
+
+	if (!cached_parent_public_key_valid)
+	{
+		if (getParentPrivateKey(k_par, seed))
+		{
+			return true; // invalid seed
+		}
+		setParentPublicKeyFromPrivateKey(k_par);
+	}
+	memcpy(out, cached_parent_public_key.x, 32);
+	memcpy(&(out[32]), cached_parent_public_key.y, 32);
+	return false; // success
+}
+
+/** Set the parent public key for the deterministic key generator (see
+  * generateDeterministic256()) to a value previously obtained using
+  * getParentPublicKey(). This avoids the point multiplication that would
+  * otherwise be needed the first time generateDeterministic256() is called.
+  * \param in The parent public key, in the format described in
+  *           getParentPublicKey().
+  * \warning The parent public key must correspond to the seed which will
+  *          be passed to generateDeterministic256(); no check is done.
+  */
+void setParentPublicKey(const uint8_t *in)
+{
+	memcpy(cached_parent_public_key.x, in, 32);
+	memcpy(cached_parent_public_key.y, &(in[32]), 32);
+	cached_parent_public_key.is_point_at_infinity = 0;
+	cached_parent_public_key_valid = true;
+}
+
 /** Use a combination of cryptographic primitives to deterministically
   * generate a new 256 bit number.
   *
@@ -454,13 +780,7 @@ bool generateDeterministic256(BigNum256 out, const uint8_t *seed, const uint32_t
 	uint8_t hash[SHA512_HASH_LENGTH];
 	uint8_t hmac_message[69]; // 04 (1 byte) + x (32 bytes) + y (32 bytes) + num (4 bytes)
 
-	setFieldToN();
-	memcpy(k_par, seed, 32);
-	swapEndian256(k_par); // since seed is big-endian
-	bigModulo(k_par, k_par); // just in case
-	// k_par cannot be 0. If it is zero, then the output of this generator
-	// will always be 0.
-	if (bigIsZero(k_par))
+	if (getParentPrivateKey(k_par, seed))
 	{
 		return true; // invalid seed
 	}
@@ -521,6 +841,8 @@ void corruptEntropyPool(void)
 
 /** Set this to true to simulate the HWRNG breaking. */
 static bool broken_hwrng;
+/** Number of times hardwareRandom32Bytes() has been called. */
+static unsigned int hwrng_calls;
 
 /** The purpose of this "random" byte source is to test the entropy
   * accumulation behaviour of getRandom256().
@@ -531,6 +853,7 @@ static bool broken_hwrng;
   */
 int hardwareRandom32Bytes(uint8_t *buffer)
 {
+	hwrng_calls++;
 	memset(buffer, 0, 32);
 	if (!broken_hwrng)
 	{
@@ -690,6 +1013,26 @@ static void type2DeterministicTest(uint8_t *seed, uint32_t num)
   * spits out samples into random.dat, where they can be analysed using
   * an external program.
   */
+/** Amount of entropy, in bits, which testEntropySource() claims for each
+  * call. Set this to a negative number to simulate failure of the source. */
+static int test_source_claimed_entropy;
+/** Number of times testEntropySource() has been called. */
+static unsigned int test_source_calls;
+
+/** Stand-in for an additional entropy source (see addEntropySource()), used
+  * to test the entropy accounting of getRandom256().
+  * \param buffer The buffer to fill. This should have enough space for 32
+  *               bytes.
+  * \return #test_source_claimed_entropy.
+  */
+static int testEntropySource(uint8_t *buffer)
+{
+	test_source_calls++;
+	memset(buffer, 0, 32);
+	buffer[31] = (uint8_t)test_source_calls;
+	return test_source_claimed_entropy;
+}
+
 int main(int argc, char **argv)
 {
 	uint8_t r[32];
@@ -955,6 +1298,176 @@ int main(int argc, char **argv)
 		reportSuccess();
 	}
 
+	// A random batch should write to the persistent entropy pool once, when
+	// it begins, and not for each draw.
+	broken_hwrng = false;
+	memset(pool_state, 42, ENTROPY_POOL_LENGTH);
+	setEntropyPool(pool_state);
+	if (beginRandomBatch())
+	{
+		printf("beginRandomBatch() doesn't work\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	getEntropyPool(compare_pool_state);
+	if (!memcmp(pool_state, compare_pool_state, ENTROPY_POOL_LENGTH))
+	{
+		printf("beginRandomBatch() not updating persistent entropy pool\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	for (i = 0; i < 4 * 32; i += 32)
+	{
+		if (getRandom256(&(generated_using_nv[i])))
+		{
+			printf("Unexpected failure of getRandom256()\n");
+			exit(1);
+		}
+	}
+	getEntropyPool(pool_state);
+	if (memcmp(pool_state, compare_pool_state, ENTROPY_POOL_LENGTH))
+	{
+		printf("getRandom256() writing to persistent entropy pool during a batch\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Draws within a batch should all be different.
+	abort = false;
+	for (i = 0; i < 4 * 32; i += 32)
+	{
+		for (j = 0; j < i; j += 32)
+		{
+			if (!memcmp(&(generated_using_nv[i]), &(generated_using_nv[j]), 32))
+			{
+				abort = true;
+			}
+		}
+	}
+	if (abort)
+	{
+		printf("getRandom256() repeating itself during a batch\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// A batch should be renewed (writing to the persistent entropy pool)
+	// once it has been used up.
+	for (i = 4; i < RANDOM_BATCH_MAX_DRAWS; i++)
+	{
+		getRandom256(r);
+	}
+	getEntropyPool(pool_state);
+	getRandom256(r);
+	getEntropyPool(compare_pool_state);
+	if (!memcmp(pool_state, compare_pool_state, ENTROPY_POOL_LENGTH))
+	{
+		printf("Random batch not being renewed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// After a batch ends, getRandom256() should go back to updating the
+	// persistent entropy pool every time.
+	endRandomBatch();
+	getEntropyPool(pool_state);
+	getRandom256(r);
+	getEntropyPool(compare_pool_state);
+	if (!memcmp(pool_state, compare_pool_state, ENTROPY_POOL_LENGTH))
+	{
+		printf("getRandom256() not updating persistent entropy pool after batch\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Fresh HWRNG output should be mixed into the persistent entropy pool
+	// state which is written when a batch begins, so beginning a batch twice
+	// from the same state should write different states.
+	memset(pool_state, 42, ENTROPY_POOL_LENGTH);
+	setEntropyPool(pool_state);
+	beginRandomBatch();
+	endRandomBatch();
+	getEntropyPool(compare_pool_state);
+	setEntropyPool(pool_state);
+	beginRandomBatch();
+	endRandomBatch();
+	getEntropyPool(pool_state);
+	if (!memcmp(pool_state, compare_pool_state, ENTROPY_POOL_LENGTH))
+	{
+		printf("beginRandomBatch() not mixing HWRNG output into persistent entropy pool\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// With a broken HWRNG, draws from a batch should not be reproducible
+	// from the persistent entropy pool state which was written when the
+	// batch began.
+	broken_hwrng = true;
+	memset(pool_state, 42, ENTROPY_POOL_LENGTH);
+	setEntropyPool(pool_state);
+	beginRandomBatch();
+	getRandom256(generated_using_nv);
+	endRandomBatch();
+	getEntropyPool(pool_state);
+	getRandom256TemporaryPool(generated_using_ram, pool_state);
+	memset(pool_state, 42, ENTROPY_POOL_LENGTH);
+	getRandom256TemporaryPool(&(generated_using_ram[32]), pool_state);
+	if (!memcmp(generated_using_nv, generated_using_ram, 32)
+		|| !memcmp(generated_using_nv, &(generated_using_ram[32]), 32))
+	{
+		printf("Random batch output can be reproduced from pool state\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// beginRandomBatch() should fail if the persistent entropy pool is
+	// corrupted.
+	nonVolatileRead(&one_byte, PARTITION_GLOBAL, ADDRESS_POOL_CHECKSUM, 1);
+	one_byte_corrupted = (uint8_t)(one_byte ^ 0xde);
+	nonVolatileWrite(&one_byte_corrupted, PARTITION_GLOBAL, ADDRESS_POOL_CHECKSUM, 1);
+	if (!beginRandomBatch())
+	{
+		printf("beginRandomBatch() not detecting corrupted entropy pool\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	if (!getRandom256(r))
+	{
+		printf("getRandom256() using a batch after beginRandomBatch() failed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
 	// initialiseEntropyPool() should directly set the entropy pool state if
 	// the current state is invalid.
 	memset(pool_state, 0, ENTROPY_POOL_LENGTH);
@@ -1034,6 +1547,126 @@ int main(int argc, char **argv)
 	memset(pool_state, 42, ENTROPY_POOL_LENGTH);
 	initialiseEntropyPool(pool_state);
 
+	// The total entropy of additional sources is limited.
+	clearEntropySources();
+	if (!addEntropySource(testEntropySource, ADDITIONAL_ENTROPY_LIMIT + 1))
+	{
+		printf("addEntropySource() accepts a source with too much entropy\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	if (addEntropySource(testEntropySource, ADDITIONAL_ENTROPY_LIMIT / 2)
+		|| !addEntropySource(testEntropySource, ADDITIONAL_ENTROPY_LIMIT / 2 + 1))
+	{
+		printf("addEntropySource() doesn't limit total entropy of sources\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	if (addEntropySource(testEntropySource, ADDITIONAL_ENTROPY_LIMIT / 2)
+		|| !addEntropySource(testEntropySource, 0))
+	{
+		printf("addEntropySource() doesn't limit number of sources\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// A working additional source should be credited with exactly its limit,
+	// without reducing the HWRNG's contribution.
+	clearEntropySources();
+	addEntropySource(testEntropySource, ADDITIONAL_ENTROPY_LIMIT);
+	test_source_claimed_entropy = 16;
+	test_source_calls = 0;
+	hwrng_calls = 0;
+	if (getRandom256(r))
+	{
+		printf("getRandom256() fails with additional source\n");
+		reportFailure();
+	}
+	else if ((entropy_sources[0].entropy_credited != ADDITIONAL_ENTROPY_LIMIT)
+		|| (hwrng_entropy_credited != (256 * ENTROPY_SAFETY_FACTOR))
+		|| (test_source_calls != (ADDITIONAL_ENTROPY_LIMIT / 16))
+		|| (hwrng_calls != ((256 * ENTROPY_SAFETY_FACTOR) / 8)))
+	{
+		printf("Additional source entropy accounting is wrong\n");
+		printf("source: %u bits in %u calls, HWRNG: %u bits in %u calls\n", entropy_sources[0].entropy_credited, test_source_calls, hwrng_entropy_credited, hwrng_calls);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// An additional source which overestimates its entropy should be
+	// capped.
+	test_source_claimed_entropy = 1000;
+	if (getRandom256(r))
+	{
+		printf("getRandom256() fails with overestimating source\n");
+		reportFailure();
+	}
+	else if ((entropy_sources[0].entropy_credited != ADDITIONAL_ENTROPY_LIMIT)
+		|| (hwrng_entropy_credited < (256 * ENTROPY_SAFETY_FACTOR)))
+	{
+		printf("Overestimating source not capped\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Failure of an additional source shouldn't cause getRandom256() to
+	// fail, since the HWRNG provides all of the required entropy anyway.
+	test_source_claimed_entropy = -1;
+	test_source_calls = 0;
+	hwrng_calls = 0;
+	if (getRandom256(r))
+	{
+		printf("getRandom256() fails when additional source fails\n");
+		reportFailure();
+	}
+	else if ((entropy_sources[0].entropy_credited != 0)
+		|| (hwrng_entropy_credited != (256 * ENTROPY_SAFETY_FACTOR))
+		|| (test_source_calls != 1))
+	{
+		printf("Failed source not handled properly\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// The additional source's bytes must actually be mixed in. With a broken
+	// HWRNG and the same initial pool state, output should depend on the
+	// additional source.
+	broken_hwrng = true;
+	test_source_claimed_entropy = 16;
+	memset(pool_state, 42, ENTROPY_POOL_LENGTH);
+	getRandom256TemporaryPool(&(generated_using_ram[0]), pool_state);
+	clearEntropySources();
+	memset(pool_state, 42, ENTROPY_POOL_LENGTH);
+	getRandom256TemporaryPool(&(generated_using_ram[32]), pool_state);
+	if (!memcmp(&(generated_using_ram[0]), &(generated_using_ram[32]), 32))
+	{
+		printf("Additional source not mixed into output\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	broken_hwrng = false;
+
 	if (argc != 3)
 	{
 		printf("Usage: %s <n> <is_broken>, where:\n", argv[0]);
@@ -36,6 +36,12 @@
   * the generateInsecureOTP() function. This includes the terminating null.
   */
 #define OTP_LENGTH				5
+/** Length, in bytes, of the parent public key used by getParentPublicKey()
+  * and setParentPublicKey(). */
+#define PARENT_PUBLIC_KEY_LENGTH	64
+/** Maximum number of entropy sources, in addition to
+  * hardwareRandom32Bytes(), which can be added using addEntropySource(). */
+#define MAX_ENTROPY_SOURCES		2
 
 // Some sanity checks.
 #if ENTROPY_POOL_LENGTH > (ADDRESS_POOL_CHECKSUM - ADDRESS_ENTROPY_POOL)
@@ -46,12 +52,18 @@
 #endif
 
 extern void clearParentPublicKeyCache(void);
+extern bool addEntropySource(int (*source)(uint8_t *buffer), uint16_t max_entropy);
+extern void clearEntropySources(void);
 extern bool setEntropyPool(uint8_t *in_pool_state);
 extern bool getEntropyPool(uint8_t *out_pool_state);
 extern bool initialiseEntropyPool(uint8_t *initial_pool_state);
 extern bool getRandom256(BigNum256 n);
 extern bool getRandom256TemporaryPool(BigNum256 n, uint8_t *pool_state);
+extern bool beginRandomBatch(void);
+extern void endRandomBatch(void);
 extern void generateInsecureOTP(char *otp);
+extern bool getParentPublicKey(uint8_t *out, const uint8_t *seed);
+extern void setParentPublicKey(const uint8_t *in);
 extern bool generateDeterministic256(BigNum256 out, const uint8_t *seed, const uint32_t num);
 #ifdef TEST
 extern void initialiseDefaultEntropyPool(void);
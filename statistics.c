@@ -20,6 +20,12 @@
   * This file is licensed as described by the file LICENCE.
   */
 
+#if defined(TEST) && defined(TEST_STATISTICS)
+#include <stdlib.h>
+#include <stdio.h>
+#include "test_helpers.h"
+#endif // #if defined(TEST) && defined(TEST_STATISTICS)
+
 #include "common.h"
 #include "fix16.h"
 #include "fft.h"
@@ -52,23 +58,15 @@ fix16_t psd_accumulator[FFT_SIZE + 1];
   * there haven't been any arithmetic errors so far.
   */
 bool psd_accumulator_error_occurred;
+/** Number of times accumulatePowerSpectralDensity() has been called since
+  * the last call to clearPowerSpectralDensity(). This allows tests to be done
+  * on a partial power spectral density estimate. */
+uint32_t psd_frames_accumulated;
 
 /** This will be set to true if one of the histogram bins overflows. */
 bool histogram_overflow_occurred;
 /** Number of samples that have been placed in the histogram. */
 uint32_t samples_in_histogram;
-/** The index (bin number) into the histogram buffer where the histogram
-  * iterator is currently at. */
-static uint32_t iterator_index;
-/** The count within a histogram bin where the histogram iterator is currently
-  * at. */
-static uint32_t iterator_count;
-/** Cached value of histogram counts in the bin specified by #iterator_index.
-  * This is used to speed up getTermFromIterator(). */
-static uint32_t cached_histogram_count;
-/** Cached value of scaled sample value for the bin specified
-  * by #iterator_index. This is used to speed up getTermFromIterator(). */
-static fix16_t cached_scaled_sample;
 
 /** Reset all histogram counts to 0. */
 void clearHistogram(void)
@@ -175,101 +173,121 @@ fix16_t scaleSample(int sample_int)
 	return r;
 }
 
-/** This must be called whenever the iterator is active and #iterator_index
-  * changes. */
-static void updateIteratorCache(void)
+/** A sum of terms, each weighted by (count / #SAMPLE_COUNT), where count is
+  * a histogram count. Each term is split into a multiple of #SAMPLE_COUNT
+  * and a remainder, so that the sum can be accumulated without any rounding
+  * (see addWeightedTerm() and finishWeightedSum()). */
+typedef struct WeightedSumStruct
 {
-	cached_histogram_count = getHistogram(iterator_index);
-	cached_scaled_sample = scaleSample((int)iterator_index);
-}
-
-/** Reset the histogram iterator back to the start. */
-static void resetIterator(void)
+	/** Sum of (term / #SAMPLE_COUNT) * count, where the division
+	  * truncates. */
+	int32_t whole;
+	/** Sum of (term % #SAMPLE_COUNT) * count. Since the counts add up
+	  * to #SAMPLE_COUNT, the magnitude of this is less
+	  * than #SAMPLE_COUNT ^ 2. */
+	int32_t remainder;
+} WeightedSum;
+
+/** Add one weighted term to a weighted sum.
+  * \param sum The weighted sum to add to.
+  * \param term The term to add.
+  * \param count The weight of the term, as a number of samples.
+  */
+static void addWeightedTerm(WeightedSum *sum, fix16_t term, uint32_t count)
 {
-	iterator_index = 0;
-	iterator_count = 0;
-	updateIteratorCache();
+	sum->whole += (term / SAMPLE_COUNT) * (int32_t)count;
+	sum->remainder += (term % SAMPLE_COUNT) * (int32_t)count;
 }
 
-/** Uses an iterator over the histogram to obtain one term in a central
-  * moment calculation. The iterator goes over each item (count) from each
-  * histogram bin (index).
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.). This must be positive and non-zero.
-  * \return One term for the calculation of the specified central moment.
+/** Get the value of a weighted sum, after all terms have been added to it.
+  * \param sum The weighted sum.
+  * \return The value of the weighted sum, rounded to the nearest fixed-point
+  *         number.
   */
-static fix16_t getTermFromIterator(fix16_t mean, uint32_t power)
+static fix16_t finishWeightedSum(WeightedSum *sum)
 {
-	uint32_t i;
-	fix16_t scaled_sample;
-	fix16_t r;
+	int32_t remainder;
 
-	// Search for the index (bin number) of the next count.
-	while (iterator_count >= cached_histogram_count)
+	if (sum->remainder < 0)
 	{
-		iterator_count = 0;
-		iterator_index++;
-		if (iterator_index >= HISTOGRAM_NUM_BINS)
-		{
-			// Iterator ran past end of samples. This should never happen.
-			fix16_error_occurred = true;
-			return fix16_zero;
-		}
-		updateIteratorCache();
+		remainder = (sum->remainder - (SAMPLE_COUNT / 2)) / SAMPLE_COUNT;
 	}
-
-	iterator_count++;
-	scaled_sample = fix16_sub(cached_scaled_sample, mean);
-	r = scaled_sample;
-	for (i = 1; i < power; i++)
+	else
 	{
-		r = fix16_mul(r, scaled_sample);
+		remainder = (sum->remainder + (SAMPLE_COUNT / 2)) / SAMPLE_COUNT;
 	}
-	return r;
+	return fix16_add(sum->whole, remainder);
 }
 
-/** Recursive handler for calculateCentralMoment(). Recursion is used to do
-  * pairwise averaging. Pairwise averaging is just like pairwise summation,
-  * except there's a divide by 2 after each sum.
-  * Why do pairwise averaging? So that overflow is less likely to occur.
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.).
-  * \param level The number of terms to use in the estimation of the central
-  *              moment.
-  * \return An estimate of the value of the specified central moment.
+/** Examines the histogram and calculates the mean and the second, third and
+  * fourth central moments from it.
+  *
+  * The histogram is swept twice: once to find the mean, then once more to
+  * accumulate all three central moments about that mean. Each bin
+  * contributes its count times the appropriate power of (sample - mean), so
+  * every bin (rather than every sample) is visited only once per sweep.
+  * The central moments are accumulated directly (rather than derived from
+  * moments about zero) to avoid catastrophic cancellation when the mean is
+  * far from zero.
+  *
+  * Each term is weighted by (count / #SAMPLE_COUNT), and the weights add up
+  * to 1. That means every partial sum is bounded by the largest term,
+  * which gives the same overflow protection as pairwise averaging.
+  * \param out_mean The mean will be written here.
+  * \param out_variance The variance (second central moment) will be written
+  *                     here.
+  * \param out_kappa3 The third central moment (non-standardised skewness)
+  *                   will be written here.
+  * \param out_kappa4 The fourth central moment (non-standardised kurtosis)
+  *                   will be written here.
   */
-static fix16_t calculateCentralMomentRecursive(fix16_t mean, uint32_t power, uint32_t level)
+void calculateMoments(fix16_t *out_mean, fix16_t *out_variance, fix16_t *out_kappa3, fix16_t *out_kappa4)
 {
-	fix16_t term1;
-	fix16_t term2;
-
-	if (level <= 2)
+	uint32_t i;
+	uint32_t count;
+	int32_t sum;
+	fix16_t mean;
+	fix16_t difference;
+	fix16_t term;
+	WeightedSum variance;
+	WeightedSum kappa3;
+	WeightedSum kappa4;
+
+	// First sweep: calculate mean. This is done using integer arithmetic
+	// (with the same offset as scaleSample()) and then scaled, so that the
+	// only rounding occurs at the very end. Any error in the mean would
+	// propagate into all the central moments.
+	sum = 0;
+	for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
 	{
-		term1 = getTermFromIterator(mean, power);
-		term2 = getTermFromIterator(mean, power);
+		sum += (int32_t)getHistogram(i) * ((int32_t)i - (HISTOGRAM_NUM_BINS / 2));
 	}
-	else
+	// This divides by #SAMPLE_COUNT and #SAMPLE_SCALE_DOWN.
+	mean = fix16_mul((fix16_t)sum, FIX16_RECIPROCAL_OF(SAMPLE_COUNT) * FIX16_RECIPROCAL_OF(SAMPLE_SCALE_DOWN));
+
+	// Second sweep: calculate central moments.
+	memset(&variance, 0, sizeof(variance));
+	memset(&kappa3, 0, sizeof(kappa3));
+	memset(&kappa4, 0, sizeof(kappa4));
+	for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
 	{
-		term1 = calculateCentralMomentRecursive(mean, power, level >> 1);
-		term2 = calculateCentralMomentRecursive(mean, power, level >> 1);
+		count = getHistogram(i);
+		if (count != 0)
+		{
+			difference = fix16_sub(scaleSample((int)i), mean);
+			term = fix16_mul(difference, difference);
+			addWeightedTerm(&variance, term, count);
+			term = fix16_mul(term, difference);
+			addWeightedTerm(&kappa3, term, count);
+			term = fix16_mul(term, difference);
+			addWeightedTerm(&kappa4, term, count);
+		}
 	}
-	return fix16_mul(fix16_add(term1, term2), FIX16_RECIPROCAL_OF(2));
-}
 
-/** Examines the histogram and calculates a central moment from it. This does
-  * require the mean to be known. If the mean is not known, it can be
-  * calculated using this function by passing mean = 0.0 and power = 1.
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.).
-  * \return The value of the specified central moment
-  */
-fix16_t calculateCentralMoment(fix16_t mean, uint32_t power)
-{
-	resetIterator();
-	return calculateCentralMomentRecursive(mean, power, SAMPLE_COUNT);
+	*out_mean = mean;
+	*out_variance = finishWeightedSum(&variance);
+	*out_kappa3 = finishWeightedSum(&kappa3);
+	*out_kappa4 = finishWeightedSum(&kappa4);
 }
 
 /** Obtains an estimate of the (Shannon) entropy per sample, based on the
@@ -330,6 +348,7 @@ void clearPowerSpectralDensity(void)
 {
 	memset(psd_accumulator, 0, sizeof(psd_accumulator));
 	psd_accumulator_error_occurred = false;
+	psd_frames_accumulated = 0;
 }
 
 /** Calculate (an estimate of) the power spectral density of a bunch of
@@ -404,10 +423,13 @@ void accumulatePowerSpectralDensity(volatile uint16_t *source_buffer)
 	{
 		psd_accumulator_error_occurred = true;
 	}
+	psd_frames_accumulated++;
 }
 
 /** Calculate the (cyclic) autocorrelation by using the power spectral density
-  * estimate (#psd_accumulator).
+  * estimate (#psd_accumulator). This can be called before all #PSD_NUM_FRAMES
+  * frames have been accumulated; the result will then be scaled down by
+  * #psd_frames_accumulated / #PSD_NUM_FRAMES.
   * \param fft_buffer The result of the autocorrelation computation will be
   *                   written here.
   * \return false if the calculation completed successfully, true if there was
@@ -453,3 +475,227 @@ bool calculateAutoCorrelation(ComplexFixed *fft_buffer)
 	}
 	return false;
 }
+
+// The firmware test builds also use TEST_STATISTICS (to mean something else),
+// but they don't define TEST, so check for both.
+#if defined(TEST) && defined(TEST_STATISTICS)
+
+/** Number of different synthetic histograms which testCalculateMoments()
+  * knows how to fill. */
+#define NUM_HISTOGRAM_SHAPES		6
+
+/** Largest allowed difference between the mean calculated by
+  * calculateMoments() and the double-precision reference, in fixed-point
+  * LSBs. The mean is calculated with integers, and only rounded once at the
+  * end. */
+#define MEAN_TOLERANCE_LSB			0.5
+/** Largest allowed difference between a central moment calculated by
+  * calculateMoments() and the double-precision reference, in fixed-point
+  * LSBs. The reference is taken about the (rounded) mean that
+  * calculateMoments() returned, so that this only covers the rounding of
+  * each term and of the final sum. */
+#define MOMENT_TOLERANCE_LSB		2.0
+
+/** State of the pseudo-random number generator used to make synthetic
+  * histograms. A fixed generator (instead of rand()) is used so that the
+  * histograms are the same on every host. */
+static uint32_t test_lcg_state;
+
+/** Get a pseudo-random number for use in synthetic histograms.
+  * \return A pseudo-random number uniformly distributed in [0, 1).
+  */
+static double testUniform(void)
+{
+	test_lcg_state = test_lcg_state * 1664525 + 1013904223;
+	return (double)(test_lcg_state >> 8) / 16777216.0;
+}
+
+/** Get a pseudo-random number which is approximately normally distributed,
+  * using the sum of 12 uniform numbers (so that libm isn't needed).
+  * \return A pseudo-random number with a mean of 0 and a variance of 1.
+  */
+static double testGaussian(void)
+{
+	unsigned int i;
+	double sum;
+
+	sum = 0.0;
+	for (i = 0; i < 12; i++)
+	{
+		sum += testUniform();
+	}
+	return sum - 6.0;
+}
+
+/** Get one sample (a histogram bin number) for a synthetic histogram.
+  * \param shape Which histogram shape to use, 0 to
+  *              #NUM_HISTOGRAM_SHAPES - 1 inclusive.
+  * \param i The index of the sample, 0 to #SAMPLE_COUNT - 1 inclusive.
+  * \return The bin number.
+  */
+static int testSample(unsigned int shape, uint32_t i)
+{
+	double g1;
+	double g2;
+	int bin;
+
+	switch (shape)
+	{
+	case 0:
+		// Normal distribution, centred in the ADC range, like a working
+		// HWRNG.
+		bin = (int)(512.0 + 60.0 * testGaussian());
+		break;
+	case 1:
+		// Narrow normal distribution, far from the centre of the ADC
+		// range. This tests for cancellation.
+		bin = (int)(900.0 + 10.0 * testGaussian());
+		break;
+	case 2:
+		// Chi-squared distribution (2 degrees of freedom), which has
+		// large skewness and kurtosis.
+		g1 = testGaussian();
+		g2 = testGaussian();
+		bin = (int)(300.0 + 40.0 * (g1 * g1 + g2 * g2));
+		break;
+	case 3:
+		// Uniform over the whole ADC range, which makes the terms as
+		// large as they can be.
+		bin = (int)(testUniform() * HISTOGRAM_NUM_BINS);
+		break;
+	case 4:
+		// Two pairs of spikes, so that every sample is a long way from the
+		// mean. Each spike must be spread over two bins, or they would
+		// overflow (see #BITS_PER_HISTOGRAM_BIN).
+		bin = ((i & 1) == 0) ? 400 : 623;
+		bin += (int)((i >> 1) & 1);
+		break;
+	default:
+		// As narrow as the histogram allows (a single bin can't hold every
+		// sample; see #BITS_PER_HISTOGRAM_BIN), so that the central moments
+		// are tiny.
+		bin = 700 + (int)(i % 3);
+		break;
+	}
+	if (bin < 0)
+	{
+		bin = 0;
+	}
+	if (bin >= HISTOGRAM_NUM_BINS)
+	{
+		bin = HISTOGRAM_NUM_BINS - 1;
+	}
+	return bin;
+}
+
+/** Check one value calculated by calculateMoments() against its
+  * double-precision reference.
+  * \param name Name of the value, for reporting failures.
+  * \param shape Which histogram shape was used.
+  * \param value The value from calculateMoments().
+  * \param reference The double-precision reference.
+  * \param tolerance_lsb The largest allowed difference, in fixed-point LSBs.
+  */
+static void checkMoment(const char *name, unsigned int shape, fix16_t value, double reference, double tolerance_lsb)
+{
+	double difference_lsb;
+
+	difference_lsb = (double)value - reference * 65536.0;
+	if ((difference_lsb > tolerance_lsb) || (difference_lsb < -tolerance_lsb))
+	{
+		printf("Shape %u: %s = %.6f, expected %.6f (off by %.2f LSB)\n", shape, name, (double)value / 65536.0, reference, difference_lsb);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+/** Fill the histogram with a synthetic distribution, then check that
+  * calculateMoments() matches a double-precision calculation of the same
+  * moments from the same samples.
+  * \param shape Which histogram shape to use, 0 to
+  *              #NUM_HISTOGRAM_SHAPES - 1 inclusive.
+  */
+static void testCalculateMoments(unsigned int shape)
+{
+	uint32_t i;
+	int bins[SAMPLE_COUNT];
+	double x;
+	double mean;
+	double variance;
+	double kappa3;
+	double kappa4;
+	fix16_t fix_mean;
+	fix16_t fix_variance;
+	fix16_t fix_kappa3;
+	fix16_t fix_kappa4;
+
+	clearHistogram();
+	test_lcg_state = 42 + shape;
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		bins[i] = testSample(shape, i);
+		incrementHistogram((uint32_t)bins[i]);
+	}
+	if (histogram_overflow_occurred)
+	{
+		printf("Shape %u: histogram overflowed\n", shape);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	calculateMoments(&fix_mean, &fix_variance, &fix_kappa3, &fix_kappa4);
+
+	// Reference: the same scaling as scaleSample(), but in double precision.
+	mean = 0.0;
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		mean += (double)(bins[i] - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN;
+	}
+	mean /= SAMPLE_COUNT;
+	checkMoment("mean", shape, fix_mean, mean, MEAN_TOLERANCE_LSB);
+
+	// The central moments are taken about the mean which calculateMoments()
+	// found. Otherwise, the (allowed) rounding error in the mean would be
+	// multiplied by up to 4 times kappa3 (see the derivative of kappa4 with
+	// respect to the mean), which would make a meaningful tolerance
+	// impossible for wide distributions.
+	mean = (double)fix_mean / 65536.0;
+	variance = 0.0;
+	kappa3 = 0.0;
+	kappa4 = 0.0;
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		x = (double)(bins[i] - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN - mean;
+		variance += x * x;
+		kappa3 += x * x * x;
+		kappa4 += x * x * x * x;
+	}
+	variance /= SAMPLE_COUNT;
+	kappa3 /= SAMPLE_COUNT;
+	kappa4 /= SAMPLE_COUNT;
+	checkMoment("variance", shape, fix_variance, variance, MOMENT_TOLERANCE_LSB);
+	checkMoment("kappa3", shape, fix_kappa3, kappa3, MOMENT_TOLERANCE_LSB);
+	checkMoment("kappa4", shape, fix_kappa4, kappa4, MOMENT_TOLERANCE_LSB);
+}
+
+int main(void)
+{
+	unsigned int shape;
+
+	initTests(__FILE__);
+
+	for (shape = 0; shape < NUM_HISTOGRAM_SHAPES; shape++)
+	{
+		testCalculateMoments(shape);
+	}
+
+	finishTests();
+	exit(0);
+}
+
+#endif // #if defined(TEST) && defined(TEST_STATISTICS)
@@ -37,16 +37,31 @@
   *          macro is used to replace division with multiplication.
   */
 #define SAMPLE_SCALE_DOWN			64
+/** Number of double-sized real FFT frames which make up one set
+  * of #SAMPLE_COUNT samples. accumulatePowerSpectralDensity() must be called
+  * this many times to obtain a complete power spectral density estimate.
+  */
+#define PSD_NUM_FRAMES				(SAMPLE_COUNT / (FFT_SIZE * 2))
+/** Ratio of the lag 0 value of the correlogram calculated by
+  * calculateAutoCorrelation() to the variance of the samples, once all
+  * #PSD_NUM_FRAMES frames have been accumulated. This is a consequence of
+  * the scaling which accumulatePowerSpectralDensity() applies. Since every
+  * lag of the correlogram scales in the same way as the number of
+  * accumulated frames, this can be used to normalise a correlogram
+  * calculated from a partial power spectral density estimate.
+  */
+#define AUTOCORR_VARIANCE_SCALE		((FFT_SIZE * 2.0) / 64.0)
 
 extern bool histogram_overflow_occurred;
 extern uint32_t samples_in_histogram;
 extern fix16_t psd_accumulator[FFT_SIZE + 1];
 extern bool psd_accumulator_error_occurred;
+extern uint32_t psd_frames_accumulated;
 
 extern void clearHistogram(void);
 extern void incrementHistogram(uint32_t index);
 extern fix16_t scaleSample(int sample_int);
-extern fix16_t calculateCentralMoment(fix16_t mean, uint32_t power);
+extern void calculateMoments(fix16_t *out_mean, fix16_t *out_variance, fix16_t *out_kappa3, fix16_t *out_kappa4);
 extern fix16_t estimateEntropy(void);
 extern void subtractMeanFromFftBuffer(ComplexFixed *fft_buffer);
 extern void clearPowerSpectralDensity(void);
@@ -26,5 +26,8 @@
 #define ADDRESS_POOL_CHECKSUM	96
 /** Address where device UUID is located. */
 #define ADDRESS_DEVICE_UUID		128
+/** Address where the storage format of the accounts partition is located.
+  * This is written by sanitiseEverything(); see getNumberOfWallets(). */
+#define ADDRESS_STORAGE_FORMAT	144
 
 #endif // #ifndef STORAGE_COMMON_H_INCLUDED
@@ -53,8 +53,9 @@ static void writeFailureString(StringSet set, uint8_t spec);
 bool hashFieldCallback(pb_istream_t *stream, const pb_field_t *field, void **arg);
 
 /** Maximum size (in bytes) of any protocol buffer message sent by functions
-  * in this file. */
-#define MAX_SEND_SIZE			255
+  * in this file. The largest messages are Entropy (up to 1024 bytes of
+  * entropy) and Signatures (up to #MAX_BATCH_INPUTS signatures). */
+#define MAX_SEND_SIZE			1100
 
 /** Union of field buffers for all protocol buffer messages. They're placed
   * in a union to make memory access more efficient, since the functions in
@@ -126,6 +127,18 @@ static size_t num_entropy_bytes;
 /** Storage for fields of SignTransaction message. Needed for the
   * signTransactionCallback() callback function. */
 static SignTransaction sign_transaction;
+/** Storage for fields of SignTransactionBatch message. Needed for the
+  * signTransactionBatchCallback() callback function. */
+static SignTransactionBatch sign_transaction_batch;
+/** Storage for fields of SignPsbt message. Needed for the
+  * signPsbtCallback() callback function. */
+static SignPsbt sign_psbt;
+/** Pointer to signatures to send to the host; used for
+  * the signaturesCallback() callback function. */
+static Signature *signatures_buffer;
+/** Number of signatures in #signatures_buffer; used for
+  * the signaturesCallback() callback function. */
+static uint32_t num_signatures;
 /** Double SHA-256 of a field parsed by hashFieldCallback(). */
 static uint8_t field_hash[32];
 /** Whether #field_hash has been set. */
@@ -157,12 +170,7 @@ static char test_otp[OTP_LENGTH] = {'1', '2', '3', '4', '\0'};
   */
 static void getBytesFromStream(uint8_t *buffer, uint8_t length)
 {
-	uint8_t i;
-
-	for (i = 0; i < length; i++)
-	{
-		buffer[i] = streamGetOneByte();
-	}
+	streamGetBytes(buffer, length);
 	payload_length -= length;
 }
 
@@ -172,15 +180,10 @@ static void getBytesFromStream(uint8_t *buffer, uint8_t length)
   */
 static void writeBytesToStream(const uint8_t *buffer, size_t length)
 {
-	size_t i;
-
-	for (i = 0; i < length; i++)
-	{
-		streamPutOneByte(buffer[i]);
-	}
+	streamPutBytes(buffer, (uint32_t)length);
 }
 
-/** nanopb input stream callback which uses streamGetOneByte() to get the
+/** nanopb input stream callback which uses streamGetBytes() to get the
   * requested bytes.
   * \param stream Input stream object that issued the callback.
   * \param buf Buffer to fill with requested bytes.
@@ -189,27 +192,34 @@ static void writeBytesToStream(const uint8_t *buffer, size_t length)
   */
 bool mainInputStreamCallback(pb_istream_t *stream, uint8_t *buf, size_t count)
 {
-	size_t i;
+	uint32_t length;
 
 	if (buf == NULL)
 	{
 		fatalError(); // this should never happen
 	}
-	for (i = 0; i < count; i++)
+	// Only read up to the end of the payload, so that the stream is left
+	// in the same state as if the bytes were read one at a time.
+	if (count > payload_length)
 	{
-		if (payload_length == 0)
-		{
-			// Attempting to read past end of payload.
-			stream->bytes_left = 0;
-			return false;
-		}
-		buf[i] = streamGetOneByte();
-		payload_length--;
+		length = payload_length;
+	}
+	else
+	{
+		length = (uint32_t)count;
+	}
+	streamGetBytes(buf, length);
+	payload_length -= length;
+	if (length < count)
+	{
+		// Attempting to read past end of payload.
+		stream->bytes_left = 0;
+		return false;
 	}
 	return true;
 }
 
-/** nanopb output stream callback which uses streamPutOneByte() to send a byte
+/** nanopb output stream callback which uses streamPutBytes() to send a byte
   * buffer.
   * \param stream Output stream object that issued the callback.
   * \param buf Buffer with bytes to send.
@@ -229,12 +239,21 @@ bool mainOutputStreamCallback(pb_ostream_t *stream, const uint8_t *buf, size_t c
   */
 static void readAndIgnoreInput(void)
 {
-	if (payload_length > 0)
+	uint8_t junk[32];
+	uint32_t length;
+
+	while (payload_length > 0)
 	{
-		for (; payload_length > 0; payload_length--)
+		if (payload_length > sizeof(junk))
 		{
-			streamGetOneByte();
+			length = sizeof(junk);
 		}
+		else
+		{
+			length = payload_length;
+		}
+		streamGetBytes(junk, length);
+		payload_length -= length;
 	}
 }
 
@@ -269,7 +288,7 @@ static bool receiveMessage(const pb_field_t fields[], void *dest_struct)
   */
 static void sendPacket(uint16_t message_id, const pb_field_t fields[], const void *src_struct)
 {
-	uint8_t buffer[4];
+	uint8_t buffer[8];
 	pb_ostream_t substream;
 
 #ifdef TEST_STREAM_COMM
@@ -289,12 +308,12 @@ static void sendPacket(uint16_t message_id, const pb_field_t fields[], const voi
 	}
 
 	// Send packet header.
-	streamPutOneByte('#');
-	streamPutOneByte('#');
-	streamPutOneByte((uint8_t)(message_id >> 8));
-	streamPutOneByte((uint8_t)message_id);
-	writeU32BigEndian(buffer, substream.bytes_written);
-	writeBytesToStream(buffer, 4);
+	buffer[0] = '#';
+	buffer[1] = '#';
+	buffer[2] = (uint8_t)(message_id >> 8);
+	buffer[3] = (uint8_t)message_id;
+	writeU32BigEndian(&(buffer[4]), substream.bytes_written);
+	writeBytesToStream(buffer, 8);
 	// Send actual message.
 	main_output_stream.bytes_written = 0;
 	main_output_stream.max_size = substream.bytes_written;
@@ -588,6 +607,40 @@ static bool otpInterjection(AskUserCommand command)
 	}
 }
 
+/** Get permission from the user to sign a transaction. If the transaction
+  * is the same as the most recently approved one (for example, another
+  * input of the same transaction is being signed), the user isn't asked
+  * again.
+  * \param transaction_hash The transaction hash (see parseTransaction()) of
+  *                         the transaction to sign. The transaction parser
+  *                         should have logged all the outputs to the user
+  *                         interface.
+  * \return true if the transaction was approved, false if it was not.
+  */
+static bool getTransactionApproval(BigNum256 transaction_hash)
+{
+	bool permission_denied;
+
+	// Does transaction_hash match previous approved transaction?
+	if (prev_transaction_hash_valid)
+	{
+		if (bigCompare(transaction_hash, prev_transaction_hash) == BIGCMP_EQUAL)
+		{
+			return true;
+		}
+	}
+	// Need to explicitly get permission from user.
+	permission_denied = buttonInterjection(ASKUSER_SIGN_TRANSACTION);
+	if (!permission_denied)
+	{
+		// User approved transaction.
+		memcpy(prev_transaction_hash, transaction_hash, 32);
+		prev_transaction_hash_valid = true;
+		return true;
+	}
+	return false;
+}
+
 /** nanopb field callback for signature data of SignTransaction message. This
   * does (or more accurately, delegates) all the "work" of transaction
   * signing: parsing the transaction, asking the user for approval, generating
@@ -601,7 +654,6 @@ bool signTransactionCallback(pb_istream_t *stream, const pb_field_t *field, void
 {
 	AddressHandle ah;
 	bool approved;
-	bool permission_denied;
 	TransactionErrors r;
 	WalletErrors wallet_return;
 	uint8_t transaction_hash[32];
@@ -627,30 +679,7 @@ bool signTransactionCallback(pb_istream_t *stream, const pb_field_t *field, void
 		return true;
 	}
 
-	// Get permission from user.
-	approved = false;
-	// Does transaction_hash match previous approved transaction?
-	if (prev_transaction_hash_valid)
-	{
-		if (bigCompare(transaction_hash, prev_transaction_hash) == BIGCMP_EQUAL)
-		{
-			approved = true;
-		}
-	}
-	if (!approved)
-	{
-		// Need to explicitly get permission from user.
-		// The call to parseTransaction() should have logged all the outputs
-		// to the user interface.
-		permission_denied = buttonInterjection(ASKUSER_SIGN_TRANSACTION);
-		if (!permission_denied)
-		{
-			// User approved transaction.
-			approved = true;
-			memcpy(prev_transaction_hash, transaction_hash, 32);
-			prev_transaction_hash_valid = true;
-		}
-	} // if (!approved)
+	approved = getTransactionApproval(transaction_hash);
 	if (approved)
 	{
 		// Okay to sign transaction.
@@ -676,6 +705,163 @@ bool signTransactionCallback(pb_istream_t *stream, const pb_field_t *field, void
 	return true;
 }
 
+/** nanopb field callback which will write out the signatures
+  * in #signatures_buffer.
+  * \param stream Output stream to write to.
+  * \param field Field which contains the Signature submessage.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool signaturesCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	uint32_t i;
+
+	if (signatures_buffer == NULL)
+	{
+		return false;
+	}
+	for (i = 0; i < num_signatures; i++)
+	{
+		if (!pb_encode_tag_for_field(stream, field))
+		{
+			return false;
+		}
+		if (!pb_encode_submessage(stream, Signature_fields, &(signatures_buffer[i])))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Sign several inputs of a transaction using only one pass over the
+  * transaction data, and send all the signatures in one Signatures message.
+  * This does the work for signTransactionBatchCallback() and
+  * signPsbtCallback().
+  * \param stream Input stream to read the transaction data from.
+  * \param is_psbt If this is true, the transaction data is a PSBT (see
+  *                parsePsbt()). If this is false, it is in the format
+  *                parseTransactionBatch() expects.
+  * \param first_input Index of the first input to sign.
+  * \param address_handles The address handle of each address which will
+  *                        sign an input, starting at first_input.
+  * \param num_inputs_to_sign Number of entries in address_handles.
+  */
+static void signBatch(pb_istream_t *stream, bool is_psbt, uint32_t first_input, uint32_t *address_handles, uint32_t num_inputs_to_sign)
+{
+	bool approved;
+	uint32_t i;
+	TransactionErrors r;
+	WalletErrors wallet_return;
+	PointAffine public_key;
+	uint8_t pubkey_hashes[MAX_BATCH_INPUTS][20];
+	uint8_t sig_hashes[MAX_BATCH_INPUTS][32];
+	uint8_t transaction_hash[32];
+	uint8_t private_key[32];
+	uint8_t signature_length;
+	Signature signatures[MAX_BATCH_INPUTS];
+	Signatures message_buffer;
+
+	// The signature hash of each input depends on the address which signs
+	// it, so those addresses are needed before the transaction is parsed.
+	// If one of them can't be obtained, the transaction still needs to be
+	// parsed, to consume it from the stream.
+	wallet_return = WALLET_NO_ERROR;
+	memset(pubkey_hashes, 0, sizeof(pubkey_hashes));
+	for (i = 0; (i < num_inputs_to_sign) && (i < MAX_BATCH_INPUTS); i++)
+	{
+		if (getAddressAndPublicKey(pubkey_hashes[i], &public_key, address_handles[i]) != WALLET_NO_ERROR)
+		{
+			wallet_return = walletGetLastError();
+			break;
+		}
+	}
+
+	// Validate transaction and calculate hashes of it.
+	clearOutputsSeen();
+	if (is_psbt)
+	{
+		r = parsePsbt(sig_hashes, transaction_hash, pubkey_hashes, first_input, num_inputs_to_sign, (uint32_t)stream->bytes_left);
+	}
+	else
+	{
+		r = parseTransactionBatch(sig_hashes, transaction_hash, pubkey_hashes, first_input, num_inputs_to_sign, (uint32_t)stream->bytes_left);
+	}
+	// See signTransactionCallback() for why this is done.
+	payload_length -= (uint32_t)stream->bytes_left;
+	stream->bytes_left = 0;
+	if (r != TRANSACTION_NO_ERROR)
+	{
+		// Transaction parse error.
+		writeFailureString(STRINGSET_TRANSACTION, (uint8_t)r);
+		return;
+	}
+	if (wallet_return != WALLET_NO_ERROR)
+	{
+		translateWalletError(wallet_return);
+		return;
+	}
+
+	approved = getTransactionApproval(transaction_hash);
+	if (approved)
+	{
+		// Okay to sign transaction. All signatures must be generated before
+		// anything can be sent, since the response is a single packet.
+		if (sizeof(signatures[0].signature_data.bytes) < MAX_SIGNATURE_LENGTH)
+		{
+			// This should never happen.
+			fatalError();
+		}
+		for (i = 0; i < num_inputs_to_sign; i++)
+		{
+			if (getPrivateKey(private_key, address_handles[i]) != WALLET_NO_ERROR)
+			{
+				wallet_return = walletGetLastError();
+				translateWalletError(wallet_return);
+				return;
+			}
+			signature_length = 0;
+			signTransaction(signatures[i].signature_data.bytes, &signature_length, sig_hashes[i], private_key);
+			signatures[i].signature_data.size = signature_length;
+		}
+		message_buffer.signature.funcs.encode = &signaturesCallback;
+		signatures_buffer = signatures;
+		num_signatures = num_inputs_to_sign;
+		sendPacket(PACKET_TYPE_SIGNATURES, Signatures_fields, &message_buffer);
+		num_signatures = 0;
+		signatures_buffer = NULL;
+	}
+}
+
+/** nanopb field callback for transaction data of SignTransactionBatch
+  * message. This is like signTransactionCallback(), except that it signs
+  * several inputs of a transaction using only one pass over the transaction
+  * data, and sends all the signatures in one Signatures message.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the transaction data.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool signTransactionBatchCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	signBatch(stream, false, sign_transaction_batch.first_input, sign_transaction_batch.address_handle, (uint32_t)sign_transaction_batch.address_handle_count);
+	return true;
+}
+
+/** nanopb field callback for PSBT data of SignPsbt message. This is like
+  * signTransactionBatchCallback(), except that the transaction data is a
+  * PSBT.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the PSBT data.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool signPsbtCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	signBatch(stream, true, sign_psbt.first_input, sign_psbt.address_handle, (uint32_t)sign_psbt.address_handle_count);
+	return true;
+}
+
 /** Send a packet containing an address and its corresponding public key.
   * This can generate new addresses as well as obtain old addresses. Both
   * use cases were combined into one function because they involve similar
@@ -810,6 +996,13 @@ static NOINLINE void getBytesOfEntropy(uint32_t num_bytes)
 	// All bytes of entropy must be collected before anything can be sent.
 	// This is because it is only safe to send those bytes if every call
 	// to getRandom256() succeeded.
+	// A random batch is used so that the entropy pool is written once,
+	// instead of once for every 32 bytes.
+	if (beginRandomBatch())
+	{
+		translateWalletError(WALLET_RNG_FAILURE);
+		return;
+	}
 	random_bytes_index = 0;
 	num_entropy_bytes = 0;
 	while (num_bytes--)
@@ -818,6 +1011,7 @@ static NOINLINE void getBytesOfEntropy(uint32_t num_bytes)
 		{
 			if (getRandom256(&(random_bytes[num_entropy_bytes])))
 			{
+				endRandomBatch();
 				translateWalletError(WALLET_RNG_FAILURE);
 				return;
 			}
@@ -826,6 +1020,7 @@ static NOINLINE void getBytesOfEntropy(uint32_t num_bytes)
 		random_bytes_index++;
 		random_bytes_index &= 31;
 	}
+	endRandomBatch();
 	message_buffer.entropy.funcs.encode = &getEntropyCallback;
 	entropy_buffer = random_bytes;
 	sendPacket(PACKET_TYPE_ENTROPY, Entropy_fields, &message_buffer);
@@ -914,6 +1109,7 @@ void processPacket(void)
 			}
 			memcpy(session_id, message_buffer.initialize.session_id.bytes, session_id_length);
 			prev_transaction_hash_valid = false;
+			clearParseCache();
 			sanitiseRam();
 			wallet_return = uninitWallet();
 			if (wallet_return == WALLET_NO_ERROR)
@@ -1090,6 +1286,20 @@ void processPacket(void)
 		receiveMessage(SignTransaction_fields, &sign_transaction);
 		break;
 
+	case PACKET_TYPE_SIGN_TRANSACTION_BATCH:
+		// Sign several inputs of a transaction.
+		sign_transaction_batch.transaction_data.funcs.decode = &signTransactionBatchCallback;
+		// Everything else is handled in signTransactionBatchCallback().
+		receiveMessage(SignTransactionBatch_fields, &sign_transaction_batch);
+		break;
+
+	case PACKET_TYPE_SIGN_PSBT:
+		// Sign several inputs of a PSBT.
+		sign_psbt.psbt_data.funcs.decode = &signPsbtCallback;
+		// Everything else is handled in signPsbtCallback().
+		receiveMessage(SignPsbt_fields, &sign_psbt);
+		break;
+
 	case PACKET_TYPE_LOAD_WALLET:
 		// Load wallet.
 		receive_failure = receiveMessage(LoadWallet_fields, &(message_buffer.load_wallet));
@@ -1390,6 +1600,34 @@ uint8_t streamGetOneByte(void)
 	}
 }
 
+/** Get bytes from the contents of the buffer set by setTestInputStream().
+  * \param buffer The bytes from the test stream buffer will be written here.
+  *               This must have space for length bytes.
+  * \param length The number of bytes to get.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	if (is_infinite_zero_stream)
+	{
+		memset(buffer, 0, length);
+	}
+	else
+	{
+		if (stream == NULL)
+		{
+			printf("ERROR: Tried to read a stream whose contents weren't set.\n");
+			exit(1);
+		}
+		if (length > (stream_length - stream_ptr))
+		{
+			printf("ERROR: Tried to read past end of stream\n");
+			exit(1);
+		}
+		memcpy(buffer, &(stream[stream_ptr]), length);
+		stream_ptr += length;
+	}
+}
+
 /** Simulate the sending of a byte by displaying its value.
   * \param one_byte The byte to send.
   */
@@ -1398,6 +1636,20 @@ void streamPutOneByte(uint8_t one_byte)
 	printf(" %02x", (int)one_byte);
 }
 
+/** Simulate the sending of bytes by displaying their values.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t i;
+
+	for (i = 0; i < length; i++)
+	{
+		streamPutOneByte(buffer[i]);
+	}
+}
+
 /** Helper for getString().
   * \param set See getString().
   * \param spec See getString().
@@ -1787,6 +2039,275 @@ static uint8_t test_stream_sign_tx[] = {
 0x23, 0x23, 0x00, 0x51, 0x00, 0x00, 0x00, 0x00
 };
 
+/** Test stream data for: sign the transaction in #test_stream_sign_tx
+  * using SignTransactionBatch, without allowing a button press. Since the
+  * transaction is the same, it should not need to be approved again. */
+static const uint8_t test_stream_sign_tx_batch[] = {
+0x23, 0x23, 0x00, 0x18, 0x00, 0x00, 0x01, 0x89,
+0x08, 0x00, 0x10, 0x01, 0x1a, 0x82, 0x03,
+// transaction data is below
+0x01, // is_ref = 1 (input)
+0x01, 0x00, 0x00, 0x00, // output number to examine
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0xdf, 0x08, 0xf9, 0xa3, 0x7c, 0x6d, 0x71, 0x3c, // previous output
+0x6a, 0x99, 0x2e, 0x88, 0x29, 0x8e, 0x0b, 0x4c,
+0x8f, 0xb5, 0xf9, 0x0e, 0x11, 0xf0, 0x2c, 0xa7,
+0x36, 0x72, 0xeb, 0x58, 0xb3, 0x04, 0xef, 0xc0,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x8a, // script length
+0x47, // 71 bytes of data follows
+0x30, 0x44, 0x02, 0x20, 0x1b, 0xf4, 0xef, 0x3c, 0x34, 0x96, 0x02, 0x9b, 0x1a,
+0xb1, 0xc8, 0x49, 0xbf, 0x18, 0x55, 0xcc, 0x16, 0xbc, 0x52, 0x6d, 0xcc, 0x20,
+0xfb, 0x7c, 0x0a, 0x1d, 0x48, 0xd6, 0xe9, 0xbd, 0xd7, 0xb1, 0x02, 0x20, 0x53,
+0xb1, 0xa3, 0xaa, 0xbf, 0xd3, 0x87, 0x84, 0xdc, 0xf3, 0x10, 0xe5, 0xd2, 0x09,
+0xa4, 0xba, 0xb0, 0x01, 0x62, 0xe5, 0xbc, 0x09, 0x75, 0x9d, 0x4f, 0x74, 0x2c,
+0xb4, 0x6b, 0x32, 0x37, 0x2c, 0x01,
+0x41, // 65 bytes of data follows
+0x04, 0x05, 0x4d, 0xb5, 0xe0, 0x8e, 0x2a, 0x33, 0x89, 0x2c, 0xf3, 0x4b, 0x7e,
+0xbc, 0x18, 0x3b, 0xa5, 0xf5, 0x54, 0xc6, 0x9d, 0x6d, 0x21, 0x65, 0x60, 0x89,
+0xf5, 0x5e, 0x2d, 0x0f, 0x3a, 0x68, 0x08, 0x23, 0x83, 0x19, 0xcd, 0x89, 0xba,
+0xda, 0x09, 0x9b, 0xc6, 0xef, 0x3f, 0xdc, 0x80, 0xd8, 0x7a, 0xb2, 0xbf, 0x2b,
+0x37, 0x18, 0xdd, 0x4a, 0x4e, 0x36, 0x09, 0x60, 0x28, 0x6e, 0x2e, 0x77, 0x57,
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0xc0, 0xa4, 0x70, 0x57, 0x00, 0x00, 0x00, 0x00, // 14.67 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 1Q6W8HTPdwccCkLRMLJpYkGvweKhpsKKjE
+0xfd, 0x55, 0x49, 0x20, 0x22, 0xa0, 0x3f, 0xf7, 0x7a, 0x9d,
+0xe0, 0x0d, 0xa2, 0x18, 0x08, 0x0c, 0xa9, 0x51, 0xde, 0xef,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x40, 0x54, 0x92, 0x3d, 0x00, 0x00, 0x00, 0x00, // 10.33 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16E7VhudyU3iXNddNazG8sChjQwfWcrHNw
+0x39, 0x53, 0x75, 0x46, 0x88, 0x84, 0x3d, 0xe5, 0x50, 0x0b,
+0x79, 0x91, 0x33, 0x7f, 0x96, 0xf5, 0x41, 0x71, 0x48, 0xa1,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+// The main (spending) transaction.
+0x00, // is_ref = 0 (main)
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0xee, 0xce, 0xae, 0x86, 0xf5, 0x70, 0x4d, 0x76, // previous output
+0xb8, 0x54, 0x5e, 0x6d, 0xcf, 0x21, 0xf1, 0x75,
+0x35, 0x7f, 0x83, 0xbd, 0xa4, 0x96, 0x43, 0x83,
+0xd6, 0xdd, 0x7e, 0x41, 0x68, 0x1b, 0x5e, 0x1a,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x00, // script length (filled in by device)
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
+0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
+0x01, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+0x01, 0x00, 0x00, 0x00, // hashtype
+};
+
+/** Test stream data for: sign the same transaction as
+  * #test_stream_sign_tx_batch, sent as a PSBT. */
+static const uint8_t test_stream_sign_psbt[] = {
+0x23, 0x23, 0x00, 0x19, 0x00, 0x00, 0x01, 0x90,
+0x08, 0x00, 0x10, 0x01, 0x1a, 0x89, 0x03,
+// PSBT data is below
+0x70, 0x73, 0x62, 0x74, 0xff, // magic bytes
+0x01, 0x00, // key: unsigned transaction
+0x77, // value length
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0xee, 0xce, 0xae, 0x86, 0xf5, 0x70, 0x4d, 0x76, // previous output
+0xb8, 0x54, 0x5e, 0x6d, 0xcf, 0x21, 0xf1, 0x75,
+0x35, 0x7f, 0x83, 0xbd, 0xa4, 0x96, 0x43, 0x83,
+0xd6, 0xdd, 0x7e, 0x41, 0x68, 0x1b, 0x5e, 0x1a,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x00, // script length (filled in by device)
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
+0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
+0x01, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+0x00, // end of global map
+0x01, 0x00, // key: non-witness UTXO of input 0
+0xfd, 0x01, 0x01, // value length
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0xdf, 0x08, 0xf9, 0xa3, 0x7c, 0x6d, 0x71, 0x3c, // previous output
+0x6a, 0x99, 0x2e, 0x88, 0x29, 0x8e, 0x0b, 0x4c,
+0x8f, 0xb5, 0xf9, 0x0e, 0x11, 0xf0, 0x2c, 0xa7,
+0x36, 0x72, 0xeb, 0x58, 0xb3, 0x04, 0xef, 0xc0,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x8a, // script length
+0x47, // 71 bytes of data follows
+0x30, 0x44, 0x02, 0x20, 0x1b, 0xf4, 0xef, 0x3c, 0x34, 0x96, 0x02, 0x9b, 0x1a,
+0xb1, 0xc8, 0x49, 0xbf, 0x18, 0x55, 0xcc, 0x16, 0xbc, 0x52, 0x6d, 0xcc, 0x20,
+0xfb, 0x7c, 0x0a, 0x1d, 0x48, 0xd6, 0xe9, 0xbd, 0xd7, 0xb1, 0x02, 0x20, 0x53,
+0xb1, 0xa3, 0xaa, 0xbf, 0xd3, 0x87, 0x84, 0xdc, 0xf3, 0x10, 0xe5, 0xd2, 0x09,
+0xa4, 0xba, 0xb0, 0x01, 0x62, 0xe5, 0xbc, 0x09, 0x75, 0x9d, 0x4f, 0x74, 0x2c,
+0xb4, 0x6b, 0x32, 0x37, 0x2c, 0x01,
+0x41, // 65 bytes of data follows
+0x04, 0x05, 0x4d, 0xb5, 0xe0, 0x8e, 0x2a, 0x33, 0x89, 0x2c, 0xf3, 0x4b, 0x7e,
+0xbc, 0x18, 0x3b, 0xa5, 0xf5, 0x54, 0xc6, 0x9d, 0x6d, 0x21, 0x65, 0x60, 0x89,
+0xf5, 0x5e, 0x2d, 0x0f, 0x3a, 0x68, 0x08, 0x23, 0x83, 0x19, 0xcd, 0x89, 0xba,
+0xda, 0x09, 0x9b, 0xc6, 0xef, 0x3f, 0xdc, 0x80, 0xd8, 0x7a, 0xb2, 0xbf, 0x2b,
+0x37, 0x18, 0xdd, 0x4a, 0x4e, 0x36, 0x09, 0x60, 0x28, 0x6e, 0x2e, 0x77, 0x57,
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0xc0, 0xa4, 0x70, 0x57, 0x00, 0x00, 0x00, 0x00, // 14.67 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 1Q6W8HTPdwccCkLRMLJpYkGvweKhpsKKjE
+0xfd, 0x55, 0x49, 0x20, 0x22, 0xa0, 0x3f, 0xf7, 0x7a, 0x9d,
+0xe0, 0x0d, 0xa2, 0x18, 0x08, 0x0c, 0xa9, 0x51, 0xde, 0xef,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x40, 0x54, 0x92, 0x3d, 0x00, 0x00, 0x00, 0x00, // 10.33 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16E7VhudyU3iXNddNazG8sChjQwfWcrHNw
+0x39, 0x53, 0x75, 0x46, 0x88, 0x84, 0x3d, 0xe5, 0x50, 0x0b,
+0x79, 0x91, 0x33, 0x7f, 0x96, 0xf5, 0x41, 0x71, 0x48, 0xa1,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+0x00, // end of input 0 map
+0x00, // end of output 0 map
+0x00 // end of output 1 map
+};
+
+/** Test stream data for: sign more inputs than
+  * #test_stream_sign_tx_batch has. */
+static const uint8_t test_stream_sign_tx_batch_too_many[] = {
+0x23, 0x23, 0x00, 0x18, 0x00, 0x00, 0x01, 0x8b,
+0x08, 0x00, 0x10, 0x01, 0x10, 0x02, 0x1a, 0x82, 0x03,
+// transaction data is below
+0x01, // is_ref = 1 (input)
+0x01, 0x00, 0x00, 0x00, // output number to examine
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0xdf, 0x08, 0xf9, 0xa3, 0x7c, 0x6d, 0x71, 0x3c, // previous output
+0x6a, 0x99, 0x2e, 0x88, 0x29, 0x8e, 0x0b, 0x4c,
+0x8f, 0xb5, 0xf9, 0x0e, 0x11, 0xf0, 0x2c, 0xa7,
+0x36, 0x72, 0xeb, 0x58, 0xb3, 0x04, 0xef, 0xc0,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x8a, // script length
+0x47, // 71 bytes of data follows
+0x30, 0x44, 0x02, 0x20, 0x1b, 0xf4, 0xef, 0x3c, 0x34, 0x96, 0x02, 0x9b, 0x1a,
+0xb1, 0xc8, 0x49, 0xbf, 0x18, 0x55, 0xcc, 0x16, 0xbc, 0x52, 0x6d, 0xcc, 0x20,
+0xfb, 0x7c, 0x0a, 0x1d, 0x48, 0xd6, 0xe9, 0xbd, 0xd7, 0xb1, 0x02, 0x20, 0x53,
+0xb1, 0xa3, 0xaa, 0xbf, 0xd3, 0x87, 0x84, 0xdc, 0xf3, 0x10, 0xe5, 0xd2, 0x09,
+0xa4, 0xba, 0xb0, 0x01, 0x62, 0xe5, 0xbc, 0x09, 0x75, 0x9d, 0x4f, 0x74, 0x2c,
+0xb4, 0x6b, 0x32, 0x37, 0x2c, 0x01,
+0x41, // 65 bytes of data follows
+0x04, 0x05, 0x4d, 0xb5, 0xe0, 0x8e, 0x2a, 0x33, 0x89, 0x2c, 0xf3, 0x4b, 0x7e,
+0xbc, 0x18, 0x3b, 0xa5, 0xf5, 0x54, 0xc6, 0x9d, 0x6d, 0x21, 0x65, 0x60, 0x89,
+0xf5, 0x5e, 0x2d, 0x0f, 0x3a, 0x68, 0x08, 0x23, 0x83, 0x19, 0xcd, 0x89, 0xba,
+0xda, 0x09, 0x9b, 0xc6, 0xef, 0x3f, 0xdc, 0x80, 0xd8, 0x7a, 0xb2, 0xbf, 0x2b,
+0x37, 0x18, 0xdd, 0x4a, 0x4e, 0x36, 0x09, 0x60, 0x28, 0x6e, 0x2e, 0x77, 0x57,
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0xc0, 0xa4, 0x70, 0x57, 0x00, 0x00, 0x00, 0x00, // 14.67 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 1Q6W8HTPdwccCkLRMLJpYkGvweKhpsKKjE
+0xfd, 0x55, 0x49, 0x20, 0x22, 0xa0, 0x3f, 0xf7, 0x7a, 0x9d,
+0xe0, 0x0d, 0xa2, 0x18, 0x08, 0x0c, 0xa9, 0x51, 0xde, 0xef,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x40, 0x54, 0x92, 0x3d, 0x00, 0x00, 0x00, 0x00, // 10.33 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16E7VhudyU3iXNddNazG8sChjQwfWcrHNw
+0x39, 0x53, 0x75, 0x46, 0x88, 0x84, 0x3d, 0xe5, 0x50, 0x0b,
+0x79, 0x91, 0x33, 0x7f, 0x96, 0xf5, 0x41, 0x71, 0x48, 0xa1,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+// The main (spending) transaction.
+0x00, // is_ref = 0 (main)
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0xee, 0xce, 0xae, 0x86, 0xf5, 0x70, 0x4d, 0x76, // previous output
+0xb8, 0x54, 0x5e, 0x6d, 0xcf, 0x21, 0xf1, 0x75,
+0x35, 0x7f, 0x83, 0xbd, 0xa4, 0x96, 0x43, 0x83,
+0xd6, 0xdd, 0x7e, 0x41, 0x68, 0x1b, 0x5e, 0x1a,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x00, // script length (filled in by device)
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
+0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
+0x01, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+0x01, 0x00, 0x00, 0x00, // hashtype
+};
+
 /** Test stream data for: format storage and allow button press. */
 static const uint8_t test_stream_format[] = {
 0x23, 0x23, 0x00, 0x0d, 0x00, 0x00, 0x00, 0x22,
@@ -2009,6 +2530,12 @@ int main(void)
 	SEND_ONE_TEST_STREAM(test_stream_sign_tx);
 	printf("Signing transaction again...\n");
 	SEND_ONE_TEST_STREAM(test_stream_sign_tx);
+	printf("Signing transaction again, using a batch...\n");
+	SEND_ONE_TEST_STREAM(test_stream_sign_tx_batch);
+	printf("Signing too many inputs in a batch...\n");
+	SEND_ONE_TEST_STREAM(test_stream_sign_tx_batch_too_many);
+	printf("Signing transaction again, using a PSBT...\n");
+	SEND_ONE_TEST_STREAM(test_stream_sign_psbt);
 	printf("Loading wallet using incorrect key...\n");
 	SEND_ONE_TEST_STREAM(test_stream_load_incorrect);
 	printf("Loading wallet using correct key...\n");
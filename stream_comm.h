@@ -60,6 +60,10 @@
 #define PACKET_TYPE_DELETE_WALLET		0x16
 /** Initialise device's state. */
 #define PACKET_TYPE_INITIALIZE			0x17
+/** Sign several inputs of a transaction at once. */
+#define PACKET_TYPE_SIGN_TRANSACTION_BATCH	0x18
+/** Sign several inputs of a partially signed transaction (PSBT). */
+#define PACKET_TYPE_SIGN_PSBT			0x19
 /** An address from a wallet (response to #PACKET_TYPE_GET_ADDRESS_PUBKEY
   * or #PACKET_TYPE_NEW_ADDRESS). */
 #define PACKET_TYPE_ADDRESS_PUBKEY		0x30
@@ -85,6 +89,9 @@
 #define PACKET_TYPE_SIGNATURE			0x39
 /** Version information and list of features. */
 #define PACKET_TYPE_FEATURES			0x3a
+/** Signatures (response to #PACKET_TYPE_SIGN_TRANSACTION_BATCH or
+  * #PACKET_TYPE_SIGN_PSBT). */
+#define PACKET_TYPE_SIGNATURES			0x3b
 /** Device wants to wait for button press (beginning of ButtonRequest
   * interjection). */
 #define PACKET_TYPE_BUTTON_REQUEST		0x50
@@ -18,6 +18,7 @@
 #ifdef TEST
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #endif // #ifdef TEST
 
 #ifdef TEST_TRANSACTION
@@ -54,11 +55,100 @@
   */
 #define MAX_OUTPUTS				2000
 
+#ifndef PARSE_CACHE_ENTRIES
+/** Number of entries in the parse cache. Each entry remembers the input
+  * references and total input amount of a spending transaction whose input
+  * transactions were successfully validated, so that the input transactions
+  * don't need to be sent and parsed again for every signature (see
+  * parseTransaction()). Set this to 0 to disable the parse cache. */
+#define PARSE_CACHE_ENTRIES		2
+#endif // #ifndef PARSE_CACHE_ENTRIES
+
+#ifndef PSBT_MAX_INPUTS
+/** The maximum number of inputs that parsePsbt() is prepared to handle. The
+  * non-witness UTXOs of a PSBT come after its unsigned transaction, so the
+  * output number of each input has to be remembered until then. Each input
+  * costs 4 bytes of RAM. */
+#define PSBT_MAX_INPUTS			32
+#endif // #ifndef PSBT_MAX_INPUTS
+
+/** \defgroup PSBTKeyTypes Types of PSBT (BIP 174) keys.
+  *
+  * @{
+  */
+/** Global key type for the unsigned transaction. */
+#define PSBT_GLOBAL_UNSIGNED_TX		0x00
+/** Input key type for a non-witness UTXO (the whole transaction which
+  * an input spends). */
+#define PSBT_IN_NON_WITNESS_UTXO	0x00
+/** Input key type for a witness UTXO (just the output which an input
+  * spends). */
+#define PSBT_IN_WITNESS_UTXO		0x01
+/** Input key type for the sighash type to sign with. */
+#define PSBT_IN_SIGHASH_TYPE		0x03
+/**@}*/
+
+/** The magic bytes which every PSBT begins with: "psbt" then 0xff. */
+static const uint8_t psbt_magic[5] = {0x70, 0x73, 0x62, 0x74, 0xff};
+
 /** The maximum amount that can appear in an output, stored as a little-endian
   * multi-precision integer. This represents 21 million BTC. */
 static const uint8_t max_money[] = {
 0x00, 0x40, 0x07, 0x5A, 0xF0, 0x75, 0x07, 0x00};
 
+#if PARSE_CACHE_ENTRIES > 0
+/** One entry of the parse cache. */
+typedef struct ParseCacheEntryStruct
+{
+	/** Whether this entry contains anything. */
+	bool valid;
+	/** The double SHA-256 hash of the input references (output numbers and
+	  * transaction hashes) of a spending transaction. This identifies which
+	  * outputs of which transactions are being spent. */
+	uint8_t ref_compare_hash[32];
+	/** Sum of the amounts of all the outputs referred to
+	  * by #ref_compare_hash, as a little-endian multi-precision integer. */
+	uint8_t input_amount[8];
+} ParseCacheEntry;
+
+/** Parse cache, which is only written to after input transactions have been
+  * validated. It is cleared by clearParseCache(). */
+static ParseCacheEntry parse_cache[PARSE_CACHE_ENTRIES];
+/** Index into #parse_cache of the entry which will be replaced next. */
+static uint8_t parse_cache_next;
+#endif // #if PARSE_CACHE_ENTRIES > 0
+
+/** The parts of an input which are needed to compute its BIP 143 signature
+  * hash, other than the parts which are common to all inputs. */
+typedef struct SegwitInputStruct
+{
+	/** Transaction hash and output number of the output being spent. */
+	uint8_t outpoint[36];
+	/** Amount of the output being spent, as a little-endian multi-precision
+	  * integer. */
+	uint8_t amount[8];
+	/** Sequence number of the input. */
+	uint8_t sequence[4];
+} SegwitInput;
+
+/** Everything needed to compute BIP 143 (segregated witness version 0)
+  * signature hashes for a batch of inputs. The three hash states are written
+  * to while the transaction is parsed, so the only thing which has to be done
+  * for each input afterwards is to hash a short, fixed-size message. */
+typedef struct SegwitStateStruct
+{
+	/** Used to calculate hashPrevouts, the hash of all outpoints. */
+	HashState prevouts_hs;
+	/** Used to calculate hashSequence, the hash of all sequence numbers. */
+	HashState sequence_hs;
+	/** Used to calculate hashOutputs, the hash of all outputs. */
+	HashState outputs_hs;
+	/** Transaction version. */
+	uint8_t version[4];
+	/** Inputs in the batch. */
+	SegwitInput inputs[MAX_BATCH_INPUTS];
+} SegwitState;
+
 /** The transaction fee amount, calculated as output amounts subtracted from
   * input amounts. */
 static uint8_t transaction_fee_amount[8];
@@ -94,6 +184,85 @@ static HashState *sig_hash_hs_ptr;
   *          stop getTransactionBytes() from attempting to dereference this.
   */
 static HashState *transaction_hash_hs_ptr;
+/** Number of consecutive hash states, starting at #sig_hash_hs_ptr, which
+  * getTransactionBytes() will write transaction data to. This is 1 except
+  * when parseTransactionBatch() is parsing the spending transaction. */
+static uint32_t num_sig_hash_hs;
+/** Public key hashes of the addresses which will sign each input in a batch,
+  * or NULL if not parsing a batch (see parseTransactionBatch()). */
+static uint8_t (*batch_pubkey_hashes)[20];
+/** Storage for BIP 143 signature hash calculation, or NULL if
+  * segregated witness spending transactions aren't allowed
+  * (see parseTransactionBatch()). */
+static SegwitState *segwit_state;
+/** If this is not NULL, then as the transaction contents are read from the
+  * stream device, they will also be written to the hash state this points
+  * to. This is used to calculate the hashes in #segwit_state. */
+static HashState *segwit_hs_ptr;
+/** Index (in the spending transaction) of the first input in a batch. */
+static uint32_t batch_first_input;
+/** Number of inputs in a batch. */
+static uint32_t batch_num_inputs;
+/** This is true while parsePsbt() is using parseTransactionInternal() to
+  * parse a transaction embedded in a PSBT. Such a transaction has no is_ref
+  * byte, output number or hashtype in the stream. */
+static bool parsing_psbt;
+/** If #parsing_psbt is true and this is not NULL, then the transaction being
+  * parsed is a non-witness UTXO (i.e. an input transaction) and this points
+  * to the 4 byte output number which is spent. If this is NULL, the
+  * transaction being parsed is the unsigned (i.e. spending) transaction. */
+static uint8_t *psbt_output_number;
+/** Output number of each input of a PSBT's unsigned transaction. */
+static uint8_t psbt_output_numbers[PSBT_MAX_INPUTS][4];
+/** Number of inputs in a PSBT's unsigned transaction. */
+static uint32_t psbt_num_inputs;
+/** Number of outputs in a PSBT's unsigned transaction. */
+static uint32_t psbt_num_outputs;
+/** Double SHA-256 of the input references of a PSBT's unsigned transaction,
+  * in the same format as the reference compare hash of
+  * parseTransactionInternal(). */
+static uint8_t psbt_ref_compare_hash[32];
+
+#ifdef TEST_TRANSACTION
+/** Number of bytes written to hash states by hashTransactionBytes(). This is
+  * used by benchmarkParser() to estimate how much time is spent hashing. */
+static uint32_t num_bytes_hashed;
+#endif // #ifdef TEST_TRANSACTION
+
+/** Write bytes to the hash states which getTransactionBytes() writes
+  * transaction data to.
+  * \param buffer The bytes to write.
+  * \param length The number of bytes to write.
+  */
+static void hashTransactionBytes(const uint8_t *buffer, uint8_t length)
+{
+	uint8_t i;
+	uint32_t k;
+
+	if (hs_ptr_valid)
+	{
+#ifdef TEST_TRANSACTION
+		num_bytes_hashed += (uint32_t)length * (num_sig_hash_hs
+			+ (suppress_transaction_hash ? 0 : 1)
+			+ ((segwit_hs_ptr != NULL) ? 1 : 0));
+#endif // #ifdef TEST_TRANSACTION
+		for (i = 0; i < length; i++)
+		{
+			for (k = 0; k < num_sig_hash_hs; k++)
+			{
+				sha256WriteByte(&(sig_hash_hs_ptr[k]), buffer[i]);
+			}
+			if (!suppress_transaction_hash)
+			{
+				sha256WriteByte(transaction_hash_hs_ptr, buffer[i]);
+			}
+			if (segwit_hs_ptr != NULL)
+			{
+				sha256WriteByte(segwit_hs_ptr, buffer[i]);
+			}
+		}
+	}
+}
 
 /** Get transaction data by reading from the stream device, checking that
   * the read operation won't go beyond the end of the transaction data.
@@ -109,9 +278,6 @@ static HashState *transaction_hash_hs_ptr;
   */
 static bool getTransactionBytes(uint8_t *buffer, uint8_t length)
 {
-	uint8_t i;
-	uint8_t one_byte;
-
 	if (transaction_data_index > (0xffffffff - (uint32_t)length))
 	{
 		// transaction_data_index + (uint32_t)length will overflow.
@@ -125,20 +291,9 @@ static bool getTransactionBytes(uint8_t *buffer, uint8_t length)
 	}
 	else
 	{
-		for (i = 0; i < length; i++)
-		{
-			one_byte = streamGetOneByte();
-			buffer[i] = one_byte;
-			if (hs_ptr_valid)
-			{
-				sha256WriteByte(sig_hash_hs_ptr, one_byte);
-				if (!suppress_transaction_hash)
-				{
-					sha256WriteByte(transaction_hash_hs_ptr, one_byte);
-				}
-			}
-			transaction_data_index++;
-		}
+		streamGetBytes(buffer, length);
+		hashTransactionBytes(buffer, length);
+		transaction_data_index += length;
 		return false;
 	}
 }
@@ -204,13 +359,179 @@ static bool getVarInt(uint32_t *out)
 	return false; // success
 }
 
+#if PARSE_CACHE_ENTRIES > 0
+/** Look for a set of input references in the parse cache.
+  * \param out_input_amount If the input references were found, the total
+  *                         amount of the outputs they refer to will be
+  *                         written here, as an 8 byte little-endian
+  *                         multi-precision integer.
+  * \param ref_compare_hash Double SHA-256 hash of the input references,
+  *                         as computed by parseTransactionInternal().
+  * \return false if the input references were found, true if they were
+  *         not.
+  */
+static bool lookupParseCache(uint8_t *out_input_amount, const uint8_t *ref_compare_hash)
+{
+	uint8_t i;
+
+	for (i = 0; i < PARSE_CACHE_ENTRIES; i++)
+	{
+		if (parse_cache[i].valid && !memcmp(parse_cache[i].ref_compare_hash, ref_compare_hash, 32))
+		{
+			memcpy(out_input_amount, parse_cache[i].input_amount, 8);
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Add a set of validated input references to the parse cache, replacing
+  * the oldest entry if the cache is full. Nothing is added if the input
+  * references are already in the cache.
+  * \param ref_compare_hash Double SHA-256 hash of the input references,
+  *                         as computed by parseTransactionInternal().
+  * \param input_amount The total amount of the outputs referred to, as an
+  *                     8 byte little-endian multi-precision integer.
+  */
+static void updateParseCache(const uint8_t *ref_compare_hash, const uint8_t *input_amount)
+{
+	uint8_t junk[8];
+
+	if (lookupParseCache(junk, ref_compare_hash))
+	{
+		parse_cache[parse_cache_next].valid = true;
+		memcpy(parse_cache[parse_cache_next].ref_compare_hash, ref_compare_hash, 32);
+		memcpy(parse_cache[parse_cache_next].input_amount, input_amount, 8);
+		parse_cache_next++;
+		if (parse_cache_next >= PARSE_CACHE_ENTRIES)
+		{
+			parse_cache_next = 0;
+		}
+	}
+}
+#endif // #if PARSE_CACHE_ENTRIES > 0
+
+/** Clear the parse cache, so that input transactions need to be sent in full
+  * again. This should be called at the start of every session.
+  */
+void clearParseCache(void)
+{
+#if PARSE_CACHE_ENTRIES > 0
+	memset(parse_cache, 0, sizeof(parse_cache));
+	parse_cache_next = 0;
+#endif // #if PARSE_CACHE_ENTRIES > 0
+}
+
+/** Write the input script of one input of the spending transaction to each
+  * of the signature hashes in a batch. The input being signed by a hash gets
+  * the standard, pay to public key hash output script of the address which
+  * signs it; every other input gets an empty script. This is the same
+  * substitution that a host does when it uses SignTransaction.
+  * \param input_index Index (in the spending transaction) of the input
+  *                    whose script is to be written.
+  */
+static void writeBatchInputScripts(uint32_t input_index)
+{
+	uint32_t k;
+	uint8_t j;
+	HashState *hs;
+
+	for (k = 0; k < num_sig_hash_hs; k++)
+	{
+		hs = &(sig_hash_hs_ptr[k]);
+		if (input_index == (batch_first_input + k))
+		{
+			// Script length, then OP_DUP, OP_HASH160, (20 bytes of data),
+			// OP_EQUALVERIFY, OP_CHECKSIG.
+			sha256WriteByte(hs, 0x19);
+			sha256WriteByte(hs, 0x76);
+			sha256WriteByte(hs, 0xa9);
+			sha256WriteByte(hs, 0x14);
+			for (j = 0; j < 20; j++)
+			{
+				sha256WriteByte(hs, batch_pubkey_hashes[k][j]);
+			}
+			sha256WriteByte(hs, 0x88);
+			sha256WriteByte(hs, 0xac);
+		}
+		else
+		{
+			sha256WriteByte(hs, 0x00); // empty script
+		}
+	}
+}
+
+/** Write an array of bytes to a SHA-256 hash state.
+  * \param hs The hash state to write to.
+  * \param buffer The bytes to write.
+  * \param length The number of bytes to write.
+  */
+static void sha256WriteBytes(HashState *hs, const uint8_t *buffer, uint8_t length)
+{
+	uint8_t i;
+
+	for (i = 0; i < length; i++)
+	{
+		sha256WriteByte(hs, buffer[i]);
+	}
+}
+
+/** Calculate the BIP 143 signature hash of each input in a batch. This must
+  * only be called after the whole spending transaction has been parsed,
+  * since hashOutputs is part of every signature hash.
+  * \param sig_hash The signature hashes will be written here, in the same
+  *                 format as for parseTransactionBatch().
+  * \param locktime The locktime of the spending transaction.
+  * \param hashtype The hashtype which was appended to the spending
+  *                 transaction.
+  */
+static void calculateSegwitSigHashes(uint8_t *sig_hash, uint8_t *locktime, uint8_t *hashtype)
+{
+	uint8_t hash_prevouts[32];
+	uint8_t hash_sequence[32];
+	uint8_t hash_outputs[32];
+	uint8_t script_code_prefix[4] = {0x19, 0x76, 0xa9, 0x14};
+	uint8_t script_code_suffix[2] = {0x88, 0xac};
+	uint32_t k;
+	HashState hs;
+
+	sha256FinishDouble(&(segwit_state->prevouts_hs));
+	writeHashToByteArray(hash_prevouts, &(segwit_state->prevouts_hs), true);
+	sha256FinishDouble(&(segwit_state->sequence_hs));
+	writeHashToByteArray(hash_sequence, &(segwit_state->sequence_hs), true);
+	sha256FinishDouble(&(segwit_state->outputs_hs));
+	writeHashToByteArray(hash_outputs, &(segwit_state->outputs_hs), true);
+	for (k = 0; k < batch_num_inputs; k++)
+	{
+		sha256Begin(&hs);
+		sha256WriteBytes(&hs, segwit_state->version, 4);
+		sha256WriteBytes(&hs, hash_prevouts, 32);
+		sha256WriteBytes(&hs, hash_sequence, 32);
+		sha256WriteBytes(&hs, segwit_state->inputs[k].outpoint, 36);
+		// The script code is the pay to public key hash script of the
+		// address which will sign this input.
+		sha256WriteBytes(&hs, script_code_prefix, 4);
+		sha256WriteBytes(&hs, batch_pubkey_hashes[k], 20);
+		sha256WriteBytes(&hs, script_code_suffix, 2);
+		sha256WriteBytes(&hs, segwit_state->inputs[k].amount, 8);
+		sha256WriteBytes(&hs, segwit_state->inputs[k].sequence, 4);
+		sha256WriteBytes(&hs, hash_outputs, 32);
+		sha256WriteBytes(&hs, locktime, 4);
+		sha256WriteBytes(&hs, hashtype, 4);
+		sha256FinishDouble(&hs);
+		writeHashToByteArray(&(sig_hash[k * 32]), &hs, false);
+	}
+}
+
 /** See comments for parseTransaction() for description of what this does
   * and return values. However, the guts of the transaction parser are in
   * the code to this function.
   * 
   * This is called once for each input transaction and once for the spending
   * transaction.
-  * \param sig_hash See parseTransaction().
+  * \param sig_hash See parseTransaction(). When parsing the spending
+  *                 transaction of a batch, this must have space for one
+  *                 32 byte signature hash for each input in the batch.
   * \param transaction_hash See parseTransaction().
   * \param is_ref_out On success, this will be written with true
   *                   if the transaction parser parsed an input (i.e.
@@ -226,6 +547,8 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 {
 	uint8_t temp[32];
 	uint8_t ref_compare_hash[32];
+	uint8_t input_amount[8];
+	uint8_t locktime[4];
 	uint32_t num_inputs;
 	uint32_t num_outputs;
 	uint32_t script_length;
@@ -235,8 +558,12 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 	uint32_t k;
 	uint32_t output_num_select;
 	bool is_ref;
+	bool use_parse_cache;
+	bool is_segwit;
+	uint8_t output_amount[8];
+	uint8_t output_hash[20];
+	uint8_t output_address_version;
 	char text_amount[TEXT_AMOUNT_LENGTH];
-	char text_address[TEXT_ADDRESS_LENGTH];
 
 	if (transaction_length > MAX_TRANSACTION_SIZE)
 	{
@@ -248,17 +575,45 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 	// be included in the signature/transaction hash.
 	hs_ptr_valid = false;
 
-	if (getTransactionBytes(temp, 1))
+	use_parse_cache = false;
+	is_segwit = false;
+	if (parsing_psbt)
 	{
-		return TRANSACTION_INVALID_FORMAT; // transaction truncated
-	}
-	if (temp[0] != 0)
-	{
-		is_ref = true;
+		// There is no is_ref byte; parsePsbt() knows what is being parsed.
+		is_ref = (psbt_output_number != NULL);
 	}
 	else
 	{
-		is_ref = false;
+		if (getTransactionBytes(temp, 1))
+		{
+			return TRANSACTION_INVALID_FORMAT; // transaction truncated
+		}
+		if (temp[0] == 0x03)
+		{
+			// Segregated witness spending transaction, with the amount of
+			// each input included in the transaction data.
+			if (segwit_state == NULL)
+			{
+				return TRANSACTION_NON_STANDARD; // segwit not allowed here
+			}
+			is_ref = false;
+			is_segwit = true;
+		}
+		else if (temp[0] == 0x02)
+		{
+			// Spending transaction whose input transactions were validated
+			// during a previous call and are in the parse cache.
+			is_ref = false;
+			use_parse_cache = true;
+		}
+		else if (temp[0] != 0)
+		{
+			is_ref = true;
+		}
+		else
+		{
+			is_ref = false;
+		}
 	}
 	*is_ref_out = is_ref;
 
@@ -266,7 +621,11 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 	if (is_ref)
 	{
 		// Get output number to add to total amount.
-		if (getTransactionBytes(temp, 4))
+		if (parsing_psbt)
+		{
+			memcpy(temp, psbt_output_number, 4);
+		}
+		else if (getTransactionBytes(temp, 4))
 		{
 			return TRANSACTION_INVALID_FORMAT; // transaction truncated
 		}
@@ -284,7 +643,29 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		sha256Begin(ref_compare_hs);
 	}
 
-	sha256Begin(sig_hash_hs_ptr);
+	if (is_segwit)
+	{
+		// Legacy signature hashes aren't needed.
+		num_sig_hash_hs = 0;
+		sha256Begin(&(segwit_state->prevouts_hs));
+		sha256Begin(&(segwit_state->sequence_hs));
+		sha256Begin(&(segwit_state->outputs_hs));
+		// Input amounts come from the transaction data, not from input
+		// transactions.
+		memset(transaction_fee_amount, 0, sizeof(transaction_fee_amount));
+	}
+	else if (is_ref || (batch_pubkey_hashes == NULL))
+	{
+		num_sig_hash_hs = 1;
+	}
+	else
+	{
+		num_sig_hash_hs = batch_num_inputs;
+	}
+	for (k = 0; k < num_sig_hash_hs; k++)
+	{
+		sha256Begin(&(sig_hash_hs_ptr[k]));
+	}
 	sha256Begin(transaction_hash_hs_ptr);
 	hs_ptr_valid = true;
 	suppress_transaction_hash = false;
@@ -298,6 +679,10 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 	{
 		return TRANSACTION_NON_STANDARD; // unsupported transaction version
 	}
+	if (is_segwit)
+	{
+		memcpy(segwit_state->version, temp, 4);
+	}
 
 	// Get number of inputs.
 	if (getVarInt(&num_inputs))
@@ -312,10 +697,39 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 	{
 		return TRANSACTION_TOO_MANY_INPUTS; // too many inputs
 	}
+	if (parsing_psbt && !is_ref)
+	{
+		if (num_inputs > PSBT_MAX_INPUTS)
+		{
+			return TRANSACTION_TOO_MANY_INPUTS; // too many inputs
+		}
+		psbt_num_inputs = num_inputs;
+	}
+	if (is_segwit)
+	{
+		// The amount of each input is only committed to by that input's
+		// signature. If some inputs were signed in a different batch, a host
+		// could understate their amounts here (and the amounts of this
+		// batch's inputs in the other batch), so that every signature is
+		// valid but the fee shown to the user is too low. Thus every input
+		// must be signed in one batch.
+		if (num_inputs > MAX_BATCH_INPUTS)
+		{
+			return TRANSACTION_TOO_MANY_INPUTS; // too many inputs to sign at once
+		}
+		if ((batch_first_input != 0) || (batch_num_inputs != num_inputs))
+		{
+			return TRANSACTION_INVALID_REFERENCE; // batch doesn't cover every input
+		}
+	}
 
 	// Process each input.
 	for (i = 0; i < num_inputs; i++)
 	{
+		if (is_segwit)
+		{
+			segwit_hs_ptr = &(segwit_state->prevouts_hs);
+		}
 		// Get input transaction reference hash.
 		if (getTransactionBytes(temp, 32))
 		{
@@ -326,6 +740,16 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		{
 			return TRANSACTION_INVALID_FORMAT; // transaction truncated
 		}
+		segwit_hs_ptr = NULL;
+		if (is_segwit && (i >= batch_first_input) && ((i - batch_first_input) < batch_num_inputs))
+		{
+			memcpy(segwit_state->inputs[i - batch_first_input].outpoint, temp, 32);
+			memcpy(&(segwit_state->inputs[i - batch_first_input].outpoint[32]), input_reference_num_buffer, 4);
+		}
+		if (parsing_psbt && !is_ref)
+		{
+			memcpy(psbt_output_numbers[i], input_reference_num_buffer, 4);
+		}
 		if (!is_ref)
 		{
 			for (j = 0; j < 4; j++)
@@ -345,30 +769,80 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		// which input is being signed for, so the calculation of the
 		// transaction hash ignores input scripts.
 		suppress_transaction_hash = true;
-		// Get input script length.
-		if (getVarInt(&script_length))
+		if (!is_ref && (batch_pubkey_hashes != NULL))
 		{
-			return TRANSACTION_INVALID_FORMAT; // transaction truncated or varint too big
+			// When signing a batch, the host sends empty input scripts and
+			// the device substitutes the appropriate script into each
+			// signature hash.
+			hs_ptr_valid = false;
+			if (getVarInt(&script_length))
+			{
+				return TRANSACTION_INVALID_FORMAT; // transaction truncated or varint too big
+			}
+			hs_ptr_valid = true;
+			if (script_length != 0)
+			{
+				return TRANSACTION_INVALID_FORMAT; // input script not empty
+			}
+			writeBatchInputScripts(i);
 		}
-		// Skip the script because it's useless here.
-		for (k = 0; k < script_length; k++)
+		else
 		{
-			if (getTransactionBytes(temp, 1))
+			// Get input script length.
+			if (getVarInt(&script_length))
 			{
-				return TRANSACTION_INVALID_FORMAT; // transaction truncated
+				return TRANSACTION_INVALID_FORMAT; // transaction truncated or varint too big
+			}
+			// Skip the script because it's useless here.
+			for (k = 0; k < script_length; k++)
+			{
+				if (getTransactionBytes(temp, 1))
+				{
+					return TRANSACTION_INVALID_FORMAT; // transaction truncated
+				}
 			}
 		}
 		suppress_transaction_hash = false;
+		if (is_segwit)
+		{
+			// Get amount of output being spent. This isn't part of a
+			// serialised transaction, but the BIP 143 signature hash of this
+			// input commits to it. Since every input is signed in this
+			// batch (see above), a host which lies about any amount will
+			// get at least one invalid signature.
+			if (getTransactionBytes(temp, 8))
+			{
+				return TRANSACTION_INVALID_FORMAT; // transaction truncated
+			}
+			if (bigCompareVariableSize(temp, (uint8_t *)max_money, 8) == BIGCMP_GREATER)
+			{
+				return TRANSACTION_INVALID_AMOUNT; // amount too high
+			}
+			if (bigAddVariableSizeNoModulo(transaction_fee_amount, transaction_fee_amount, temp, 8))
+			{
+				return TRANSACTION_INVALID_AMOUNT; // overflow occurred (carry occurred)
+			}
+			if ((i >= batch_first_input) && ((i - batch_first_input) < batch_num_inputs))
+			{
+				memcpy(segwit_state->inputs[i - batch_first_input].amount, temp, 8);
+			}
+			segwit_hs_ptr = &(segwit_state->sequence_hs);
+		}
 		// Check sequence. Since locktime is checked below, this check
 		// is probably superfluous. But it's better to be safe than sorry.
 		if (getTransactionBytes(temp, 4))
 		{
 			return TRANSACTION_INVALID_FORMAT; // transaction truncated
 		}
+		segwit_hs_ptr = NULL;
 		if (readU32LittleEndian(temp) != 0xFFFFFFFF)
 		{
 			return TRANSACTION_NON_STANDARD; // replacement not supported
 		}
+		if (is_segwit && (i >= batch_first_input) && ((i - batch_first_input) < batch_num_inputs))
+		{
+			memcpy(segwit_state->inputs[i - batch_first_input].sequence, temp, 4);
+		}
 	} // end for (i = 0; i < num_inputs; i++)
 
 	if (!is_ref)
@@ -376,10 +850,43 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		// Compare input references with input transactions.
 		sha256FinishDouble(ref_compare_hs);
 		writeHashToByteArray(temp, ref_compare_hs, false);
-		if (memcmp(temp, ref_compare_hash, 32))
+		if (is_segwit)
+		{
+			// There are no input transactions; the input amounts were
+			// included in the spending transaction.
+		}
+		else if (parsing_psbt)
+		{
+			// The input transactions (non-witness UTXOs) come after the
+			// spending transaction, so parsePsbt() does the comparison.
+			memcpy(psbt_ref_compare_hash, temp, 32);
+		}
+		else if (use_parse_cache)
+		{
+			// The input transactions weren't sent, so get the total input
+			// amount from the parse cache instead.
+#if PARSE_CACHE_ENTRIES > 0
+			if (lookupParseCache(transaction_fee_amount, temp))
+			{
+				return TRANSACTION_INVALID_REFERENCE; // input references not in cache
+			}
+#else
+			return TRANSACTION_INVALID_REFERENCE; // no parse cache
+#endif // #if PARSE_CACHE_ENTRIES > 0
+		}
+		else if (memcmp(temp, ref_compare_hash, 32))
 		{
 			return TRANSACTION_INVALID_REFERENCE; // references don't match input transactions
 		}
+		memcpy(input_amount, transaction_fee_amount, sizeof(input_amount));
+		if (batch_pubkey_hashes != NULL)
+		{
+			if ((batch_first_input >= num_inputs)
+				|| (batch_num_inputs > (num_inputs - batch_first_input)))
+			{
+				return TRANSACTION_INVALID_REFERENCE; // batch refers to non-existent inputs
+			}
+		}
 	}
 
 	// Get number of outputs.
@@ -395,6 +902,10 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 	{
 		return TRANSACTION_TOO_MANY_OUTPUTS; // too many outputs
 	}
+	if (parsing_psbt && !is_ref)
+	{
+		psbt_num_outputs = num_outputs;
+	}
 	if (is_ref)
 	{
 		if (output_num_select >= num_outputs)
@@ -402,6 +913,11 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 			return TRANSACTION_INVALID_REFERENCE; // bad reference number
 		}
 	}
+	if (is_segwit)
+	{
+		// hashOutputs covers all outputs, but not the number of outputs.
+		segwit_hs_ptr = &(segwit_state->outputs_hs);
+	}
 
 	// Process each output.
 	for (i = 0; i < num_outputs; i++)
@@ -427,11 +943,21 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		}
 		else
 		{
-			if (bigSubtractVariableSizeNoModulo(transaction_fee_amount, transaction_fee_amount, temp, 8))
+			if (parsing_psbt)
+			{
+				// Input amounts aren't known yet, so add up the output
+				// amounts instead. parsePsbt() will subtract them from the
+				// input amounts.
+				if (bigAddVariableSizeNoModulo(transaction_fee_amount, transaction_fee_amount, temp, 8))
+				{
+					return TRANSACTION_INVALID_AMOUNT; // overflow occurred (carry occurred)
+				}
+			}
+			else if (bigSubtractVariableSizeNoModulo(transaction_fee_amount, transaction_fee_amount, temp, 8))
 			{
 				return TRANSACTION_INVALID_AMOUNT; // overflow occurred (borrow occurred)
 			}
-			amountToText(text_amount, temp);
+			memcpy(output_amount, temp, sizeof(output_amount));
 		}
 		// Get output script length.
 		if (getVarInt(&script_length))
@@ -470,7 +996,8 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 				{
 					return TRANSACTION_INVALID_FORMAT; // transaction truncated
 				}
-				hashToAddr(text_address, temp, ADDRESS_VERSION_PUBKEY);
+				memcpy(output_hash, temp, sizeof(output_hash));
+				output_address_version = ADDRESS_VERSION_PUBKEY;
 				// Look for: OP_EQUALVERIFY OP_CHECKSIG.
 				if (getTransactionBytes(temp, 2))
 				{
@@ -497,7 +1024,8 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 				{
 					return TRANSACTION_INVALID_FORMAT; // transaction truncated
 				}
-				hashToAddr(text_address, temp, ADDRESS_VERSION_P2SH);
+				memcpy(output_hash, temp, sizeof(output_hash));
+				output_address_version = ADDRESS_VERSION_P2SH;
 				// Look for: OP_EQUAL.
 				if (getTransactionBytes(temp, 1))
 				{
@@ -512,24 +1040,33 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 			{
 				return TRANSACTION_NON_STANDARD; // nonstandard transaction
 			}
-			if (newOutputSeen(text_amount, text_address))
+			if (newOutputSeen(output_amount, output_hash, output_address_version))
 			{
 				return TRANSACTION_TOO_MANY_OUTPUTS; // too many outputs
 			}
 		} // end if (is_ref)
 	} // end for (i = 0; i < num_outputs; i++)
+	segwit_hs_ptr = NULL;
 
 	// Check locktime.
-	if (getTransactionBytes(temp, 4))
+	if (getTransactionBytes(locktime, 4))
 	{
 		return TRANSACTION_INVALID_FORMAT; // transaction truncated
 	}
-	if (readU32LittleEndian(temp) != 0x00000000)
+	if (readU32LittleEndian(locktime) != 0x00000000)
 	{
 		return TRANSACTION_NON_STANDARD; // replacement not supported
 	}
 
-	if (!is_ref)
+	if (!is_ref && parsing_psbt)
+	{
+		// A PSBT doesn't include the hashtype, but it is part of the
+		// signature hash. Only SIGHASH_ALL is supported. parsePsbt() takes
+		// care of everything else.
+		writeU32LittleEndian(temp, 0x00000001);
+		hashTransactionBytes(temp, 4);
+	}
+	else if (!is_ref)
 	{
 		// Check hashtype.
 		if (getTransactionBytes(temp, 4))
@@ -552,13 +1089,31 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 			amountToText(text_amount, transaction_fee_amount);
 			setTransactionFee(text_amount);
 		}
+
+#if PARSE_CACHE_ENTRIES > 0
+		// The input transactions have been fully validated, so they can be
+		// referred to by later calls.
+		if (!use_parse_cache && !is_segwit)
+		{
+			updateParseCache(ref_compare_hash, input_amount);
+		}
+#endif // #if PARSE_CACHE_ENTRIES > 0
 	}
 
-	sha256FinishDouble(sig_hash_hs_ptr);
 	// The signature hash is written in a little-endian format because it
 	// is used as a little-endian multi-precision integer in
 	// signTransaction().
-	writeHashToByteArray(sig_hash, sig_hash_hs_ptr, false);
+	for (k = 0; k < num_sig_hash_hs; k++)
+	{
+		sha256FinishDouble(&(sig_hash_hs_ptr[k]));
+		writeHashToByteArray(&(sig_hash[k * 32]), &(sig_hash_hs_ptr[k]), false);
+	}
+	if (is_segwit)
+	{
+		// Hashtype was checked above, so it must be 1.
+		writeU32LittleEndian(temp, 0x00000001);
+		calculateSegwitSigHashes(sig_hash, locktime, temp);
+	}
 	sha256FinishDouble(transaction_hash_hs_ptr);
 	writeHashToByteArray(transaction_hash, transaction_hash_hs_ptr, false);
 
@@ -575,58 +1130,321 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 	return TRANSACTION_NO_ERROR;
 }
 
-/** Parse a Bitcoin transaction, extracting the output amounts/addresses,
-  * validating the transaction (ensuring that it is "standard") and computing
-  * a double SHA-256 hash of the transaction. This double SHA-256 hash is the
-  * "signature hash" because it is the hash which is passed on to the signing
-  * function signTransaction().
-  *
-  * The Bitcoin protocol for signing a transaction involves replacing
-  * the corresponding input script with the output script that
-  * the input references. This means that for a transaction with n
-  * inputs, there will be n different signature hashes - one for each input.
-  * Requiring the user to approve a transaction n times would be very
-  * annoying, so there needs to be a way to determine whether a bunch of
-  * transactions are actually "the same".
-  * So in addition to the signature hash, a "transaction hash" will be
-  * computed. The transaction hash is just like the signature hash, except
-  * input scripts are not included.
-  *
-  * This expects the input stream to contain many concatenated transactions;
-  * it should contain each input transaction (of the spending transaction)
-  * followed by the spending transaction. This is necessary
-  * to calculate the transaction fee. A transaction does directly contain the
-  * output amounts, but not the input amounts. The only way to get input
-  * amounts is to look at the output amounts of the transactions the inputs
-  * refer to.
-  *
-  * \param sig_hash The signature hash will be written here (if everything
-  *                 goes well), as a 32 byte little-endian multi-precision
-  *                 number.
-  * \param transaction_hash The transaction hash will be written here (if
-  *                         everything goes well), as a 32 byte little-endian
-  *                         multi-precision number.
-  * \param length The total length of the transaction. If no stream read
-  *               errors occured, then exactly length bytes will be read from
-  *               the stream, even if the transaction was not parsed
-  *               correctly.
-  * \return One of the values in #TransactionErrorsEnum.
-  */
-TransactionErrors parseTransaction(BigNum256 sig_hash, BigNum256 transaction_hash, uint32_t length)
+/** Always try to consume the entire stream, so that exactly
+  * #transaction_length bytes are read from the stream device, even if the
+  * transaction was not parsed correctly. */
+static void skipRemainingTransactionData(void)
 {
-	TransactionErrors r;
 	uint8_t junk;
-	bool is_ref;
-	HashState sig_hash_hs;
-	HashState transaction_hash_hs;
-	HashState ref_compare_hs;
 
 	hs_ptr_valid = false;
-	transaction_data_index = 0;
-	transaction_length = length;
-	memset(transaction_fee_amount, 0, sizeof(transaction_fee_amount));
-	sig_hash_hs_ptr = &sig_hash_hs;
-	transaction_hash_hs_ptr = &transaction_hash_hs;
+	while (!isEndOfTransactionData())
+	{
+		if (getTransactionBytes(&junk, 1))
+		{
+			break;
+		}
+	}
+}
+
+/** Read and discard transaction data.
+  * \param length The number of bytes to discard.
+  * \return false on success, true if the read would go beyond the end of
+  *         the transaction data.
+  */
+static bool skipTransactionBytes(uint32_t length)
+{
+	uint8_t junk[32];
+	uint8_t chunk;
+
+	while (length > 0)
+	{
+		if (length > sizeof(junk))
+		{
+			chunk = sizeof(junk);
+		}
+		else
+		{
+			chunk = (uint8_t)length;
+		}
+		if (getTransactionBytes(junk, chunk))
+		{
+			return true; // transaction truncated
+		}
+		length -= chunk;
+	}
+	return false;
+}
+
+/** Read the key of a PSBT key-value pair. Only the key type is returned;
+  * the rest of the key is skipped.
+  * \param out_key_type The key type will be written here. This is only
+  *                     valid if the key length is not 0.
+  * \param out_key_length The length of the key, including the key type, will
+  *                       be written here. A key length of 0 marks the end
+  *                       of a map.
+  * \return false on success, true if the PSBT is truncated.
+  */
+static bool getPsbtKey(uint8_t *out_key_type, uint32_t *out_key_length)
+{
+	if (getVarInt(out_key_length))
+	{
+		return true; // PSBT truncated or varint too big
+	}
+	if (*out_key_length == 0)
+	{
+		return false; // end of map
+	}
+	if (getTransactionBytes(out_key_type, 1))
+	{
+		return true; // PSBT truncated
+	}
+	return skipTransactionBytes(*out_key_length - 1);
+}
+
+/** Parse a transaction which is the value of a PSBT key-value pair.
+  * \param sig_hash See parseTransactionInternal().
+  * \param transaction_hash See parseTransactionInternal().
+  * \param output_number See #psbt_output_number.
+  * \param ref_compare_hs See parseTransactionInternal().
+  * \param value_length The length of the value, in number of bytes. The
+  *                     transaction must take up exactly this many bytes.
+  * \return One of the values in #TransactionErrorsEnum.
+  */
+static TransactionErrors parsePsbtTransaction(BigNum256 sig_hash, BigNum256 transaction_hash, uint8_t *output_number, HashState *ref_compare_hs, uint32_t value_length)
+{
+	uint32_t saved_length;
+	bool is_ref;
+	TransactionErrors r;
+
+	if (value_length > (transaction_length - transaction_data_index))
+	{
+		return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+	}
+	// Pretend that the transaction data ends where the value ends, so that
+	// parseTransactionInternal() can't read past the value.
+	saved_length = transaction_length;
+	transaction_length = transaction_data_index + value_length;
+	psbt_output_number = output_number;
+	r = parseTransactionInternal(sig_hash, transaction_hash, &is_ref, ref_compare_hs);
+	hs_ptr_valid = false;
+	if ((r == TRANSACTION_NO_ERROR) && !isEndOfTransactionData())
+	{
+		r = TRANSACTION_INVALID_FORMAT; // junk at end of value
+	}
+	transaction_length = saved_length;
+	return r;
+}
+
+/** See comments for parsePsbt() for description of what this does
+  * and return values.
+  * \param sig_hash See parseTransactionInternal().
+  * \param transaction_hash See parsePsbt().
+  * \return See parsePsbt().
+  */
+static TransactionErrors parsePsbtInternal(BigNum256 sig_hash, BigNum256 transaction_hash)
+{
+	uint8_t temp[32];
+	uint8_t ref_transaction_hash[32];
+	uint8_t output_total[8];
+	uint32_t key_length;
+	uint32_t value_length;
+	uint32_t i;
+	uint8_t key_type;
+	bool got_transaction;
+	TransactionErrors r;
+	HashState ref_compare_hs;
+	char text_amount[TEXT_AMOUNT_LENGTH];
+
+	// Check magic bytes.
+	if (getTransactionBytes(temp, sizeof(psbt_magic)))
+	{
+		return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+	}
+	if (memcmp(temp, psbt_magic, sizeof(psbt_magic)))
+	{
+		return TRANSACTION_INVALID_FORMAT; // not a PSBT
+	}
+
+	// Process the global map. The only thing needed from it is the unsigned
+	// transaction.
+	got_transaction = false;
+	sha256Begin(&ref_compare_hs);
+	while (true)
+	{
+		if (getPsbtKey(&key_type, &key_length))
+		{
+			return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+		}
+		if (key_length == 0)
+		{
+			break; // end of global map
+		}
+		if (getVarInt(&value_length))
+		{
+			return TRANSACTION_INVALID_FORMAT; // PSBT truncated or varint too big
+		}
+		if ((key_type == PSBT_GLOBAL_UNSIGNED_TX) && (key_length == 1))
+		{
+			if (got_transaction)
+			{
+				return TRANSACTION_INVALID_FORMAT; // duplicate key
+			}
+			got_transaction = true;
+			r = parsePsbtTransaction(sig_hash, transaction_hash, NULL, &ref_compare_hs, value_length);
+			if (r != TRANSACTION_NO_ERROR)
+			{
+				return r;
+			}
+		}
+		else if (skipTransactionBytes(value_length))
+		{
+			return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+		}
+	} // end while (true)
+	if (!got_transaction)
+	{
+		return TRANSACTION_INVALID_FORMAT; // no unsigned transaction
+	}
+
+	// Process one map for each input. Each map must contain the input's
+	// non-witness UTXO, so that the input amount can be obtained (and
+	// checked) in the same way as for parseTransaction().
+	memcpy(output_total, transaction_fee_amount, sizeof(output_total));
+	memset(transaction_fee_amount, 0, sizeof(transaction_fee_amount));
+	sha256Begin(&ref_compare_hs);
+	for (i = 0; i < psbt_num_inputs; i++)
+	{
+		got_transaction = false;
+		while (true)
+		{
+			if (getPsbtKey(&key_type, &key_length))
+			{
+				return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+			}
+			if (key_length == 0)
+			{
+				break; // end of input map
+			}
+			if (getVarInt(&value_length))
+			{
+				return TRANSACTION_INVALID_FORMAT; // PSBT truncated or varint too big
+			}
+			if ((key_type == PSBT_IN_NON_WITNESS_UTXO) && (key_length == 1))
+			{
+				if (got_transaction)
+				{
+					return TRANSACTION_INVALID_FORMAT; // duplicate key
+				}
+				got_transaction = true;
+				r = parsePsbtTransaction(temp, ref_transaction_hash, psbt_output_numbers[i], &ref_compare_hs, value_length);
+				if (r != TRANSACTION_NO_ERROR)
+				{
+					return r;
+				}
+			}
+			else if (key_type == PSBT_IN_WITNESS_UTXO)
+			{
+				return TRANSACTION_NON_STANDARD; // segwit inputs not supported here
+			}
+			else if ((key_type == PSBT_IN_SIGHASH_TYPE) && (key_length == 1))
+			{
+				if (value_length != 4)
+				{
+					return TRANSACTION_INVALID_FORMAT; // invalid sighash type
+				}
+				if (getTransactionBytes(temp, 4))
+				{
+					return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+				}
+				if (readU32LittleEndian(temp) != 0x00000001)
+				{
+					return TRANSACTION_NON_STANDARD; // only SIGHASH_ALL is supported
+				}
+			}
+			else if (skipTransactionBytes(value_length))
+			{
+				return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+			}
+		} // end while (true)
+		if (!got_transaction)
+		{
+			return TRANSACTION_INVALID_REFERENCE; // no non-witness UTXO
+		}
+	} // end for (i = 0; i < psbt_num_inputs; i++)
+
+	// Compare input references with input transactions.
+	sha256FinishDouble(&ref_compare_hs);
+	writeHashToByteArray(temp, &ref_compare_hs, false);
+	if (memcmp(temp, psbt_ref_compare_hash, 32))
+	{
+		return TRANSACTION_INVALID_REFERENCE; // references don't match input transactions
+	}
+
+	// Process one map for each output. Nothing in them is needed, since
+	// outputs are displayed using the unsigned transaction.
+	for (i = 0; i < psbt_num_outputs; i++)
+	{
+		while (true)
+		{
+			if (getPsbtKey(&key_type, &key_length))
+			{
+				return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+			}
+			if (key_length == 0)
+			{
+				break; // end of output map
+			}
+			if (getVarInt(&value_length))
+			{
+				return TRANSACTION_INVALID_FORMAT; // PSBT truncated or varint too big
+			}
+			if (skipTransactionBytes(value_length))
+			{
+				return TRANSACTION_INVALID_FORMAT; // PSBT truncated
+			}
+		}
+	}
+
+	// Is there junk at the end of the PSBT?
+	if (!isEndOfTransactionData())
+	{
+		return TRANSACTION_INVALID_FORMAT; // junk at end of PSBT
+	}
+
+	if (bigSubtractVariableSizeNoModulo(transaction_fee_amount, transaction_fee_amount, output_total, 8))
+	{
+		return TRANSACTION_INVALID_AMOUNT; // overflow occurred (borrow occurred)
+	}
+	if (!bigIsZeroVariableSize(transaction_fee_amount, sizeof(transaction_fee_amount)))
+	{
+		amountToText(text_amount, transaction_fee_amount);
+		setTransactionFee(text_amount);
+	}
+	return TRANSACTION_NO_ERROR;
+}
+
+/** Parse all the transactions in the stream, using hash states
+  * starting at #sig_hash_hs_ptr for the signature hash(es).
+  * \param sig_hash See parseTransactionInternal().
+  * \param transaction_hash See parseTransaction().
+  * \param length See parseTransaction().
+  * \return One of the values in #TransactionErrorsEnum.
+  */
+static TransactionErrors parseAllTransactions(BigNum256 sig_hash, BigNum256 transaction_hash, uint32_t length)
+{
+	TransactionErrors r;
+	bool is_ref;
+	HashState transaction_hash_hs;
+	HashState ref_compare_hs;
+
+	hs_ptr_valid = false;
+	transaction_data_index = 0;
+	transaction_length = length;
+	memset(transaction_fee_amount, 0, sizeof(transaction_fee_amount));
+	transaction_hash_hs_ptr = &transaction_hash_hs;
+	num_sig_hash_hs = 1;
+	segwit_hs_ptr = NULL;
 	sha256Begin(&ref_compare_hs);
 
 	hs_ptr_valid = true;
@@ -636,14 +1454,202 @@ TransactionErrors parseTransaction(BigNum256 sig_hash, BigNum256 transaction_has
 	} while ((r == TRANSACTION_NO_ERROR) && is_ref);
 	hs_ptr_valid = false;
 
-	// Always try to consume the entire stream.
-	while (!isEndOfTransactionData())
+	skipRemainingTransactionData();
+	return r;
+}
+
+/** Parse a Bitcoin transaction, extracting the output amounts/addresses,
+  * validating the transaction (ensuring that it is "standard") and computing
+  * a double SHA-256 hash of the transaction. This double SHA-256 hash is the
+  * "signature hash" because it is the hash which is passed on to the signing
+  * function signTransaction().
+  *
+  * The Bitcoin protocol for signing a transaction involves replacing
+  * the corresponding input script with the output script that
+  * the input references. This means that for a transaction with n
+  * inputs, there will be n different signature hashes - one for each input.
+  * Requiring the user to approve a transaction n times would be very
+  * annoying, so there needs to be a way to determine whether a bunch of
+  * transactions are actually "the same".
+  * So in addition to the signature hash, a "transaction hash" will be
+  * computed. The transaction hash is just like the signature hash, except
+  * input scripts are not included.
+  *
+  * This expects the input stream to contain many concatenated transactions;
+  * it should contain each input transaction (of the spending transaction)
+  * followed by the spending transaction. This is necessary
+  * to calculate the transaction fee. A transaction does directly contain the
+  * output amounts, but not the input amounts. The only way to get input
+  * amounts is to look at the output amounts of the transactions the inputs
+  * refer to.
+  *
+  * Each transaction is preceded by an is_ref byte. An input transaction has
+  * is_ref = 1, followed by the 4 byte output number which the spending
+  * transaction refers to. The spending transaction has is_ref = 0.
+  * Once a spending transaction has been successfully parsed, its input
+  * references and total input amount are remembered in the parse cache. Later
+  * calls can then send the spending transaction (with any input scripts)
+  * alone, with is_ref = 2, and the input transactions don't need to be sent
+  * or parsed again. The parse cache is cleared by clearParseCache().
+  * is_ref = 3 is reserved for segregated witness spending transactions,
+  * which only parseTransactionBatch() accepts.
+  *
+  * \param sig_hash The signature hash will be written here (if everything
+  *                 goes well), as a 32 byte little-endian multi-precision
+  *                 number.
+  * \param transaction_hash The transaction hash will be written here (if
+  *                         everything goes well), as a 32 byte little-endian
+  *                         multi-precision number.
+  * \param length The total length of the transaction. If no stream read
+  *               errors occured, then exactly length bytes will be read from
+  *               the stream, even if the transaction was not parsed
+  *               correctly.
+  * \return One of the values in #TransactionErrorsEnum.
+  */
+TransactionErrors parseTransaction(BigNum256 sig_hash, BigNum256 transaction_hash, uint32_t length)
+{
+	HashState sig_hash_hs;
+
+	batch_pubkey_hashes = NULL;
+	segwit_state = NULL;
+	sig_hash_hs_ptr = &sig_hash_hs;
+	return parseAllTransactions(sig_hash, transaction_hash, length);
+}
+
+/** Parse a Bitcoin transaction like parseTransaction(), but compute the
+  * signature hashes of several inputs at once. This means that the
+  * input transactions and the spending transaction only need to be sent and
+  * parsed once for every #MAX_BATCH_INPUTS inputs, instead of once for every
+  * input.
+  *
+  * The format of the input stream is the same as for parseTransaction(),
+  * except that all input scripts of the spending transaction must be empty.
+  * The script of each signed input is filled in
+  * by writeBatchInputScripts(), using pubkey_hashes. The transaction hash is
+  * the same as the one parseTransaction() computes, since it doesn't include
+  * input scripts.
+  *
+  * This also accepts segregated witness (version 0, pay to witness public
+  * key hash) spending transactions, for which BIP 143 signature hashes are
+  * computed. These are marked with is_ref = 3, and no input transactions are
+  * needed. Instead, the 8 byte amount of the output which each input spends
+  * is placed between the input's (empty) script and its sequence number.
+  * A segwit batch must cover every input of the spending transaction
+  * (first_input must be 0 and num_inputs_to_sign must be the number of
+  * inputs), because each amount is only committed to by the signature of the
+  * input it belongs to. Otherwise, a host could understate the amount of
+  * an input which is signed in another batch, so that the fee shown to the
+  * user is too low.
+  * hashPrevouts, hashSequence and hashOutputs are computed once while the
+  * transaction is parsed, after which each signature hash takes constant
+  * time (see calculateSegwitSigHashes()).
+  * \param sig_hashes The signature hash of input (first_input + i) will be
+  *                   written to sig_hashes[i] (if everything goes well),
+  *                   as a 32 byte little-endian multi-precision number.
+  * \param transaction_hash See parseTransaction().
+  * \param pubkey_hashes pubkey_hashes[i] should be the 20 byte
+  *                      public key hash (RIPEMD-160 of SHA-256 of public key)
+  *                      of the address which will sign input
+  *                      (first_input + i).
+  * \param first_input Index (in the spending transaction) of the first
+  *                    input to compute a signature hash for.
+  * \param num_inputs_to_sign Number of consecutive inputs to compute
+  *                           signature hashes for. This must be between 1
+  *                           and #MAX_BATCH_INPUTS inclusive.
+  * \param length See parseTransaction().
+  * \return One of the values in #TransactionErrorsEnum.
+  */
+TransactionErrors parseTransactionBatch(uint8_t sig_hashes[][32], BigNum256 transaction_hash, uint8_t pubkey_hashes[][20], uint32_t first_input, uint32_t num_inputs_to_sign, uint32_t length)
+{
+	// A segwit spending transaction doesn't need legacy signature hashes,
+	// and input transactions only use the first legacy hash state, which is
+	// finished with before the spending transaction is parsed. So the two
+	// can share memory.
+	union
 	{
-		if (getTransactionBytes(&junk, 1))
+		HashState sig_hash_hs[MAX_BATCH_INPUTS];
+		SegwitState segwit;
+	} hash_states;
+
+	if ((num_inputs_to_sign == 0) || (num_inputs_to_sign > MAX_BATCH_INPUTS))
+	{
+		hs_ptr_valid = false;
+		transaction_data_index = 0;
+		transaction_length = length;
+		skipRemainingTransactionData();
+		if (num_inputs_to_sign == 0)
 		{
-			break;
+			return TRANSACTION_INVALID_FORMAT; // nothing to sign
+		}
+		return TRANSACTION_TOO_MANY_INPUTS;
+	}
+	batch_pubkey_hashes = pubkey_hashes;
+	batch_first_input = first_input;
+	batch_num_inputs = num_inputs_to_sign;
+	sig_hash_hs_ptr = hash_states.sig_hash_hs;
+	segwit_state = &(hash_states.segwit);
+	return parseAllTransactions(sig_hashes[0], transaction_hash, length);
+}
+
+/** Parse a partially signed Bitcoin transaction (PSBT, see BIP 174) and
+  * compute the signature hashes of several of its inputs, like
+  * parseTransactionBatch(). This allows a host which works with PSBTs to send
+  * them as-is, instead of re-serialising them into the format which
+  * parseTransaction() expects.
+  *
+  * The PSBT is parsed as it is read from the stream, so the amount of RAM
+  * needed doesn't depend on the size of the PSBT. The unsigned transaction
+  * in the global map is parsed like the spending transaction of
+  * parseTransactionBatch(): outputs are passed to newOutputSeen() and its
+  * input scripts must be empty. Every input map must contain a non-witness
+  * UTXO, which is checked against the input's reference and used to
+  * calculate the transaction fee. Witness UTXOs and sighash types other
+  * than SIGHASH_ALL are rejected. All other key-value pairs are ignored,
+  * including any partial signatures which are already there.
+  * \param sig_hashes See parseTransactionBatch().
+  * \param transaction_hash See parseTransaction(). This is the same as the
+  *                         one parseTransaction() would compute, if the
+  *                         PSBT was converted into its format.
+  * \param pubkey_hashes See parseTransactionBatch().
+  * \param first_input See parseTransactionBatch().
+  * \param num_inputs_to_sign See parseTransactionBatch().
+  * \param length The total length of the PSBT. If no stream read errors
+  *               occured, then exactly length bytes will be read from
+  *               the stream, even if the PSBT was not parsed correctly.
+  * \return One of the values in #TransactionErrorsEnum.
+  */
+TransactionErrors parsePsbt(uint8_t sig_hashes[][32], BigNum256 transaction_hash, uint8_t pubkey_hashes[][20], uint32_t first_input, uint32_t num_inputs_to_sign, uint32_t length)
+{
+	TransactionErrors r;
+	HashState sig_hash_hs[MAX_BATCH_INPUTS];
+	HashState transaction_hash_hs;
+
+	hs_ptr_valid = false;
+	transaction_data_index = 0;
+	transaction_length = length;
+	if ((num_inputs_to_sign == 0) || (num_inputs_to_sign > MAX_BATCH_INPUTS))
+	{
+		skipRemainingTransactionData();
+		if (num_inputs_to_sign == 0)
+		{
+			return TRANSACTION_INVALID_FORMAT; // nothing to sign
 		}
+		return TRANSACTION_TOO_MANY_INPUTS;
 	}
+	memset(transaction_fee_amount, 0, sizeof(transaction_fee_amount));
+	batch_pubkey_hashes = pubkey_hashes;
+	batch_first_input = first_input;
+	batch_num_inputs = num_inputs_to_sign;
+	sig_hash_hs_ptr = sig_hash_hs;
+	transaction_hash_hs_ptr = &transaction_hash_hs;
+	num_sig_hash_hs = 1;
+	segwit_state = NULL;
+	segwit_hs_ptr = NULL;
+	parsing_psbt = true;
+	r = parsePsbtInternal(sig_hashes[0], transaction_hash);
+	parsing_psbt = false;
+	psbt_output_number = NULL;
+	skipRemainingTransactionData();
 	return r;
 }
 
@@ -773,18 +1779,44 @@ void signTransaction(uint8_t *signature, uint8_t *out_length, BigNum256 sig_hash
 
 /** Number of outputs seen. */
 static int num_outputs_seen;
-
-bool newOutputSeen(char *text_amount, char *text_address)
+/** If this is true, newOutputSeen() and setTransactionFee() won't print
+  * anything, and newOutputSeen() will add the time it spends converting
+  * outputs to text to #output_conversion_time. */
+static bool benchmark_outputs;
+/** Total processor time (in clock() ticks) spent converting outputs to text,
+  * while #benchmark_outputs is true. */
+static clock_t output_conversion_time;
+
+bool newOutputSeen(uint8_t *amount, uint8_t *hash, uint8_t address_version)
 {
-	printf("Amount: %s\n", text_amount);
-	printf("Address: %s\n", text_address);
+	char text_amount[TEXT_AMOUNT_LENGTH];
+	char text_address[TEXT_ADDRESS_LENGTH];
+	clock_t start;
+
+	if (benchmark_outputs)
+	{
+		start = clock();
+		amountToText(text_amount, amount);
+		hashToAddr(text_address, hash, address_version);
+		output_conversion_time += clock() - start;
+	}
+	else
+	{
+		amountToText(text_amount, amount);
+		hashToAddr(text_address, hash, address_version);
+		printf("Amount: %s\n", text_amount);
+		printf("Address: %s\n", text_address);
+	}
 	num_outputs_seen++;
 	return false; // success
 }
 
 void setTransactionFee(char *text_amount)
 {
-	printf("Transaction fee: %s\n", text_amount);
+	if (!benchmark_outputs)
+	{
+		printf("Transaction fee: %s\n", text_amount);
+	}
 }
 
 void clearOutputsSeen(void)
@@ -986,25 +2018,146 @@ static const uint8_t good_main_transaction[] = {
 0x01, 0x00, 0x00, 0x00 // hashtype
 };
 
-/** The main transaction from #good_full_transaction, with the inputs
-  * removed. */
-static const uint8_t inputs_removed_transaction[] = {
+/** A segregated witness version of #good_main_transaction, with a second
+  * input and with the amount of each input included. This is in the format
+  * which parseTransactionBatch() expects (see is_ref = 3). */
+static const uint8_t good_segwit_transaction[] = {
+0x03, // is_ref = 3 (main, segwit)
 0x01, 0x00, 0x00, 0x00, // version
-0x01, // number of inputs
-0x02, // number of outputs
-0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
-0x19, // script length
-0x76, // OP_DUP
-0xA9, // OP_HASH160
-0x14, // 20 bytes of data follows
-// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
-0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
-0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
-0x88, // OP_EQUALVERIFY
-0xAC, // OP_CHECKSIG
-0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
-0x19, // script length
-0x76, // OP_DUP
+0x02, // number of inputs
+0xee, 0xce, 0xae, 0x86, 0xf5, 0x70, 0x4d, 0x76, // previous output
+0xb8, 0x54, 0x5e, 0x6d, 0xcf, 0x21, 0xf1, 0x75,
+0x35, 0x7f, 0x83, 0xbd, 0xa4, 0x96, 0x43, 0x83,
+0xd6, 0xdd, 0x7e, 0x41, 0x68, 0x1b, 0x5e, 0x1a,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x00, // script length
+0x40, 0x54, 0x92, 0x3d, 0x00, 0x00, 0x00, 0x00, // 10.33 BTC (input amount)
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0xee, 0xce, 0xae, 0x86, 0xf5, 0x70, 0x4d, 0x76, // previous output
+0xb8, 0x54, 0x5e, 0x6d, 0xcf, 0x21, 0xf1, 0x75,
+0x35, 0x7f, 0x83, 0xbd, 0xa4, 0x96, 0x43, 0x83,
+0xd6, 0xdd, 0x7e, 0x41, 0x68, 0x1b, 0x5e, 0x1a,
+0x00, 0x00, 0x00, 0x00, // number in previous output
+0x00, // script length
+0xc0, 0xa4, 0x70, 0x57, 0x00, 0x00, 0x00, 0x00, // 14.67 BTC (input amount)
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
+0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
+0x01, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+0x01, 0x00, 0x00, 0x00 // hashtype
+};
+
+/** Public key hashes used to sign each input of #good_segwit_transaction. */
+static const uint8_t segwit_pubkey_hashes[2][20] = {
+{0xde, 0xad, 0xbe, 0xef, 0xc0, 0xff, 0xee, 0xee, 0x00, 0x00,
+0xde, 0xad, 0xbe, 0xef, 0xc0, 0xff, 0xee, 0xee, 0x00, 0x00},
+{0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23}};
+
+/** Expected BIP 143 signature hashes (as little-endian multi-precision
+  * integers) of each input of #good_segwit_transaction, when signed
+  * using #segwit_pubkey_hashes. These were calculated using an independent
+  * implementation of BIP 143, which was checked against the native P2WPKH
+  * example in BIP 143. */
+static const uint8_t segwit_sig_hashes[2][32] = {
+{0x8a, 0xc0, 0x5a, 0xbb, 0x3b, 0x5a, 0x5e, 0x8e, 0x39, 0x17, 0x2a, 0x2c,
+0xf7, 0x7c, 0x18, 0x23, 0x35, 0xe4, 0xac, 0xf6, 0x1e, 0x75, 0x3c, 0x39,
+0xb7, 0xcb, 0xa0, 0x8d, 0xa5, 0x6e, 0xee, 0xbc},
+{0x7f, 0x66, 0x7a, 0x7d, 0x5a, 0xa9, 0x39, 0x9e, 0x21, 0xee, 0x02, 0xe5,
+0xb4, 0xca, 0x04, 0xd7, 0x9f, 0xfa, 0x71, 0x4b, 0xd2, 0x81, 0x35, 0x90,
+0xae, 0xf4, 0x8c, 0xa8, 0xb1, 0x6e, 0x98, 0x8b}};
+
+/** Outpoints (previous transaction hash and output number) of the two
+  * inputs of the unsigned transaction in the native P2WPKH example of
+  * BIP 143. */
+static const uint8_t bip143_example_outpoints[2][36] = {
+{0xff, 0xf7, 0xf7, 0x88, 0x1a, 0x80, 0x99, 0xaf,
+0xa6, 0x94, 0x0d, 0x42, 0xd1, 0xe7, 0xf6, 0x36,
+0x2b, 0xec, 0x38, 0x17, 0x1e, 0xa3, 0xed, 0xf4,
+0x33, 0x54, 0x1d, 0xb4, 0xe4, 0xad, 0x96, 0x9f,
+0x00, 0x00, 0x00, 0x00},
+{0xef, 0x51, 0xe1, 0xb8, 0x04, 0xcc, 0x89, 0xd1,
+0x82, 0xd2, 0x79, 0x65, 0x5c, 0x3a, 0xa8, 0x9e,
+0x81, 0x5b, 0x1b, 0x30, 0x9f, 0xe2, 0x87, 0xd9,
+0xb2, 0xb5, 0x5d, 0x57, 0xb9, 0x0e, 0xc6, 0x8a,
+0x01, 0x00, 0x00, 0x00}};
+
+/** Sequence numbers of the two inputs in the native P2WPKH example of
+  * BIP 143. */
+static const uint8_t bip143_example_sequences[2][4] = {
+{0xee, 0xff, 0xff, 0xff},
+{0xff, 0xff, 0xff, 0xff}};
+
+/** Serialised outputs of the native P2WPKH example of BIP 143. */
+static const uint8_t bip143_example_outputs[] = {
+0x20, 0x2c, 0xb2, 0x06, 0x00, 0x00, 0x00, 0x00, // 1.1234 BTC
+0x19, 0x76, 0xa9, 0x14, 0x82, 0x80, 0xb3, 0x7d, // script
+0xf3, 0x78, 0xdb, 0x99, 0xf6, 0x6f, 0x85, 0xc9,
+0x5a, 0x78, 0x3a, 0x76, 0xac, 0x7a, 0x6d, 0x59,
+0x88, 0xac,
+0x90, 0x93, 0x51, 0x0d, 0x00, 0x00, 0x00, 0x00, // 2.2345 BTC
+0x19, 0x76, 0xa9, 0x14, 0x3b, 0xde, 0x42, 0xdb, // script
+0xee, 0x7e, 0x4d, 0xbe, 0x6a, 0x21, 0xb2, 0xd5,
+0x0c, 0xe2, 0xf0, 0x16, 0x7f, 0xaa, 0x81, 0x59,
+0x88, 0xac};
+
+/** Amount of the output spent by the second (P2WPKH) input in the native
+  * P2WPKH example of BIP 143. */
+static const uint8_t bip143_example_amount[8] = {
+0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00}; // 6 BTC
+
+/** Public key hash of the second (P2WPKH) input in the native P2WPKH example
+  * of BIP 143. */
+static const uint8_t bip143_example_pubkey_hash[20] = {
+0x1d, 0x0f, 0x17, 0x2a, 0x0e, 0xcb, 0x48, 0xae, 0xe1, 0xbe,
+0x1f, 0x26, 0x87, 0xd2, 0x96, 0x3a, 0xe3, 0x3f, 0x71, 0xa1};
+
+/** Signature hash (as a little-endian multi-precision integer) of the second
+  * input in the native P2WPKH example of BIP 143. This is the published
+  * value, c37af311...78cb670, byte-reversed. */
+static const uint8_t bip143_example_sig_hash[32] = {
+0x70, 0xb6, 0x8c, 0x47, 0x49, 0xeb, 0xd0, 0x57, 0x76, 0x91, 0x5b, 0x4d,
+0x01, 0x29, 0x79, 0x47, 0xf1, 0x82, 0xac, 0xe3, 0xe9, 0xaa, 0x68, 0xaf,
+0x7c, 0xb2, 0xd1, 0x16, 0x11, 0xf3, 0x7a, 0xc3};
+
+/** The main transaction from #good_full_transaction, with the inputs
+  * removed. */
+static const uint8_t inputs_removed_transaction[] = {
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0x02, // number of outputs
+0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
+0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
+0x19, // script length
+0x76, // OP_DUP
 0xA9, // OP_HASH160
 0x14, // 20 bytes of data follows
 // 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
@@ -2505,76 +3658,703 @@ static uint8_t *generateTestTransaction(uint32_t *out_length, uint32_t num_input
 	// Write number of outputs.
 	if (num_outputs < 0xfd)
 	{
-		buffer[ptr] = (uint8_t)num_outputs;
-		ptr++;
+		buffer[ptr] = (uint8_t)num_outputs;
+		ptr++;
+	}
+	else if (num_outputs <= 0xffff)
+	{
+		buffer[ptr] = 0xfd;
+		ptr++;
+		buffer[ptr] = (uint8_t)num_outputs;
+		ptr++;
+		buffer[ptr] = (uint8_t)(num_outputs >> 8);
+		ptr++;
+	}
+	else
+	{
+		buffer[ptr] = 0xfe;
+		ptr++;
+		writeU32LittleEndian(&(buffer[ptr]), num_outputs);
+		ptr += 4;
+	}
+	// Write outputs.
+	for (i = 0; i < num_outputs; i++)
+	{
+		memcpy(&(buffer[ptr]), one_output, sizeof(one_output));
+		if (i == 0)
+		{
+			memcpy(&(buffer[ptr]), output_amount1, sizeof(output_amount1));
+			memcpy(&(buffer[ptr + 12]), output_address1, sizeof(output_address1));
+		}
+		else if (i == 1)
+		{
+			memcpy(&(buffer[ptr]), output_amount2, sizeof(output_amount2));
+			memcpy(&(buffer[ptr + 12]), output_address2, sizeof(output_address2));
+		}
+		else
+		{
+			// Use random amount/address.
+			memset(temp, 0, 8);
+			// Make sure it's small enough that the transaction fee is always
+			// positive.
+			for (j = 0; j < 2; j++)
+			{
+				temp[j] = (uint8_t)(rand() & 0xff);
+			}
+			memcpy(&(buffer[ptr]), temp, 8);
+			for (j = 0; j < 20; j++)
+			{
+				temp[j] = (uint8_t)(rand() & 0xff);
+			}
+			memcpy(&(buffer[ptr + 12]), temp, 20);
+		}
+		ptr += sizeof(one_output);
+	}
+	// Write locktime.
+	writeU32LittleEndian(&(buffer[ptr]), 0x00000000);
+	ptr += 4;
+	// Write hashtype.
+	writeU32LittleEndian(&(buffer[ptr]), 0x00000001);
+	ptr += 4;
+	*out_length = ptr;
+	return buffer;
+}
+
+/** Check that the number of outputs seen is as expected.
+  * \param target The expected number of outputs.
+  */
+static void checkOutputsSeen(int target)
+{
+	if (num_outputs_seen != target)
+	{
+		printf("Expected to see %d outputs, got %d\n", target, num_outputs_seen);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+/** Set the input stream to some transaction data and attempt to parse that
+  * transaction.
+  * \param buffer The test transaction data. If this is NULL, the input stream
+  *               will be set to an infinite stream of zeroes.
+  * \param length The length of the transaction, in number of bytes.
+  * \param name The test name of the transaction. This is displayed on stdout
+  *             if a test fails.
+  * \param expected_return The expected return value of parseTransaction().
+  */
+static void testTransaction(const uint8_t *buffer, uint32_t length, const char *name, TransactionErrors expected_return)
+{
+	uint8_t sig_hash[32];
+	uint8_t transaction_hash[32];
+	TransactionErrors r;
+
+	clearOutputsSeen();
+	if (buffer == NULL)
+	{
+		setInfiniteZeroInputStream();
+	}
+	else
+	{
+		setTestInputStream(buffer, length);
+	}
+	r = parseTransaction(sig_hash, transaction_hash, length);
+	// Check return value is what is expected.
+	if (r != expected_return)
+	{
+		printf("parseTransaction() returned unexpected value for transaction \"%s\"\n", name);
+		printf("Expected: %d, got: %d\n", (int)expected_return, (int)r);
+		reportFailure();
+	}
+	else
+	{
+		// Then check if all bytes in the transaction were consumed.
+		if (!isEndOfTransactionData())
+		{
+			printf("parseTransaction() didn't eat everything for transaction \"%s\"\n", name);
+			reportFailure();
+		}
+		else
+		{
+			// Then check that there was no attempt to read past the end of
+			// the transaction.
+			if (transaction_data_index > transaction_length)
+			{
+				printf("parseTransaction() read past end for transaction \"%s\"\n", name);
+				reportFailure();
+			}
+			else
+			{
+				reportSuccess();
+			}
+		}
+	} // end if (r != expected_return)
+}
+
+/** This is just like testTransaction(), except this prepends
+  * #good_input_transaction (and the is_ref bytes) to the test transaction data.
+  * \param buffer See testTransaction().
+  * \param length See testTransaction().
+  * \param name See testTransaction().
+  * \param expected_return See testTransaction().
+  */
+static void prependGoodInputTestTransaction(const uint8_t *buffer, uint32_t length, const char *name, TransactionErrors expected_return)
+{
+	uint8_t *new_buffer;
+	uint32_t new_length;
+
+	if (length > (0xffffffff - (sizeof(good_input_transaction) + 2)))
+	{
+		// length + sizeof(good_input_transaction) + 2 will overflow.
+		printf("Unexpected fatal error: length too big in prependGoodInputTestTransaction()\n");
+		exit(1);
+	}
+	new_length = length + sizeof(good_input_transaction) + 2;
+	new_buffer = malloc(new_length);
+	new_buffer[0] = 0x01; // is_ref = 1 (input)
+	memcpy(&(new_buffer[1]), good_input_transaction, sizeof(good_input_transaction));
+	new_buffer[sizeof(good_input_transaction) + 1] = 0x00; // is_ref = 0 (main)
+	memcpy(&(new_buffer[sizeof(good_input_transaction) + 2]), buffer, length);
+	testTransaction(new_buffer, new_length, name, expected_return);
+	free(new_buffer);
+}
+
+/** This is just like testTransaction(), except this prepends
+  * #p2sh_test_prepend to the test transaction data.
+  * \param buffer See testTransaction().
+  * \param length See testTransaction().
+  * \param name See testTransaction().
+  * \param expected_return See testTransaction().
+  */
+static void prependGoodP2SHInputsTestTransaction(const uint8_t *buffer, uint32_t length, const char *name, TransactionErrors expected_return)
+{
+	uint8_t *new_buffer;
+	uint32_t new_length;
+
+	if (length > (0xffffffff - sizeof(p2sh_test_prepend)))
+	{
+		// length + sizeof(p2sh_test_prepend) will overflow.
+		printf("Unexpected fatal error: length too big in prependGoodP2SHInputsTestTransaction()\n");
+		exit(1);
+	}
+	new_length = length + sizeof(p2sh_test_prepend);
+	new_buffer = malloc(new_length);
+	memcpy(new_buffer, p2sh_test_prepend, sizeof(p2sh_test_prepend));
+	memcpy(&(new_buffer[sizeof(p2sh_test_prepend)]), buffer, length);
+	testTransaction(new_buffer, new_length, name, expected_return);
+	free(new_buffer);
+}
+
+/** Copy the output of generateTestTransaction(), replacing the input scripts
+  * of the spending transaction with empty scripts. This only works if the
+  * number of inputs is less than 0xfd.
+  * \param out_length The length of the copy, in number of bytes, will be
+  *                   written here.
+  * \param buffer Output of generateTestTransaction().
+  * \param length Length of buffer, in number of bytes.
+  * \param num_inputs The number of inputs which was passed to
+  *                   generateTestTransaction().
+  * \param keep_input The index of an input whose script will be kept. Use
+  *                   a value >= num_inputs to make all input scripts empty.
+  * \return A copy, allocated using malloc(), of the transaction data.
+  */
+static uint8_t *blankInputScripts(uint32_t *out_length, const uint8_t *buffer, uint32_t length, uint32_t num_inputs, uint32_t keep_input)
+{
+	uint8_t *new_buffer;
+	uint32_t in_ptr;
+	uint32_t out_ptr;
+	uint32_t i;
+
+	new_buffer = malloc(length);
+	in_ptr = main_offset + 5; // skip version and number of inputs
+	memcpy(new_buffer, buffer, in_ptr);
+	out_ptr = in_ptr;
+	for (i = 0; i < num_inputs; i++)
+	{
+		if (i == keep_input)
+		{
+			memcpy(&(new_buffer[out_ptr]), &(buffer[in_ptr]), sizeof(one_input));
+			out_ptr += sizeof(one_input);
+		}
+		else
+		{
+			// Reference (36 bytes), empty script, then sequence (4 bytes).
+			memcpy(&(new_buffer[out_ptr]), &(buffer[in_ptr]), 36);
+			new_buffer[out_ptr + 36] = 0x00;
+			memcpy(&(new_buffer[out_ptr + 37]), &(buffer[in_ptr + sizeof(one_input) - 4]), 4);
+			out_ptr += 41;
+		}
+		in_ptr += sizeof(one_input);
+	}
+	memcpy(&(new_buffer[out_ptr]), &(buffer[in_ptr]), length - in_ptr);
+	out_ptr += length - in_ptr;
+	*out_length = out_ptr;
+	return new_buffer;
+}
+
+/** Check that parseTransactionBatch() computes the same signature hashes
+  * and transaction hash as one call to parseTransaction() for each input
+  * in the batch.
+  * \param num_inputs Number of inputs in the test transaction. This must be
+  *                   less than 0xfd.
+  * \param first_input See parseTransactionBatch().
+  * \param num_inputs_to_sign See parseTransactionBatch().
+  */
+static void testBatch(uint32_t num_inputs, uint32_t first_input, uint32_t num_inputs_to_sign)
+{
+	uint8_t *generated_transaction;
+	uint8_t *single_transaction;
+	uint8_t *batch_transaction;
+	uint32_t generated_length;
+	uint32_t single_length;
+	uint32_t batch_length;
+	uint32_t i;
+	uint8_t sig_hash[32];
+	uint8_t transaction_hash[32];
+	uint8_t batch_sig_hashes[MAX_BATCH_INPUTS][32];
+	uint8_t batch_transaction_hash[32];
+	uint8_t pubkey_hashes[MAX_BATCH_INPUTS][20];
+	TransactionErrors r;
+
+	generated_transaction = generateTestTransaction(&generated_length, num_inputs, 2);
+	batch_transaction = blankInputScripts(&batch_length, generated_transaction, generated_length, num_inputs, num_inputs);
+	for (i = 0; i < num_inputs_to_sign; i++)
+	{
+		// This is the public key hash in the input script of one_input.
+		memcpy(pubkey_hashes[i], &(one_input[40]), 20);
+	}
+	clearOutputsSeen();
+	setTestInputStream(batch_transaction, batch_length);
+	r = parseTransactionBatch(batch_sig_hashes, batch_transaction_hash, pubkey_hashes, first_input, num_inputs_to_sign, batch_length);
+	if ((r != TRANSACTION_NO_ERROR) || !isEndOfTransactionData())
+	{
+		printf("parseTransactionBatch() failed for %u inputs, first = %u, batch size = %u\n", num_inputs, first_input, num_inputs_to_sign);
+		reportFailure();
+	}
+	else
+	{
+		for (i = 0; i < num_inputs_to_sign; i++)
+		{
+			single_transaction = blankInputScripts(&single_length, generated_transaction, generated_length, num_inputs, first_input + i);
+			setTestInputStream(single_transaction, single_length);
+			r = parseTransaction(sig_hash, transaction_hash, single_length);
+			free(single_transaction);
+			if ((r != TRANSACTION_NO_ERROR)
+				|| memcmp(sig_hash, batch_sig_hashes[i], 32)
+				|| memcmp(transaction_hash, batch_transaction_hash, 32))
+			{
+				printf("Batch hash mismatch for %u inputs, input %u\n", num_inputs, first_input + i);
+				reportFailure();
+			}
+			else
+			{
+				reportSuccess();
+			}
+		}
+	}
+	free(batch_transaction);
+	free(generated_transaction);
+}
+
+/** Check that parseTransactionBatch() rejects an invalid batch and consumes
+  * all of the transaction data anyway.
+  * \param num_inputs Number of inputs in the test transaction. This must be
+  *                   less than 0xfd.
+  * \param first_input See parseTransactionBatch().
+  * \param num_inputs_to_sign See parseTransactionBatch().
+  * \param blank_scripts Whether to make the input scripts of the spending
+  *                      transaction empty, as parseTransactionBatch()
+  *                      expects.
+  * \param expected_return The expected return value of
+  *                        parseTransactionBatch().
+  */
+static void testBadBatch(uint32_t num_inputs, uint32_t first_input, uint32_t num_inputs_to_sign, bool blank_scripts, TransactionErrors expected_return)
+{
+	uint8_t *generated_transaction;
+	uint8_t *batch_transaction;
+	uint32_t generated_length;
+	uint32_t batch_length;
+	uint8_t batch_sig_hashes[MAX_BATCH_INPUTS][32];
+	uint8_t batch_transaction_hash[32];
+	uint8_t pubkey_hashes[MAX_BATCH_INPUTS][20];
+	TransactionErrors r;
+
+	generated_transaction = generateTestTransaction(&generated_length, num_inputs, 2);
+	if (blank_scripts)
+	{
+		batch_transaction = blankInputScripts(&batch_length, generated_transaction, generated_length, num_inputs, num_inputs);
+		free(generated_transaction);
+	}
+	else
+	{
+		batch_transaction = generated_transaction;
+		batch_length = generated_length;
+	}
+	memset(pubkey_hashes, 0, sizeof(pubkey_hashes));
+	clearOutputsSeen();
+	setTestInputStream(batch_transaction, batch_length);
+	r = parseTransactionBatch(batch_sig_hashes, batch_transaction_hash, pubkey_hashes, first_input, num_inputs_to_sign, batch_length);
+	if ((r != expected_return) || !isEndOfTransactionData())
+	{
+		printf("parseTransactionBatch() returned %d (expected %d) for %u inputs, first = %u, batch size = %u\n", (int)r, (int)expected_return, num_inputs, first_input, num_inputs_to_sign);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	free(batch_transaction);
+}
+
+/** Parse the spending transaction in #good_main_transaction with is_ref = 2,
+  * so that the parse cache is used instead of input transactions.
+  * \param sig_hash See parseTransaction().
+  * \param transaction_hash See parseTransaction().
+  * \return See parseTransaction().
+  */
+static TransactionErrors parseCachedGoodMainTransaction(uint8_t *sig_hash, uint8_t *transaction_hash)
+{
+	uint8_t buffer[sizeof(good_main_transaction) + 1];
+	TransactionErrors r;
+
+	buffer[0] = 0x02; // is_ref = 2 (main, with cached inputs)
+	memcpy(&(buffer[1]), good_main_transaction, sizeof(good_main_transaction));
+	clearOutputsSeen();
+	setTestInputStream(buffer, sizeof(buffer));
+	r = parseTransaction(sig_hash, transaction_hash, sizeof(buffer));
+	if (!isEndOfTransactionData())
+	{
+		printf("parseTransaction() didn't eat everything for cached transaction\n");
+		reportFailure();
+	}
+	return r;
+}
+
+/** Check that parseTransactionBatch() computes the expected BIP 143
+  * signature hashes for #good_segwit_transaction, or that it rejects the
+  * batch.
+  * \param first_input See parseTransactionBatch().
+  * \param num_inputs_to_sign See parseTransactionBatch().
+  * \param expected_return The expected return value of
+  *                        parseTransactionBatch().
+  */
+static void testSegwitBatch(uint32_t first_input, uint32_t num_inputs_to_sign, TransactionErrors expected_return)
+{
+	uint8_t sig_hashes[MAX_BATCH_INPUTS][32];
+	uint8_t transaction_hash[32];
+	uint8_t pubkey_hashes[MAX_BATCH_INPUTS][20];
+	uint32_t i;
+	TransactionErrors r;
+
+	for (i = 0; i < num_inputs_to_sign; i++)
+	{
+		memcpy(pubkey_hashes[i], segwit_pubkey_hashes[first_input + i], 20);
+	}
+	clearOutputsSeen();
+	setTestInputStream(good_segwit_transaction, sizeof(good_segwit_transaction));
+	r = parseTransactionBatch(sig_hashes, transaction_hash, pubkey_hashes, first_input, num_inputs_to_sign, sizeof(good_segwit_transaction));
+	if ((r != expected_return) || !isEndOfTransactionData())
+	{
+		printf("parseTransactionBatch() returned %d (expected %d) on segwit transaction, first = %u, batch size = %u\n", (int)r, (int)expected_return, first_input, num_inputs_to_sign);
+		reportFailure();
+		return;
+	}
+	if (expected_return != TRANSACTION_NO_ERROR)
+	{
+		reportSuccess();
+		return;
+	}
+	for (i = 0; i < num_inputs_to_sign; i++)
+	{
+		if (memcmp(sig_hashes[i], segwit_sig_hashes[first_input + i], 32))
+		{
+			printf("Segwit signature hash mismatch for input %u\n", first_input + i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+}
+
+/** Check calculateSegwitSigHashes() against the native P2WPKH example in
+  * BIP 143. The example transaction can't be passed to
+  * parseTransactionBatch(), since its first input has a non-final sequence
+  * number and its locktime is non-zero, so the segwit state is filled in
+  * directly, as the parser would have done.
+  */
+static void testBip143Example(void)
+{
+	SegwitState state;
+	uint8_t pubkey_hashes[1][20];
+	uint8_t sig_hash[32];
+	uint8_t locktime[4] = {0x11, 0x00, 0x00, 0x00};
+	uint8_t hashtype[4] = {0x01, 0x00, 0x00, 0x00};
+	uint32_t i;
+
+	sha256Begin(&(state.prevouts_hs));
+	sha256Begin(&(state.sequence_hs));
+	sha256Begin(&(state.outputs_hs));
+	for (i = 0; i < 2; i++)
+	{
+		sha256WriteBytes(&(state.prevouts_hs), bip143_example_outpoints[i], 36);
+		sha256WriteBytes(&(state.sequence_hs), bip143_example_sequences[i], 4);
+	}
+	sha256WriteBytes(&(state.outputs_hs), bip143_example_outputs, sizeof(bip143_example_outputs));
+	writeU32LittleEndian(state.version, 0x00000001);
+	memcpy(state.inputs[0].outpoint, bip143_example_outpoints[1], 36);
+	memcpy(state.inputs[0].amount, bip143_example_amount, 8);
+	memcpy(state.inputs[0].sequence, bip143_example_sequences[1], 4);
+	memcpy(pubkey_hashes[0], bip143_example_pubkey_hash, 20);
+
+	segwit_state = &state;
+	batch_pubkey_hashes = pubkey_hashes;
+	batch_num_inputs = 1;
+	calculateSegwitSigHashes(sig_hash, locktime, hashtype);
+	segwit_state = NULL;
+	if (memcmp(sig_hash, bip143_example_sig_hash, 32))
+	{
+		printf("Segwit signature hash doesn't match BIP 143 example\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+/** Offset, within the PSBT most recently generated by generateTestPsbt(),
+  * of the non-witness UTXO of the first input. */
+static uint32_t psbt_utxo_offset;
+
+/** Write a variable-sized integer, in the format which getVarInt() reads.
+  * \param buffer The integer will be written here. There must be space for
+  *               5 bytes.
+  * \param value The value to write.
+  * \return The number of bytes written.
+  */
+static uint32_t writeTestVarInt(uint8_t *buffer, uint32_t value)
+{
+	if (value < 0xfd)
+	{
+		buffer[0] = (uint8_t)value;
+		return 1;
+	}
+	else if (value <= 0xffff)
+	{
+		buffer[0] = 0xfd;
+		buffer[1] = (uint8_t)value;
+		buffer[2] = (uint8_t)(value >> 8);
+		return 3;
+	}
+	else
+	{
+		buffer[0] = 0xfe;
+		writeU32LittleEndian(&(buffer[1]), value);
+		return 5;
+	}
+}
+
+/** Generate a PSBT containing the same transaction as
+  * generateTestTransaction() (with 2 outputs). The PSBT also contains some
+  * key-value pairs which parsePsbt() should ignore.
+  * \param out_length The length of the PSBT will be written here.
+  * \param num_inputs The number of inputs to include in the transaction.
+  *                   This must be less than 0xfd.
+  * \param omit_utxo The index of an input whose non-witness UTXO will be
+  *                  left out. Use a value >= num_inputs to include all of
+  *                  them.
+  * \param extra_key_type If this is not 0xff, a key-value pair with this key
+  *                       type and a 4 byte value will be added to the map
+  *                       of the first input.
+  * \param extra_value The 4 byte value (written in little-endian format) of
+  *                    the key-value pair described by extra_key_type.
+  * \return A pointer to a byte array containing the PSBT. This array must
+  *         eventually be freed by the caller.
+  */
+static uint8_t *generateTestPsbt(uint32_t *out_length, uint32_t num_inputs, uint32_t omit_utxo, uint8_t extra_key_type, uint32_t extra_value)
+{
+	uint8_t *generated_transaction;
+	uint8_t *blank_transaction;
+	uint8_t *buffer;
+	uint32_t generated_length;
+	uint32_t blank_length;
+	uint32_t unsigned_length;
+	uint32_t utxo_length;
+	uint32_t ptr;
+	uint32_t i;
+
+	generated_transaction = generateTestTransaction(&generated_length, num_inputs, 2);
+	blank_transaction = blankInputScripts(&blank_length, generated_transaction, generated_length, num_inputs, num_inputs);
+	free(generated_transaction);
+	// The unsigned transaction doesn't include the hashtype and the
+	// non-witness UTXOs don't include the output number.
+	unsigned_length = blank_length - main_offset - 4;
+	utxo_length = sizeof(good_input_transaction) - 4;
+	buffer = malloc(blank_length + num_inputs * (utxo_length + 20) + 100);
+	ptr = 0;
+
+	memcpy(&(buffer[ptr]), psbt_magic, sizeof(psbt_magic));
+	ptr += sizeof(psbt_magic);
+	// Global map: an unknown key-value pair, then the unsigned transaction.
+	buffer[ptr++] = 0x02; // key length
+	buffer[ptr++] = 0x01; // key type
+	buffer[ptr++] = 0xaa;
+	buffer[ptr++] = 0x03; // value length
+	buffer[ptr++] = 0x01;
+	buffer[ptr++] = 0x02;
+	buffer[ptr++] = 0x03;
+	buffer[ptr++] = 0x01; // key length
+	buffer[ptr++] = PSBT_GLOBAL_UNSIGNED_TX;
+	ptr += writeTestVarInt(&(buffer[ptr]), unsigned_length);
+	memcpy(&(buffer[ptr]), &(blank_transaction[main_offset]), unsigned_length);
+	ptr += unsigned_length;
+	buffer[ptr++] = 0x00; // end of map
+	// Input maps.
+	for (i = 0; i < num_inputs; i++)
+	{
+		if (i != omit_utxo)
+		{
+			buffer[ptr++] = 0x01; // key length
+			buffer[ptr++] = PSBT_IN_NON_WITNESS_UTXO;
+			ptr += writeTestVarInt(&(buffer[ptr]), utxo_length);
+			if (i == 0)
+			{
+				psbt_utxo_offset = ptr;
+			}
+			memcpy(&(buffer[ptr]), &(good_input_transaction[4]), utxo_length);
+			ptr += utxo_length;
+		}
+		if ((i == 0) && (extra_key_type != 0xff))
+		{
+			buffer[ptr++] = 0x01; // key length
+			buffer[ptr++] = extra_key_type;
+			buffer[ptr++] = 0x04; // value length
+			writeU32LittleEndian(&(buffer[ptr]), extra_value);
+			ptr += 4;
+		}
+		buffer[ptr++] = 0x00; // end of map
+	}
+	// Output maps, each with an unknown key-value pair.
+	for (i = 0; i < 2; i++)
+	{
+		buffer[ptr++] = 0x02; // key length
+		buffer[ptr++] = 0x02; // key type
+		buffer[ptr++] = 0x00;
+		buffer[ptr++] = 0x01; // value length
+		buffer[ptr++] = 0x55;
+		buffer[ptr++] = 0x00; // end of map
+	}
+	free(blank_transaction);
+	*out_length = ptr;
+	return buffer;
+}
+
+/** Check that parsePsbt() computes the same signature hashes and
+  * transaction hash as parseTransactionBatch() does for the equivalent
+  * transaction.
+  * \param num_inputs Number of inputs in the test transaction. This must be
+  *                   less than 0xfd.
+  * \param first_input See parsePsbt().
+  * \param num_inputs_to_sign See parsePsbt().
+  */
+static void testPsbt(uint32_t num_inputs, uint32_t first_input, uint32_t num_inputs_to_sign)
+{
+	uint8_t *generated_transaction;
+	uint8_t *batch_transaction;
+	uint8_t *psbt;
+	uint32_t generated_length;
+	uint32_t batch_length;
+	uint32_t psbt_length;
+	uint32_t i;
+	uint8_t batch_sig_hashes[MAX_BATCH_INPUTS][32];
+	uint8_t batch_transaction_hash[32];
+	uint8_t psbt_sig_hashes[MAX_BATCH_INPUTS][32];
+	uint8_t psbt_transaction_hash[32];
+	uint8_t pubkey_hashes[MAX_BATCH_INPUTS][20];
+	TransactionErrors r;
+
+	for (i = 0; i < num_inputs_to_sign; i++)
+	{
+		// This is the public key hash in the input script of one_input.
+		memcpy(pubkey_hashes[i], &(one_input[40]), 20);
 	}
-	else if (num_outputs <= 0xffff)
+	generated_transaction = generateTestTransaction(&generated_length, num_inputs, 2);
+	batch_transaction = blankInputScripts(&batch_length, generated_transaction, generated_length, num_inputs, num_inputs);
+	setTestInputStream(batch_transaction, batch_length);
+	r = parseTransactionBatch(batch_sig_hashes, batch_transaction_hash, pubkey_hashes, first_input, num_inputs_to_sign, batch_length);
+	free(batch_transaction);
+	free(generated_transaction);
+	if (r != TRANSACTION_NO_ERROR)
 	{
-		buffer[ptr] = 0xfd;
-		ptr++;
-		buffer[ptr] = (uint8_t)num_outputs;
-		ptr++;
-		buffer[ptr] = (uint8_t)(num_outputs >> 8);
-		ptr++;
+		printf("parseTransactionBatch() failed for PSBT comparison\n");
+		reportFailure();
+		return;
 	}
-	else
+
+	psbt = generateTestPsbt(&psbt_length, num_inputs, num_inputs, PSBT_IN_SIGHASH_TYPE, 0x00000001);
+	clearOutputsSeen();
+	setTestInputStream(psbt, psbt_length);
+	r = parsePsbt(psbt_sig_hashes, psbt_transaction_hash, pubkey_hashes, first_input, num_inputs_to_sign, psbt_length);
+	free(psbt);
+	if ((r != TRANSACTION_NO_ERROR) || !isEndOfTransactionData())
 	{
-		buffer[ptr] = 0xfe;
-		ptr++;
-		writeU32LittleEndian(&(buffer[ptr]), num_outputs);
-		ptr += 4;
+		printf("parsePsbt() failed for %u inputs, first = %u, batch size = %u\n", num_inputs, first_input, num_inputs_to_sign);
+		reportFailure();
+		return;
 	}
-	// Write outputs.
-	for (i = 0; i < num_outputs; i++)
+	checkOutputsSeen(2);
+	for (i = 0; i < num_inputs_to_sign; i++)
 	{
-		memcpy(&(buffer[ptr]), one_output, sizeof(one_output));
-		if (i == 0)
+		if (memcmp(psbt_sig_hashes[i], batch_sig_hashes[i], 32)
+			|| memcmp(psbt_transaction_hash, batch_transaction_hash, 32))
 		{
-			memcpy(&(buffer[ptr]), output_amount1, sizeof(output_amount1));
-			memcpy(&(buffer[ptr + 12]), output_address1, sizeof(output_address1));
-		}
-		else if (i == 1)
-		{
-			memcpy(&(buffer[ptr]), output_amount2, sizeof(output_amount2));
-			memcpy(&(buffer[ptr + 12]), output_address2, sizeof(output_address2));
+			printf("PSBT hash mismatch for %u inputs, input %u\n", num_inputs, first_input + i);
+			reportFailure();
 		}
 		else
 		{
-			// Use random amount/address.
-			memset(temp, 0, 8);
-			// Make sure it's small enough that the transaction fee is always
-			// positive.
-			for (j = 0; j < 2; j++)
-			{
-				temp[j] = (uint8_t)(rand() & 0xff);
-			}
-			memcpy(&(buffer[ptr]), temp, 8);
-			for (j = 0; j < 20; j++)
-			{
-				temp[j] = (uint8_t)(rand() & 0xff);
-			}
-			memcpy(&(buffer[ptr + 12]), temp, 20);
+			reportSuccess();
 		}
-		ptr += sizeof(one_output);
 	}
-	// Write locktime.
-	writeU32LittleEndian(&(buffer[ptr]), 0x00000000);
-	ptr += 4;
-	// Write hashtype.
-	writeU32LittleEndian(&(buffer[ptr]), 0x00000001);
-	ptr += 4;
-	*out_length = ptr;
-	return buffer;
 }
 
-/** Check that the number of outputs seen is as expected.
-  * \param target The expected number of outputs.
+/** Check that parsePsbt() rejects an invalid PSBT and consumes all of it
+  * anyway.
+  * \param num_inputs See generateTestPsbt().
+  * \param omit_utxo See generateTestPsbt().
+  * \param extra_key_type See generateTestPsbt().
+  * \param extra_value See generateTestPsbt().
+  * \param corrupt_utxo Whether to modify the first non-witness UTXO, so that
+  *                     it no longer matches the reference to it.
+  * \param expected_return The expected return value of parsePsbt().
   */
-static void checkOutputsSeen(int target)
+static void testBadPsbt(uint32_t num_inputs, uint32_t omit_utxo, uint8_t extra_key_type, uint32_t extra_value, bool corrupt_utxo, TransactionErrors expected_return)
 {
-	if (num_outputs_seen != target)
+	uint8_t *psbt;
+	uint32_t psbt_length;
+	uint8_t sig_hashes[MAX_BATCH_INPUTS][32];
+	uint8_t transaction_hash[32];
+	uint8_t pubkey_hashes[MAX_BATCH_INPUTS][20];
+	TransactionErrors r;
+
+	memset(pubkey_hashes, 0, sizeof(pubkey_hashes));
+	psbt = generateTestPsbt(&psbt_length, num_inputs, omit_utxo, extra_key_type, extra_value);
+	if (corrupt_utxo)
 	{
-		printf("Expected to see %d outputs, got %d\n", target, num_outputs_seen);
+		// Modify the previous output hash of the UTXO's first input.
+		psbt[psbt_utxo_offset + 10] ^= 0x01;
+	}
+	clearOutputsSeen();
+	setTestInputStream(psbt, psbt_length);
+	r = parsePsbt(sig_hashes, transaction_hash, pubkey_hashes, 0, 1, psbt_length);
+	free(psbt);
+	if ((r != expected_return) || !isEndOfTransactionData())
+	{
+		printf("parsePsbt() returned %d (expected %d) for bad PSBT\n", (int)r, (int)expected_return);
 		reportFailure();
 	}
 	else
@@ -2583,118 +4363,213 @@ static void checkOutputsSeen(int target)
 	}
 }
 
-/** Set the input stream to some transaction data and attempt to parse that
-  * transaction.
-  * \param buffer The test transaction data. If this is NULL, the input stream
-  *               will be set to an infinite stream of zeroes.
-  * \param length The length of the transaction, in number of bytes.
-  * \param name The test name of the transaction. This is displayed on stdout
-  *             if a test fails.
-  * \param expected_return The expected return value of parseTransaction().
+/** Number of bytes to hash when measuring the speed of sha256WriteByte(). */
+#define BENCHMARK_HASH_BYTES		4000000
+
+/** benchmarkParser() will parse each generated transaction repeatedly until
+  * at least this many bytes have been parsed, so that small transactions can
+  * be timed accurately. */
+#define BENCHMARK_PARSE_BYTES		4000000
+
+/** Numbers of inputs (for transactions with 1 output) and numbers of outputs
+  * (for transactions with 1 input) which benchmarkParser() will time. */
+static const uint32_t benchmark_sizes[] = {1, 10, 100, 1000, MAX_OUTPUTS, MAX_INPUTS};
+
+/** Breakdown of the time taken to parse a transaction, in seconds. */
+typedef struct ParserTimingStruct
+{
+	/** Total time taken by parseTransaction(). */
+	double total;
+	/** Estimated time spent hashing transaction data. */
+	double hashing;
+	/** Time spent converting outputs to text (base 58 and base 10). */
+	double base58;
+	/** Everything else; the parser itself. */
+	double parsing;
+} ParserTiming;
+
+/** Measure how long sha256WriteByte() takes per byte.
+  * \return Time per byte, in seconds.
   */
-static void testTransaction(const uint8_t *buffer, uint32_t length, const char *name, TransactionErrors expected_return)
+static double measureHashByteTime(void)
+{
+	HashState hs;
+	clock_t start;
+	clock_t elapsed;
+	uint32_t i;
+
+	start = clock();
+	sha256Begin(&hs);
+	for (i = 0; i < BENCHMARK_HASH_BYTES; i++)
+	{
+		sha256WriteByte(&hs, (uint8_t)i);
+	}
+	sha256Finish(&hs);
+	elapsed = clock() - start;
+	return (double)elapsed / (double)CLOCKS_PER_SEC / (double)BENCHMARK_HASH_BYTES;
+}
+
+/** Time how long parseTransaction() takes to parse a generated transaction,
+  * and print the results.
+  * \param out The time taken for one parse will be written here.
+  * \param num_inputs The number of inputs in the generated transaction.
+  * \param num_outputs The number of outputs in the generated transaction.
+  * \param hash_byte_time Time per byte for sha256WriteByte(), as returned by
+  *                       measureHashByteTime().
+  * \return false on success, true if parseTransaction() failed.
+  */
+static bool timeParser(ParserTiming *out, uint32_t num_inputs, uint32_t num_outputs, double hash_byte_time)
 {
+	uint8_t *generated_transaction;
+	uint32_t length;
 	uint8_t sig_hash[32];
 	uint8_t transaction_hash[32];
+	uint32_t num_repeats;
+	uint32_t i;
+	double total_bytes_hashed;
+	clock_t start;
+	clock_t elapsed;
 	TransactionErrors r;
 
-	clearOutputsSeen();
-	if (buffer == NULL)
+	generated_transaction = generateTestTransaction(&length, num_inputs, num_outputs);
+	num_repeats = BENCHMARK_PARSE_BYTES / length + 1;
+	total_bytes_hashed = 0.0;
+	output_conversion_time = 0;
+	elapsed = 0;
+	r = TRANSACTION_NO_ERROR;
+	for (i = 0; i < num_repeats; i++)
 	{
-		setInfiniteZeroInputStream();
+		clearOutputsSeen();
+		clearParseCache();
+		setTestInputStream(generated_transaction, length);
+		num_bytes_hashed = 0;
+		start = clock();
+		r = parseTransaction(sig_hash, transaction_hash, length);
+		elapsed += clock() - start;
+		total_bytes_hashed += (double)num_bytes_hashed;
+		if (r != TRANSACTION_NO_ERROR)
+		{
+			break;
+		}
 	}
-	else
+	free(generated_transaction);
+	if (r != TRANSACTION_NO_ERROR)
 	{
-		setTestInputStream(buffer, length);
+		printf("parseTransaction() returned %d for %u inputs, %u outputs\n", (int)r, num_inputs, num_outputs);
+		return true;
 	}
-	r = parseTransaction(sig_hash, transaction_hash, length);
-	// Check return value is what is expected.
-	if (r != expected_return)
+
+	out->total = (double)elapsed / (double)CLOCKS_PER_SEC / (double)num_repeats;
+	out->hashing = total_bytes_hashed * hash_byte_time / (double)num_repeats;
+	out->base58 = (double)output_conversion_time / (double)CLOCKS_PER_SEC / (double)num_repeats;
+	out->parsing = out->total - out->hashing - out->base58;
+	if (out->total <= 0.0)
 	{
-		printf("parseTransaction() returned unexpected value for transaction \"%s\"\n", name);
-		printf("Expected: %d, got: %d\n", (int)expected_return, (int)r);
-		reportFailure();
+		out->total = 1.0 / (double)CLOCKS_PER_SEC;
 	}
-	else
+	printf("%7u %7u %9u %12.0f %9.3f %8.1f%% %8.1f%% %8.1f%%\n", num_inputs, num_outputs, length,
+		(double)length / out->total, out->total * 1000.0,
+		100.0 * out->hashing / out->total, 100.0 * out->base58 / out->total,
+		100.0 * out->parsing / out->total);
+	return false;
+}
+
+/** Print the cost of each additional input or output, obtained from the
+  * difference in timing between the smallest and largest transactions.
+  * \param name "input" or "output".
+  * \param smallest Timing for the transaction with 1 input and 1 output.
+  * \param largest Timing for the transaction with many inputs or outputs.
+  * \param count The number of inputs or outputs in the largest transaction.
+  */
+static void printMarginalCost(const char *name, ParserTiming *smallest, ParserTiming *largest, uint32_t count)
+{
+	double scale;
+
+	scale = 1000000.0 / (double)(count - 1);
+	printf("Cost per %s: %.2f us (hashing %.2f us, base58 %.2f us, parsing %.2f us)\n", name,
+		(largest->total - smallest->total) * scale,
+		(largest->hashing - smallest->hashing) * scale,
+		(largest->base58 - smallest->base58) * scale,
+		(largest->parsing - smallest->parsing) * scale);
+}
+
+/** Feed generated transactions of increasing size to parseTransaction() and
+  * report throughput, the cost of each input and output, and how the time is
+  * split between hashing, converting outputs to base 58 and everything else.
+  * Hashing time is estimated by counting the bytes written to hash states
+  * and multiplying by the time sha256WriteByte() takes per byte.
+  * \return false on success, true if a transaction failed to parse.
+  */
+static bool benchmarkParser(void)
+{
+	ParserTiming smallest;
+	ParserTiming largest;
+	ParserTiming current;
+	double hash_byte_time;
+	uint32_t size;
+	uint32_t largest_size;
+	unsigned int i;
+	unsigned int num_sizes;
+
+	benchmark_outputs = true;
+	hash_byte_time = measureHashByteTime();
+	printf("sha256WriteByte(): %.0f bytes per second\n", 1.0 / hash_byte_time);
+	printf("MAX_INPUTS = %u, MAX_OUTPUTS = %u, MAX_TRANSACTION_SIZE = %u\n", (unsigned int)MAX_INPUTS, (unsigned int)MAX_OUTPUTS, (unsigned int)MAX_TRANSACTION_SIZE);
+	printf("%7s %7s %9s %12s %9s %9s %9s %9s\n", "inputs", "outputs", "bytes", "bytes/s", "ms", "hashing", "base58", "parsing");
+	if (timeParser(&smallest, 1, 1, hash_byte_time))
 	{
-		// Then check if all bytes in the transaction were consumed.
-		if (!isEndOfTransactionData())
-		{
-			printf("parseTransaction() didn't eat everything for transaction \"%s\"\n", name);
-			reportFailure();
-		}
-		else
+		return true;
+	}
+
+	num_sizes = sizeof(benchmark_sizes) / sizeof(uint32_t);
+	largest_size = 1;
+	for (i = 0; i < num_sizes; i++)
+	{
+		size = benchmark_sizes[i];
+		if ((size > 1) && (size <= MAX_INPUTS))
 		{
-			// Then check that there was no attempt to read past the end of
-			// the transaction.
-			if (transaction_data_index > transaction_length)
+			if (timeParser(&current, size, 1, hash_byte_time))
 			{
-				printf("parseTransaction() read past end for transaction \"%s\"\n", name);
-				reportFailure();
+				return true;
 			}
-			else
+			if (size > largest_size)
 			{
-				reportSuccess();
+				largest = current;
+				largest_size = size;
 			}
 		}
-	} // end if (r != expected_return)
-}
-
-/** This is just like testTransaction(), except this prepends
-  * #good_input_transaction (and the is_ref bytes) to the test transaction data.
-  * \param buffer See testTransaction().
-  * \param length See testTransaction().
-  * \param name See testTransaction().
-  * \param expected_return See testTransaction().
-  */
-static void prependGoodInputTestTransaction(const uint8_t *buffer, uint32_t length, const char *name, TransactionErrors expected_return)
-{
-	uint8_t *new_buffer;
-	uint32_t new_length;
-
-	if (length > (0xffffffff - (sizeof(good_input_transaction) + 2)))
+	}
+	if (largest_size > 1)
 	{
-		// length + sizeof(good_input_transaction) + 2 will overflow.
-		printf("Unexpected fatal error: length too big in prependGoodInputTestTransaction()\n");
-		exit(1);
+		printMarginalCost("input", &smallest, &largest, largest_size);
 	}
-	new_length = length + sizeof(good_input_transaction) + 2;
-	new_buffer = malloc(new_length);
-	new_buffer[0] = 0x01; // is_ref = 1 (input)
-	memcpy(&(new_buffer[1]), good_input_transaction, sizeof(good_input_transaction));
-	new_buffer[sizeof(good_input_transaction) + 1] = 0x00; // is_ref = 0 (main)
-	memcpy(&(new_buffer[sizeof(good_input_transaction) + 2]), buffer, length);
-	testTransaction(new_buffer, new_length, name, expected_return);
-	free(new_buffer);
-}
-
-/** This is just like testTransaction(), except this prepends
-  * #p2sh_test_prepend to the test transaction data.
-  * \param buffer See testTransaction().
-  * \param length See testTransaction().
-  * \param name See testTransaction().
-  * \param expected_return See testTransaction().
-  */
-static void prependGoodP2SHInputsTestTransaction(const uint8_t *buffer, uint32_t length, const char *name, TransactionErrors expected_return)
-{
-	uint8_t *new_buffer;
-	uint32_t new_length;
 
-	if (length > (0xffffffff - sizeof(p2sh_test_prepend)))
+	largest_size = 1;
+	for (i = 0; i < num_sizes; i++)
 	{
-		// length + sizeof(p2sh_test_prepend) will overflow.
-		printf("Unexpected fatal error: length too big in prependGoodP2SHInputsTestTransaction()\n");
-		exit(1);
+		size = benchmark_sizes[i];
+		if ((size > 1) && (size <= MAX_OUTPUTS))
+		{
+			if (timeParser(&current, 1, size, hash_byte_time))
+			{
+				return true;
+			}
+			if (size > largest_size)
+			{
+				largest = current;
+				largest_size = size;
+			}
+		}
 	}
-	new_length = length + sizeof(p2sh_test_prepend);
-	new_buffer = malloc(new_length);
-	memcpy(new_buffer, p2sh_test_prepend, sizeof(p2sh_test_prepend));
-	memcpy(&(new_buffer[sizeof(p2sh_test_prepend)]), buffer, length);
-	testTransaction(new_buffer, new_length, name, expected_return);
-	free(new_buffer);
+	if (largest_size > 1)
+	{
+		printMarginalCost("output", &smallest, &largest, largest_size);
+	}
+	benchmark_outputs = false;
+	return false;
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
 	int i;
 	int num_tests;
@@ -2707,6 +4582,7 @@ int main(void)
 	uint8_t sig_hash[32];
 	uint8_t transaction_hash[32];
 	uint8_t calculated_sig_hash[32];
+	uint8_t batch_sig_hashes[MAX_BATCH_INPUTS][32];
 	uint8_t calculated_transaction_hash[32];
 	uint8_t sig_hash_input_changed[32];
 	uint8_t transaction_hash_input_changed[32];
@@ -2721,6 +4597,22 @@ int main(void)
 	initWalletTest();
 	initialiseDefaultEntropyPool();
 
+	if (argc > 1)
+	{
+		if ((argc == 2) && !strcmp(argv[1], "benchmark"))
+		{
+			if (benchmarkParser())
+			{
+				exit(1);
+			}
+			exit(0);
+		}
+		printf("Usage: %s [benchmark]\n", argv[0]);
+		printf("  With no arguments, run the transaction parser tests\n");
+		printf("  With \"benchmark\", measure the speed of the transaction parser\n");
+		exit(1);
+	}
+
 	// Test the transaction parser on some transactions which have invalid
 	// lengths.
 	testTransaction(good_full_transaction, 0, "blank", TRANSACTION_INVALID_FORMAT);
@@ -3119,6 +5011,130 @@ int main(void)
 		reportSuccess();
 	}
 
+	// If the input transactions aren't in the parse cache, a spending
+	// transaction with is_ref = 2 should be rejected.
+	clearParseCache();
+	if (parseCachedGoodMainTransaction(sig_hash, transaction_hash) != TRANSACTION_INVALID_REFERENCE)
+	{
+		printf("Parse cache accepted uncached inputs\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	// After the full transaction has been parsed, is_ref = 2 should work
+	// and produce the same hashes.
+	testTransaction(good_full_transaction, sizeof(good_full_transaction), "good_fill_cache", TRANSACTION_NO_ERROR);
+	setTestInputStream(good_full_transaction, sizeof(good_full_transaction));
+	parseTransaction(calculated_sig_hash, calculated_transaction_hash, sizeof(good_full_transaction));
+	if ((parseCachedGoodMainTransaction(sig_hash, transaction_hash) != TRANSACTION_NO_ERROR)
+		|| memcmp(sig_hash, calculated_sig_hash, 32)
+		|| memcmp(transaction_hash, calculated_transaction_hash, 32))
+	{
+		printf("Parse cache doesn't reproduce full parse\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	checkOutputsSeen(2);
+	// Different input references shouldn't match the cache entry.
+	memcpy(bad_main_transaction, good_main_transaction, sizeof(good_main_transaction));
+	bad_main_transaction[5] ^= 0x01; // input reference hash
+	length = sizeof(good_main_transaction) + 1;
+	generated_transaction = malloc(length);
+	generated_transaction[0] = 0x02; // is_ref = 2 (main, with cached inputs)
+	memcpy(&(generated_transaction[1]), bad_main_transaction, sizeof(good_main_transaction));
+	testTransaction(generated_transaction, length, "cache_bad_reference", TRANSACTION_INVALID_REFERENCE);
+	free(generated_transaction);
+	// Clearing the cache (as is done on Initialize) should forget the entry.
+	clearParseCache();
+	if (parseCachedGoodMainTransaction(sig_hash, transaction_hash) != TRANSACTION_INVALID_REFERENCE)
+	{
+		printf("clearParseCache() doesn't clear parse cache\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// BIP 143 signature hashes should match the known good values.
+	testSegwitBatch(0, 2, TRANSACTION_NO_ERROR);
+	checkOutputsSeen(2);
+	// Segwit batches must cover every input; see parseTransactionBatch().
+	testSegwitBatch(0, 1, TRANSACTION_INVALID_REFERENCE);
+	testSegwitBatch(1, 1, TRANSACTION_INVALID_REFERENCE);
+	// The native P2WPKH example in BIP 143 is an independent check.
+	testBip143Example();
+	// parseTransaction() can't compute BIP 143 signature hashes.
+	testTransaction(good_segwit_transaction, sizeof(good_segwit_transaction), "segwit_not_batch", TRANSACTION_NON_STANDARD);
+	// Truncated segwit transactions should be rejected.
+	for (i = 0; i < sizeof(good_segwit_transaction); i++)
+	{
+		clearOutputsSeen();
+		setTestInputStream(good_segwit_transaction, (uint32_t)i);
+		if (parseTransactionBatch(batch_sig_hashes, calculated_transaction_hash, (uint8_t (*)[20])segwit_pubkey_hashes, 0, 2, (uint32_t)i) != TRANSACTION_INVALID_FORMAT)
+		{
+			printf("Truncated segwit transaction (length %d) not rejected\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
+	// Batch signature hashes should match the ones computed one input at
+	// a time.
+	testBatch(1, 0, 1);
+	testBatch(2, 1, 1);
+	testBatch(5, 0, 5);
+	testBatch(10, 2, MAX_BATCH_INPUTS);
+	testBatch(MAX_BATCH_INPUTS, 0, MAX_BATCH_INPUTS);
+	// Invalid batches.
+	testBadBatch(3, 2, 2, true, TRANSACTION_INVALID_REFERENCE);
+	testBadBatch(3, 3, 1, true, TRANSACTION_INVALID_REFERENCE);
+	testBadBatch(3, 0xffffffff, 1, true, TRANSACTION_INVALID_REFERENCE);
+	testBadBatch(3, 0, 1, false, TRANSACTION_INVALID_FORMAT);
+	testBadBatch(3, 0, 0, true, TRANSACTION_INVALID_FORMAT);
+	testBadBatch(3, 0, MAX_BATCH_INPUTS + 1, true, TRANSACTION_TOO_MANY_INPUTS);
+
+	// PSBT signature hashes should match batch signature hashes.
+	testPsbt(1, 0, 1);
+	testPsbt(2, 1, 1);
+	testPsbt(5, 0, 5);
+	testPsbt(10, 2, MAX_BATCH_INPUTS);
+	testPsbt(PSBT_MAX_INPUTS, 0, MAX_BATCH_INPUTS);
+	// Invalid PSBTs.
+	testBadPsbt(3, 3, 0xff, 0, false, TRANSACTION_NO_ERROR); // sanity check
+	testBadPsbt(3, 1, 0xff, 0, false, TRANSACTION_INVALID_REFERENCE);
+	testBadPsbt(3, 3, 0xff, 0, true, TRANSACTION_INVALID_REFERENCE);
+	testBadPsbt(3, 3, PSBT_IN_SIGHASH_TYPE, 0x00000002, false, TRANSACTION_NON_STANDARD);
+	testBadPsbt(3, 3, PSBT_IN_WITNESS_UTXO, 0, false, TRANSACTION_NON_STANDARD);
+	testBadPsbt(3, 3, PSBT_IN_NON_WITNESS_UTXO, 0, false, TRANSACTION_INVALID_FORMAT);
+	testBadPsbt(PSBT_MAX_INPUTS + 1, PSBT_MAX_INPUTS + 1, 0xff, 0, false, TRANSACTION_TOO_MANY_INPUTS);
+	// Truncated PSBTs should be rejected.
+	generated_transaction = generateTestPsbt(&length, 2, 2, 0xff, 0);
+	for (i = 0; i < (int)length; i++)
+	{
+		clearOutputsSeen();
+		setTestInputStream(generated_transaction, (uint32_t)i);
+		if ((parsePsbt(batch_sig_hashes, calculated_transaction_hash, (uint8_t (*)[20])segwit_pubkey_hashes, 0, 2, (uint32_t)i) != TRANSACTION_INVALID_FORMAT)
+			|| !isEndOfTransactionData())
+		{
+			printf("Truncated PSBT (length %d) not rejected\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+	free(generated_transaction);
+
 	// Check that the transaction parser doesn't choke on a transaction
 	// with the maximum possible size. This test takes a while.
 	testTransaction(NULL, 0xffffffff, "max_size", TRANSACTION_TOO_LARGE);
@@ -15,6 +15,15 @@
   * signTransaction() generates. */
 #define MAX_SIGNATURE_LENGTH		73
 
+#ifndef MAX_BATCH_INPUTS
+/** Maximum number of inputs which parseTransactionBatch() can compute
+  * signature hashes for in one pass. Each one costs a hash state on the
+  * stack, so small targets may want to reduce this. This must not be larger
+  * than the max_count of the address_handle field of SignTransactionBatch
+  * (see messages.proto). */
+#define MAX_BATCH_INPUTS			8
+#endif // #ifndef MAX_BATCH_INPUTS
+
 /** Return values for parseTransaction(). */
 typedef enum TransactionErrorsEnum
 {
@@ -38,6 +47,9 @@ typedef enum TransactionErrorsEnum
 } TransactionErrors;
 
 extern TransactionErrors parseTransaction(BigNum256 sig_hash, BigNum256 transaction_hash, uint32_t length);
+extern TransactionErrors parseTransactionBatch(uint8_t sig_hashes[][32], BigNum256 transaction_hash, uint8_t pubkey_hashes[][20], uint32_t first_input, uint32_t num_inputs_to_sign, uint32_t length);
+extern TransactionErrors parsePsbt(uint8_t sig_hashes[][32], BigNum256 transaction_hash, uint8_t pubkey_hashes[][20], uint32_t first_input, uint32_t num_inputs_to_sign, uint32_t length);
+extern void clearParseCache(void);
 extern void signTransaction(uint8_t *signature, uint8_t *out_length, BigNum256 sig_hash, BigNum256 private_key);
 
 #endif // #ifndef TRANSACTION_H_INCLUDED
@@ -52,6 +52,52 @@
   * long. */
 #define CHECKSUM_LENGTH			32
 
+/** Number of entries in the address cache, which is stored at the end of
+  * the accounts partition. Each entry remembers the address and public key
+  * of one address handle, so that getAddressAndPublicKey() can avoid a point
+  * multiplication for handles it has seen before. One extra entry holds the
+  * parent public key of a wallet (see #PARENT_PUBLIC_KEY_CACHE_HANDLE). The
+  * default is small; on the PIC32 port it costs 3 of 92 wallet slots. Set
+  * this to 0 to disable the address cache, including the parent public key
+  * entry.
+  * \warning The address cache takes space away from wallet records, so it is
+  *          only used on an accounts partition which sanitiseEverything()
+  *          formatted with the same value of this (see getNumberOfWallets()).
+  *          On any other partition, that space might hold hidden wallets.
+  *          Reformat after changing this: creating wallets and then going
+  *          back to the value the partition was formatted with would put
+  *          the address cache over them.
+  */
+#ifndef ADDRESS_CACHE_ENTRIES
+#ifdef TEST_WALLET
+#define ADDRESS_CACHE_ENTRIES	2
+#else
+#define ADDRESS_CACHE_ENTRIES	4
+#endif // #ifdef TEST_WALLET
+#endif // #ifndef ADDRESS_CACHE_ENTRIES
+
+/** Length of the checksum field of an address cache entry. This is a
+  * truncated SHA-256 hash; it only needs to be long enough to reliably
+  * detect entries which were written under another wallet's encryption
+  * key. */
+#define ADDRESS_CACHE_CHECKSUM_LENGTH	8
+
+/** Address handle used for the address cache entry which holds the parent
+  * public key (see getParentPublicKey()) of a wallet, instead of the address
+  * and public key of an address handle. This entry goes after the
+  * #ADDRESS_CACHE_ENTRIES ordinary entries. Caching the parent public key
+  * means that initWallet() can avoid the point multiplication which would
+  * otherwise be needed to derive it from the seed. */
+#define PARENT_PUBLIC_KEY_CACHE_HANDLE	BAD_ADDRESS_HANDLE
+/** Total number of entries in the address cache, including the parent public
+  * key entry. */
+#define ADDRESS_CACHE_SLOTS		(ADDRESS_CACHE_ENTRIES + 1)
+
+/** Value written to #ADDRESS_STORAGE_FORMAT by sanitiseEverything(). The
+  * bottom 16 bits are the number of address cache entries reserved at the
+  * end of the accounts partition (0 if the address cache is disabled). */
+#define STORAGE_FORMAT_MAGIC	0x57410000
+
 /** Structure of the unencrypted portion of a wallet record. */
 struct WalletRecordUnencryptedStruct
 {
@@ -95,6 +141,36 @@ typedef struct WalletRecordStruct
 	struct WalletRecordEncryptedStruct encrypted;
 } WalletRecord;
 
+/** Structure of an entry in the address cache. The entire entry is
+  * encrypted using the encryption key of the wallet which wrote it.
+  * \warning The size of this must be a multiple of 16, since the block size
+  *          of AES is 128 bits.
+  */
+typedef struct AddressCacheEntryStruct
+{
+	/** The address handle that this entry is for. */
+	uint32_t handle;
+	/** UUID of the wallet that this entry is for. This prevents an entry
+	  * from being used by another wallet which shares the same encryption
+	  * key. */
+	uint8_t uuid[UUID_LENGTH];
+	/** The address (RIPEMD-160 of SHA-256 of compressed public key). */
+	uint8_t address[20];
+	/** x component of public key, in little-endian format. */
+	uint8_t public_key_x[32];
+	/** y component of public key, in little-endian format. The full public
+	  * key is stored because callers need the full point and recovering y
+	  * from x would require a modular square root. */
+	uint8_t public_key_y[32];
+	/** Truncated SHA-256 of everything except this. */
+	uint8_t checksum[ADDRESS_CACHE_CHECKSUM_LENGTH];
+} AddressCacheEntry;
+
+/** This causes a compile-time error if the size of #AddressCacheEntry isn't
+  * a multiple of 16 (the AES block size). sizeof can't be used in a
+  * preprocessor conditional, hence this instead of an #error. */
+typedef char AddressCacheEntrySizeCheck[((sizeof(AddressCacheEntry) % 16) == 0) ? 1 : -1];
+
 /** The most recent error to occur in a function in this file,
   * or #WALLET_NO_ERROR if no error occurred in the most recent function
   * call. See #WalletErrorsEnum for possible values. */
@@ -118,6 +194,20 @@ static uint32_t wallet_nv_address;
   * be 0 if a value hasn't been calculated yet. This is set by
   * getNumberOfWallets(). */
 static uint32_t num_wallets;
+#if ADDRESS_CACHE_ENTRIES > 0
+/** The address in non-volatile memory where the address cache begins. This
+  * is set by getNumberOfWallets(), so it is only valid if #num_wallets is
+  * non-zero. */
+static uint32_t address_cache_nv_address;
+/** Whether space for the address cache is reserved at the end of the
+  * accounts partition. This is set by getNumberOfWallets(), so it is only
+  * valid if #num_wallets is non-zero. */
+static bool address_cache_reserved;
+/** Whether the parent public key of the currently loaded wallet is known to
+  * be in the address cache. If #wallet_loaded is false (i.e. no wallet is
+  * loaded), then the meaning of this variable is undefined. */
+static bool parent_public_key_cached;
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
 
 #ifdef TEST
 /** The file to perform test non-volatile I/O on. */
@@ -295,6 +385,171 @@ static void deriveAndSetEncryptionKey(const uint8_t *uuid, const uint8_t *passwo
 	}
 }
 
+#if ADDRESS_CACHE_ENTRIES > 0
+/** Calculate the checksum of an address cache entry.
+  * \param hash The truncated SHA-256 hash will be written here. This must be
+  *             a byte array with space for #ADDRESS_CACHE_CHECKSUM_LENGTH
+  *             bytes.
+  * \param entry The address cache entry to calculate the checksum of.
+  */
+static void calculateAddressCacheChecksum(uint8_t *hash, AddressCacheEntry *entry)
+{
+	uint8_t buffer[32];
+	uint8_t *ptr;
+	unsigned int i;
+	HashState hs;
+
+	sha256Begin(&hs);
+	ptr = (uint8_t *)entry;
+	for (i = 0; i < offsetof(AddressCacheEntry, checksum); i++)
+	{
+		sha256WriteByte(&hs, ptr[i]);
+	}
+	sha256Finish(&hs);
+	writeHashToByteArray(buffer, &hs, true);
+	memcpy(hash, buffer, ADDRESS_CACHE_CHECKSUM_LENGTH);
+}
+
+/** Get the address in non-volatile memory of the address cache entry which
+  * an address handle maps to. The address cache is direct-mapped, so each
+  * address handle can only go in one entry.
+  * \param ah The address handle to look up. This can be
+  *           #PARENT_PUBLIC_KEY_CACHE_HANDLE.
+  * \return The address in non-volatile memory of the entry.
+  */
+static uint32_t getAddressCacheEntryAddress(AddressHandle ah)
+{
+	if (ah == PARENT_PUBLIC_KEY_CACHE_HANDLE)
+	{
+		return address_cache_nv_address + (uint32_t)(ADDRESS_CACHE_ENTRIES * sizeof(AddressCacheEntry));
+	}
+	return address_cache_nv_address + (uint32_t)((ah % ADDRESS_CACHE_ENTRIES) * sizeof(AddressCacheEntry));
+}
+
+/** Look for an address handle of the currently loaded wallet in the address
+  * cache. Entries which were written by other wallets, or which have been
+  * corrupted, will fail the checksum and are treated as absent.
+  * \param out_address If the address handle was found, the address will be
+  *                    written here. This must be a byte array with space for
+  *                    20 bytes.
+  * \param out_public_key If the address handle was found, the public key
+  *                       will be written here.
+  * \param ah The address handle to look up.
+  * \return true if the address handle was found, false if it wasn't.
+  */
+static bool lookupAddressCache(uint8_t *out_address, PointAffine *out_public_key, AddressHandle ah)
+{
+	AddressCacheEntry entry;
+	uint8_t hash[ADDRESS_CACHE_CHECKSUM_LENGTH];
+
+	if (is_hidden_wallet || !address_cache_reserved)
+	{
+		return false;
+	}
+	if (encryptedNonVolatileRead(
+		(uint8_t *)&entry,
+		PARTITION_ACCOUNTS,
+		getAddressCacheEntryAddress(ah),
+		sizeof(entry)) != NV_NO_ERROR)
+	{
+		return false;
+	}
+	calculateAddressCacheChecksum(hash, &entry);
+	if (memcmp(hash, entry.checksum, sizeof(hash))
+		|| (entry.handle != ah)
+		|| memcmp(entry.uuid, current_wallet.unencrypted.uuid, UUID_LENGTH))
+	{
+		return false;
+	}
+	memcpy(out_address, entry.address, 20);
+	memcpy(out_public_key->x, entry.public_key_x, 32);
+	memcpy(out_public_key->y, entry.public_key_y, 32);
+	out_public_key->is_point_at_infinity = 0;
+	return true;
+}
+
+/** Write the address and public key of an address handle of the currently
+  * loaded wallet into the address cache, replacing whatever was in its
+  * entry. Since the address cache is only a cache, write errors are
+  * ignored. The write isn't flushed; like any other buffered write, it
+  * reaches non-volatile storage when its sector is evicted from the
+  * non-volatile memory write cache or when something else calls
+  * nonVolatileFlush(). Losing it to a reset just means another miss.
+  * \param address The address to store. This must be a byte array of
+  *                length 20 bytes.
+  * \param public_key The public key to store.
+  * \param ah The address handle that address and public key belong to.
+  */
+static void updateAddressCache(uint8_t *address, PointAffine *public_key, AddressHandle ah)
+{
+	AddressCacheEntry entry;
+
+	// Writing to the address cache would reveal that a hidden wallet is
+	// being used.
+	if (is_hidden_wallet || !address_cache_reserved)
+	{
+		return;
+	}
+	entry.handle = ah;
+	memcpy(entry.uuid, current_wallet.unencrypted.uuid, UUID_LENGTH);
+	memcpy(entry.address, address, 20);
+	memcpy(entry.public_key_x, public_key->x, 32);
+	memcpy(entry.public_key_y, public_key->y, 32);
+	calculateAddressCacheChecksum(entry.checksum, &entry);
+	encryptedNonVolatileWrite(
+		(uint8_t *)&entry,
+		PARTITION_ACCOUNTS,
+		getAddressCacheEntryAddress(ah),
+		sizeof(entry));
+}
+
+/** Look for the parent public key of the currently loaded wallet in the
+  * address cache and, if it's there, pass it to setParentPublicKey(). This
+  * will set #parent_public_key_cached.
+  */
+static void loadParentPublicKey(void)
+{
+	uint8_t unused_address[20];
+	uint8_t buffer[PARENT_PUBLIC_KEY_LENGTH];
+	PointAffine parent_public_key;
+
+	parent_public_key_cached = lookupAddressCache(unused_address, &parent_public_key, PARENT_PUBLIC_KEY_CACHE_HANDLE);
+	if (parent_public_key_cached)
+	{
+		memcpy(buffer, parent_public_key.x, 32);
+		memcpy(&(buffer[32]), parent_public_key.y, 32);
+		setParentPublicKey(buffer);
+	}
+}
+
+/** Write the parent public key of the currently loaded wallet into the
+  * address cache, if it isn't already there. This should only be called
+  * once the parent public key has been derived (eg. by generating a private
+  * key), otherwise it will do a point multiplication.
+  */
+static void storeParentPublicKey(void)
+{
+	uint8_t zero_address[20];
+	uint8_t buffer[PARENT_PUBLIC_KEY_LENGTH];
+	PointAffine parent_public_key;
+
+	if (parent_public_key_cached)
+	{
+		return;
+	}
+	if (getParentPublicKey(buffer, current_wallet.encrypted.seed))
+	{
+		return; // invalid seed
+	}
+	memset(zero_address, 0, sizeof(zero_address));
+	memcpy(parent_public_key.x, buffer, 32);
+	memcpy(parent_public_key.y, &(buffer[32]), 32);
+	parent_public_key.is_point_at_infinity = 0;
+	updateAddressCache(zero_address, &parent_public_key, PARENT_PUBLIC_KEY_CACHE_HANDLE);
+	parent_public_key_cached = true;
+}
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
+
 /** Initialise a wallet (load it if it's there).
   * \param wallet_spec The wallet number of the wallet to load.
   * \param password Password to use to derive wallet encryption key.
@@ -363,6 +618,9 @@ WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const uns
 	}
 
 	wallet_loaded = true;
+#if ADDRESS_CACHE_ENTRIES > 0
+	loadParentPublicKey();
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
 	last_error = WALLET_NO_ERROR;
 	return last_error;
 }
@@ -580,19 +838,55 @@ static WalletErrors sanitisePartition(NVPartitions partition)
 	return last_error;
 }
 
-/** Sanitise (clear) all partitions.
+/** Sanitise (clear) all partitions. Afterwards, the accounts partition is
+  * formatted for this firmware's value of #ADDRESS_CACHE_ENTRIES.
   * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
   *         error occurred.
   */
 WalletErrors sanitiseEverything(void)
 {
+	uint8_t buffer[4];
+
 	last_error = sanitisePartition(PARTITION_GLOBAL);
 	if (last_error == WALLET_NO_ERROR)
 	{
 		last_error = sanitisePartition(PARTITION_ACCOUNTS);
 	}
+	if (last_error == WALLET_NO_ERROR)
+	{
+		// There are no wallets any more, so nothing can be in the way of the
+		// address cache.
+		writeU32LittleEndian(buffer, STORAGE_FORMAT_MAGIC | ADDRESS_CACHE_ENTRIES);
+		if ((nonVolatileWrite(buffer, PARTITION_GLOBAL, ADDRESS_STORAGE_FORMAT, 4) != NV_NO_ERROR)
+			|| (nonVolatileFlush() != NV_NO_ERROR))
+		{
+			last_error = WALLET_WRITE_ERROR;
+		}
+	}
+	num_wallets = 0; // the layout may have changed
+	return last_error;
+}
+
+#if ADDRESS_CACHE_ENTRIES > 0
+/** Clear every entry in the address cache. This must be called whenever
+  * a wallet is deleted, so that the address cache doesn't retain any
+  * information about that wallet. getNumberOfWallets() must have been
+  * successfully called before calling this.
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred.
+  */
+static WalletErrors clearAddressCache(void)
+{
+	parent_public_key_cached = false;
+	if (!address_cache_reserved)
+	{
+		last_error = WALLET_NO_ERROR;
+		return last_error;
+	}
+	last_error = sanitiseNonVolatileStorage(PARTITION_ACCOUNTS, address_cache_nv_address, ADDRESS_CACHE_SLOTS * sizeof(AddressCacheEntry));
 	return last_error;
 }
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
 
 /** Computes wallet version of current wallet. This is in its own function
   * because it's used by both newWallet() and changeEncryptionKey().
@@ -648,6 +942,12 @@ WalletErrors deleteWallet(uint32_t wallet_spec)
 	}
 	address = wallet_spec * sizeof(WalletRecord);
 	last_error = sanitiseNonVolatileStorage(PARTITION_ACCOUNTS, address, sizeof(WalletRecord));
+#if ADDRESS_CACHE_ENTRIES > 0
+	if (last_error == WALLET_NO_ERROR)
+	{
+		clearAddressCache();
+	}
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
 	return last_error;
 }
 
@@ -707,6 +1007,14 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 		return last_error;
 	}
 
+	// Several random values are needed below. Getting them all from one
+	// random batch means that the entropy pool is only written once.
+	if (beginRandomBatch())
+	{
+		last_error = WALLET_RNG_FAILURE;
+		return last_error;
+	}
+
 	if (make_hidden)
 	{
 		// The creation of a hidden wallet is supposed to be discreet, so
@@ -720,6 +1028,7 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 		// encryption key.
 		if (getRandom256(random_buffer))
 		{
+			endRandomBatch();
 			last_error = WALLET_RNG_FAILURE;
 			return last_error;
 		}
@@ -733,6 +1042,7 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 		r = updateWalletVersion();
 		if (r != WALLET_NO_ERROR)
 		{
+			endRandomBatch();
 			last_error = r;
 			return last_error;
 		}
@@ -745,6 +1055,7 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 	current_wallet.encrypted.num_addresses = 0;
 	if (getRandom256(random_buffer))
 	{
+		endRandomBatch();
 		last_error = WALLET_RNG_FAILURE;
 		return last_error;
 	}
@@ -758,17 +1069,20 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 	{
 		if (getRandom256(random_buffer))
 		{
+			endRandomBatch();
 			last_error = WALLET_RNG_FAILURE;
 			return last_error;
 		}
 		memcpy(current_wallet.encrypted.seed, random_buffer, 32);
 		if (getRandom256(random_buffer))
 		{
+			endRandomBatch();
 			last_error = WALLET_RNG_FAILURE;
 			return last_error;
 		}
 		memcpy(&(current_wallet.encrypted.seed[32]), random_buffer, 32);
 	}
+	endRandomBatch();
 	calculateWalletChecksum(current_wallet.encrypted.checksum);
 
 	r = writeCurrentWalletRecord(wallet_nv_address);
@@ -866,6 +1180,14 @@ WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_publi
 		return last_error;
 	}
 
+#if ADDRESS_CACHE_ENTRIES > 0
+	if (lookupAddressCache(out_address, out_public_key, ah))
+	{
+		last_error = WALLET_NO_ERROR;
+		return last_error;
+	}
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
+
 	// Calculate private key.
 	r = getPrivateKey(buffer, ah);
 	if (r != WALLET_NO_ERROR)
@@ -899,6 +1221,12 @@ WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_publi
 	ripemd160Finish(&hs);
 	writeHashToByteArray(buffer, &hs, true);
 	memcpy(out_address, buffer, 20);
+#if ADDRESS_CACHE_ENTRIES > 0
+	updateAddressCache(out_address, out_public_key, ah);
+	// getPrivateKey() has derived the parent public key, so it's cheap to
+	// cache it now.
+	storeParentPublicKey();
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
 
 	last_error = WALLET_NO_ERROR;
 	return last_error;
@@ -1017,6 +1345,15 @@ WalletErrors changeEncryptionKey(const uint8_t *password, const unsigned int pas
 	// where it is, so don't do it.
 	if (!is_hidden_wallet)
 	{
+#if ADDRESS_CACHE_ENTRIES > 0
+		// Entries encrypted with the old key would otherwise remain readable
+		// to anyone who knows the old password.
+		r = clearAddressCache();
+		if (r != WALLET_NO_ERROR)
+		{
+			return last_error;
+		}
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
 		r = updateWalletVersion();
 		if (r != WALLET_NO_ERROR)
 		{
@@ -1160,12 +1497,16 @@ WalletErrors backupWallet(bool do_encrypt, uint32_t destination_device)
 
 /** Get the number of wallets which can fit in non-volatile storage, assuming
   * the storage format specified in storage_common.h.
-  * This will set #num_wallets.
+  * This will set #num_wallets. If the address cache is enabled, this will
+  * also set #address_cache_reserved and #address_cache_nv_address.
   * \return The number of wallets on success, or 0 if a read error occurred.
   */
 uint32_t getNumberOfWallets(void)
 {
 	uint32_t size;
+#if ADDRESS_CACHE_ENTRIES > 0
+	uint8_t buffer[4];
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
 
 	last_error = WALLET_NO_ERROR;
 	if (num_wallets == 0)
@@ -1174,6 +1515,22 @@ uint32_t getNumberOfWallets(void)
 		// storage.
 		if (nonVolatileGetSize(&size, PARTITION_ACCOUNTS) == NV_NO_ERROR)
 		{
+#if ADDRESS_CACHE_ENTRIES > 0
+			// The address cache goes at the end of the accounts partition,
+			// but only if the partition was formatted with space for it.
+			// Otherwise the last wallet records could be in the way.
+			address_cache_reserved = false;
+			if ((nonVolatileRead(buffer, PARTITION_GLOBAL, ADDRESS_STORAGE_FORMAT, 4) == NV_NO_ERROR)
+				&& (readU32LittleEndian(buffer) == (STORAGE_FORMAT_MAGIC | ADDRESS_CACHE_ENTRIES))
+				&& (size >= ADDRESS_CACHE_SLOTS * sizeof(AddressCacheEntry)))
+			{
+				// Its start is aligned to the AES block size so that every
+				// entry is encrypted in whole blocks.
+				address_cache_reserved = true;
+				size = (size - ADDRESS_CACHE_SLOTS * sizeof(AddressCacheEntry)) & ~(uint32_t)15;
+				address_cache_nv_address = size;
+			}
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
 			num_wallets = size / sizeof(WalletRecord);
 		}
 		else
@@ -1641,6 +1998,7 @@ int main(void)
 	uint32_t version_field_address;
 	uint32_t returned_num_wallets;
 	uint32_t stupidly_calculated_num_wallets;
+	int end_of_wallets;
 	AddressHandle *handles_buffer;
 	AddressHandle ah;
 	PointAffine master_public_key;
@@ -2635,6 +2993,45 @@ int main(void)
 		reportFailure();
 	}
 
+#if ADDRESS_CACHE_ENTRIES > 0
+	// Generating an address should have put the correct parent public key of
+	// the restored wallet in the address cache.
+	memcpy(temp, seed1, 32);
+	swapEndian256(temp);
+	setToG(&public_key);
+	pointMultiply(&public_key, temp);
+	if (lookupAddressCache(address2, &compare_public_key, PARENT_PUBLIC_KEY_CACHE_HANDLE)
+		&& !memcmp(public_key.x, compare_public_key.x, 32)
+		&& !memcmp(public_key.y, compare_public_key.y, 32))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Restored wallet has incorrect cached parent public key\n");
+		reportFailure();
+	}
+
+	// Reloading the wallet should use the cached parent public key, and
+	// still generate the same private keys.
+	initWallet(0, test_password0, sizeof(test_password0));
+	lookupAddressCache(address2, &compare_public_key, 1);
+	getPrivateKey(temp, 1);
+	setToG(&public_key);
+	pointMultiply(&public_key, temp);
+	if (parent_public_key_cached
+		&& !memcmp(public_key.x, compare_public_key.x, 32)
+		&& !memcmp(public_key.y, compare_public_key.y, 32))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Cached parent public key not used after reload\n");
+		reportFailure();
+	}
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
+
 	// Test wallet backup with encryption.
 	if (backupWallet(true, 0) == WALLET_NO_ERROR)
 	{
@@ -2876,6 +3273,10 @@ int main(void)
 		reportFailure();
 	}
 
+	// The tests above left random data where sanitiseEverything() writes the
+	// storage format, so put it back.
+	sanitiseEverything();
+
 	// Check that getNumberOfWallets() works and returns the appropriate value
 	// for various non-volatile storage sizes.
 	abort = false;
@@ -2894,7 +3295,17 @@ int main(void)
 			break;
 		}
 		stupidly_calculated_num_wallets = 0;
-		for (j = 0; (int)(j + (sizeof(WalletRecord) - 1)) < i; j += sizeof(WalletRecord))
+		end_of_wallets = i;
+#if ADDRESS_CACHE_ENTRIES > 0
+		// Wallet records must not overlap the address cache, which is
+		// aligned to a 16 byte boundary.
+		end_of_wallets -= (int)(ADDRESS_CACHE_SLOTS * sizeof(AddressCacheEntry));
+		while ((end_of_wallets % 16) != 0)
+		{
+			end_of_wallets--;
+		}
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
+		for (j = 0; (int)(j + (sizeof(WalletRecord) - 1)) < end_of_wallets; j += sizeof(WalletRecord))
 		{
 			stupidly_calculated_num_wallets++;
 		}
@@ -2917,6 +3328,36 @@ int main(void)
 	accounts_partition_size = TEST_ACCOUNTS_PARTITION_SIZE;
 	num_wallets = 0; // reset cache for next test
 
+#if ADDRESS_CACHE_ENTRIES > 0
+	// The address cache must not be reserved on an accounts partition which
+	// wasn't formatted for it, since wallets could be in the way.
+	nonVolatileRead(temp, PARTITION_GLOBAL, ADDRESS_STORAGE_FORMAT, 4);
+	writeU32LittleEndian(&(temp[4]), STORAGE_FORMAT_MAGIC | (ADDRESS_CACHE_ENTRIES + 1));
+	nonVolatileWrite(&(temp[4]), PARTITION_GLOBAL, ADDRESS_STORAGE_FORMAT, 4);
+	if ((getNumberOfWallets() == TEST_ACCOUNTS_PARTITION_SIZE / sizeof(WalletRecord))
+		&& !address_cache_reserved)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Address cache reserved on unformatted partition\n");
+		reportFailure();
+	}
+	nonVolatileWrite(temp, PARTITION_GLOBAL, ADDRESS_STORAGE_FORMAT, 4);
+	num_wallets = 0; // reset cache for next test
+	if ((getNumberOfWallets() < TEST_ACCOUNTS_PARTITION_SIZE / sizeof(WalletRecord))
+		&& address_cache_reserved)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Address cache not reserved on formatted partition\n");
+		reportFailure();
+	}
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
+
 	// For all functions which accept wallet numbers, try some wallet numbers
 	// which are in or out of range.
 	returned_num_wallets = getNumberOfWallets();
@@ -3424,6 +3865,114 @@ int main(void)
 		reportSuccess();
 	}
 
+#if ADDRESS_CACHE_ENTRIES > 0
+	// Check that the address cache is filled in by makeNewAddress() and that
+	// it contains the same address and public key.
+	uninitWallet();
+	deleteWallet(0);
+	deleteWallet(1);
+	newWallet(0, name, false, NULL, false, NULL, 0);
+	makeNewAddress(address1, &public_key);
+	if (!lookupAddressCache(address2, &compare_public_key, 1))
+	{
+		printf("makeNewAddress() doesn't fill in address cache\n");
+		reportFailure();
+	}
+	else if (memcmp(address1, address2, 20) || memcmp(&public_key, &compare_public_key, sizeof(PointAffine)))
+	{
+		printf("Address cache contents don't match makeNewAddress()\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Repeat lookups should get the same result.
+	if ((getAddressAndPublicKey(address2, &compare_public_key, 1) != WALLET_NO_ERROR)
+		|| memcmp(address1, address2, 20)
+		|| memcmp(&public_key, &compare_public_key, sizeof(PointAffine)))
+	{
+		printf("Address cache hit returns wrong address or public key\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// A corrupted entry should be ignored and then recalculated.
+	ah = 1;
+	nonVolatileRead(&one_byte, PARTITION_ACCOUNTS, getAddressCacheEntryAddress(ah) + 40, 1);
+	one_byte ^= 0x01;
+	nonVolatileWrite(&one_byte, PARTITION_ACCOUNTS, getAddressCacheEntryAddress(ah) + 40, 1);
+	nonVolatileFlush();
+	if (lookupAddressCache(address2, &compare_public_key, ah))
+	{
+		printf("Corrupted address cache entry is accepted\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	if ((getAddressAndPublicKey(address2, &compare_public_key, ah) != WALLET_NO_ERROR)
+		|| memcmp(address1, address2, 20)
+		|| memcmp(&public_key, &compare_public_key, sizeof(PointAffine))
+		|| !lookupAddressCache(address2, &compare_public_key, ah))
+	{
+		printf("Corrupted address cache entry is not recalculated\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Another wallet using the same encryption key shouldn't be able to use
+	// the entry.
+	newWallet(1, name, false, NULL, false, NULL, 0);
+	if (lookupAddressCache(address2, &compare_public_key, 1))
+	{
+		printf("Address cache entry is shared between wallets\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Deleting any wallet should invalidate the address cache.
+	deleteWallet(1);
+	initWallet(0, NULL, 0);
+	if (lookupAddressCache(address2, &compare_public_key, 1))
+	{
+		printf("deleteWallet() doesn't clear address cache\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Using a hidden wallet should never write to the address cache.
+	newWallet(1, name, false, NULL, true, test_password0, sizeof(test_password0));
+	nonVolatileRead(copy_of_nv, PARTITION_ACCOUNTS, address_cache_nv_address, ADDRESS_CACHE_SLOTS * sizeof(AddressCacheEntry));
+	makeNewAddress(address1, &public_key);
+	getAddressAndPublicKey(address2, &compare_public_key, 1);
+	nonVolatileRead(copy_of_nv2, PARTITION_ACCOUNTS, address_cache_nv_address, ADDRESS_CACHE_SLOTS * sizeof(AddressCacheEntry));
+	if (memcmp(copy_of_nv, copy_of_nv2, ADDRESS_CACHE_SLOTS * sizeof(AddressCacheEntry)))
+	{
+		printf("Hidden wallet writes to address cache\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	uninitWallet();
+#endif // #if ADDRESS_CACHE_ENTRIES > 0
+
 	// Check that sanitisePartition() only affects one partition.
 	suppress_set_entropy_pool = true; // avoid spurious writes to global partition
 	memset(copy_of_nv, 0, sizeof(copy_of_nv));